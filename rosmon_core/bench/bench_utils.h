@@ -0,0 +1,111 @@
+// Statistics and output helpers shared by the benchmarks
+// Author: Max Schwarz <max.schwarz@uni-bonn.de>
+
+#ifndef ROSMON_BENCH_UTILS_H
+#define ROSMON_BENCH_UTILS_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace rosmon
+{
+
+namespace bench
+{
+
+struct Statistics
+{
+	double median;
+	double mad; //!< median absolute deviation
+	double min;
+	double max;
+};
+
+inline double median(std::vector<double> values)
+{
+	std::sort(values.begin(), values.end());
+
+	std::size_t n = values.size();
+	if(n % 2)
+		return values[n/2];
+	else
+		return 0.5 * (values[n/2 - 1] + values[n/2]);
+}
+
+//! Median and MAD are robust against the occasional scheduling hiccup
+inline Statistics statistics(const std::vector<double>& samples)
+{
+	Statistics stats;
+	stats.median = median(samples);
+	stats.min = *std::min_element(samples.begin(), samples.end());
+	stats.max = *std::max_element(samples.begin(), samples.end());
+
+	std::vector<double> deviations;
+	for(double d : samples)
+		deviations.push_back(std::abs(d - stats.median));
+	stats.mad = median(deviations);
+
+	return stats;
+}
+
+//! Nearest-rank percentile, p in [0, 1]
+inline double percentile(std::vector<double> samples, double p)
+{
+	std::size_t rank = p > 0 ? std::ceil(p * samples.size()) - 1 : 0;
+	rank = std::min(rank, samples.size() - 1);
+	std::nth_element(samples.begin(), samples.begin() + rank, samples.end());
+	return samples[rank];
+}
+
+/**
+ * Calls setup() outside and fn() inside the timed region. The first
+ * warmup runs are discarded.
+ **/
+inline Statistics measure(unsigned int runs, unsigned int warmup, const std::function<void()>& setup, const std::function<void()>& fn)
+{
+	std::vector<double> durations;
+
+	for(unsigned int run = 0; run < warmup + runs; ++run)
+	{
+		setup();
+
+		auto start = std::chrono::steady_clock::now();
+		fn();
+		auto end = std::chrono::steady_clock::now();
+
+		if(run >= warmup)
+			durations.push_back(std::chrono::duration<double>(end - start).count());
+	}
+
+	return statistics(durations);
+}
+
+/**
+ * Send everything written to stdout to /dev/null and return a stream
+ * to the original stdout, so that results are not mixed with chatter
+ * of the code under test.
+ **/
+inline FILE* redirectStdout()
+{
+	fflush(stdout);
+	FILE* out = fdopen(dup(STDOUT_FILENO), "w");
+
+	int devnull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+	dup2(devnull, STDOUT_FILENO);
+	close(devnull);
+
+	return out;
+}
+
+}
+
+}
+
+#endif
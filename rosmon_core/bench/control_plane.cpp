@@ -0,0 +1,291 @@
+// Benchmark for parameter upload and the ROS control interface
+// Author: Max Schwarz <max.schwarz@uni-bonn.de>
+
+#include "../src/monitor/monitor.h"
+#include "../src/ros_interface.h"
+#include "../test/fake_master/fake_master.h"
+#include "bench_utils.h"
+
+#include <cstdio>
+#include <stdexcept>
+
+#include <getopt.h>
+
+#include <ros/init.h>
+#include <ros/callback_queue.h>
+#include <ros/node_handle.h>
+#include <ros/spinner.h>
+#include <ros/this_node.h>
+
+#include <rosmon_msgs/State.h>
+#include <rosmon_msgs/StartStop.h>
+
+#include <fmt/format.h>
+
+using namespace rosmon;
+using namespace rosmon::bench;
+
+namespace
+{
+
+struct Options
+{
+	unsigned int nodes = 50;
+	unsigned int params = 1000;
+	unsigned int latency = 0; //!< in microseconds
+	unsigned int runs = 15;
+	unsigned int warmup = 2;
+	unsigned int iterations = 200;
+};
+
+void usage()
+{
+	fmt::print(stderr, R"EOS(
+Usage: bench_control_plane [options]
+
+Runs rosmon's parameter upload and ROS interface against an in-process
+fake ROS master, so that no roscore is needed and results do not depend
+on other processes. Results are written to stdout as one JSON object per
+line.
+
+Options:
+  --nodes=N          Number of nodes (default 50)
+  --params=M         Number of parameters (default 1000)
+  --latency=US       Latency of each master request in microseconds (default 0)
+  --runs=R           Number of measured runs (default 15)
+  --warmup=W         Number of discarded runs (default 2)
+  --iterations=I     Service calls / messages per run (default 200)
+  --help             This help screen
+)EOS");
+}
+
+std::string generateLaunch(const Options& opt)
+{
+	std::string xml = "<launch>\n";
+
+	for(unsigned int i = 0; i < opt.params; ++i)
+		xml += fmt::format("\t<param name=\"group_{}/param_{}\" value=\"{}\" />\n", i % 10, i, i);
+
+	// The nodes are never started, the executable only has to exist.
+	for(unsigned int i = 0; i < opt.nodes; ++i)
+		xml += fmt::format("\t<node name=\"node_{}\" pkg=\"rosmon_core\" type=\"abort\" />\n", i);
+
+	xml += "</launch>\n";
+
+	return xml;
+}
+
+void report(FILE* out, const Options& opt, const char* name, const Statistics& stats, std::size_t operations, std::size_t masterCalls)
+{
+	fmt::print(out,
+		R"({{"benchmark":"{}","nodes":{},"params":{},"latency_us":{},"runs":{},"operations":{},"master_calls":{},)"
+		R"("median_s":{:.9f},"mad_s":{:.9f},"min_s":{:.9f},"max_s":{:.9f},"ops_per_s":{:.1f}}})" "\n",
+		name, opt.nodes, opt.params, opt.latency, opt.runs, operations, masterCalls,
+		stats.median, stats.mad, stats.min, stats.max,
+		stats.median > 0 ? operations / stats.median : 0.0
+	);
+	fflush(out);
+}
+
+uint64_t totalCalls(const FakeMaster& master)
+{
+	uint64_t total = 0;
+	for(auto& pair : master.callCounts())
+		total += pair.second;
+
+	return total;
+}
+
+}
+
+static const struct option OPTIONS[] = {
+	{"nodes", required_argument, nullptr, 'n'},
+	{"params", required_argument, nullptr, 'p'},
+	{"latency", required_argument, nullptr, 'l'},
+	{"runs", required_argument, nullptr, 'r'},
+	{"warmup", required_argument, nullptr, 'w'},
+	{"iterations", required_argument, nullptr, 'i'},
+	{"help", no_argument, nullptr, 'h'},
+	{nullptr, 0, nullptr, 0}
+};
+
+int main(int argc, char** argv)
+{
+	Options opt;
+
+	while(true)
+	{
+		int option_index;
+		int c = getopt_long(argc, argv, "h", OPTIONS, &option_index);
+
+		if(c == -1)
+			break;
+
+		switch(c)
+		{
+			case 'n': opt.nodes = std::stoul(optarg); break;
+			case 'p': opt.params = std::stoul(optarg); break;
+			case 'l': opt.latency = std::stoul(optarg); break;
+			case 'r': opt.runs = std::stoul(optarg); break;
+			case 'w': opt.warmup = std::stoul(optarg); break;
+			case 'i': opt.iterations = std::stoul(optarg); break;
+			case 'h':
+				usage();
+				return 0;
+			default:
+				usage();
+				return 1;
+		}
+	}
+
+	if(opt.runs == 0 || opt.iterations == 0 || opt.nodes == 0)
+	{
+		fmt::print(stderr, "--runs, --iterations and --nodes need to be positive\n");
+		return 1;
+	}
+
+	FILE* out = redirectStdout();
+
+	FakeMaster master;
+	master.setLatency(std::chrono::microseconds(opt.latency));
+
+	ros::M_string remappings;
+	remappings["__master"] = master.uri();
+	remappings["__ip"] = "127.0.0.1";
+	ros::init(remappings, "rosmon_bench",
+		ros::init_options::NoSigintHandler | ros::init_options::NoRosout
+	);
+
+	{
+		ros::NodeHandle nh;
+
+		auto config = std::make_shared<launch::LaunchConfig>();
+		try
+		{
+			config->parseString(generateLaunch(opt));
+			config->evaluateParameters();
+		}
+		catch(launch::ParseException& e)
+		{
+			fmt::print(stderr, "Could not load launch file: {}\n", e.what());
+			return 1;
+		}
+
+		FDWatcher::Ptr watcher(new FDWatcher);
+		monitor::Monitor monitor(config, watcher, "/tmp", false, true, {}, {});
+
+		// Parameter upload as done on startup: one setParam per parameter
+		{
+			uint64_t callsBefore = 0;
+			Statistics stats = measure(opt.runs, opt.warmup,
+				[&]() { callsBefore = totalCalls(master); },
+				[&]() { monitor.setParameters(); }
+			);
+			report(out, opt, "param_upload", stats, config->parameters().size(), totalCalls(master) - callsBefore);
+		}
+
+		// The same upload as a single system.multicall request, as a
+		// reference for what batching would gain.
+		{
+			XmlRpc::XmlRpcValue calls;
+			calls.setSize(0);
+
+			int i = 0;
+			for(auto& param : config->parameters())
+			{
+				XmlRpc::XmlRpcValue call;
+				call["methodName"] = "setParam";
+				call["params"][0] = ros::this_node::getName();
+				call["params"][1] = param.first;
+				call["params"][2] = param.second;
+				calls[i++] = call;
+			}
+
+			XmlRpc::XmlRpcValue args;
+			args[0] = calls;
+
+			XmlRpc::XmlRpcClient client("127.0.0.1", master.port(), "/");
+
+			uint64_t callsBefore = 0;
+			Statistics stats = measure(opt.runs, opt.warmup,
+				[&]() { callsBefore = totalCalls(master); },
+				[&]() {
+					XmlRpc::XmlRpcValue result;
+					if(!client.execute("system.multicall", args, result) || client.isFault())
+						throw std::runtime_error("system.multicall failed");
+				}
+			);
+			report(out, opt, "param_upload_multicall", stats, config->parameters().size(), totalCalls(master) - callsBefore);
+
+			client.close();
+		}
+
+		LaunchInfo launchInfo;
+		ROSInterface rosInterface(&monitor, &launchInfo);
+
+		ros::AsyncSpinner spinner(1);
+		spinner.start();
+
+		// ~start_stop round trip. The nodes are not running, so this
+		// measures the service dispatch and node lookup only.
+		{
+			ros::ServiceClient client = nh.serviceClient<rosmon_msgs::StartStop>(
+				ros::this_node::getName() + "/start_stop", true
+			);
+
+			rosmon_msgs::StartStop srv;
+			srv.request.node = fmt::format("node_{}", opt.nodes - 1);
+			srv.request.action = rosmon_msgs::StartStopRequest::STOP;
+
+			uint64_t callsBefore = 0;
+			Statistics stats = measure(opt.runs, opt.warmup,
+				[&]() { callsBefore = totalCalls(master); },
+				[&]() {
+					for(unsigned int i = 0; i < opt.iterations; ++i)
+					{
+						if(!client.call(srv))
+							throw std::runtime_error("start_stop call failed");
+					}
+				}
+			);
+			report(out, opt, "start_stop", stats, opt.iterations, totalCalls(master) - callsBefore);
+		}
+
+		// Latency from ROSInterface stamping a State message to its delivery
+		{
+			ros::CallbackQueue queue;
+			ros::NodeHandle subNh;
+			subNh.setCallbackQueue(&queue);
+
+			std::vector<double> latencies;
+			ros::Subscriber sub = subNh.subscribe<rosmon_msgs::State>(
+				ros::this_node::getName() + "/ros_monitor", 10,
+				[&](const rosmon_msgs::StateConstPtr& msg) {
+					latencies.push_back((ros::Time::now() - msg->header.stamp).toSec());
+				}
+			);
+
+			rosInterface.setUpdatePeriod(0.005);
+
+			// The latched message from before we subscribed does not count
+			queue.callAvailable(ros::WallDuration(1.0));
+			latencies.clear();
+
+			std::size_t wanted = opt.iterations;
+			auto deadline = ros::WallTime::now() + ros::WallDuration(60.0);
+			while(latencies.size() < wanted && ros::WallTime::now() < deadline)
+				queue.callAvailable(ros::WallDuration(0.1));
+
+			if(!latencies.empty())
+				report(out, opt, "state_publish", statistics(latencies), latencies.size(), 0);
+		}
+
+		spinner.stop();
+	}
+
+	ros::shutdown();
+
+	fclose(out);
+
+	return 0;
+}
@@ -0,0 +1,280 @@
+// Benchmark for launch file loading on synthetic launch trees
+// Author: Max Schwarz <max.schwarz@uni-bonn.de>
+
+#include "../src/launch/launch_config.h"
+#include "../src/package_registry.h"
+#include "bench_utils.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include <getopt.h>
+#include <unistd.h>
+
+#include <boost/filesystem.hpp>
+
+#include <fmt/format.h>
+
+using namespace rosmon;
+using namespace rosmon::launch;
+using namespace rosmon::bench;
+
+namespace fs = boost::filesystem;
+
+namespace
+{
+
+struct Options
+{
+	unsigned int nodes = 100;
+	unsigned int params = 1000;
+	unsigned int includes = 4;
+	unsigned int substitutions = 8;
+	unsigned int yamlSize = 1000;
+	unsigned int runs = 15;
+	unsigned int warmup = 2;
+	unsigned int iterations = 10000;
+};
+
+void usage()
+{
+	fmt::print(stderr, R"EOS(
+Usage: rosmon_bench [options]
+
+Generates a synthetic launch tree and measures launch file loading.
+Results are written to stdout as one JSON object per line.
+
+Options:
+  --nodes=N          Number of nodes (default 100)
+  --params=M         Number of <param> tags (default 1000)
+  --includes=K       Depth of nested <include> tags (default 4)
+  --substitutions=S  Number of $(arg) substitutions per param (default 8)
+  --yaml-size=Y      Number of entries per YAML file (default 1000)
+  --runs=R           Number of measured runs (default 15)
+  --warmup=W         Number of discarded runs (default 2)
+  --iterations=I     Calls per run for micro benchmarks (default 10000)
+  --help             This help screen
+)EOS");
+}
+
+/**
+ * Writes a chain of K+1 launch files, level0.launch including level1.launch
+ * and so on. Nodes and params are spread evenly across the levels. Each
+ * level also loads a YAML file through a deferred textfile parameter, so
+ * that evaluateParameters() has work to do.
+ **/
+std::string generateTree(const fs::path& dir, const Options& opt)
+{
+	unsigned int levels = opt.includes + 1;
+
+	for(unsigned int level = 0; level < levels; ++level)
+	{
+		std::string xml = "<launch>\n";
+
+		for(unsigned int i = 0; i < opt.substitutions; ++i)
+		{
+			if(level == 0)
+				xml += fmt::format("\t<arg name=\"a{}\" default=\"value_{}\" />\n", i, i);
+			else
+				xml += fmt::format("\t<arg name=\"a{}\" />\n", i);
+		}
+
+		std::string substituted;
+		for(unsigned int i = 0; i < opt.substitutions; ++i)
+			substituted += fmt::format("$(arg a{})_", i);
+
+		xml += fmt::format("\t<group ns=\"level{}\">\n", level);
+
+		for(unsigned int i = level; i < opt.params; i += levels)
+			xml += fmt::format("\t\t<param name=\"param_{}\" value=\"{}{}\" />\n", i, substituted, i);
+
+		for(unsigned int i = level; i < opt.nodes; i += levels)
+		{
+			xml += fmt::format("\t\t<node name=\"node_{}\" pkg=\"rosmon_core\" type=\"abort\" args=\"{}\">\n", i, substituted);
+			xml += fmt::format("\t\t\t<param name=\"id\" value=\"{}\" />\n", i);
+			xml += "\t\t</node>\n";
+		}
+
+		if(opt.yamlSize != 0)
+			xml += fmt::format("\t\t<param name=\"yaml\" type=\"yaml\" textfile=\"$(dirname)/level{}.yaml\" />\n", level);
+
+		xml += "\t</group>\n";
+
+		if(level + 1 < levels)
+			xml += fmt::format("\t<include file=\"$(dirname)/level{}.launch\" pass_all_args=\"true\" />\n", level + 1);
+
+		xml += "</launch>\n";
+
+		std::ofstream(fs::path(dir / fmt::format("level{}.launch", level)).string()) << xml;
+
+		std::ofstream yaml(fs::path(dir / fmt::format("level{}.yaml", level)).string());
+		for(unsigned int i = 0; i < opt.yamlSize; ++i)
+			yaml << fmt::format("entry_{}: {{ value: {}, name: \"entry {}\", list: [1, 2, 3] }}\n", i, i, i);
+	}
+
+	return fs::path(dir / "level0.launch").string();
+}
+
+void report(FILE* out, const Options& opt, const char* name, const Statistics& stats, std::size_t operations)
+{
+	fmt::print(out,
+		R"({{"benchmark":"{}","nodes":{},"params":{},"includes":{},"substitutions":{},"yaml_size":{},)"
+		R"("runs":{},"operations":{},"median_s":{:.9f},"mad_s":{:.9f},"min_s":{:.9f},"max_s":{:.9f},"ops_per_s":{:.1f}}})" "\n",
+		name, opt.nodes, opt.params, opt.includes, opt.substitutions, opt.yamlSize,
+		opt.runs, operations, stats.median, stats.mad, stats.min, stats.max,
+		stats.median > 0 ? operations / stats.median : 0.0
+	);
+	fflush(out);
+}
+
+}
+
+static const struct option OPTIONS[] = {
+	{"nodes", required_argument, nullptr, 'n'},
+	{"params", required_argument, nullptr, 'p'},
+	{"includes", required_argument, nullptr, 'k'},
+	{"substitutions", required_argument, nullptr, 's'},
+	{"yaml-size", required_argument, nullptr, 'y'},
+	{"runs", required_argument, nullptr, 'r'},
+	{"warmup", required_argument, nullptr, 'w'},
+	{"iterations", required_argument, nullptr, 'i'},
+	{"help", no_argument, nullptr, 'h'},
+	{nullptr, 0, nullptr, 0}
+};
+
+int main(int argc, char** argv)
+{
+	Options opt;
+
+	while(true)
+	{
+		int option_index;
+		int c = getopt_long(argc, argv, "h", OPTIONS, &option_index);
+
+		if(c == -1)
+			break;
+
+		switch(c)
+		{
+			case 'n': opt.nodes = std::stoul(optarg); break;
+			case 'p': opt.params = std::stoul(optarg); break;
+			case 'k': opt.includes = std::stoul(optarg); break;
+			case 's': opt.substitutions = std::stoul(optarg); break;
+			case 'y': opt.yamlSize = std::stoul(optarg); break;
+			case 'r': opt.runs = std::stoul(optarg); break;
+			case 'w': opt.warmup = std::stoul(optarg); break;
+			case 'i': opt.iterations = std::stoul(optarg); break;
+			case 'h':
+				usage();
+				return 0;
+			default:
+				usage();
+				return 1;
+		}
+	}
+
+	if(opt.runs == 0 || opt.iterations == 0)
+	{
+		fmt::print(stderr, "--runs and --iterations need to be positive\n");
+		return 1;
+	}
+
+	char dirTemplate[] = "/tmp/rosmon_bench_XXXXXX";
+	if(!mkdtemp(dirTemplate))
+	{
+		fmt::print(stderr, "Could not create temporary directory: {}\n", strerror(errno));
+		return 1;
+	}
+	fs::path dir(dirTemplate);
+
+	std::string launchFile = generateTree(dir, opt);
+
+	// LaunchConfig reports loading times on stdout. Keep stdout clean for
+	// the results and send the chatter to /dev/null.
+	FILE* out = redirectStdout();
+
+	int ret = 0;
+	try
+	{
+		LaunchConfig::Ptr config;
+
+		// Parse only
+		report(out, opt, "parse", measure(opt.runs, opt.warmup,
+			[&]() { config = std::make_shared<LaunchConfig>(); },
+			[&]() { config->parse(launchFile); }
+		), 1);
+
+		// Parameter evaluation of an already parsed tree
+		report(out, opt, "evaluate_parameters", measure(opt.runs, opt.warmup,
+			[&]() {
+				config = std::make_shared<LaunchConfig>();
+				config->parse(launchFile);
+			},
+			[&]() { config->evaluateParameters(); }
+		), 1);
+
+		// Substitution args, as used in every attribute
+		{
+			config = std::make_shared<LaunchConfig>();
+			ParseContext ctx(config.get());
+			ctx.setFilename(launchFile);
+
+			std::string tpl = "$(dirname)/";
+			for(unsigned int i = 0; i < opt.substitutions; ++i)
+			{
+				ctx.setArg(fmt::format("a{}", i), fmt::format("value_{}", i), true);
+				tpl += fmt::format("$(arg a{})_", i);
+			}
+
+			report(out, opt, "substitution", measure(opt.runs, opt.warmup,
+				[]() {},
+				[&]() {
+					for(unsigned int i = 0; i < opt.iterations; ++i)
+						ctx.evaluate(tpl);
+				}
+			), opt.iterations);
+		}
+
+		// PackageRegistry caches all lookups, so the first call is the only
+		// one that touches the file system. Measure it separately.
+		{
+			Options single = opt;
+			single.runs = 1;
+			single.warmup = 0;
+
+			report(out, single, "package_registry_cold", measure(single.runs, single.warmup,
+				[]() {},
+				[&]() {
+					PackageRegistry::getPath("rosmon_core");
+					PackageRegistry::getExecutable("rosmon_core", "abort");
+				}
+			), 1);
+
+			report(out, opt, "package_registry", measure(opt.runs, opt.warmup,
+				[]() {},
+				[&]() {
+					for(unsigned int i = 0; i < opt.iterations; ++i)
+					{
+						PackageRegistry::getPath("rosmon_core");
+						PackageRegistry::getExecutable("rosmon_core", "abort");
+					}
+				}
+			), opt.iterations);
+		}
+	}
+	catch(ParseException& e)
+	{
+		fmt::print(stderr, "Could not load launch file: {}\n", e.what());
+		ret = 1;
+	}
+
+	fclose(out);
+
+	boost::system::error_code ec;
+	fs::remove_all(dir, ec);
+
+	return ret;
+}
@@ -0,0 +1,522 @@
+// End-to-end benchmark of the node output pipeline using spew nodes
+// Author: Max Schwarz <max.schwarz@uni-bonn.de>
+
+#include "../test/fake_master/fake_master.h"
+#include "bench_utils.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <getopt.h>
+#include <poll.h>
+#include <pty.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <boost/filesystem.hpp>
+
+#include <fmt/format.h>
+
+using namespace rosmon;
+using namespace rosmon::bench;
+
+namespace fs = boost::filesystem;
+
+namespace
+{
+
+struct Options
+{
+	unsigned int nodes = 4;
+	double rate = 1000.0;
+	unsigned int length = 100;
+	double color = 0.2;
+	unsigned int burst = 1;
+	double duration = 10.0;
+	double warmup = 2.0;
+	std::vector<bool> ui{false, true};
+	std::vector<bool> log{false, true};
+	std::vector<std::string> output{"pty", "pipe", "raw"};
+	std::string rosmon;
+};
+
+void usage()
+{
+	fmt::print(stderr, R"EOS(
+Usage: bench_log_pipeline [options]
+
+Launches spew nodes under rosmon and follows their output through the
+terminal and the log file. A fake ROS master runs in-process, so no
+roscore is needed. Results are written to stdout as one JSON object per
+configuration.
+
+Options:
+  --nodes=K          Number of spew nodes (default 4)
+  --rate=R           Lines per second and node, 0 for unlimited (default 1000)
+  --length=L         Line length in bytes (default 100)
+  --color=P          Fraction of colored lines (default 0.2)
+  --burst=B          Lines per burst (default 1)
+  --duration=S       Measurement duration in seconds (default 10)
+  --warmup=S         Ignored startup phase in seconds (default 2)
+  --ui=on|off|both   Run with the UI enabled, disabled or both (default both)
+  --log=on|off|both  Run with the log file enabled, disabled or both (default both)
+  --output=MODES      Comma-separated output capture modes of the nodes
+                     (pty, pipe, raw, default: all of them). Raw output is
+                     only spliced into the log file with --ui=off, and its
+                     log latency is limited by the 1s timestamp markers.
+  --rosmon=PATH      rosmon executable (default: next to this binary)
+  --help             This help screen
+)EOS");
+}
+
+std::vector<bool> parseSwitch(const std::string& value)
+{
+	if(value == "on")
+		return {true};
+	else if(value == "off")
+		return {false};
+	else if(value == "both")
+		return {false, true};
+
+	throw std::invalid_argument(fmt::format("Invalid value '{}', expected on, off or both", value));
+}
+
+std::vector<std::string> parseOutputModes(const std::string& value)
+{
+	std::vector<std::string> modes;
+
+	std::size_t begin = 0;
+	while(begin <= value.size())
+	{
+		std::size_t end = std::min(value.find(',', begin), value.size());
+		std::string mode = value.substr(begin, end - begin);
+
+		if(mode != "pty" && mode != "pipe" && mode != "raw")
+			throw std::invalid_argument(fmt::format("Invalid output mode '{}', expected pty, pipe or raw", mode));
+
+		modes.push_back(mode);
+		begin = end + 1;
+	}
+
+	return modes;
+}
+
+uint64_t realtimeMicroseconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return uint64_t(ts.tv_sec) * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+//! Process CPU time (without children) in seconds
+double processCPUTime(pid_t pid)
+{
+	std::ifstream stream(fmt::format("/proc/{}/stat", pid));
+	std::string stat((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+
+	// The process name may contain spaces, skip past it
+	auto pos = stat.rfind(')');
+	if(pos == std::string::npos)
+		return 0.0;
+
+	unsigned long utime = 0;
+	unsigned long stime = 0;
+	if(sscanf(stat.c_str() + pos + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)
+		return 0.0;
+
+	return double(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+/**
+ * Collects the spew markers arriving at one end of the pipeline
+ **/
+class Sink
+{
+public:
+	Sink(unsigned int nodes, uint64_t windowStart, uint64_t windowEnd)
+	 : m_seen(nodes)
+	 , m_windowStart(windowStart)
+	 , m_windowEnd(windowEnd)
+	{}
+
+	/**
+	 * @param line One line of output
+	 * @param arrival Arrival time in microseconds (CLOCK_REALTIME)
+	 **/
+	void process(const char* line, uint64_t arrival)
+	{
+		const char* marker = strstr(line, "@@");
+		if(!marker)
+			return;
+
+		unsigned int id;
+		unsigned long long seq;
+		unsigned long long written;
+		if(sscanf(marker, "@@%u:%llu:%llu@@", &id, &seq, &written) != 3 || id >= m_seen.size())
+			return;
+
+		auto& seen = m_seen[id];
+		if(seq >= seen.size())
+			seen.resize(seq + 1, false);
+		if(seen[seq])
+			return;
+		seen[seq] = true;
+
+		if(written >= m_windowStart && written < m_windowEnd)
+		{
+			m_windowLines++;
+			m_latencies.push_back(1e-6 * (double(arrival) - double(written)));
+		}
+	}
+
+	//! Lines missing between the first and last line seen of each node
+	uint64_t drops() const
+	{
+		uint64_t drops = 0;
+		for(auto& seen : m_seen)
+		{
+			auto first = std::find(seen.begin(), seen.end(), true);
+			drops += std::count(first, seen.end(), false);
+		}
+		return drops;
+	}
+
+	uint64_t windowLines() const
+	{ return m_windowLines; }
+
+	const std::vector<double>& latencies() const
+	{ return m_latencies; }
+private:
+	std::vector<std::vector<bool>> m_seen;
+	uint64_t m_windowStart;
+	uint64_t m_windowEnd;
+	uint64_t m_windowLines = 0;
+	std::vector<double> m_latencies;
+};
+
+struct Result
+{
+	double cpu = 0.0;
+	std::unique_ptr<Sink> terminal;
+	std::unique_ptr<Sink> log;
+};
+
+/**
+ * Parse a rosmon log file. Each line starts with the local time in the
+ * format "%a %F %T.mmm", which gives the time of the write with
+ * millisecond resolution. Raw output has no prefix, its lines get the
+ * time of the last timestamp marker.
+ **/
+void parseLog(const fs::path& path, Sink* sink)
+{
+	std::ifstream stream(path.string());
+	std::string line;
+	uint64_t lastTimestamp = 0;
+	while(std::getline(stream, line))
+	{
+		struct tm btime;
+		memset(&btime, 0, sizeof(btime));
+		btime.tm_isdst = -1;
+
+		const char* rest = strptime(line.c_str(), "%a %Y-%m-%d %H:%M:%S", &btime);
+		if(!rest || *rest != '.')
+		{
+			if(lastTimestamp != 0)
+				sink->process(line.c_str(), lastTimestamp);
+			continue;
+		}
+
+		lastTimestamp = uint64_t(mktime(&btime)) * 1000000ULL + 1000ULL * strtoul(rest + 1, nullptr, 10);
+		sink->process(rest, lastTimestamp);
+	}
+}
+
+std::string writeLaunchFile(const fs::path& dir, const Options& opt, const std::string& output)
+{
+	std::string xml = "<launch>\n";
+	for(unsigned int i = 0; i < opt.nodes; ++i)
+	{
+		xml += fmt::format("\t<node name=\"spew_{}\" pkg=\"rosmon_core\" type=\"spew\" args=\"--id={} --rate={} --length={} --color={} --burst={}\" rosmon-output=\"{}\" />\n",
+			i, i, opt.rate, opt.length, opt.color, opt.burst, output
+		);
+	}
+	xml += "</launch>\n";
+
+	fs::path path = dir / fmt::format("spew_{}.launch", output);
+	std::ofstream(path.string()) << xml;
+
+	return path.string();
+}
+
+Result run(const Options& opt, const FakeMaster& master, const std::string& launchFile, const fs::path& logDir, bool ui, bool log)
+{
+	std::vector<std::string> args{
+		opt.rosmon,
+		"--name=rosmon_bench",
+		"--disable-diagnostics",
+	};
+	if(!ui)
+		args.push_back("--disable-ui");
+	if(log)
+		args.push_back("--log=" + logDir.string());
+	else
+		args.push_back("--disable-log");
+	args.push_back(launchFile);
+
+	std::vector<char*> argv;
+	for(auto& arg : args)
+		argv.push_back(const_cast<char*>(arg.c_str()));
+	argv.push_back(nullptr);
+
+	// rosmon gets a real terminal, as in interactive use
+	struct winsize size;
+	memset(&size, 0, sizeof(size));
+	size.ws_row = 50;
+	size.ws_col = 200;
+
+	std::string masterURI = master.uri();
+
+	int fd;
+	pid_t pid = forkpty(&fd, nullptr, nullptr, &size);
+	if(pid < 0)
+		throw std::runtime_error(fmt::format("Could not forkpty(): {}", strerror(errno)));
+
+	if(pid == 0)
+	{
+		setenv("ROS_MASTER_URI", masterURI.c_str(), 1);
+		setenv("ROS_IP", "127.0.0.1", 1);
+		setenv("TERM", "xterm-256color", 0);
+
+		execv(argv[0], argv.data());
+		fprintf(stderr, "Could not execute %s: %s\n", argv[0], strerror(errno));
+		_exit(127);
+	}
+
+	uint64_t start = realtimeMicroseconds();
+	uint64_t windowStart = start + uint64_t(opt.warmup * 1e6);
+	uint64_t windowEnd = windowStart + uint64_t(opt.duration * 1e6);
+
+	Result result;
+	result.terminal.reset(new Sink(opt.nodes, windowStart, windowEnd));
+
+	double cpuStart = -1.0;
+	bool stopping = false;
+	std::string buffer;
+	char chunk[65536];
+
+	while(true)
+	{
+		uint64_t now = realtimeMicroseconds();
+
+		if(cpuStart < 0 && now >= windowStart)
+			cpuStart = processCPUTime(pid);
+
+		if(!stopping && now >= windowEnd)
+		{
+			result.cpu = (processCPUTime(pid) - cpuStart) / opt.duration;
+			kill(pid, SIGINT);
+			stopping = true;
+		}
+
+		pollfd pfd{fd, POLLIN, 0};
+		int ret = poll(&pfd, 1, 10);
+		if(ret < 0 && errno != EINTR)
+			throw std::runtime_error(fmt::format("Could not poll(): {}", strerror(errno)));
+		if(ret <= 0)
+			continue;
+
+		// EIO signals that the slave side has been closed
+		ssize_t bytes = read(fd, chunk, sizeof(chunk));
+		if(bytes <= 0)
+			break;
+
+		uint64_t arrival = realtimeMicroseconds();
+		buffer.append(chunk, bytes);
+
+		std::size_t begin = 0;
+		std::size_t end;
+		while((end = buffer.find('\n', begin)) != std::string::npos)
+		{
+			buffer[end] = 0;
+			result.terminal->process(buffer.c_str() + begin, arrival);
+			begin = end + 1;
+		}
+		buffer.erase(0, begin);
+	}
+
+	close(fd);
+
+	int status;
+	waitpid(pid, &status, 0);
+	if(WIFEXITED(status) && WEXITSTATUS(status) == 127)
+		throw std::runtime_error("Could not start rosmon");
+
+	if(log && fs::exists(logDir))
+	{
+		result.log.reset(new Sink(opt.nodes, windowStart, windowEnd));
+
+		for(fs::recursive_directory_iterator it(logDir); it != fs::recursive_directory_iterator(); ++it)
+		{
+			if(it->path().extension() == ".log")
+				parseLog(it->path(), result.log.get());
+		}
+	}
+
+	return result;
+}
+
+std::string sinkJSON(const char* prefix, const Options& opt, const Sink* sink)
+{
+	if(!sink || sink->latencies().empty())
+	{
+		return fmt::format(R"("{0}_lines_per_s":null,"{0}_drops":null,"{0}_latency_median_s":null,"{0}_latency_p99_s":null,"{0}_latency_max_s":null)",
+			prefix
+		);
+	}
+
+	Statistics stats = statistics(sink->latencies());
+
+	return fmt::format(R"("{0}_lines_per_s":{1:.1f},"{0}_drops":{2},"{0}_latency_median_s":{3:.6f},"{0}_latency_p99_s":{4:.6f},"{0}_latency_max_s":{5:.6f})",
+		prefix, sink->windowLines() / opt.duration, sink->drops(),
+		stats.median, percentile(sink->latencies(), 0.99), stats.max
+	);
+}
+
+}
+
+static const struct option OPTIONS[] = {
+	{"nodes", required_argument, nullptr, 'n'},
+	{"rate", required_argument, nullptr, 'r'},
+	{"length", required_argument, nullptr, 'l'},
+	{"color", required_argument, nullptr, 'c'},
+	{"burst", required_argument, nullptr, 'b'},
+	{"duration", required_argument, nullptr, 'd'},
+	{"warmup", required_argument, nullptr, 'w'},
+	{"ui", required_argument, nullptr, 'u'},
+	{"log", required_argument, nullptr, 'L'},
+	{"output", required_argument, nullptr, 'o'},
+	{"rosmon", required_argument, nullptr, 'R'},
+	{"help", no_argument, nullptr, 'h'},
+	{nullptr, 0, nullptr, 0}
+};
+
+int main(int argc, char** argv)
+{
+	Options opt;
+
+	try
+	{
+		while(true)
+		{
+			int option_index;
+			int c = getopt_long(argc, argv, "h", OPTIONS, &option_index);
+
+			if(c == -1)
+				break;
+
+			switch(c)
+			{
+				case 'n': opt.nodes = std::stoul(optarg); break;
+				case 'r': opt.rate = std::stod(optarg); break;
+				case 'l': opt.length = std::stoul(optarg); break;
+				case 'c': opt.color = std::stod(optarg); break;
+				case 'b': opt.burst = std::stoul(optarg); break;
+				case 'd': opt.duration = std::stod(optarg); break;
+				case 'w': opt.warmup = std::stod(optarg); break;
+				case 'u': opt.ui = parseSwitch(optarg); break;
+				case 'L': opt.log = parseSwitch(optarg); break;
+				case 'o': opt.output = parseOutputModes(optarg); break;
+				case 'R': opt.rosmon = optarg; break;
+				case 'h':
+					usage();
+					return 0;
+				default:
+					usage();
+					return 1;
+			}
+		}
+	}
+	catch(std::invalid_argument& e)
+	{
+		fmt::print(stderr, "Invalid argument: {}\n", e.what());
+		return 1;
+	}
+
+	if(opt.nodes == 0 || opt.duration <= 0)
+	{
+		fmt::print(stderr, "--nodes and --duration need to be positive\n");
+		return 1;
+	}
+
+	if(opt.rosmon.empty())
+	{
+		char self[PATH_MAX];
+		ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+		if(len < 0)
+		{
+			fmt::print(stderr, "Could not find rosmon, please specify --rosmon\n");
+			return 1;
+		}
+		self[len] = 0;
+
+		opt.rosmon = (fs::path(self).parent_path() / "rosmon").string();
+	}
+
+	char dirTemplate[] = "/tmp/rosmon_bench_XXXXXX";
+	if(!mkdtemp(dirTemplate))
+	{
+		fmt::print(stderr, "Could not create temporary directory: {}\n", strerror(errno));
+		return 1;
+	}
+	fs::path dir(dirTemplate);
+
+	int ret = 0;
+	try
+	{
+		FakeMaster master;
+
+		unsigned int index = 0;
+		for(auto& output : opt.output)
+		{
+			std::string launchFile = writeLaunchFile(dir, opt, output);
+
+			for(bool ui : opt.ui)
+			{
+				for(bool log : opt.log)
+				{
+					fs::path logDir = dir / fmt::format("run{}", index++);
+
+					Result result = run(opt, master, launchFile, logDir, ui, log);
+
+					fmt::print(R"({{"benchmark":"log_pipeline","output":"{}","ui":{},"log":{},"nodes":{},"rate":{},"length":{},"color":{},"burst":{},"duration_s":{},"rosmon_cpu":{:.3f},{},{}}})" "\n",
+						output, ui, log, opt.nodes, opt.rate, opt.length, opt.color, opt.burst, opt.duration,
+						result.cpu,
+						sinkJSON("terminal", opt, result.terminal.get()),
+						sinkJSON("log", opt, result.log.get())
+					);
+					fflush(stdout);
+				}
+			}
+		}
+	}
+	catch(std::runtime_error& e)
+	{
+		fmt::print(stderr, "{}\n", e.what());
+		ret = 1;
+	}
+
+	boost::system::error_code ec;
+	fs::remove_all(dir, ec);
+
+	return ret;
+}
@@ -0,0 +1,102 @@
+// Benchmark for Terminal::Parser::wrap() with colored rosconsole output
+// Author: Max Schwarz <max.schwarz@uni-bonn.de>
+
+#include "../src/terminal.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <random>
+
+#include <fmt/format.h>
+
+using namespace rosmon;
+
+namespace
+{
+
+// Mimics rosconsole output with the ROSCONSOLE_FORMAT set by rosmon
+std::vector<std::string> generateLines(std::size_t count)
+{
+	const char* LEVEL_COLORS[] = {"\033[0m", "\033[0m", "\033[0m", "\033[33m", "\033[31m"};
+	const char* LEVEL_NAMES[] = {" INFO", " INFO", " INFO", " WARN", "ERROR"};
+
+	std::mt19937 gen(42);
+	std::uniform_int_distribution<int> levelDist(0, 4);
+	std::uniform_int_distribution<int> lengthDist(20, 200);
+
+	std::vector<std::string> lines;
+	lines.reserve(count);
+
+	for(std::size_t i = 0; i < count; ++i)
+	{
+		int level = levelDist(gen);
+
+		std::string message(lengthDist(gen), 'x');
+		for(std::size_t j = 7; j < message.size(); j += 8)
+			message[j] = ' ';
+
+		lines.push_back(fmt::format("{}[{}] [Publisher::publish] [1571234567.{:09d}]: frame {} {}\033[0m\n",
+			LEVEL_COLORS[level], LEVEL_NAMES[level], i, i, message
+		));
+	}
+
+	return lines;
+}
+
+}
+
+int main()
+{
+	// Use a fixed terminal description so that results are comparable
+	setenv("ROSMON_COLOR_MODE", "256colors", 1);
+
+	Terminal term;
+	Terminal::Parser parser(&term);
+	Terminal::WrapBuffer buffer;
+
+	const std::size_t NUM_LINES = 100000;
+	const int NUM_RUNS = 7;
+
+	auto lines = generateLines(NUM_LINES);
+
+	std::size_t totalBytes = 0;
+	for(auto& line : lines)
+		totalBytes += line.size();
+
+	fmt::print("{:>8} {:>12} {:>12} {:>10}\n", "columns", "ns/line", "MB/s", "out lines");
+
+	for(unsigned int columns : {0u, 80u, 120u, 200u})
+	{
+		std::vector<double> durations;
+		std::size_t outLines = 0;
+
+		for(int run = 0; run < NUM_RUNS; ++run)
+		{
+			outLines = 0;
+
+			auto start = std::chrono::steady_clock::now();
+			for(auto& line : lines)
+			{
+				parser.wrap(line.data(), line.data() + line.size(), columns, &buffer);
+				outLines += buffer.size();
+			}
+			auto end = std::chrono::steady_clock::now();
+
+			durations.push_back(std::chrono::duration<double>(end - start).count());
+		}
+
+		// Report the median run
+		std::sort(durations.begin(), durations.end());
+		double duration = durations[NUM_RUNS/2];
+
+		fmt::print("{:>8} {:>12.1f} {:>12.1f} {:>10}\n",
+			columns,
+			1e9 * duration / NUM_LINES,
+			totalBytes / duration / 1e6,
+			outLines
+		);
+	}
+
+	return 0;
+}
@@ -68,12 +68,57 @@ void DiagnosticsPublisher::publish(const std::vector<NodeMonitor::Ptr>& state)
 		kv.value = memoryToString(nodeState->memory());
 		nodeStatus.values.push_back(kv);
 
+		if(nodeState->detailedMemoryAvailable())
+		{
+			kv.key = "PSS";
+			kv.value = memoryToString(nodeState->memoryPSS());
+			nodeStatus.values.push_back(kv);
+
+			kv.key = "USS";
+			kv.value = memoryToString(nodeState->memoryUSS());
+			nodeStatus.values.push_back(kv);
+
+			kv.key = "swap";
+			kv.value = memoryToString(nodeState->memorySwap());
+			nodeStatus.values.push_back(kv);
+		}
+
+		kv.key = "page faults";
+		kv.value = fmt::format("{:.0f}/s minor, {:.0f}/s major",
+			nodeState->minorFaultRate(), nodeState->majorFaultRate());
+		nodeStatus.values.push_back(kv);
+
+		kv.key = "context switches";
+		kv.value = fmt::format("{:.0f}/s voluntary, {:.0f}/s involuntary",
+			nodeState->voluntarySwitchRate(), nodeState->involuntarySwitchRate());
+		nodeStatus.values.push_back(kv);
+
+		kv.key = "I/O";
+		kv.value = fmt::format("{}/s read, {}/s written",
+			memoryToString(static_cast<uint64_t>(nodeState->readRate())),
+			memoryToString(static_cast<uint64_t>(nodeState->writeRate())));
+		nodeStatus.values.push_back(kv);
+
 		kv.key = "restart count";
 		kv.value = std::to_string(nodeState->restartCount());
 		nodeStatus.values.push_back(kv);
 
+		if(nodeState->livenessFailures() > 0)
+		{
+			kv.key = "liveness failures";
+			kv.value = std::to_string(nodeState->livenessFailures());
+			nodeStatus.values.push_back(kv);
+		}
+
+		if(nodeState->state() == NodeMonitor::STATE_BACKOFF)
+		{
+			kv.key = "respawn delay";
+			kv.value = fmt::format("{:.1f}s", nodeState->respawnDelay());
+			nodeStatus.values.push_back(kv);
+		}
+
 		// Apply the operation level rule :
-		// If process is CRASHED => ERROR
+		// If process is CRASHED or FAILED (crash loop) => ERROR
 		// If process has been automatically restarted => WARN
 		// If process memory limit or cpu limit is too high => WARN
 		std::string msg;
@@ -83,6 +128,11 @@ void DiagnosticsPublisher::publish(const std::vector<NodeMonitor::Ptr>& state)
 			nodeStatus.level = diagnostic_msgs::DiagnosticStatus::ERROR;
 			nodeStatus.message = "Process has crashed";
 		}
+		else if(nodeState->state() == NodeMonitor::STATE_FAILED)
+		{
+			nodeStatus.level = diagnostic_msgs::DiagnosticStatus::ERROR;
+			nodeStatus.message = "Process is in a crash loop, not restarting";
+		}
 		else
 		{
 			if(nodeState->restartCount() > 0)
@@ -91,7 +141,13 @@ void DiagnosticsPublisher::publish(const std::vector<NodeMonitor::Ptr>& state)
 				msg = "restart count > 0! (" + std::to_string(nodeState->restartCount()) + ")";
 			}
 
-			if(nodeState->memory() > nodeState->memoryLimit())
+			if(nodeState->livenessFailures() > 0)
+			{
+				nodeStatus.level = diagnostic_msgs::DiagnosticStatus::WARN;
+				msg += "liveness probe failed! ";
+			}
+
+			if(nodeState->memoryForLimit() > nodeState->memoryLimit())
 			{
 				nodeStatus.level = diagnostic_msgs::DiagnosticStatus::WARN;
 				msg += "memory usage is high! ";
@@ -2,7 +2,9 @@
 // Author: Max Schwarz <max.schwarz@uni-bonn.de>
 
 #include "fd_watcher.h"
+#include "self_stats.h"
 
+#include <chrono>
 #include <cstdarg>
 #include <vector>
 
@@ -21,12 +23,15 @@ namespace rosmon
 {
 
 FDWatcher::FDWatcher()
+ : m_wakeLatency(&SelfStats::instance().histogram("loop/wake_latency"))
+ , m_dispatch(&SelfStats::instance().histogram("loop/dispatch"))
 {
 }
 
-void FDWatcher::registerFD(int fd, const boost::function<void (int)>& cb)
+void FDWatcher::registerFD(int fd, const boost::function<void (int)>& cb, const std::string& name)
 {
-	m_fds[fd] = cb;
+	std::string histogramName = "fd/" + (name.empty() ? std::to_string(fd) : name);
+	m_fds[fd] = {cb, &SelfStats::instance().histogram(histogramName)};
 }
 
 void FDWatcher::removeFD(int fd)
@@ -50,6 +55,8 @@ void FDWatcher::wait(const ros::WallDuration& duration)
 		maxfd = std::max(pair.first, maxfd);
 	}
 
+	auto selectStart = std::chrono::steady_clock::now();
+
 	int ret = select(maxfd+1, &fds, nullptr, nullptr, &timeout);
 	if(ret < 0)
 	{
@@ -59,11 +66,21 @@ void FDWatcher::wait(const ros::WallDuration& duration)
 		throw error("Could not select(): {}", strerror(errno));
 	}
 
-	if(ret != 0)
+	auto wakeup = std::chrono::steady_clock::now();
+
+	if(ret == 0)
+	{
+		// How late did we wake up after the timeout?
+		double slept = std::chrono::duration<double>(wakeup - selectStart).count();
+		m_wakeLatency->record(std::max(0.0, slept - duration.toSec()));
+	}
+	else
 	{
+		ScopedTimer dispatchTimer(m_dispatch);
+
 		// Store the callbacks to be notified in a temporary list, as calling
 		// the callback might call removeFD(), which will confuse us...
-		std::vector<std::pair<int, boost::function<void(int)>>> toBeNotified;
+		std::vector<std::pair<int, Watch>> toBeNotified;
 
 		for(auto pair : m_fds)
 		{
@@ -73,7 +90,10 @@ void FDWatcher::wait(const ros::WallDuration& duration)
 
 		// Actually call the callbacks
 		for(auto pair : toBeNotified)
-			pair.second(pair.first);
+		{
+			ScopedTimer timer(pair.second.duration);
+			pair.second.cb(pair.first);
+		}
 	}
 }
 
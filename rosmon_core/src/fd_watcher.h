@@ -7,12 +7,15 @@
 #include <ros/time.h>
 
 #include <map>
+#include <string>
 
 #include <boost/function.hpp>
 
 namespace rosmon
 {
 
+class Histogram;
+
 class FDWatcher
 {
 public:
@@ -20,12 +23,27 @@ public:
 
 	FDWatcher();
 
-	void registerFD(int fd, const boost::function<void(int)>& cb);
+	/**
+	 * @brief Call cb when fd becomes readable
+	 *
+	 * @param name Name for the callback duration histogram in SelfStats
+	 *   ("fd/<name>"), defaults to the fd number.
+	 **/
+	void registerFD(int fd, const boost::function<void(int)>& cb, const std::string& name = {});
 	void removeFD(int fd);
 
 	void wait(const ros::WallDuration& duration);
 private:
-	std::map<int, boost::function<void(int)>> m_fds;
+	struct Watch
+	{
+		boost::function<void(int)> cb;
+		Histogram* duration;
+	};
+
+	std::map<int, Watch> m_fds;
+
+	Histogram* m_wakeLatency;
+	Histogram* m_dispatch;
 };
 
 }
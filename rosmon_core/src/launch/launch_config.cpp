@@ -6,19 +6,24 @@
 #include "yaml_params.h"
 #include "bytes_parser.h"
 #include "string_utils.h"
+#include "../trace.h"
 
 #include <ros/package.h>
 #include <ros/names.h>
 
+#include <algorithm>
 #include <cctype>
 #include <cstdarg>
 #include <cstdio>
 #include <fstream>
 
+#include <linux/mempolicy.h>
+#include <sched.h>
 #include <sys/wait.h>
 
 #include <boost/regex.hpp>
 #include <boost/algorithm/string/case_conv.hpp>
+#include <boost/algorithm/string/split.hpp>
 #include <boost/algorithm/string/trim.hpp>
 #include <boost/lexical_cast.hpp>
 
@@ -151,6 +156,11 @@ void LaunchConfig::setDefaultMemoryLimit(uint64_t memoryLimit)
     m_defaultMemoryLimit = memoryLimit;
 }
 
+void LaunchConfig::setDefaultStatsPeriod(double period)
+{
+	m_defaultStatsPeriod = period;
+}
+
 void LaunchConfig::setWorkingDirectory(std::string workingDirectory)
 {
     m_workingDirectory = workingDirectory;
@@ -177,6 +187,7 @@ void LaunchConfig::parse(const std::string& filename, bool onlyArguments)
 	}
 
 	ros::WallTime start = ros::WallTime::now();
+	trace::Span span("launch", onlyArguments ? "parse arguments" : "parse", fmt::format("\"file\":\"{}\"", trace::escape(filename)));
 	parse(document.RootElement(), &m_rootContext, onlyArguments);
 
 	// Parse top-level rosmon-specific attributes
@@ -281,6 +292,52 @@ void LaunchConfig::parse(TiXmlElement* element, ParseContext* ctx, bool onlyArgu
 	}
 }
 
+/**
+ * @brief Parse a CPU/NUMA node list like "0-3,6" (same syntax as taskset -c)
+ *
+ * @return false on syntax errors or indices >= limit
+ **/
+static bool parseIndexList(const std::string& spec, unsigned int limit, std::vector<unsigned int>* values)
+{
+	std::vector<std::string> parts;
+	boost::algorithm::split(parts, spec, [](char c){ return c == ','; });
+
+	values->clear();
+	for(auto& part : parts)
+	{
+		boost::algorithm::trim(part);
+
+		unsigned int first;
+		unsigned int last;
+		try
+		{
+			auto dash = part.find('-');
+			if(dash == std::string::npos)
+				first = last = boost::lexical_cast<unsigned int>(part);
+			else
+			{
+				first = boost::lexical_cast<unsigned int>(part.substr(0, dash));
+				last = boost::lexical_cast<unsigned int>(part.substr(dash+1));
+			}
+		}
+		catch(boost::bad_lexical_cast&)
+		{
+			return false;
+		}
+
+		if(first > last || last >= limit)
+			return false;
+
+		for(unsigned int value = first; value <= last; ++value)
+			values->push_back(value);
+	}
+
+	std::sort(values->begin(), values->end());
+	values->erase(std::unique(values->begin(), values->end()), values->end());
+
+	return !values->empty();
+}
+
 void LaunchConfig::parseNode(TiXmlElement* element, ParseContext ctx)
 {
 	const char* name = element->Attribute("name");
@@ -299,6 +356,31 @@ void LaunchConfig::parseNode(TiXmlElement* element, ParseContext ctx)
     const char* memoryLimit = element->Attribute("rosmon-memory-limit");
     const char* cpuLimit = element->Attribute("rosmon-cpu-limit");
     const char* shutdownHandler = element->Attribute("shutdown-handler");
+	const char* shutdownHandlerTimeout = element->Attribute("rosmon-shutdown-handler-timeout");
+	const char* shutdownGroup = element->Attribute("rosmon-shutdown-group");
+	const char* statsPeriod = element->Attribute("rosmon-stats-period");
+	const char* cpuAffinity = element->Attribute("rosmon-cpu-affinity");
+	const char* nice = element->Attribute("rosmon-nice");
+	const char* schedPolicy = element->Attribute("rosmon-sched-policy");
+	const char* schedPriority = element->Attribute("rosmon-sched-priority");
+	const char* mlockAll = element->Attribute("rosmon-mlockall");
+	const char* memlockLimit = element->Attribute("rosmon-memlock-limit");
+	const char* numaPolicy = element->Attribute("rosmon-numa-policy");
+	const char* numaNodes = element->Attribute("rosmon-numa-nodes");
+	const char* respawnBackoff = element->Attribute("rosmon-respawn-backoff");
+	const char* respawnMaxDelay = element->Attribute("rosmon-respawn-max-delay");
+	const char* respawnJitter = element->Attribute("rosmon-respawn-jitter");
+	const char* crashLoopCount = element->Attribute("rosmon-crash-loop-count");
+	const char* crashLoopWindow = element->Attribute("rosmon-crash-loop-window");
+	const char* livenessCPU = element->Attribute("rosmon-liveness-cpu");
+	const char* livenessDState = element->Attribute("rosmon-liveness-dstate");
+	const char* livenessOutput = element->Attribute("rosmon-liveness-output");
+	const char* livenessHeartbeat = element->Attribute("rosmon-liveness-heartbeat");
+	const char* livenessHeartbeatTimeout = element->Attribute("rosmon-liveness-heartbeat-timeout");
+	const char* livenessGrace = element->Attribute("rosmon-liveness-grace");
+	const char* coreQuota = element->Attribute("rosmon-core-quota");
+	const char* coreMode = element->Attribute("rosmon-core-mode");
+	const char* outputMode = element->Attribute("rosmon-output");
 
 
 	if(!name || !pkg || !type)
@@ -388,6 +470,145 @@ void LaunchConfig::parseNode(TiXmlElement* element, ParseContext ctx)
 		node->setCPULimit(m_defaultCPULimit);
 	}
 
+	if(statsPeriod)
+	{
+		double seconds;
+		try
+		{
+			seconds = boost::lexical_cast<double>(ctx.evaluate(statsPeriod));
+		}
+		catch(boost::bad_lexical_cast&)
+		{
+			throw ctx.error("bad rosmon-stats-period value '{}'", statsPeriod);
+		}
+		if(seconds < Node::MIN_STATS_PERIOD)
+			throw ctx.error("rosmon-stats-period value '{}' needs to be at least {}", statsPeriod, Node::MIN_STATS_PERIOD);
+
+		node->setStatsPeriod(seconds);
+	}
+	else
+		node->setStatsPeriod(m_defaultStatsPeriod);
+
+	if(cpuAffinity)
+	{
+		std::vector<unsigned int> cpus;
+		if(!parseIndexList(ctx.evaluate(cpuAffinity), CPU_SETSIZE, &cpus))
+			throw ctx.error("bad rosmon-cpu-affinity value '{}', expected a CPU list like '0-3,6'", cpuAffinity);
+
+		node->setCPUAffinity(cpus);
+	}
+
+	if(nice)
+	{
+		int value;
+		try
+		{
+			value = boost::lexical_cast<int>(ctx.evaluate(nice));
+		}
+		catch(boost::bad_lexical_cast&)
+		{
+			throw ctx.error("bad rosmon-nice value '{}'", nice);
+		}
+		if(value < -20 || value > 19)
+			throw ctx.error("rosmon-nice value '{}' needs to be in [-20, 19]", nice);
+
+		node->setNice(value);
+	}
+
+	if(schedPolicy)
+	{
+		std::string policyName = ctx.evaluate(schedPolicy);
+		int policy;
+		if(policyName == "other")
+			policy = SCHED_OTHER;
+		else if(policyName == "batch")
+			policy = SCHED_BATCH;
+		else if(policyName == "idle")
+			policy = SCHED_IDLE;
+		else if(policyName == "fifo")
+			policy = SCHED_FIFO;
+		else if(policyName == "rr")
+			policy = SCHED_RR;
+		else
+			throw ctx.error("bad rosmon-sched-policy value '{}', expected one of other, batch, idle, fifo, rr", policyName);
+
+		int minPriority = sched_get_priority_min(policy);
+		int maxPriority = sched_get_priority_max(policy);
+
+		int priority = minPriority;
+		if(schedPriority)
+		{
+			try
+			{
+				priority = boost::lexical_cast<int>(ctx.evaluate(schedPriority));
+			}
+			catch(boost::bad_lexical_cast&)
+			{
+				throw ctx.error("bad rosmon-sched-priority value '{}'", schedPriority);
+			}
+
+			if(priority < minPriority || priority > maxPriority)
+			{
+				throw ctx.error("rosmon-sched-priority value '{}' needs to be in [{}, {}] for policy '{}'",
+					schedPriority, minPriority, maxPriority, policyName
+				);
+			}
+		}
+
+		node->setSchedPolicy(policy, priority);
+	}
+	else if(schedPriority)
+		throw ctx.error("rosmon-sched-priority needs rosmon-sched-policy");
+
+	if(mlockAll)
+		node->setMlockAll(ctx.parseBool(mlockAll, element->Row()));
+
+	if(memlockLimit)
+	{
+		std::string value = ctx.evaluate(memlockLimit);
+		if(value == "unlimited")
+			node->setMemlockLimit(Node::MEMLOCK_UNLIMITED);
+		else
+		{
+			uint64_t bytes;
+			bool ok;
+			std::tie(bytes, ok) = parseMemory(value);
+			if(!ok)
+				throw ctx.error("{} cannot be parsed as a memlock limit", memlockLimit);
+
+			node->setMemlockLimit(bytes);
+		}
+	}
+
+	if(numaPolicy)
+	{
+		std::string policyName = ctx.evaluate(numaPolicy);
+		int mode;
+		if(policyName == "bind")
+			mode = MPOL_BIND;
+		else if(policyName == "preferred")
+			mode = MPOL_PREFERRED;
+		else if(policyName == "interleave")
+			mode = MPOL_INTERLEAVE;
+		else
+			throw ctx.error("bad rosmon-numa-policy value '{}', expected one of bind, preferred, interleave", policyName);
+
+		if(!numaNodes)
+			throw ctx.error("rosmon-numa-policy needs rosmon-numa-nodes");
+
+		// The kernel supports at most 1024 NUMA nodes (CONFIG_NODES_SHIFT)
+		std::vector<unsigned int> nodes;
+		if(!parseIndexList(ctx.evaluate(numaNodes), 1024, &nodes))
+			throw ctx.error("bad rosmon-numa-nodes value '{}', expected a node list like '0-1'", numaNodes);
+
+		if(mode == MPOL_PREFERRED && nodes.size() != 1)
+			throw ctx.error("rosmon-numa-policy 'preferred' needs exactly one NUMA node");
+
+		node->setNUMAPolicy(mode, nodes);
+	}
+	else if(numaNodes)
+		throw ctx.error("rosmon-numa-nodes needs rosmon-numa-policy");
+
 	if(args)
 		node->addExtraArguments(ctx.evaluate(args));
 
@@ -424,12 +645,156 @@ void LaunchConfig::parseNode(TiXmlElement* element, ParseContext ctx)
 
 		node->setRespawnDelay(ros::WallDuration(seconds));
 	}
+
+	if(respawnBackoff || respawnMaxDelay || respawnJitter)
+	{
+		auto parseDouble = [&](const char* value, const char* attribute, double defaultValue) {
+			if(!value)
+				return defaultValue;
+
+			try
+			{
+				return boost::lexical_cast<double>(ctx.evaluate(value));
+			}
+			catch(boost::bad_lexical_cast&)
+			{
+				throw ctx.error("bad {} value '{}'", attribute, value);
+			}
+		};
+
+		double factor = parseDouble(respawnBackoff, "rosmon-respawn-backoff", node->respawnBackoff());
+		double maxDelay = parseDouble(respawnMaxDelay, "rosmon-respawn-max-delay", node->respawnMaxDelay().toSec());
+		double jitter = parseDouble(respawnJitter, "rosmon-respawn-jitter", node->respawnJitter());
+
+		if(factor < 1.0)
+			throw ctx.error("rosmon-respawn-backoff value '{}' needs to be >= 1", respawnBackoff);
+		if(maxDelay < node->respawnDelay().toSec())
+			throw ctx.error("rosmon-respawn-max-delay value '{}' is smaller than respawn_delay", respawnMaxDelay);
+		if(jitter < 0.0 || jitter > 1.0)
+			throw ctx.error("rosmon-respawn-jitter value '{}' needs to be in [0, 1]", respawnJitter);
+
+		node->setRespawnBackoff(factor, ros::WallDuration(maxDelay), jitter);
+	}
+
+	if(crashLoopCount)
+	{
+		unsigned int count;
+		try
+		{
+			count = boost::lexical_cast<unsigned int>(ctx.evaluate(crashLoopCount));
+		}
+		catch(boost::bad_lexical_cast&)
+		{
+			throw ctx.error("bad rosmon-crash-loop-count value '{}'", crashLoopCount);
+		}
+
+		double window = node->crashLoopWindow().toSec();
+		if(crashLoopWindow)
+		{
+			try
+			{
+				window = boost::lexical_cast<double>(ctx.evaluate(crashLoopWindow));
+			}
+			catch(boost::bad_lexical_cast&)
+			{
+				throw ctx.error("bad rosmon-crash-loop-window value '{}'", crashLoopWindow);
+			}
+			if(window <= 0)
+				throw ctx.error("rosmon-crash-loop-window value '{}' needs to be positive", crashLoopWindow);
+		}
+
+		node->setCrashLoopLimit(count, ros::WallDuration(window));
+	}
+	else if(crashLoopWindow)
+		throw ctx.error("rosmon-crash-loop-window needs rosmon-crash-loop-count");
+
+	if(livenessCPU || livenessDState || livenessOutput || livenessHeartbeat || livenessHeartbeatTimeout || livenessGrace)
+	{
+		auto parseTimeout = [&](const char* value, const char* attribute, double defaultValue) {
+			if(!value)
+				return defaultValue;
+
+			double seconds;
+			try
+			{
+				seconds = boost::lexical_cast<double>(ctx.evaluate(value));
+			}
+			catch(boost::bad_lexical_cast&)
+			{
+				throw ctx.error("bad {} value '{}'", attribute, value);
+			}
+			if(seconds < 0)
+				throw ctx.error("negative {} value '{}'", attribute, value);
+
+			return seconds;
+		};
+
+		Node::Liveness liveness;
+		liveness.cpuTimeout = parseTimeout(livenessCPU, "rosmon-liveness-cpu", 0.0);
+		liveness.dStateTimeout = parseTimeout(livenessDState, "rosmon-liveness-dstate", 0.0);
+		liveness.outputTimeout = parseTimeout(livenessOutput, "rosmon-liveness-output", 0.0);
+		liveness.grace = parseTimeout(livenessGrace, "rosmon-liveness-grace", liveness.grace);
+
+		if(livenessHeartbeat)
+		{
+			liveness.heartbeat = ctx.evaluate(livenessHeartbeat);
+			if(liveness.heartbeat.empty() || liveness.heartbeat == "unix:")
+				throw ctx.error("empty rosmon-liveness-heartbeat path");
+
+			liveness.heartbeatTimeout = parseTimeout(livenessHeartbeatTimeout, "rosmon-liveness-heartbeat-timeout", 5.0);
+			if(liveness.heartbeatTimeout == 0)
+				throw ctx.error("rosmon-liveness-heartbeat-timeout needs to be positive");
+		}
+		else if(livenessHeartbeatTimeout)
+			throw ctx.error("rosmon-liveness-heartbeat-timeout needs rosmon-liveness-heartbeat");
+
+		if(node->statsPeriod() > liveness.maxStatsPeriod())
+		{
+			throw ctx.error("rosmon-liveness-cpu/rosmon-liveness-dstate timeouts need to be at least twice the stats period ({}s)",
+				node->statsPeriod()
+			);
+		}
+
+		node->setLiveness(liveness);
+	}
         
 	if(shutdownHandler)
 	{
 		node->setShutdownHandler(ctx.evaluate(shutdownHandler));
 	}
 
+	if(shutdownHandlerTimeout)
+	{
+		double seconds;
+		try
+		{
+			seconds = boost::lexical_cast<double>(ctx.evaluate(shutdownHandlerTimeout));
+		}
+		catch(boost::bad_lexical_cast&)
+		{
+			throw ctx.error("bad rosmon-shutdown-handler-timeout value '{}'", shutdownHandlerTimeout);
+		}
+		if(seconds < 0)
+			throw ctx.error("negative rosmon-shutdown-handler-timeout value '{}'", shutdownHandlerTimeout);
+
+		node->setShutdownHandlerTimeout(seconds);
+	}
+
+	if(shutdownGroup)
+	{
+		int group;
+		try
+		{
+			group = boost::lexical_cast<int>(ctx.evaluate(shutdownGroup));
+		}
+		catch(boost::bad_lexical_cast&)
+		{
+			throw ctx.error("bad rosmon-shutdown-group value '{}'", shutdownGroup);
+		}
+
+		node->setShutdownGroup(group);
+	}
+
 	if(required && ctx.parseBool(required, element->Row()))
 	{
 		node->setRequired(true);
@@ -467,6 +832,41 @@ void LaunchConfig::parseNode(TiXmlElement* element, ParseContext ctx)
 	if(coredumpsEnabled)
 		node->setCoredumpsEnabled(ctx.parseBool(coredumpsEnabled, element->Row()));
 
+	if(coreQuota)
+	{
+		uint64_t bytes;
+		bool ok;
+		std::tie(bytes, ok) = parseMemory(ctx.evaluate(coreQuota));
+		if(!ok)
+			throw ctx.error("{} cannot be parsed as a core quota", coreQuota);
+
+		node->setCoreQuota(bytes);
+	}
+
+	if(coreMode)
+	{
+		std::string mode = ctx.evaluate(coreMode);
+		if(mode == "full")
+			node->setCoreMode(Node::CORE_FULL);
+		else if(mode == "backtrace")
+			node->setCoreMode(Node::CORE_BACKTRACE);
+		else
+			throw ctx.error("bad rosmon-core-mode value '{}', expected one of full, backtrace", mode);
+	}
+
+	if(outputMode)
+	{
+		std::string mode = ctx.evaluate(outputMode);
+		if(mode == "pty")
+			node->setOutputMode(Node::OUTPUT_PTY);
+		else if(mode == "pipe")
+			node->setOutputMode(Node::OUTPUT_PIPE);
+		else if(mode == "raw")
+			node->setOutputMode(Node::OUTPUT_RAW);
+		else
+			throw ctx.error("bad rosmon-output value '{}', expected one of pty, pipe, raw", mode);
+	}
+
 	if (!m_workingDirectory.empty())
 		node->setWorkingDirectory(m_workingDirectory);
 	else if(cwd)
@@ -1067,6 +1467,8 @@ void safeAdvance(Iterator& it, const Iterator& end, size_t i)
 
 void LaunchConfig::evaluateParameters()
 {
+	trace::Span span("launch", "evaluateParameters");
+
 	// This function is optimized for speed, since we usually have a lot of
 	// parameters and some of those take time (>2s) to compute and upload
 	// (e.g. xacro).
@@ -1087,6 +1489,8 @@ void LaunchConfig::evaluateParameters()
 	for(int i = 0; i < NUM_THREADS; ++i)
 	{
 		threads[i] = std::thread([this,i,NUM_THREADS,&mutex,&caughtException,&caughtExceptionFlag]() {
+			trace::setThreadName(fmt::format("param worker {}", i));
+
 			try
 			{
 				// Thread number i starts at position i and moves in NUM_THREADS
@@ -1096,7 +1500,9 @@ void LaunchConfig::evaluateParameters()
 
 				while(it != m_paramJobs.end())
 				{
+					uint64_t start = trace::now();
 					XmlRpc::XmlRpcValue val = it->second.get();
+					trace::complete("param", it->first, start, trace::now() - start);
 					{
 						std::lock_guard<std::mutex> guard(mutex);
 						m_params[it->first] = val;
@@ -1111,7 +1517,9 @@ void LaunchConfig::evaluateParameters()
 
 				while(yamlIt != m_yamlParamJobs.end())
 				{
+					uint64_t start = trace::now();
 					YAMLResult yaml = yamlIt->get();
+					trace::complete("param", yaml.name + " (yaml)", start, trace::now() - start);
 					{
 						std::lock_guard<std::mutex> guard(mutex);
 						loadYAMLParams(m_rootContext, yaml.yaml, yaml.name);
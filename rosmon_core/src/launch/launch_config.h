@@ -157,6 +157,7 @@ public:
 	constexpr static float DEFAULT_CPU_LIMIT = 0.9f;
 	constexpr static uint64_t DEFAULT_MEMORY_LIMIT = 500*1024*1024;
 	constexpr static float DEFAULT_STOP_TIMEOUT = 5.0f;
+	constexpr static float DEFAULT_STATS_PERIOD = 1.0f;
 
 	LaunchConfig();
 
@@ -165,6 +166,7 @@ public:
 	void setDefaultStopTimeout(double timeout);
 	void setDefaultCPULimit(double CPULimit);
 	void setDefaultMemoryLimit(uint64_t memoryLimit);
+	void setDefaultStatsPeriod(double period);
 	void setWorkingDirectory(std::string);
 	void setRespawnBehaviour(bool respawnAll, bool respawnObey, bool respawnDefault);
 
@@ -238,6 +240,7 @@ private:
 	double m_defaultStopTimeout{DEFAULT_STOP_TIMEOUT};
     uint64_t m_defaultMemoryLimit{DEFAULT_MEMORY_LIMIT};
     double m_defaultCPULimit{DEFAULT_CPU_LIMIT};
+	double m_defaultStatsPeriod{DEFAULT_STATS_PERIOD};
     
     std::string m_workingDirectory;
     bool m_respawnAll;
@@ -8,6 +8,7 @@
 #include <wordexp.h>
 #include <glob.h>
 
+#include <cmath>
 #include <cstdarg>
 
 #include <fmt/format.h>
@@ -34,13 +35,32 @@ Node::Node(std::string name, std::string package, std::string type)
  //  however, the source tells a different story...
  , m_respawn(false)
  , m_respawnDelay(1.0)
+ , m_respawnBackoff(1.0)
+ , m_respawnMaxDelay(60.0)
+ , m_respawnJitter(0.0)
+ , m_crashLoopCount(0)
+ , m_crashLoopWindow(60.0)
+ , m_shutdownHandlerTimeout(10.0)
+ , m_shutdownGroup(0)
 
  , m_required(false)
  , m_coredumpsEnabled(true)
+ , m_coreQuota(0)
+ , m_coreMode(CORE_FULL)
+ , m_outputMode(OUTPUT_PTY)
  , m_clearParams(false)
  , m_stopTimeout(5.0)
  , m_memoryLimitByte(15e6)
  , m_cpuLimit(0.05)
+ , m_statsPeriod(1.0)
+ , m_hasNice(false)
+ , m_nice(0)
+ , m_schedPolicy(-1)
+ , m_schedPriority(0)
+ , m_mlockAll(false)
+ , m_hasMemlockLimit(false)
+ , m_memlockLimit(0)
+ , m_numaPolicy(-1)
 {
 	m_executable = PackageRegistry::getExecutable(m_package, m_type);
 }
@@ -100,11 +120,40 @@ void Node::setRespawnDelay(const ros::WallDuration& respawnDelay)
 	m_respawnDelay = respawnDelay;
 }
 
+void Node::setRespawnBackoff(double factor, const ros::WallDuration& maxDelay, double jitter)
+{
+	m_respawnBackoff = factor;
+	m_respawnMaxDelay = maxDelay;
+	m_respawnJitter = jitter;
+}
+
+double Node::respawnDelayAt(unsigned int level) const
+{
+	double delay = m_respawnDelay.toSec() * std::pow(m_respawnBackoff, level);
+	return std::min(delay, respawnMaxDelay().toSec());
+}
+
+void Node::setCrashLoopLimit(unsigned int count, const ros::WallDuration& window)
+{
+	m_crashLoopCount = count;
+	m_crashLoopWindow = window;
+}
+
 void Node::setShutdownHandler(const std::string& handler)
 {
 	m_shutdownHandler = handler;
 }
 
+void Node::setShutdownHandlerTimeout(double timeout)
+{
+	m_shutdownHandlerTimeout = timeout;
+}
+
+void Node::setShutdownGroup(int group)
+{
+	m_shutdownGroup = group;
+}
+
 void Node::setLaunchPrefix(const std::string& launchPrefix)
 {
 	wordexp_t tokens;
@@ -135,6 +184,21 @@ void Node::setCoredumpsEnabled(bool on)
 	m_coredumpsEnabled = on;
 }
 
+void Node::setCoreQuota(uint64_t bytes)
+{
+	m_coreQuota = bytes;
+}
+
+void Node::setCoreMode(CoreMode mode)
+{
+	m_coreMode = mode;
+}
+
+void Node::setOutputMode(OutputMode mode)
+{
+	m_outputMode = mode;
+}
+
 void Node::setWorkingDirectory(const std::string& cwd)
 {
 	m_workingDirectory = cwd;
@@ -160,6 +224,104 @@ void Node::setCPULimit(float cpuLimit)
     m_cpuLimit = cpuLimit;
 }
 
+void Node::setStatsPeriod(double period)
+{
+	m_statsPeriod = period;
+}
+
+void Node::setCPUAffinity(const std::vector<unsigned int>& cpus)
+{
+	m_cpuAffinity = cpus;
+}
+
+void Node::setNice(int nice)
+{
+	m_hasNice = true;
+	m_nice = nice;
+}
+
+void Node::setSchedPolicy(int policy, int priority)
+{
+	m_schedPolicy = policy;
+	m_schedPriority = priority;
+}
+
+void Node::setMlockAll(bool on)
+{
+	m_mlockAll = on;
+}
+
+void Node::setMemlockLimit(uint64_t bytes)
+{
+	m_hasMemlockLimit = true;
+	m_memlockLimit = bytes;
+}
+
+void Node::setNUMAPolicy(int mode, const std::vector<unsigned int>& nodes)
+{
+	m_numaPolicy = mode;
+	m_numaNodes = nodes;
+}
+
+void Node::setLiveness(const Liveness& liveness)
+{
+	m_liveness = liveness;
+}
+
+bool Node::sameProcess(const Node& other) const
+{
+	return m_name == other.m_name
+		&& m_package == other.m_package
+		&& m_type == other.m_type
+		&& m_executable == other.m_executable
+		&& m_namespace == other.m_namespace
+		&& m_remappings == other.m_remappings
+		&& m_extraArgs == other.m_extraArgs
+		&& m_extraEnvironment == other.m_extraEnvironment
+		&& m_launchPrefix == other.m_launchPrefix
+		&& m_coredumpsEnabled == other.m_coredumpsEnabled
+		&& m_outputMode == other.m_outputMode
+		&& m_workingDirectory == other.m_workingDirectory
+		&& m_cpuAffinity == other.m_cpuAffinity
+		&& m_hasNice == other.m_hasNice
+		&& m_nice == other.m_nice
+		&& m_schedPolicy == other.m_schedPolicy
+		&& m_schedPriority == other.m_schedPriority
+		&& m_mlockAll == other.m_mlockAll
+		&& m_hasMemlockLimit == other.m_hasMemlockLimit
+		&& m_memlockLimit == other.m_memlockLimit
+		&& m_numaPolicy == other.m_numaPolicy
+		&& m_numaNodes == other.m_numaNodes
+		&& m_liveness.heartbeat == other.m_liveness.heartbeat;
+}
+
+bool Node::sameSupervision(const Node& other) const
+{
+	return m_respawn == other.m_respawn
+		&& m_respawnDelay.toSec() == other.m_respawnDelay.toSec()
+		&& m_respawnBackoff == other.m_respawnBackoff
+		&& m_respawnMaxDelay.toSec() == other.m_respawnMaxDelay.toSec()
+		&& m_respawnJitter == other.m_respawnJitter
+		&& m_crashLoopCount == other.m_crashLoopCount
+		&& m_crashLoopWindow.toSec() == other.m_crashLoopWindow.toSec()
+		&& m_shutdownHandler == other.m_shutdownHandler
+		&& m_shutdownHandlerTimeout == other.m_shutdownHandlerTimeout
+		&& m_shutdownGroup == other.m_shutdownGroup
+		&& m_coreQuota == other.m_coreQuota
+		&& m_coreMode == other.m_coreMode
+		&& m_required == other.m_required
+		&& m_clearParams == other.m_clearParams
+		&& m_stopTimeout == other.m_stopTimeout
+		&& m_memoryLimitByte == other.m_memoryLimitByte
+		&& m_cpuLimit == other.m_cpuLimit
+		&& m_statsPeriod == other.m_statsPeriod
+		&& m_liveness.cpuTimeout == other.m_liveness.cpuTimeout
+		&& m_liveness.dStateTimeout == other.m_liveness.dStateTimeout
+		&& m_liveness.outputTimeout == other.m_liveness.outputTimeout
+		&& m_liveness.heartbeatTimeout == other.m_liveness.heartbeatTimeout
+		&& m_liveness.grace == other.m_liveness.grace;
+}
+
 }
 
 }
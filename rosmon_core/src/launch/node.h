@@ -4,6 +4,8 @@
 #ifndef ROSMON_LAUNCH_NODE_H
 #define ROSMON_LAUNCH_NODE_H
 
+#include <algorithm>
+#include <limits>
 #include <string>
 #include <map>
 #include <memory>
@@ -23,6 +25,55 @@ public:
 	typedef std::shared_ptr<Node> Ptr;
 	typedef std::shared_ptr<const Node> ConstPtr;
 
+	/**
+	 * @brief Liveness probe configuration
+	 *
+	 * All timeouts are in seconds, a timeout of zero disables the probe.
+	 **/
+	struct Liveness
+	{
+		double cpuTimeout = 0.0;       //!< No CPU time consumed
+		double dStateTimeout = 0.0;    //!< Stuck in uninterruptible sleep
+		double outputTimeout = 0.0;    //!< No output on stdout/stderr
+		std::string heartbeat;         //!< Heartbeat file or "unix:<socket path>"
+		double heartbeatTimeout = 0.0; //!< No heartbeat
+		double grace = 10.0;           //!< Probes are inactive after start
+
+		bool enabled() const
+		{ return cpuTimeout > 0 || dStateTimeout > 0 || outputTimeout > 0 || heartbeatTimeout > 0; }
+
+		/**
+		 * The CPU and D state probes only see progress when the stats
+		 * sampler runs, so it needs to run at least twice per timeout.
+		 * @return Longest usable stats period, infinity without these probes
+		 **/
+		double maxStatsPeriod() const
+		{
+			double period = std::numeric_limits<double>::infinity();
+			for(double timeout : {cpuTimeout, dStateTimeout})
+			{
+				if(timeout > 0)
+					period = std::min(period, timeout / 2.0);
+			}
+			return period;
+		}
+	};
+
+	//! What to keep of a core dump
+	enum CoreMode
+	{
+		CORE_FULL,      //!< Keep the (compressed) core file
+		CORE_BACKTRACE  //!< Keep only backtraces and registers, delete the core
+	};
+
+	//! How node output is captured
+	enum OutputMode
+	{
+		OUTPUT_PTY,  //!< Pseudo terminal, stdout and stderr merged
+		OUTPUT_PIPE, //!< Separate pipes for stdout and stderr with large buffers
+		OUTPUT_RAW   //!< Spliced into the log file unless someone is watching
+	};
+
 	Node(std::string name, std::string package, std::string type);
 
 	void setRemappings(const std::map<std::string, std::string>& remappings);
@@ -30,11 +81,18 @@ public:
 	void setNamespace(const std::string& ns);
 	void setExtraEnvironment(const std::map<std::string, std::string>& env);
 	void setCoredumpsEnabled(bool on);
+	void setCoreQuota(uint64_t bytes);
+	void setCoreMode(CoreMode mode);
+	void setOutputMode(OutputMode mode);
 
 	void setRespawn(bool respawn);
 	void setRespawnDelay(const ros::WallDuration& respawnDelay);
+	void setRespawnBackoff(double factor, const ros::WallDuration& maxDelay, double jitter);
+	void setCrashLoopLimit(unsigned int count, const ros::WallDuration& window);
         
 	void setShutdownHandler(const std::string& handler);
+	void setShutdownHandlerTimeout(double timeout);
+	void setShutdownGroup(int group);
 
 	void setLaunchPrefix(const std::string& launchPrefix);
 
@@ -48,6 +106,33 @@ public:
 
     void setCPULimit(float cpuLimit);
 
+	void setStatsPeriod(double period);
+
+	void setCPUAffinity(const std::vector<unsigned int>& cpus);
+	void setNice(int nice);
+	void setSchedPolicy(int policy, int priority);
+
+	void setMlockAll(bool on);
+	void setMemlockLimit(uint64_t bytes);
+	void setNUMAPolicy(int mode, const std::vector<unsigned int>& nodes);
+
+	void setLiveness(const Liveness& liveness);
+
+	/**
+	 * @brief Would other start exactly the same process?
+	 *
+	 * Compares everything that ends up in the command line, environment or
+	 * process setup. Used to decide which nodes need a restart on reload.
+	 **/
+	bool sameProcess(const Node& other) const;
+
+	/**
+	 * @brief Is everything else (respawn, limits, probes, ...) the same?
+	 *
+	 * These settings can be changed without restarting the process.
+	 **/
+	bool sameSupervision(const Node& other) const;
+
 	std::string name() const
 	{ return m_name; }
 
@@ -77,10 +162,55 @@ public:
 
 	ros::WallDuration respawnDelay() const
 	{ return m_respawnDelay; }
+
+	//! Factor applied to the respawn delay after each consecutive crash
+	double respawnBackoff() const
+	{ return m_respawnBackoff; }
+
+	//! Upper bound for the respawn delay when using backoff (never below respawnDelay())
+	ros::WallDuration respawnMaxDelay() const
+	{ return std::max(m_respawnDelay, m_respawnMaxDelay); }
+
+	/**
+	 * @brief Respawn delay after level consecutive crashes, without jitter
+	 *
+	 * Level 0 is respawnDelay(). Each level multiplies by respawnBackoff(),
+	 * up to respawnMaxDelay().
+	 **/
+	double respawnDelayAt(unsigned int level) const;
+
+	//! Relative random jitter applied to the respawn delay (0..1)
+	double respawnJitter() const
+	{ return m_respawnJitter; }
+
+	//! Give up respawning after this many abnormal exits (non-zero status or signal) in crashLoopWindow(), 0: never
+	unsigned int crashLoopCount() const
+	{ return m_crashLoopCount; }
+
+	ros::WallDuration crashLoopWindow() const
+	{ return m_crashLoopWindow; }
         
 	std::string shutdownHandler() const
 	{ return m_shutdownHandler; }
 
+	//! The shutdown handler is killed after this many seconds
+	double shutdownHandlerTimeout() const
+	{ return m_shutdownHandlerTimeout; }
+
+	//! Nodes are shut down group by group in ascending order
+	int shutdownGroup() const
+	{ return m_shutdownGroup; }
+
+	//! Disk space for collected core dumps of this node, zero means unlimited
+	uint64_t coreQuota() const
+	{ return m_coreQuota; }
+
+	CoreMode coreMode() const
+	{ return m_coreMode; }
+
+	OutputMode outputMode() const
+	{ return m_outputMode; }
+
 	void setRequired(bool required);
 
 	bool required() const
@@ -106,6 +236,54 @@ public:
 
     float cpuLimit()const
     { return m_cpuLimit; }
+
+	//! Sampling period for resource statistics in seconds
+	double statsPeriod() const
+	{ return m_statsPeriod; }
+
+	//! CPUs the node may run on (empty: inherit from rosmon)
+	std::vector<unsigned int> cpuAffinity() const
+	{ return m_cpuAffinity; }
+
+	bool hasNice() const
+	{ return m_hasNice; }
+
+	int nice() const
+	{ return m_nice; }
+
+	//! Scheduling policy (SCHED_* constant), -1: inherit from rosmon
+	int schedPolicy() const
+	{ return m_schedPolicy; }
+
+	//! Static scheduling priority, only meaningful for SCHED_FIFO/SCHED_RR
+	int schedPriority() const
+	{ return m_schedPriority; }
+
+	//! Lock all current and future pages of the node into RAM
+	bool mlockAll() const
+	{ return m_mlockAll; }
+
+	bool hasMemlockLimit() const
+	{ return m_hasMemlockLimit; }
+
+	//! RLIMIT_MEMLOCK in bytes, MEMLOCK_UNLIMITED for no limit
+	uint64_t memlockLimit() const
+	{ return m_memlockLimit; }
+
+	static constexpr uint64_t MEMLOCK_UNLIMITED = static_cast<uint64_t>(-1);
+
+	//! Shortest allowed stats period in seconds (50 Hz)
+	static constexpr double MIN_STATS_PERIOD = 0.02;
+
+	//! NUMA memory policy (MPOL_* constant), -1: inherit from rosmon
+	int numaPolicy() const
+	{ return m_numaPolicy; }
+
+	std::vector<unsigned int> numaNodes() const
+	{ return m_numaNodes; }
+
+	const Liveness& liveness() const
+	{ return m_liveness; }
 private:
 	std::string m_name;
 	std::string m_package;
@@ -122,14 +300,25 @@ private:
 
 	bool m_respawn;
 	ros::WallDuration m_respawnDelay;
+	double m_respawnBackoff;
+	ros::WallDuration m_respawnMaxDelay;
+	double m_respawnJitter;
+	unsigned int m_crashLoopCount;
+	ros::WallDuration m_crashLoopWindow;
         
 	std::string m_shutdownHandler;
+	double m_shutdownHandlerTimeout;
+	int m_shutdownGroup;
 
 	bool m_required;
 
 	std::vector<std::string> m_launchPrefix;
 
 	bool m_coredumpsEnabled;
+	uint64_t m_coreQuota;
+	CoreMode m_coreMode;
+
+	OutputMode m_outputMode;
 
 	std::string m_workingDirectory;
 
@@ -139,6 +328,22 @@ private:
 
     uint64_t m_memoryLimitByte;
     float m_cpuLimit;
+
+	double m_statsPeriod;
+
+	std::vector<unsigned int> m_cpuAffinity;
+	bool m_hasNice;
+	int m_nice;
+	int m_schedPolicy;
+	int m_schedPriority;
+
+	bool m_mlockAll;
+	bool m_hasMemlockLimit;
+	uint64_t m_memlockLimit;
+	int m_numaPolicy;
+	std::vector<unsigned int> m_numaNodes;
+
+	Liveness m_liveness;
 };
 
 }
@@ -4,6 +4,7 @@
 #ifndef ROSMON_LOG_EVENT_H
 #define ROSMON_LOG_EVENT_H
 
+#include <chrono>
 #include <string>
 
 namespace rosmon
@@ -24,13 +25,25 @@ public:
 		Error
 	};
 
-	LogEvent(std::string source, std::string message, Type type = Type::Raw)
-	 : source{std::move(source)}, message{std::move(message)}, type{type}
+	//! Output stream a Raw message was read from
+	enum class Channel
+	{
+		NotApplicable, //!< rosmon messages and nodes on a PTY (stdout & stderr merged)
+		Stdout,
+		Stderr
+	};
+
+	LogEvent(std::string source, std::string message, Type type = Type::Raw, Channel channel = Channel::NotApplicable)
+	 : source{std::move(source)}, message{std::move(message)}, type{type}, channel{channel}
 	{}
 
 	std::string source;
 	std::string message;
 	Type type;
+	Channel channel;
+
+	//! When the message was read from the node (or generated by rosmon)
+	std::chrono::system_clock::time_point stamp = std::chrono::system_clock::now();
 };
 
 inline std::string toString(LogEvent::Type type) {
@@ -0,0 +1,247 @@
+// Publishes batches of node output on ROS topics
+// Author: Max Schwarz <max.schwarz@uni-bonn.de>
+
+#include "log_streamer.h"
+
+#include <ros/names.h>
+
+#include <algorithm>
+#include <cctype>
+
+namespace rosmon
+{
+
+namespace
+{
+	uint8_t severityToMsg(LogEvent::Type type)
+	{
+		switch(type)
+		{
+			case LogEvent::Type::Raw:     return rosmon_msgs::LogEntry::RAW;
+			case LogEvent::Type::Info:    return rosmon_msgs::LogEntry::INFO;
+			case LogEvent::Type::Warning: return rosmon_msgs::LogEntry::WARNING;
+			case LogEvent::Type::Error:   return rosmon_msgs::LogEntry::ERROR;
+		}
+
+		return rosmon_msgs::LogEntry::RAW;
+	}
+
+	uint8_t channelToMsg(LogEvent::Channel channel)
+	{
+		switch(channel)
+		{
+			case LogEvent::Channel::NotApplicable: return rosmon_msgs::LogEntry::CHANNEL_UNKNOWN;
+			case LogEvent::Channel::Stdout:        return rosmon_msgs::LogEntry::CHANNEL_STDOUT;
+			case LogEvent::Channel::Stderr:        return rosmon_msgs::LogEntry::CHANNEL_STDERR;
+		}
+
+		return rosmon_msgs::LogEntry::CHANNEL_UNKNOWN;
+	}
+
+	/**
+	 * Severity of a node line from its rosconsole ("[ WARN] [...]: ") or
+	 * rospy ("[WARN] [...]: ") prefix. Lines without a recognized prefix
+	 * and DEBUG lines stay RAW.
+	 **/
+	uint8_t parseSeverity(const std::string& line)
+	{
+		std::size_t pos = 0;
+
+		// rosconsole colors the whole line, e.g. "\033[33m[ WARN]"
+		while(pos + 1 < line.size() && line[pos] == '\033' && line[pos+1] == '[')
+		{
+			pos += 2;
+			while(pos < line.size() && !std::isalpha(static_cast<unsigned char>(line[pos])))
+				pos++;
+			pos++;
+		}
+
+		if(pos >= line.size() || line[pos] != '[')
+			return rosmon_msgs::LogEntry::RAW;
+
+		std::size_t end = line.find(']', pos);
+		if(end == std::string::npos || end - pos > 7)
+			return rosmon_msgs::LogEntry::RAW;
+
+		std::size_t begin = line.find_first_not_of(' ', pos + 1);
+		std::string level = line.substr(begin, end - begin);
+
+		if(level == "INFO")
+			return rosmon_msgs::LogEntry::INFO;
+		if(level == "WARN")
+			return rosmon_msgs::LogEntry::WARNING;
+		if(level == "ERROR" || level == "FATAL")
+			return rosmon_msgs::LogEntry::ERROR;
+
+		return rosmon_msgs::LogEntry::RAW;
+	}
+}
+
+LogStreamer::LogStreamer(monitor::Monitor* monitor, ros::NodeHandle& nh, double flushPeriod, unsigned int maxLines)
+ : m_nh(nh)
+ , m_maxLines(maxLines)
+ , m_monitor(monitor)
+{
+	auto& stream = m_streams[""];
+	stream.pub = m_nh.advertise<rosmon_msgs::LogBatch>("log_stream", 10);
+	stream.batch.entries.reserve(m_maxLines);
+
+	m_srv_setFilter = m_nh.advertiseService("set_log_filter", &LogStreamer::handleSetFilter, this);
+
+	m_flushTimer = m_nh.createWallTimer(ros::WallDuration(flushPeriod), boost::bind(&LogStreamer::flushAll, this));
+
+	m_connections.push_back(monitor->logMessageSignal.connect(boost::bind(&LogStreamer::log, this, _1)));
+	for(auto& node : monitor->nodes())
+		connectNode(node);
+
+	// Launch file reloads may add & remove nodes
+	m_connections.push_back(monitor->nodeAddedSignal.connect(boost::bind(&LogStreamer::connectNode, this, _1)));
+	m_connections.push_back(monitor->nodesChangedSignal.connect(boost::bind(&LogStreamer::handleNodesChanged, this)));
+}
+
+LogStreamer::~LogStreamer()
+{
+	for(auto& connection : m_connections)
+		connection.disconnect();
+
+	for(auto& pair : m_nodeConnections)
+		pair.second.disconnect();
+
+	flushAll();
+}
+
+void LogStreamer::connectNode(const monitor::NodeMonitor::Ptr& node)
+{
+	auto& connection = m_nodeConnections[node.get()];
+	connection.disconnect();
+	connection = node->logMessageSignal.connect(boost::bind(&LogStreamer::log, this, _1));
+}
+
+void LogStreamer::handleNodesChanged()
+{
+	// Drop the connections of removed nodes
+	const auto& nodes = m_monitor->nodes();
+	for(auto it = m_nodeConnections.begin(); it != m_nodeConnections.end();)
+	{
+		bool active = std::any_of(nodes.begin(), nodes.end(), [&](const monitor::NodeMonitor::Ptr& node) {
+			return node.get() == it->first;
+		});
+
+		if(active)
+			++it;
+		else
+		{
+			it->second.disconnect();
+			it = m_nodeConnections.erase(it);
+		}
+	}
+}
+
+void LogStreamer::log(const LogEvent& event)
+{
+	rosmon_msgs::LogEntry entry;
+	bool filled = false;
+	int severity = -1;
+
+	for(auto& pair : m_streams)
+	{
+		Stream& stream = pair.second;
+
+		if(!stream.sources.empty() && stream.sources.count(event.source) == 0)
+			continue;
+
+		// Nobody listening, don't bother
+		if(stream.pub.getNumSubscribers() == 0)
+			continue;
+
+		if(severity < 0)
+		{
+			severity = (event.type == LogEvent::Type::Raw)
+				? parseSeverity(event.message) : severityToMsg(event.type);
+		}
+
+		if(severity < stream.minSeverity)
+			continue;
+
+		if(!filled)
+		{
+			auto nsec = std::chrono::duration_cast<std::chrono::nanoseconds>(event.stamp.time_since_epoch()).count();
+			entry.stamp = ros::Time(nsec / 1000000000LL, nsec % 1000000000LL);
+			entry.source = event.source;
+			entry.severity = severity;
+			entry.channel = channelToMsg(event.channel);
+
+			std::size_t len = event.message.size();
+			while(len != 0 && (event.message[len-1] == '\n' || event.message[len-1] == '\r'))
+				len--;
+			entry.text = event.message.substr(0, len);
+
+			filled = true;
+		}
+
+		stream.batch.entries.push_back(entry);
+		if(stream.batch.entries.size() >= m_maxLines)
+			flush(&stream);
+	}
+}
+
+void LogStreamer::flush(Stream* stream)
+{
+	if(stream->batch.entries.empty())
+		return;
+
+	stream->batch.header.stamp = ros::Time::now();
+	stream->pub.publish(stream->batch);
+
+	stream->batch.entries.clear();
+}
+
+void LogStreamer::flushAll()
+{
+	for(auto& pair : m_streams)
+		flush(&pair.second);
+}
+
+bool LogStreamer::handleSetFilter(rosmon_msgs::SetLogFilterRequest& req, rosmon_msgs::SetLogFilterResponse& resp)
+{
+	if(!req.stream.empty() && !ros::names::validate(req.stream, resp.topic))
+	{
+		ROS_ERROR("rosmon: invalid log stream name '%s': %s", req.stream.c_str(), resp.topic.c_str());
+		return false;
+	}
+
+	auto it = m_streams.find(req.stream);
+
+	if(req.remove)
+	{
+		if(req.stream.empty())
+			return false; // the default stream always exists
+
+		if(it != m_streams.end())
+			m_streams.erase(it);
+
+		resp.topic.clear();
+		return true;
+	}
+
+	if(it == m_streams.end())
+	{
+		it = m_streams.emplace(req.stream, Stream{}).first;
+		it->second.pub = m_nh.advertise<rosmon_msgs::LogBatch>("log_stream/" + req.stream, 10);
+		it->second.batch.entries.reserve(m_maxLines);
+	}
+	else
+	{
+		// Lines collected with the old filter go out first
+		flush(&it->second);
+	}
+
+	it->second.sources.clear();
+	it->second.sources.insert(req.nodes.begin(), req.nodes.end());
+	it->second.minSeverity = req.min_severity;
+
+	resp.topic = it->second.pub.getTopic();
+	return true;
+}
+
+}
@@ -0,0 +1,77 @@
+// Publishes batches of node output on ROS topics
+// Author: Max Schwarz <max.schwarz@uni-bonn.de>
+
+#ifndef ROSMON_LOG_STREAMER_H
+#define ROSMON_LOG_STREAMER_H
+
+#include "monitor/monitor.h"
+#include "log_event.h"
+
+#include <ros/node_handle.h>
+
+#include <rosmon_msgs/LogBatch.h>
+#include <rosmon_msgs/SetLogFilter.h>
+
+#include <boost/signals2/connection.hpp>
+
+#include <map>
+#include <unordered_set>
+
+namespace rosmon
+{
+
+/**
+ * @brief Streams log lines to remote consumers
+ *
+ * Lines are collected into rosmon_msgs::LogBatch messages, which are
+ * published every flush period or as soon as a batch is full. Lines are only
+ * collected for streams with subscribers.
+ **/
+class LogStreamer
+{
+public:
+	/**
+	 * @brief Constructor
+	 *
+	 * @param monitor Monitor whose nodes are streamed
+	 * @param nh Node handle, topics are advertised relative to it
+	 * @param flushPeriod Maximum time a line is held back in seconds
+	 * @param maxLines Maximum number of lines per batch
+	 **/
+	LogStreamer(monitor::Monitor* monitor, ros::NodeHandle& nh, double flushPeriod, unsigned int maxLines);
+	~LogStreamer();
+
+	void log(const LogEvent& event);
+private:
+	void connectNode(const monitor::NodeMonitor::Ptr& node);
+	void handleNodesChanged();
+
+	struct Stream
+	{
+		ros::Publisher pub;
+		std::unordered_set<std::string> sources; //!< empty: all
+		uint8_t minSeverity = 0; //!< rosmon_msgs::LogEntry severity
+		rosmon_msgs::LogBatch batch;
+	};
+
+	bool handleSetFilter(rosmon_msgs::SetLogFilterRequest& req, rosmon_msgs::SetLogFilterResponse& resp);
+	void flush(Stream* stream);
+	void flushAll();
+
+	ros::NodeHandle m_nh;
+	unsigned int m_maxLines;
+
+	std::map<std::string, Stream> m_streams;
+
+	ros::WallTimer m_flushTimer;
+	ros::ServiceServer m_srv_setFilter;
+
+	monitor::Monitor* m_monitor;
+
+	std::vector<boost::signals2::connection> m_connections;
+	std::map<monitor::NodeMonitor*, boost::signals2::connection> m_nodeConnections;
+};
+
+}
+
+#endif
@@ -9,15 +9,21 @@
 #include <ctime>
 #include <stdexcept>
 
+#include <fcntl.h>
+#include <sys/stat.h>
 #include <sys/time.h>
+#include <unistd.h>
 
 #include "fmt_no_throw.h"
+#include "self_stats.h"
 
 namespace rosmon
 {
 
 Logger::Logger(const std::string& path, bool flush)
- : m_flush(flush)
+ : m_path(path)
+ , m_flush(flush)
+ , m_latency(&SelfStats::instance().histogram("logger/log"))
 {
 	m_file = fopen(path.c_str(), "a");
 	if(!m_file)
@@ -32,34 +38,118 @@ Logger::~Logger()
 {
 	if(m_file)
 		fclose(m_file);
+
+	if(m_rawFD != -1)
+		close(m_rawFD);
 }
 
 void Logger::log(const LogEvent& event)
 {
+	if(m_raw && event.type == LogEvent::Type::Raw)
+		return;
+
+	ScopedTimer timer(m_latency);
+
 	struct timeval tv;
 	memset(&tv, 0, sizeof(tv));
 	gettimeofday(&tv, nullptr);
 
+	unsigned int len = event.message.length();
+	while(len != 0 && (event.message[len-1] == '\n' || event.message[len-1] == '\r'))
+		len--;
+
+	writePrefix(event.source, tv);
+	fwrite(event.message.c_str(), 1, len, m_file);
+	fputc('\n', m_file);
+
+	if(m_flush)
+		fflush(m_file);
+}
+
+void Logger::writePrefix(const std::string& source, const struct timeval& tv)
+{
 	struct tm btime;
-	memset(&btime, 0, sizeof(tv));
+	memset(&btime, 0, sizeof(btime));
 	localtime_r(&tv.tv_sec, &btime);
 
 	char timeString[100];
 	strftime(timeString, sizeof(timeString), "%a %F %T", &btime);
 
-	unsigned int len = event.message.length();
-	while(len != 0 && (event.message[len-1] == '\n' || event.message[len-1] == '\r'))
-		len--;
-
 	fmtNoThrow::print(m_file, "{}.{:03d}: {:>20}: ",
 		timeString, tv.tv_usec / 1000,
-		event.source.c_str()
+		source.c_str()
 	);
-	fwrite(event.message.c_str(), 1, len, m_file);
-	fputc('\n', m_file);
+}
 
-	if(m_flush)
-		fflush(m_file);
+off_t Logger::fileEnd()
+{
+	fflush(m_file);
+
+	struct stat st;
+	if(fstat(fileno(m_file), &st) != 0)
+		return -1;
+
+	return st.st_size;
+}
+
+void Logger::writeRawMarker(const std::string& source)
+{
+	struct timeval tv;
+	memset(&tv, 0, sizeof(tv));
+	gettimeofday(&tv, nullptr);
+
+	// Without --log-dir, all nodes share one log file. If anything was
+	// written since our last raw chunk, the next chunk needs a marker,
+	// otherwise it would be attributed to the previous writer.
+	double now = tv.tv_sec + 1e-6 * tv.tv_usec;
+	off_t end = fileEnd();
+	if(end != -1 && end == m_rawEnd && now - m_lastRawMarker < 1.0)
+		return;
+	m_lastRawMarker = now;
+
+	writePrefix(source, tv);
+	fputs("[raw output]\n", m_file);
+	m_rawEnd = fileEnd();
+}
+
+void Logger::writeRaw(const std::string& source, const char* data, std::size_t size)
+{
+	ScopedTimer timer(m_latency);
+
+	writeRawMarker(source);
+	fwrite(data, 1, size, m_file);
+
+	// Always flushed, we need to know where our output ends
+	m_rawEnd = fileEnd();
+}
+
+ssize_t Logger::spliceRaw(const std::string& source, int fd, std::size_t size)
+{
+	ScopedTimer timer(m_latency);
+
+	// This also flushes m_file, anything buffered needs to end up in front
+	// of the spliced data.
+	writeRawMarker(source);
+
+	if(m_rawFD == -1)
+	{
+		m_rawFD = open(m_path.c_str(), O_WRONLY | O_CLOEXEC);
+		if(m_rawFD == -1)
+			return -1;
+	}
+
+	// Other writers (e.g. loggers of other nodes sharing the file) append,
+	// so the end of the file is the right place.
+	struct stat st;
+	if(fstat(m_rawFD, &st) != 0)
+		return -1;
+
+	loff_t offset = st.st_size;
+	ssize_t bytes = splice(fd, nullptr, m_rawFD, &offset, size, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if(bytes > 0)
+		m_rawEnd = offset;
+
+	return bytes;
 }
 
 }
@@ -6,11 +6,15 @@
 
 #include <string>
 
+#include <sys/types.h>
+
 #include "log_event.h"
 
 namespace rosmon
 {
 
+class Histogram;
+
 /**
  * @brief Write log messages into a log file
  **/
@@ -27,9 +31,44 @@ public:
 
 	//! Log message
 	void log(const LogEvent& event);
+
+	/**
+	 * @brief Raw mode for node output
+	 *
+	 * In raw mode, LogEvent::Type::Raw events are ignored by log(). Node
+	 * output is appended unmodified with writeRaw() or spliceRaw() instead,
+	 * preceded by a timestamp marker line. A marker is written at least once
+	 * per second and whenever anything else was written to the file since
+	 * the last raw chunk. Markers are written between chunks, so they may
+	 * split a line of output.
+	 **/
+	void setRaw(bool raw)
+	{ m_raw = raw; }
+
+	//! Append node output unmodified (raw mode)
+	void writeRaw(const std::string& source, const char* data, std::size_t size);
+
+	/**
+	 * @brief Move up to size bytes from the pipe fd to the log file (raw mode)
+	 *
+	 * Uses splice(), so the data is not copied to user space.
+	 * @return Number of bytes moved, or -1 with errno set
+	 **/
+	ssize_t spliceRaw(const std::string& source, int fd, std::size_t size);
 private:
+	void writePrefix(const std::string& source, const struct timeval& tv);
+	void writeRawMarker(const std::string& source);
+	off_t fileEnd();
+
+	std::string m_path;
 	FILE* m_file = nullptr;
 	bool m_flush = false;
+	Histogram* m_latency;
+
+	bool m_raw = false;
+	int m_rawFD = -1; //!< Without O_APPEND, which splice() refuses
+	double m_lastRawMarker = 0.0;
+	off_t m_rawEnd = -1; //!< End of our last raw chunk in the file
 };
 
 }
@@ -28,11 +28,14 @@
 #include "package_registry.h"
 #include "fd_watcher.h"
 #include "logger.h"
+#include "self_stats.h"
+#include "trace.h"
 #include "fmt_no_throw.h"
 
 namespace fs = boost::filesystem;
 
 bool g_shouldStop = false;
+bool g_shouldReload = false;
 bool g_flushStdout = false;
 
 static fs::path findFile(const fs::path& base, const std::string& name)
@@ -89,6 +92,18 @@ void usage()
 		"  --disable-diagnostics\n"
 		"		  Disable publication of ros diagnostics message about\n"
 		"		  monitored nodes\n"
+		"  --state-period=SECONDS\n"
+		"		  Period for publishing node states and diagnostics\n"
+		"		  (default: 3.0). State transitions (start, crash,\n"
+		"		  stop) are published immediately in any case.\n"
+		"  --state-delta[=SECONDS]\n"
+		"		  Additionally publish compact state updates on\n"
+		"		  ~ros_monitor_delta, with a full keyframe at least\n"
+		"		  every SECONDS (default: 30).\n"
+		"  --log-stream[=MS]\n"
+		"		  Publish node output in batches on ~log_stream, at\n"
+		"		  most every MS milliseconds (default: 100). Filtered\n"
+		"		  streams can be set up with ~set_log_filter.\n"
 		"  --diagnostics-prefix=PREFIX\n"
 		"		  Prefix for the ros diagnostics generated by this node.\n"
 		"		  By default this will be the node name.\n"
@@ -98,6 +113,43 @@ void usage()
 		"		  CPU usage.\n"
 		"  --memory-limit=15MB\n"
 		"		  Default memory limit usage of monitored process.\n"
+		"  --stats-period=SECONDS\n"
+		"		  Default sampling period for CPU & memory statistics\n"
+		"		  (default: 1.0, minimum: 0.02). Can be set per node\n"
+		"		  with the rosmon-stats-period attribute.\n"
+		"  --adaptive-stats\n"
+		"		  Sample nodes close to their CPU/memory limit faster\n"
+		"		  and quiet nodes slower than their stats period.\n"
+		"  --thread-stats=N\n"
+		"		  Sample CPU usage per thread and keep the N busiest\n"
+		"		  threads of each node (shown when a node is selected,\n"
+		"		  and available via the get_threads service).\n"
+		"  --smaps-period=SECONDS\n"
+		"		  Sample PSS/USS/swap usage from\n"
+		"		  /proc/<pid>/smaps_rollup every SECONDS (default: off).\n"
+		"  --memory-limit-metric=rss|pss|uss\n"
+		"		  Memory measure compared against the memory limit\n"
+		"		  (default: rss). pss and uss enable smaps sampling\n"
+		"		  with a period of 10s unless --smaps-period is given.\n"
+		"  --core-quota=SIZE\n"
+		"		  Limit disk usage of all core dumps collected in this\n"
+		"		  session (default: unlimited). The oldest cores are\n"
+		"		  deleted first. Cores are compressed with zstd if it\n"
+		"		  is installed.\n"
+		"  --output-threads=N\n"
+		"		  Read node output on N threads instead of the main\n"
+		"		  loop, so that nodes are not blocked by a slow UI or a\n"
+		"		  chatty neighbor (default: 0).\n"
+		"  --self-stats    Print rosmon's own overhead (event loop latency,\n"
+		"		  callback durations, output rates) at exit. The same\n"
+		"		  data is available on ~self_stats and ~get_self_stats.\n"
+		"  --trace=FILE    Record launch file parsing, parameter evaluation,\n"
+		"		  node fork/exec/first output/exit and event loop\n"
+		"		  iterations into FILE (Chrome trace JSON, open with\n"
+		"		  ui.perfetto.dev or chrome://tracing).\n"
+		"\n"
+		"On SIGUSR1 or a call to the ~reload service, rosmon re-reads the launch\n"
+		"file and only restarts nodes whose configuration changed.\n"
 		"\n"
 		"rosmon also obeys some environment variables:\n"
 		"  ROSMON_COLOR_MODE   Can be set to 'truecolor', '256colors', 'ansi'\n"
@@ -112,6 +164,11 @@ void handleSignal(int)
 	g_shouldStop = true;
 }
 
+void handleReloadSignal(int)
+{
+	g_shouldReload = true;
+}
+
 void logToStdout(const rosmon::LogEvent& event)
 {
 	std::string clean = event.message;
@@ -148,6 +205,18 @@ static const struct option OPTIONS[] = {
 	{"cpu-limit", required_argument, nullptr, 'c'},
 	{"memory-limit", required_argument, nullptr, 'm'},
 	{"diagnostics-prefix", required_argument, nullptr, 'p'},
+	{"stats-period", required_argument, nullptr, 'P'},
+	{"adaptive-stats", no_argument, nullptr, 'A'},
+	{"thread-stats", required_argument, nullptr, 'T'},
+	{"state-period", required_argument, nullptr, 'I'},
+	{"state-delta", optional_argument, nullptr, 'E'},
+	{"log-stream", optional_argument, nullptr, 'O'},
+	{"smaps-period", required_argument, nullptr, 'Y'},
+	{"memory-limit-metric", required_argument, nullptr, 'M'},
+	{"core-quota", required_argument, nullptr, 'Q'},
+	{"output-threads", required_argument, nullptr, 'K'},
+	{"self-stats", no_argument, nullptr, 'W'},
+	{"trace", required_argument, nullptr, 'J'},
 	{nullptr, 0, nullptr, 0}
 };
 
@@ -175,6 +244,18 @@ int main(int argc, char** argv)
 	double stopTimeout = rosmon::launch::LaunchConfig::DEFAULT_STOP_TIMEOUT;
 	uint64_t memoryLimit = rosmon::launch::LaunchConfig::DEFAULT_MEMORY_LIMIT;
 	float cpuLimit = rosmon::launch::LaunchConfig::DEFAULT_CPU_LIMIT;
+	double statsPeriod = rosmon::launch::LaunchConfig::DEFAULT_STATS_PERIOD;
+	bool adaptiveStats = false;
+	unsigned int threadStats = 0;
+	double statePeriod = 3.0;
+	double stateKeyframePeriod = 0.0;
+	double logStreamPeriod = 0.0;
+	double smapsPeriod = -1.0;
+	auto memoryLimitMetric = rosmon::monitor::NodeMonitor::MEMORY_RSS;
+	uint64_t coreQuota = 0;
+	unsigned int outputThreads = 0;
+	bool printSelfStats = false;
+	std::string traceFile;
 	bool disableDiagnostics = false;
 	std::string diagnosticsPrefix;
 
@@ -276,6 +357,154 @@ int main(int argc, char** argv)
 				}
 				break;
 			}
+			case 'P':
+				try
+				{
+					statsPeriod = boost::lexical_cast<double>(optarg);
+				}
+				catch(boost::bad_lexical_cast&)
+				{
+					fmtNoThrow::print(stderr, "Bad value for --stats-period argument: '{}'\n", optarg);
+					return 1;
+				}
+
+				if(statsPeriod < rosmon::launch::Node::MIN_STATS_PERIOD)
+				{
+					fmtNoThrow::print(stderr, "Stats period needs to be at least {}s\n", rosmon::launch::Node::MIN_STATS_PERIOD);
+					return 1;
+				}
+				break;
+			case 'A':
+				adaptiveStats = true;
+				break;
+			case 'T':
+				try
+				{
+					threadStats = boost::lexical_cast<unsigned int>(optarg);
+				}
+				catch(boost::bad_lexical_cast&)
+				{
+					fmtNoThrow::print(stderr, "Bad value for --thread-stats argument: '{}'\n", optarg);
+					return 1;
+				}
+				break;
+			case 'I':
+				try
+				{
+					statePeriod = boost::lexical_cast<double>(optarg);
+				}
+				catch(boost::bad_lexical_cast&)
+				{
+					fmtNoThrow::print(stderr, "Bad value for --state-period argument: '{}'\n", optarg);
+					return 1;
+				}
+
+				if(statePeriod <= 0)
+				{
+					fmtNoThrow::print(stderr, "State period needs to be positive\n");
+					return 1;
+				}
+				break;
+			case 'E':
+				stateKeyframePeriod = 30.0;
+				if(optarg)
+				{
+					try
+					{
+						stateKeyframePeriod = boost::lexical_cast<double>(optarg);
+					}
+					catch(boost::bad_lexical_cast&)
+					{
+						fmtNoThrow::print(stderr, "Bad value for --state-delta argument: '{}'\n", optarg);
+						return 1;
+					}
+
+					if(stateKeyframePeriod <= 0)
+					{
+						fmtNoThrow::print(stderr, "Keyframe period needs to be positive\n");
+						return 1;
+					}
+				}
+				break;
+			case 'O':
+				logStreamPeriod = 0.1;
+				if(optarg)
+				{
+					try
+					{
+						logStreamPeriod = boost::lexical_cast<unsigned int>(optarg) / 1000.0;
+					}
+					catch(boost::bad_lexical_cast&)
+					{
+						fmtNoThrow::print(stderr, "Bad value for --log-stream argument: '{}'\n", optarg);
+						return 1;
+					}
+
+					if(logStreamPeriod <= 0)
+					{
+						fmtNoThrow::print(stderr, "Log stream period needs to be positive\n");
+						return 1;
+					}
+				}
+				break;
+			case 'Y':
+				try
+				{
+					smapsPeriod = boost::lexical_cast<double>(optarg);
+				}
+				catch(boost::bad_lexical_cast&)
+				{
+					fmtNoThrow::print(stderr, "Bad value for --smaps-period argument: '{}'\n", optarg);
+					return 1;
+				}
+
+				if(smapsPeriod < 0)
+				{
+					fmtNoThrow::print(stderr, "Smaps period cannot be negative\n");
+					return 1;
+				}
+				break;
+			case 'M':
+				if(strcmp(optarg, "rss") == 0)
+					memoryLimitMetric = rosmon::monitor::NodeMonitor::MEMORY_RSS;
+				else if(strcmp(optarg, "pss") == 0)
+					memoryLimitMetric = rosmon::monitor::NodeMonitor::MEMORY_PSS;
+				else if(strcmp(optarg, "uss") == 0)
+					memoryLimitMetric = rosmon::monitor::NodeMonitor::MEMORY_USS;
+				else
+				{
+					fmtNoThrow::print(stderr, "Bad value for --memory-limit-metric argument: '{}'\n", optarg);
+					return 1;
+				}
+				break;
+			case 'W':
+				printSelfStats = true;
+				break;
+			case 'J':
+				traceFile = optarg;
+				break;
+			case 'Q':
+			{
+				bool ok;
+				std::tie(coreQuota, ok) = rosmon::launch::parseMemory(optarg);
+				if(!ok)
+				{
+					fmtNoThrow::print(stderr, "Bad value for --core-quota argument: '{}'\n", optarg);
+					return 1;
+				}
+				break;
+			}
+			case 'K':
+				try
+				{
+					outputThreads = boost::lexical_cast<unsigned int>(optarg);
+				}
+				catch(boost::bad_lexical_cast&)
+				{
+					fmtNoThrow::print(stderr, "Bad value for --output-threads argument: '{}'\n", optarg);
+					return 1;
+				}
+				break;
 			case 'p':
 				fmtNoThrow::print(stderr, "Prefix : {}", optarg);
 				diagnosticsPrefix = std::string(optarg);
@@ -416,14 +645,8 @@ int main(int argc, char** argv)
 
 	rosmon::FDWatcher::Ptr watcher(new rosmon::FDWatcher);
 
-	rosmon::launch::LaunchConfig::Ptr config(new rosmon::launch::LaunchConfig);
-	config->setDefaultStopTimeout(stopTimeout);
-	config->setDefaultCPULimit(cpuLimit);
-	config->setDefaultMemoryLimit(memoryLimit);
-	config->setWorkingDirectory(workDir);
-	config->setRespawnBehaviour(respawnAll, respawnObey, respawnDefault);
-
 	// Parse launch file arguments from command line
+	std::vector<std::pair<std::string, std::string>> launchArguments;
 	for(int i = firstArg; i < argc; ++i)
 	{
 		char* arg = strstr(argv[i], ":=");
@@ -440,9 +663,47 @@ int main(int argc, char** argv)
 
 		char* value = arg + 2;
 
-		config->setArgument(name, value);
+		launchArguments.emplace_back(name, value);
+	}
+
+	// Also used for reloading the launch file later on
+	auto createConfig = [&]() {
+		rosmon::launch::LaunchConfig::Ptr config(new rosmon::launch::LaunchConfig);
+		config->setDefaultStopTimeout(stopTimeout);
+		config->setDefaultCPULimit(cpuLimit);
+		config->setDefaultMemoryLimit(memoryLimit);
+		config->setDefaultStatsPeriod(statsPeriod);
+		config->setWorkingDirectory(workDir);
+		config->setRespawnBehaviour(respawnAll, respawnObey, respawnDefault);
+
+		for(const auto& arg : launchArguments)
+			config->setArgument(arg.first, arg.second);
+
+		return config;
+	};
+
+	// Finish the trace file on every exit path
+	struct TraceGuard
+	{
+		~TraceGuard() { rosmon::trace::stop(); }
+	} traceGuard;
+
+	if(!traceFile.empty())
+	{
+		try
+		{
+			rosmon::trace::start(traceFile);
+			rosmon::trace::setThreadName("main");
+		}
+		catch(std::runtime_error& e)
+		{
+			fmtNoThrow::print(stderr, "{}\n", e.what());
+			return 1;
+		}
 	}
 
+	rosmon::launch::LaunchConfig::Ptr config = createConfig();
+
 	bool onlyArguments = (action == ACTION_LIST_ARGS);
 
 	try
@@ -514,6 +775,17 @@ int main(int argc, char** argv)
 	fmtNoThrow::print("Running as '{}'\n", ros::this_node::getName());
 
 	rosmon::monitor::Monitor monitor(config, watcher, logDir, flushLog, disableLog, launchInfo.launch_group, launchInfo.launch_config);
+	monitor.setAdaptiveStats(adaptiveStats);
+	monitor.setThreadStats(threadStats);
+	monitor.setMemoryLimitMetric(memoryLimitMetric);
+	if(smapsPeriod < 0)
+	{
+		// Not given explicitly: only sample if needed for the limit check
+		smapsPeriod = (memoryLimitMetric == rosmon::monitor::NodeMonitor::MEMORY_RSS) ? 0.0 : 10.0;
+	}
+	monitor.setSmapsPeriod(smapsPeriod);
+	monitor.setCoreQuota(coreQuota);
+	monitor.setOutputThreads(outputThreads);
 	if (!disableLog) {
 		monitor.logMessageSignal.connect(boost::bind(&rosmon::Logger::log, logger.get(), _1));
 	}
@@ -547,6 +819,27 @@ int main(int argc, char** argv)
 
 	// ROS interface
 	rosmon::ROSInterface rosInterface(&monitor, &launchInfo, !disableDiagnostics, diagnosticsPrefix);
+	rosInterface.setUpdatePeriod(statePeriod);
+	if(stateKeyframePeriod > 0)
+		rosInterface.enableDeltaPublishing(stateKeyframePeriod);
+	if(logStreamPeriod > 0)
+		rosInterface.enableLogStreaming(logStreamPeriod, 200);
+
+	if(!enableUI)
+	{
+		monitor.nodeAddedSignal.connect([](const rosmon::monitor::NodeMonitor::Ptr& node) {
+			node->logMessageSignal.connect(logToStdout);
+		});
+	}
+
+	auto reload = [&]() {
+		auto newConfig = createConfig();
+		newConfig->parse(launchFilePath);
+		newConfig->evaluateParameters();
+
+		return monitor.reload(newConfig);
+	};
+	rosInterface.setReloadHandler(reload);
 
 	ros::WallDuration waitDuration(0.1);
 
@@ -554,13 +847,54 @@ int main(int argc, char** argv)
 	signal(SIGINT, handleSignal);
 	signal(SIGHUP, handleSignal);
 	signal(SIGTERM, handleSignal);
+	signal(SIGUSR1, handleReloadSignal);
 
 	// Main loop
+	ros::WallTime nextTraceFlush = ros::WallTime::now();
 	while(ros::ok() && monitor.ok() && !g_shouldStop)
 	{
-		ros::spinOnce();
+		rosmon::trace::Span loopSpan("supervisor", "loop");
+
+		{
+			rosmon::trace::Span spinSpan("supervisor", "spinOnce");
+			ros::spinOnce();
+		}
 		watcher->wait(waitDuration);
 
+		if(rosmon::trace::enabled() && ros::WallTime::now() >= nextTraceFlush)
+		{
+			rosmon::trace::flush();
+			nextTraceFlush = ros::WallTime::now() + ros::WallDuration(1.0);
+		}
+
+		if(g_shouldReload)
+		{
+			g_shouldReload = false;
+
+			auto logEvent = [&](const rosmon::LogEvent& event) {
+				if(ui)
+					ui->log(event);
+				else
+					logToStdout(event);
+			};
+
+			logEvent({"[rosmon]", "Reloading launch file...", rosmon::LogEvent::Type::Info});
+			try
+			{
+				auto result = reload();
+				logEvent({"[rosmon]", fmt::format(
+					"Reloaded: {} started, {} stopped, {} restarted, {} updated",
+					result.started.size(), result.stopped.size(), result.restarted.size(), result.updated.size()
+				), rosmon::LogEvent::Type::Info});
+			}
+			catch(std::exception& e)
+			{
+				// Parse errors, but also XmlRpc failures during parameter upload.
+				// Parameters are updated first, so the nodes are untouched.
+				logEvent({"[rosmon]", fmt::format("Could not reload launch file, keeping the old one: {}", e.what()), rosmon::LogEvent::Type::Error});
+			}
+		}
+
 		if(ui)
 			ui->update();
 	}
@@ -569,20 +903,16 @@ int main(int argc, char** argv)
 		ui->log({"[rosmon]", "Shutting down..."});
 	monitor.shutdown();
 
-	// Wait for graceful shutdown
-	ros::WallTime start = ros::WallTime::now();
-	while(!monitor.allShutdown() && ros::WallTime::now() - start < ros::WallDuration(monitor.shutdownTimeout()))
+	// Wait for graceful shutdown. The monitor kills nodes (group by group)
+	// that exceed their timeouts.
+	while(!monitor.updateShutdown())
 	{
-		watcher->wait(waitDuration);
+		watcher->wait(ros::WallDuration(0.05));
 
 		if(ui)
 			ui->update();
 	}
 
-	// If we timed out, force exit (kill the nodes with SIGKILL)
-	if(!monitor.allShutdown())
-		monitor.forceExit();
-
 	rosInterface.shutdown();
 
 	// Wait until that is finished (should always work)
@@ -594,6 +924,66 @@ int main(int argc, char** argv)
 			ui->update();
 	}
 
+	fmtNoThrow::print("Shutdown took {:.2f}s\n", monitor.shutdownDuration());
+
+	// Report how much the stats sampler cost us
+	{
+		const auto& overhead = monitor.statsOverhead();
+		if(overhead.updates != 0)
+		{
+			std::string msg = fmt::format(
+				"Stats sampler: {} updates ({} /proc scans), {:.3f} ms CPU per update, max {:.3f} ms wall time",
+				overhead.updates, overhead.processScans,
+				1000.0 * overhead.cpuTime / overhead.updates,
+				1000.0 * overhead.maxWallTime
+			);
+
+			if(ui)
+				ui->log({"[rosmon]", msg});
+			else
+				fmtNoThrow::print("{}\n", msg);
+		}
+	}
+
+	if(printSelfStats)
+	{
+		const auto& stats = rosmon::SelfStats::instance();
+		double uptime = stats.uptime();
+
+		std::vector<std::string> lines;
+		lines.push_back(fmt::format("rosmon self stats after {:.1f}s (durations in ms):", uptime));
+		lines.push_back(fmt::format("{:40} {:>10} {:>9} {:>9} {:>9} {:>9}", "", "count", "mean", "p50", "p99", "max"));
+		for(const auto& pair : stats.histograms())
+		{
+			const auto& histogram = pair.second;
+			if(histogram.count() == 0)
+				continue;
+
+			lines.push_back(fmt::format("{:40} {:>10} {:>9.3f} {:>9.3f} {:>9.3f} {:>9.3f}",
+				pair.first, histogram.count(),
+				1000.0 * histogram.mean(), 1000.0 * histogram.percentile(0.5),
+				1000.0 * histogram.percentile(0.99), 1000.0 * histogram.max()
+			));
+		}
+
+		lines.push_back(fmt::format("{:40} {:>10} {:>12} {:>9} {:>12}", "node output", "lines", "bytes", "lines/s", "bytes/s"));
+		for(const auto& node : monitor.nodes())
+		{
+			lines.push_back(fmt::format("{:40} {:>10} {:>12} {:>9.1f} {:>12.1f}",
+				node->name(), node->outputLines(), node->outputBytes(),
+				node->outputLines() / uptime, node->outputBytes() / uptime
+			));
+		}
+
+		for(const auto& line : lines)
+		{
+			if(ui)
+				ui->log({"[rosmon]", line});
+			else
+				fmtNoThrow::print("{}\n", line);
+		}
+	}
+
 	// If coredumps are available, be helpful and display gdb commands
 	bool coredumpsAvailable = std::any_of(monitor.nodes().begin(), monitor.nodes().end(),
 		[](const rosmon::monitor::NodeMonitor::Ptr& n) { return n->coredumpAvailable(); }
@@ -0,0 +1,685 @@
+// Collects and compresses core dumps in the background
+// Author: Max Schwarz <max.schwarz@uni-bonn.de>
+
+#include "coredump_collector.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <sstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <glob.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <boost/range.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/regex.hpp>
+
+#include "../fmt_no_throw.h"
+#include "../trace.h"
+
+#define TASK_COMM_LEN 16 // from linux/sched.h
+
+namespace rosmon
+{
+
+namespace monitor
+{
+
+namespace
+{
+
+boost::iterator_range<std::string::const_iterator>
+corePatternFormatFinder(std::string::const_iterator begin, std::string::const_iterator end)
+{
+	for(; begin != end && begin+1 != end; ++begin)
+	{
+		if(*begin == '%')
+			return {begin, begin+2};
+	}
+
+	return {end, end};
+}
+
+/**
+ * Close all fds from first on in a forked child. We fork from the worker
+ * thread, so the child inherits the output pipes and PTYs of all nodes,
+ * which would keep rosmon from noticing node exits while gdb or zstd runs.
+ * Only async-signal-safe calls are allowed here.
+ **/
+void closeFrom(int first, int maxFD)
+{
+#ifdef SYS_close_range
+	if(syscall(SYS_close_range, first, ~0U, 0) == 0)
+		return;
+#endif
+
+	for(int fd = first; fd < maxFD; ++fd)
+		close(fd);
+}
+
+int maxFD()
+{
+	rlimit limit;
+	if(getrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur == RLIM_INFINITY)
+		return 65536;
+
+	return limit.rlim_cur;
+}
+
+template<typename... Args>
+void addMessage(CoreDumpCollector::Result* result, LogEvent::Type type, const char* fmt, Args&& ... args)
+{
+	result->messages.emplace_back(type, fmt::format(fmt, std::forward<Args>(args)...));
+}
+
+}
+
+CoreDumpCollector::CoreDumpCollector(FDWatcher::Ptr fdWatcher)
+ : m_fdWatcher(std::move(fdWatcher))
+{
+	if(pipe2(m_pipe, O_CLOEXEC | O_NONBLOCK) != 0)
+		throw std::runtime_error(fmt::format("Could not create pipe: {}", strerror(errno)));
+
+	m_fdWatcher->registerFD(m_pipe[0], [this](int fd) { handleResults(fd); }, "coredump_collector");
+
+	m_thread = std::thread(&CoreDumpCollector::run, this);
+}
+
+CoreDumpCollector::~CoreDumpCollector()
+{
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_quit = true;
+
+		// Do not wait for a running compression or gdb. The worker reaps
+		// the child and notices m_quit afterwards. Queued jobs are skipped.
+		if(m_child != -1)
+			kill(m_child, SIGKILL);
+	}
+	m_cond.notify_all();
+
+	m_thread.join();
+
+	m_fdWatcher->removeFD(m_pipe[0]);
+	close(m_pipe[0]);
+	close(m_pipe[1]);
+}
+
+void CoreDumpCollector::submit(const void* owner, const Job& job, const Callback& cb)
+{
+	uint64_t id = m_nextID++;
+	m_callbacks[id] = std::make_pair(owner, cb);
+
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_jobs.push_back({id, job});
+	}
+	m_cond.notify_one();
+}
+
+void CoreDumpCollector::forget(const void* owner)
+{
+	for(auto it = m_callbacks.begin(); it != m_callbacks.end();)
+	{
+		if(it->second.first == owner)
+			it = m_callbacks.erase(it);
+		else
+			++it;
+	}
+}
+
+void CoreDumpCollector::setGlobalQuota(uint64_t bytes)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_globalQuota = bytes;
+}
+
+bool CoreDumpCollector::trackChild(int pid)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	if(m_quit)
+	{
+		kill(pid, SIGKILL);
+		return false;
+	}
+
+	m_child = pid;
+	return true;
+}
+
+void CoreDumpCollector::untrackChild()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_child = -1;
+}
+
+void CoreDumpCollector::run()
+{
+	trace::setThreadName("core dump collector");
+
+	while(true)
+	{
+		QueuedJob job;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_cond.wait(lock, [&]() { return m_quit || !m_jobs.empty(); });
+
+			if(m_quit)
+				return;
+
+			job = std::move(m_jobs.front());
+			m_jobs.pop_front();
+		}
+
+		Result result = collect(job.job);
+
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_results.emplace_back(job.id, std::move(result));
+		}
+
+		// Wake up the main loop. If the pipe is full, it will see our
+		// result anyway.
+		char c = 0;
+		if(write(m_pipe[1], &c, 1) != 1 && errno != EAGAIN)
+			fmtNoThrow::print(stderr, "Could not write to core dump pipe: {}\n", strerror(errno));
+	}
+}
+
+void CoreDumpCollector::handleResults(int fd)
+{
+	char buf[256];
+	while(read(fd, buf, sizeof(buf)) > 0)
+		;
+
+	std::vector<std::pair<uint64_t, Result>> results;
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		std::swap(results, m_results);
+	}
+
+	for(auto& pair : results)
+	{
+		auto it = m_callbacks.find(pair.first);
+		if(it == m_callbacks.end())
+			continue; // Node is gone
+
+		Callback cb = std::move(it->second.second);
+		m_callbacks.erase(it);
+
+		cb(pair.second);
+	}
+}
+
+CoreDumpCollector::Result CoreDumpCollector::collect(const Job& job)
+{
+	Result result;
+
+	char core_pattern[256];
+	int core_fd = open("/proc/sys/kernel/core_pattern", O_RDONLY | O_CLOEXEC);
+	if(core_fd < 0)
+	{
+		addMessage(&result, LogEvent::Type::Error, "could not open /proc/sys/kernel/core_pattern: {}", strerror(errno));
+		return result;
+	}
+
+	int bytes = read(core_fd, core_pattern, sizeof(core_pattern)-1);
+	close(core_fd);
+
+	if(bytes < 1)
+	{
+		addMessage(&result, LogEvent::Type::Info, "Could not read /proc/sys/kernel/core_pattern: {}", strerror(errno));
+		return result;
+	}
+
+	core_pattern[bytes-1] = 0; // Strip off the newline at the end
+
+	if(core_pattern[0] == '|')
+	{
+		// This may be apport, but apport still writes a "core" file if the
+		// limit is set appropriately.
+		strncpy(core_pattern, "core", sizeof(core_pattern));
+	}
+
+	auto formatter = [&](boost::iterator_range<std::string::const_iterator> match) -> std::string {
+		char code = *(match.begin()+1);
+
+		switch(code)
+		{
+			case '%':
+				return "%";
+			case 'p':
+				return std::to_string(job.pid);
+			case 'u':
+				return std::to_string(getuid());
+			case 'g':
+				return std::to_string(getgid());
+			case 's':
+				return std::to_string(job.signal);
+			case 't':
+				return "*"; // No chance
+			case 'h':
+			{
+				utsname uts;
+				memset(&uts, 0, sizeof(uts));
+				if(uname(&uts) != 0)
+					return "*";
+
+				return uts.nodename;
+			}
+			case 'e':
+				return job.nodeType.substr(0, TASK_COMM_LEN-1);
+			case 'E':
+			{
+				std::string executable = job.executable;
+				boost::replace_all(executable, "/", "!");
+				return executable;
+			}
+			case 'c':
+			{
+				rlimit limit;
+				memset(&limit, 0, sizeof(limit));
+				getrlimit(RLIMIT_CORE, &limit);
+
+				// core limit is set to the maximum above
+				return std::to_string(limit.rlim_max);
+			}
+			default:
+				return "*";
+		}
+	};
+
+	std::string coreGlob = boost::find_format_all_copy(std::string(core_pattern), corePatternFormatFinder, formatter);
+
+	// If the pattern is not absolute, it is relative to our node's cwd.
+	if(coreGlob[0] != '/')
+		coreGlob = job.workingDirectory.find("/tmp/rosmon-node-") == std::string::npos ? job.workingDirectory + "/core_dumps/" + coreGlob : job.workingDirectory + "/" + coreGlob;
+
+	addMessage(&result, LogEvent::Type::Info, "Determined pattern '{}'", coreGlob);
+
+	glob_t results;
+	memset(&results, 0, sizeof(results));
+	int ret = glob(coreGlob.c_str(), GLOB_NOSORT, nullptr, &results);
+
+	// Wildcards may also match cores we collected before
+	std::vector<std::string> matches;
+	for(std::size_t i = 0; ret == 0 && i < results.gl_pathc; ++i)
+	{
+		std::string match = results.gl_pathv[i];
+		bool known = boost::algorithm::ends_with(match, ".zst")
+			|| boost::algorithm::ends_with(match, ".backtrace")
+			|| std::any_of(m_cores.begin(), m_cores.end(), [&](const CoreFile& core) {
+			return core.path == match;
+		});
+
+		if(!known)
+			matches.push_back(std::move(match));
+	}
+	globfree(&results);
+
+	if(matches.empty())
+	{
+		addMessage(&result, LogEvent::Type::Warning, "Could not find a matching core file :-(");
+		return result;
+	}
+
+	if(matches.size() > 1)
+	{
+		addMessage(&result, LogEvent::Type::Info, "Found multiple matching core files :-(");
+		return result;
+	}
+
+	std::string coreFile = matches.front();
+
+	// Give the core a unique name, so that it is not overwritten by the next crash
+	time_t t = time(nullptr);
+	tm currentTime;
+	memset(&currentTime, 0, sizeof(currentTime));
+	localtime_r(&t, &currentTime);
+
+	char buf[256];
+	strftime(buf, sizeof(buf), "_%Y_%m_%d_%H_%M_%S", &currentTime);
+	std::string coreRename = coreFile + "_" + job.nodeName + buf;
+
+	if(rename(coreFile.c_str(), coreRename.c_str()) != 0)
+		addMessage(&result, LogEvent::Type::Warning, "Error renaming core file: {}", strerror(errno));
+	else
+		coreFile = coreRename;
+
+	if(job.backtraceOnly && extractBacktrace(job, coreFile, &result))
+	{
+		std::string summaryFile = coreFile + ".backtrace";
+		FILE* f = fopen(summaryFile.c_str(), "we");
+		if(f)
+		{
+			fwrite(result.backtrace.c_str(), 1, result.backtrace.size(), f);
+			fclose(f);
+		}
+		else
+			addMessage(&result, LogEvent::Type::Warning, "Could not write '{}': {}", summaryFile, strerror(errno));
+
+		if(unlink(coreFile.c_str()) != 0)
+			addMessage(&result, LogEvent::Type::Warning, "Could not delete core file '{}': {}", coreFile, strerror(errno));
+		else
+			addMessage(&result, LogEvent::Type::Info, "Saved backtrace to '{}' and deleted the core", summaryFile);
+
+		if(f)
+			enforceQuota(job, summaryFile, &result);
+
+		return result;
+	}
+
+	bool compressed = compress(&coreFile, &result);
+
+	enforceQuota(job, coreFile, &result);
+	if(access(coreFile.c_str(), F_OK) != 0)
+		return result;
+
+	if(compressed)
+	{
+		std::string uncompressed = coreFile.substr(0, coreFile.size() - 4);
+		// Terminals started by launchDebugger() do not run a shell
+		result.debuggerCommand = fmt::format("sh -c \"zstd -d -q -f {} -o {} && gdb {} {}\"",
+			coreFile, uncompressed, job.executable, uncompressed
+		);
+	}
+	else
+		result.debuggerCommand = fmt::format("gdb {} {}", job.executable, coreFile);
+
+	addMessage(&result, LogEvent::Type::Info, "Debug with '{}'", result.debuggerCommand);
+
+	return result;
+}
+
+bool CoreDumpCollector::extractBacktrace(const Job& job, const std::string& core, Result* result)
+{
+	if(!m_haveGdb)
+		return false;
+
+	// Registers are only interesting for the crashing thread, which is the
+	// current one after loading the core.
+	const char* argv[] = {
+		"gdb", "-batch", "-nx", "-q",
+		"-ex", "set pagination off",
+		"-ex", "info registers",
+		"-ex", "thread apply all bt 32",
+		job.executable.c_str(), core.c_str(),
+		nullptr
+	};
+
+	int fds[2];
+	if(pipe2(fds, O_CLOEXEC) != 0)
+	{
+		addMessage(result, LogEvent::Type::Warning, "Could not create pipe for gdb: {}", strerror(errno));
+		return false;
+	}
+
+	int fdLimit = maxFD();
+	int pid = fork();
+	if(pid < 0)
+	{
+		addMessage(result, LogEvent::Type::Warning, "Could not fork() for gdb: {}", strerror(errno));
+		close(fds[0]);
+		close(fds[1]);
+		return false;
+	}
+
+	if(pid == 0)
+	{
+		setpriority(PRIO_PROCESS, 0, 19);
+
+		int devnull = open("/dev/null", O_RDWR);
+		if(devnull >= 0)
+		{
+			dup2(devnull, STDIN_FILENO);
+			dup2(devnull, STDERR_FILENO);
+		}
+		dup2(fds[1], STDOUT_FILENO);
+		closeFrom(STDERR_FILENO + 1, fdLimit);
+
+		execvp("gdb", const_cast<char* const*>(argv));
+		_exit(127);
+	}
+
+	close(fds[1]);
+	bool killed = !trackChild(pid);
+
+	// Symbol loading for a large node can take a while, but a stuck gdb
+	// should not block the collection of further cores forever.
+	const int TIMEOUT_MS = 120 * 1000;
+	const std::size_t MAX_OUTPUT = 4 * 1024 * 1024;
+
+	std::string output;
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(TIMEOUT_MS);
+	bool timeout = false;
+	while(true)
+	{
+		int remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+		if(remaining <= 0)
+		{
+			timeout = true;
+			break;
+		}
+
+		pollfd pfd{fds[0], POLLIN, 0};
+		int ret = poll(&pfd, 1, remaining);
+		if(ret < 0 && errno == EINTR)
+			continue;
+		if(ret <= 0)
+		{
+			timeout = (ret == 0);
+			break;
+		}
+
+		char buf[4096];
+		int bytes = read(fds[0], buf, sizeof(buf));
+		if(bytes < 0 && errno == EINTR)
+			continue;
+		if(bytes <= 0)
+			break;
+
+		if(output.size() < MAX_OUTPUT)
+			output.append(buf, bytes);
+	}
+	close(fds[0]);
+
+	if(timeout)
+	{
+		addMessage(result, LogEvent::Type::Warning, "gdb did not finish within {}s, keeping the core", TIMEOUT_MS / 1000);
+		kill(pid, SIGKILL);
+	}
+
+	int status;
+	while(waitpid(pid, &status, 0) < 0)
+	{
+		if(errno != EINTR)
+		{
+			untrackChild();
+			return false;
+		}
+	}
+	untrackChild();
+
+	if(timeout || killed)
+		return false;
+
+	if(WIFEXITED(status) && WEXITSTATUS(status) == 127)
+	{
+		addMessage(result, LogEvent::Type::Warning, "gdb is not installed, keeping the full core");
+		m_haveGdb = false;
+		return false;
+	}
+
+	// Only keep what is needed to understand the crash and drop the noise
+	// about symbol loading, new LWPs, etc.
+	static const boost::regex registerLine("^[a-z0-9]+\\s+0x[0-9a-f]+.*$");
+
+	std::stringstream ss(output);
+	std::string summary;
+	std::string line;
+	unsigned int frames = 0;
+	while(std::getline(ss, line))
+	{
+		bool keep = boost::algorithm::starts_with(line, "Program terminated")
+			|| boost::algorithm::starts_with(line, "Thread ")
+			|| boost::regex_match(line, registerLine);
+
+		if(boost::algorithm::starts_with(line, "#"))
+		{
+			keep = true;
+			frames++;
+		}
+
+		if(!keep)
+			continue;
+
+		if(line.size() > 200)
+			line = line.substr(0, 197) + "...";
+
+		summary += line + "\n";
+	}
+
+	if(frames == 0)
+	{
+		addMessage(result, LogEvent::Type::Warning, "gdb did not produce a backtrace, keeping the full core");
+		return false;
+	}
+
+	result->backtrace = std::move(summary);
+	return true;
+}
+
+bool CoreDumpCollector::compress(std::string* path, Result* result)
+{
+	if(!m_haveZstd)
+		return false;
+
+	// Prepare everything before fork(), the child may only call
+	// async-signal-safe functions since we are multi-threaded.
+	const char* argv[] = {"zstd", "-q", "-f", "-T0", "--rm", path->c_str(), nullptr};
+
+	int fdLimit = maxFD();
+	int pid = fork();
+	if(pid < 0)
+	{
+		addMessage(result, LogEvent::Type::Warning, "Could not fork() for core compression: {}", strerror(errno));
+		return false;
+	}
+
+	if(pid == 0)
+	{
+		// Compression should not compete with the other nodes
+		setpriority(PRIO_PROCESS, 0, 19);
+
+		int devnull = open("/dev/null", O_RDWR);
+		if(devnull >= 0)
+		{
+			dup2(devnull, STDIN_FILENO);
+			dup2(devnull, STDOUT_FILENO);
+			dup2(devnull, STDERR_FILENO);
+		}
+		closeFrom(STDERR_FILENO + 1, fdLimit);
+
+		execvp("zstd", const_cast<char* const*>(argv));
+		_exit(127);
+	}
+
+	trackChild(pid);
+
+	int status;
+	while(waitpid(pid, &status, 0) < 0)
+	{
+		if(errno != EINTR)
+		{
+			untrackChild();
+			addMessage(result, LogEvent::Type::Warning, "Could not waitpid() for core compression: {}", strerror(errno));
+			return false;
+		}
+	}
+	untrackChild();
+
+	if(WIFEXITED(status) && WEXITSTATUS(status) == 127)
+	{
+		addMessage(result, LogEvent::Type::Warning, "zstd is not installed, keeping core dumps uncompressed");
+		m_haveZstd = false;
+		return false;
+	}
+
+	if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	{
+		addMessage(result, LogEvent::Type::Warning, "Could not compress core file, keeping it uncompressed");
+		return false;
+	}
+
+	*path += ".zst";
+	return true;
+}
+
+void CoreDumpCollector::enforceQuota(const Job& job, const std::string& path, Result* result)
+{
+	struct stat st;
+	if(stat(path.c_str(), &st) != 0)
+		return;
+
+	m_cores.push_back({path, job.nodeName, static_cast<uint64_t>(st.st_size)});
+
+	uint64_t globalQuota;
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		globalQuota = m_globalQuota;
+	}
+
+	auto trim = [&](uint64_t quota, const std::string& nodeName) {
+		if(quota == 0)
+			return;
+
+		uint64_t usage = 0;
+		for(auto& core : m_cores)
+		{
+			if(nodeName.empty() || core.nodeName == nodeName)
+				usage += core.size;
+		}
+
+		for(auto it = m_cores.begin(); usage > quota && it != m_cores.end();)
+		{
+			if(!nodeName.empty() && it->nodeName != nodeName)
+			{
+				++it;
+				continue;
+			}
+
+			if(unlink(it->path.c_str()) != 0 && errno != ENOENT)
+				addMessage(result, LogEvent::Type::Warning, "Could not delete core file '{}': {}", it->path, strerror(errno));
+			else
+			{
+				addMessage(result, LogEvent::Type::Info, "Core dump quota exceeded, deleted '{}' ({:.1f} MiB)",
+					it->path, it->size / (1024.0 * 1024.0)
+				);
+			}
+
+			usage -= it->size;
+			it = m_cores.erase(it);
+		}
+	};
+
+	trim(job.nodeQuota, job.nodeName);
+	trim(globalQuota, std::string());
+}
+
+}
+
+}
@@ -0,0 +1,148 @@
+// Collects and compresses core dumps in the background
+// Author: Max Schwarz <max.schwarz@uni-bonn.de>
+
+#ifndef ROSMON_MONITOR_COREDUMP_COLLECTOR_H
+#define ROSMON_MONITOR_COREDUMP_COLLECTOR_H
+
+#include "../fd_watcher.h"
+#include "../log_event.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace rosmon
+{
+
+namespace monitor
+{
+
+/**
+ * @brief Locates, renames and compresses core dumps on a worker thread
+ *
+ * Finding a core file means reading /proc/sys/kernel/core_pattern and
+ * globbing the file system, and compressing a core of a few GB takes
+ * seconds. None of this should happen on the main loop, where it would
+ * stall output and respawn timers of all other nodes.
+ *
+ * Jobs are processed in order on a single worker thread. Results are passed
+ * back to the main loop through a pipe registered with the FDWatcher, so
+ * the callbacks run on the main thread.
+ *
+ * For nodes that only need stack traces, gdb extracts a compact per-thread
+ * backtrace summary and the core is deleted afterwards.
+ *
+ * Collected cores are compressed with zstd (if available) and their disk
+ * usage is limited per node (see launch::Node::coreQuota()) and globally
+ * (see setGlobalQuota()). If a quota is exceeded, the oldest cores are
+ * deleted.
+ **/
+class CoreDumpCollector
+{
+public:
+	typedef std::shared_ptr<CoreDumpCollector> Ptr;
+
+	//! Everything the worker needs to know about the crashed process
+	struct Job
+	{
+		std::string nodeName;
+		std::string nodeType;
+		std::string executable;
+		std::string workingDirectory;
+		int pid;
+		int signal;
+		uint64_t nodeQuota; //!< Zero means unlimited
+		bool backtraceOnly; //!< Replace the core by a backtrace summary
+	};
+
+	struct Result
+	{
+		//! Messages to be logged by the node
+		std::vector<std::pair<LogEvent::Type, std::string>> messages;
+
+		//! Command to debug the core, empty if no core was kept
+		std::string debuggerCommand;
+
+		//! Per-thread backtraces and registers if the core was replaced
+		std::string backtrace;
+	};
+
+	typedef std::function<void(const Result&)> Callback;
+
+	explicit CoreDumpCollector(FDWatcher::Ptr fdWatcher);
+	~CoreDumpCollector();
+
+	CoreDumpCollector(const CoreDumpCollector&) = delete;
+	CoreDumpCollector& operator=(const CoreDumpCollector&) = delete;
+
+	/**
+	 * @brief Queue a core dump for collection
+	 *
+	 * @param owner Used by forget() to drop pending callbacks
+	 * @param cb Called on the main loop when the job is done
+	 **/
+	void submit(const void* owner, const Job& job, const Callback& cb);
+
+	//! Do not call any callbacks for this owner anymore
+	void forget(const void* owner);
+
+	//! Limit disk usage of all collected cores, zero means unlimited
+	void setGlobalQuota(uint64_t bytes);
+private:
+	struct QueuedJob
+	{
+		uint64_t id;
+		Job job;
+	};
+
+	struct CoreFile
+	{
+		std::string path;
+		std::string nodeName;
+		uint64_t size;
+	};
+
+	void run();
+	Result collect(const Job& job);
+	bool extractBacktrace(const Job& job, const std::string& core, Result* result);
+	bool compress(std::string* path, Result* result);
+	bool trackChild(int pid);
+	void untrackChild();
+	void enforceQuota(const Job& job, const std::string& path, Result* result);
+	void handleResults(int fd);
+
+	FDWatcher::Ptr m_fdWatcher;
+	int m_pipe[2];
+
+	std::thread m_thread;
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	bool m_quit = false;
+
+	// Protected by m_mutex
+	std::deque<QueuedJob> m_jobs;
+	std::vector<std::pair<uint64_t, Result>> m_results;
+	uint64_t m_globalQuota = 0;
+	int m_child = -1; //!< Running gdb or zstd process, killed on shutdown
+
+	// Only touched by the worker thread
+	std::deque<CoreFile> m_cores; //!< Oldest first
+	bool m_haveZstd = true;
+	bool m_haveGdb = true;
+
+	// Only touched by the main thread
+	uint64_t m_nextID = 0;
+	std::map<uint64_t, std::pair<const void*, Callback>> m_callbacks;
+};
+
+}
+
+}
+
+#endif
@@ -3,7 +3,10 @@
 
 #include "linux_process_info.h"
 
+#include <fcntl.h>
 #include <unistd.h>
+
+#include <cerrno>
 #include <cstdio>
 #include <cstring>
 
@@ -51,82 +54,324 @@ std::size_t page_size()
 	return g_page_size;
 }
 
+namespace
+{
+	inline bool isSpace(char c)
+	{ return c == ' ' || c == '\t' || c == '\n'; }
+
+	inline bool isDigit(char c)
+	{ return c >= '0' && c <= '9'; }
+
+	/**
+	 * @brief Allocation-free scanner for whitespace-separated fields
+	 *
+	 * Only handles what we need from /proc: skipping arbitrary fields and
+	 * reading unsigned decimal numbers.
+	 **/
+	class FieldScanner
+	{
+	public:
+		FieldScanner(const char* begin, const char* end)
+		 : m_p{begin}, m_end{end}
+		{}
+
+		//! Skip count fields
+		bool skip(unsigned int count = 1)
+		{
+			for(unsigned int i = 0; i < count; ++i)
+			{
+				skipSpace();
+				if(m_p == m_end)
+					return false;
+
+				while(m_p != m_end && !isSpace(*m_p))
+					++m_p;
+			}
+
+			return true;
+		}
+
+		//! Read an unsigned decimal field
+		template<class T>
+		bool read(T* value)
+		{
+			skipSpace();
+			if(m_p == m_end || !isDigit(*m_p))
+				return false;
+
+			T v = 0;
+			for(; m_p != m_end && isDigit(*m_p); ++m_p)
+				v = 10*v + (*m_p - '0');
+
+			*value = v;
+			return true;
+		}
+	private:
+		void skipSpace()
+		{
+			while(m_p != m_end && isSpace(*m_p))
+				++m_p;
+		}
+
+		const char* m_p;
+		const char* m_end;
+	};
+
+	/**
+	 * @brief Call cb(key, keyLength, value) for all "Key: <value>" lines
+	 *
+	 * Lines without a numeric value are ignored.
+	 **/
+	template<class Callback>
+	void forEachKeyValue(const char* begin, const char* end, Callback&& cb)
+	{
+		const char* line = begin;
+		while(line < end)
+		{
+			auto eol = static_cast<const char*>(memchr(line, '\n', end - line));
+			if(!eol)
+				eol = end;
+
+			auto colon = static_cast<const char*>(memchr(line, ':', eol - line));
+			if(colon)
+			{
+				FieldScanner scanner(colon + 1, eol);
+				unsigned long long value;
+				if(scanner.read(&value))
+					cb(line, colon - line, value);
+			}
+
+			line = eol + 1;
+		}
+	}
+
+	template<std::size_t N>
+	inline bool keyIs(const char* key, std::size_t length, const char (&name)[N])
+	{
+		return length == N-1 && memcmp(key, name, N-1) == 0;
+	}
+
+	/**
+	 * @brief Read a whole (small) file into buf
+	 *
+	 * We do not use stdio here, since fopen() allocates its buffer on
+	 * the heap.
+	 *
+	 * @param dirfd Directory fd for relative filenames (or AT_FDCWD)
+	 * @return Number of bytes read, or -1 on error
+	 **/
+	ssize_t readFile(int dirfd, const char* filename, char* buf, std::size_t size)
+	{
+		int fd = openat(dirfd, filename, O_RDONLY | O_CLOEXEC);
+		if(fd < 0)
+			return -1;
+
+		std::size_t length = 0;
+		while(length < size)
+		{
+			ssize_t ret = read(fd, buf + length, size - length);
+			if(ret < 0)
+			{
+				if(errno == EINTR)
+					continue;
+
+				int err = errno;
+				close(fd);
+				errno = err;
+				return -1;
+			}
+
+			if(ret == 0)
+				break;
+
+			length += ret;
+		}
+
+		close(fd);
+		return length;
+	}
+}
+
 bool readStatFile(const char* filename, ProcessStat* stat)
 {
-	FILE* f = fopen(filename, "r");
-	if(!f)
-		return false;
+	return readStatFileAt(AT_FDCWD, filename, stat);
+}
 
+bool readStatFileAt(int dirfd, const char* filename, ProcessStat* stat)
+{
 	char buf[1024];
-	int ret = fread(buf, 1, sizeof(buf)-1, f);
-	fclose(f);
-
-	if(ret <= 0)
+	ssize_t size = readFile(dirfd, filename, buf, sizeof(buf));
+	if(size <= 0)
 		return false;
 
-	buf[ret] = 0;
+	const char* end = buf + size;
 
 	unsigned long pid = 0;
-	if(sscanf(buf, "%lu", &pid) != 1)
+	if(!FieldScanner(buf, end).read(&pid))
 		return false;
 
-	// from procps: skip "(filename)"
-	char* start = strrchr(buf, ')');
+	// from procps: skip "(filename)". The filename may contain anything,
+	// so search for the last ')'.
+	const char* start = end;
+	while(start != buf && *(start-1) != ')')
+		--start;
 
-	if(start - buf > (int)strlen(buf) - 4)
+	if(start == buf)
 		return false;
 
-	// Skip ")"
-	start += 2;
+	// The state is a single character following the name
+	const char* statePtr = start;
+	while(statePtr != end && *statePtr == ' ')
+		++statePtr;
+
+	if(statePtr == end)
+		return false;
+
+	FieldScanner scanner(start, end);
 
 	unsigned long pgrp = 0;
-	long long unsigned int user_jiffies = 0;
-	long long unsigned int kernel_jiffies = 0;
-	long long unsigned int rss_pages = 0;
+	unsigned long long minor_faults = 0;
+	unsigned long long major_faults = 0;
+	unsigned long long user_jiffies = 0;
+	unsigned long long kernel_jiffies = 0;
+	unsigned long num_threads = 0;
+	unsigned long long rss_pages = 0;
 
 	// Parse interesting fields
-	ret = sscanf(start,
-		"%*c " // state
-		"%*u " // ppid
-		"%lu " // pgrp
-		"%*u " // sid
-		"%*u " // tty_nr
-		"%*u " // tty_pgrp
-		"%*u " // flags
-		"%*u " // number of minor faults
-		"%*u " // number of minor faults with child's
-		"%*u " // number of major faults
-		"%*u " // number of major faults with child's
-		"%llu " // user mode jiffies
-		"%llu " // kernel mode jiffies
-		"%*u " // user mode jiffies with child's
-		"%*u " // kernel mode jiffies with child's
-		"%*u " // priority level
-		"%*u " // nice level
-		"%*u " // num_threads
-		"%*u " // it_real_value (obsolete, always 0)
-		"%*u " // time the process started after system boot
-		"%*u " // virtual memory size
-		"%llu " // resident memory size
-		, // many more fields follow
-		&pgrp,
-		&user_jiffies,
-		&kernel_jiffies,
-		&rss_pages
-	);
-
-	if(ret != 4)
+	bool ok = scanner.skip(2) // state, ppid
+		&& scanner.read(&pgrp)
+		&& scanner.skip(4) // sid, tty_nr, tty_pgrp, flags
+		&& scanner.read(&minor_faults)
+		&& scanner.skip() // minor faults with child's
+		&& scanner.read(&major_faults)
+		&& scanner.skip() // major faults with child's
+		&& scanner.read(&user_jiffies)
+		&& scanner.read(&kernel_jiffies)
+		&& scanner.skip(4) // child user & kernel jiffies, priority, nice
+		&& scanner.read(&num_threads)
+		&& scanner.skip(3) // it_real_value, start time, virtual memory size
+		&& scanner.read(&rss_pages);
+		// many more fields follow
+
+	if(!ok)
 		return false;
 
 	stat->pid = pid;
 	stat->pgrp = pgrp;
+	stat->state = *statePtr;
 	stat->utime = user_jiffies;
 	stat->stime = kernel_jiffies;
 	stat->mem_rss = rss_pages * page_size();
+	stat->num_threads = num_threads;
+	stat->minor_faults = minor_faults;
+	stat->major_faults = major_faults;
+
+	return true;
+}
+
+bool readCommFileAt(int dirfd, const char* filename, char* name, std::size_t size)
+{
+	if(size == 0)
+		return false;
+
+	ssize_t length = readFile(dirfd, filename, name, size - 1);
+	if(length < 0)
+		return false;
 
+	// Strip trailing newline
+	if(length > 0 && name[length-1] == '\n')
+		length--;
+
+	name[length] = 0;
 	return true;
 }
 
+bool readStatusFile(const char* filename, ProcessStatus* status)
+{
+	return readStatusFileAt(AT_FDCWD, filename, status);
+}
+
+bool readStatusFileAt(int dirfd, const char* filename, ProcessStatus* status)
+{
+	// The context switch counters are the last lines, so make sure we
+	// get the whole file (usually around 1.5 KiB).
+	char buf[8192];
+	ssize_t size = readFile(dirfd, filename, buf, sizeof(buf));
+	if(size <= 0)
+		return false;
+
+	int found = 0;
+	forEachKeyValue(buf, buf + size, [&](const char* key, std::size_t length, unsigned long long value) {
+		if(keyIs(key, length, "voluntary_ctxt_switches"))
+		{
+			status->voluntary_ctxt_switches = value;
+			found++;
+		}
+		else if(keyIs(key, length, "nonvoluntary_ctxt_switches"))
+		{
+			status->nonvoluntary_ctxt_switches = value;
+			found++;
+		}
+	});
+
+	return found == 2;
+}
+
+bool readIOFile(const char* filename, ProcessIO* io)
+{
+	char buf[512];
+	ssize_t size = readFile(AT_FDCWD, filename, buf, sizeof(buf));
+	if(size <= 0)
+		return false;
+
+	int found = 0;
+	forEachKeyValue(buf, buf + size, [&](const char* key, std::size_t length, unsigned long long value) {
+		if(keyIs(key, length, "read_bytes"))
+		{
+			io->read_bytes = value;
+			found++;
+		}
+		else if(keyIs(key, length, "write_bytes"))
+		{
+			io->write_bytes = value;
+			found++;
+		}
+	});
+
+	return found == 2;
+}
+
+bool readSmapsRollupFile(const char* filename, ProcessMemory* mem)
+{
+	// smaps_rollup is about 1 KiB, so this is plenty
+	char buf[4096];
+	ssize_t size = readFile(AT_FDCWD, filename, buf, sizeof(buf));
+	if(size <= 0)
+		return false;
+
+	mem->pss = 0;
+	mem->uss = 0;
+	mem->swap = 0;
+
+	// The first line is the (pseudo-)mapping header, the following lines
+	// have the form "Key:   <value> kB".
+	bool foundPss = false;
+	forEachKeyValue(buf, buf + size, [&](const char* key, std::size_t length, unsigned long long value) {
+		value *= 1024;
+
+		if(keyIs(key, length, "Pss"))
+		{
+			mem->pss = value;
+			foundPss = true;
+		}
+		else if(keyIs(key, length, "Private_Clean") || keyIs(key, length, "Private_Dirty"))
+			mem->uss += value;
+		else if(keyIs(key, length, "Swap"))
+			mem->swap = value;
+	});
+
+	return foundPss;
+}
 
 }
 }
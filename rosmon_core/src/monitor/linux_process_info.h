@@ -33,9 +33,13 @@ struct ProcessStat
 {
 	unsigned long pid;
 	unsigned long pgrp; //!< Process group ID
+	char state;         //!< Scheduler state (R, S, D, Z, T, ...)
 	jiffies_t utime;    //!< Total time spent in userspace
 	jiffies_t stime;    //!< Total time spent in kernel space
 	std::size_t mem_rss; //!< Resident memory size in bytes
+	unsigned long num_threads; //!< Number of threads
+	unsigned long long minor_faults; //!< Page faults without disk access
+	unsigned long long major_faults; //!< Page faults requiring disk access
 };
 
 /**
@@ -47,6 +51,100 @@ struct ProcessStat
  **/
 bool readStatFile(const char* filename, ProcessStat* stat);
 
+/**
+ * Read process state relative to a directory fd
+ *
+ * Same as readStatFile(), but avoids the path lookup from the root
+ * directory, e.g. for "<tid>/stat" relative to an open /proc/<pid>/task.
+ *
+ * @param dirfd Directory file descriptor
+ * @param filename Filename relative to dirfd
+ * @param stat Output struct
+ * @return true on success
+ **/
+bool readStatFileAt(int dirfd, const char* filename, ProcessStat* stat);
+
+/**
+ * Read process/thread name from a comm file relative to a directory fd
+ *
+ * @param dirfd Directory file descriptor
+ * @param filename Filename relative to dirfd (e.g. "1234/comm")
+ * @param name Output buffer (null-terminated on success)
+ * @param size Size of the output buffer
+ * @return true on success
+ **/
+bool readCommFileAt(int dirfd, const char* filename, char* name, std::size_t size);
+
+/**
+ * Scheduler counters extracted from /proc/<pid>/status
+ *
+ * The kernel reports these per thread: /proc/<pid>/status only covers the
+ * main thread. See ThreadTracker::readStatus() for whole-process values.
+ **/
+struct ProcessStatus
+{
+	//! Number of times the process blocked (e.g. waiting for I/O or a lock)
+	unsigned long long voluntary_ctxt_switches;
+	//! Number of times the process was preempted
+	unsigned long long nonvoluntary_ctxt_switches;
+};
+
+/**
+ * Read scheduler counters from /proc/<pid>/status
+ *
+ * @param filename Filename of the status file (e.g. "/proc/1234/status")
+ * @param status Output struct
+ * @return true on success
+ **/
+bool readStatusFile(const char* filename, ProcessStatus* status);
+
+//! Same as readStatusFile(), relative to a directory fd
+bool readStatusFileAt(int dirfd, const char* filename, ProcessStatus* status);
+
+
+/**
+ * I/O counters extracted from /proc/<pid>/io
+ **/
+struct ProcessIO
+{
+	unsigned long long read_bytes;  //!< Bytes fetched from the storage layer
+	unsigned long long write_bytes; //!< Bytes sent to the storage layer
+};
+
+/**
+ * Read I/O counters from /proc/<pid>/io
+ *
+ * Note that this file is only readable if we are allowed to ptrace the
+ * process, so it may fail e.g. for setuid binaries.
+ *
+ * @param filename Filename of the io file (e.g. "/proc/1234/io")
+ * @param io Output struct
+ * @return true on success
+ **/
+bool readIOFile(const char* filename, ProcessIO* io);
+
+/**
+ * Detailed memory usage extracted from /proc/<pid>/smaps_rollup
+ *
+ * This is considerably more expensive to read than /proc/<pid>/stat, since
+ * the kernel has to walk all memory mappings of the process.
+ **/
+struct ProcessMemory
+{
+	std::size_t pss;  //!< Proportional set size in bytes
+	std::size_t uss;  //!< Unique set size (private pages) in bytes
+	std::size_t swap; //!< Swapped out memory in bytes
+};
+
+/**
+ * Read detailed memory usage from /proc/<pid>/smaps_rollup
+ *
+ * @param filename Filename of the file (e.g. "/proc/1234/smaps_rollup")
+ * @param mem Output struct
+ * @return true on success
+ **/
+bool readSmapsRollupFile(const char* filename, ProcessMemory* mem);
+
 }
 }
 }
@@ -0,0 +1,126 @@
+// Preload library which locks the memory of a node process
+// Author: Max Schwarz <max.schwarz@ais.uni-bonn.de>
+
+// Memory locks are removed on execve(), so _shim cannot simply call
+// mlockall() before starting the node. Instead, it preloads this library
+// and sets ROSMON_MLOCKALL to the path of the node executable.
+//
+// The first image started by _shim is often not the node itself, but env
+// (from a "#!/usr/bin/env python" shebang), a shell wrapper or a
+// launch-prefix, which exec()s the node later on. These images pass both
+// variables on unchanged. Once we are loaded into the node itself, we lock
+// and remove the variables, so processes started by the node do not
+// lock their memory as well.
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace
+{
+
+bool samePath(const char* a, const char* b)
+{
+	char realA[PATH_MAX];
+	char realB[PATH_MAX];
+
+	if(!realpath(a, realA) || !realpath(b, realB))
+		return false;
+
+	return strcmp(realA, realB) == 0;
+}
+
+/**
+ * @brief Is this image the node executable?
+ *
+ * Binaries are recognized by /proc/self/exe. Scripts are executed by their
+ * interpreter, which gets the script path as first argument - or second,
+ * if the shebang line passes an option.
+ **/
+bool isTarget(const char* target, int argc, char** argv)
+{
+	char self[PATH_MAX];
+	ssize_t len = readlink("/proc/self/exe", self, sizeof(self)-1);
+	if(len > 0)
+	{
+		self[len] = 0;
+		if(samePath(self, target))
+			return true;
+	}
+
+	if(argc > 1 && samePath(argv[1], target))
+		return true;
+
+	if(argc > 2 && argv[1][0] == '-' && samePath(argv[2], target))
+		return true;
+
+	return false;
+}
+
+void removeFromPreload()
+{
+	const char* preload = getenv("LD_PRELOAD");
+	if(!preload)
+		return;
+
+	std::string list = preload;
+	std::string remaining;
+
+	std::size_t start = 0;
+	while(start <= list.size())
+	{
+		std::size_t end = list.find_first_of(": ", start);
+		if(end == std::string::npos)
+			end = list.size();
+
+		std::string entry = list.substr(start, end - start);
+		std::size_t slash = entry.rfind('/');
+		std::string name = (slash == std::string::npos) ? entry : entry.substr(slash+1);
+
+		if(!entry.empty() && name != "librosmon_mlock.so")
+		{
+			if(!remaining.empty())
+				remaining += ":";
+			remaining += entry;
+		}
+
+		start = end + 1;
+	}
+
+	if(remaining.empty())
+		unsetenv("LD_PRELOAD");
+	else
+		setenv("LD_PRELOAD", remaining.c_str(), 1);
+}
+
+}
+
+// glibc passes the program arguments to constructors of shared libraries
+__attribute__((constructor))
+static void rosmonMlockAll(int argc, char** argv, char**)
+{
+	// Only act in processes started (directly or through exec) by _shim
+	const char* target = getenv("ROSMON_MLOCKALL");
+	if(!target)
+		return;
+
+	// Wrappers in the exec chain keep the variables for the node
+	if(!isTarget(target, argc, argv))
+		return;
+
+	if(mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+	{
+		fprintf(stderr, "rosmon: mlockall() failed: %s (check rosmon-memlock-limit)\n",
+			strerror(errno)
+		);
+	}
+
+	unsetenv("ROSMON_MLOCKALL");
+	removeFromPreload();
+}
@@ -7,9 +7,14 @@
 #include <ros/node_handle.h>
 #include <ros/param.h>
 
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
 #include <cstdarg>
 #include <cstdio>
+#include <ctime>
 #include <fstream>
+#include <limits>
 
 #include <boost/regex.hpp>
 #include <boost/algorithm/string/trim.hpp>
@@ -22,6 +27,8 @@
 
 #include "linux_process_info.h"
 #include "../fmt_no_throw.h"
+#include "../self_stats.h"
+#include "../trace.h"
 
 template<typename... Args>
 std::runtime_error error(const char* fmt, const Args& ... args)
@@ -37,68 +44,145 @@ namespace monitor
 Monitor::Monitor(launch::LaunchConfig::ConstPtr config, FDWatcher::Ptr watcher, std::string logDir, bool flushLog, bool disableLog, std::string launchGroup, std::string launchConfig)
  : m_config(std::move(config))
  , m_fdWatcher(std::move(watcher))
+ , m_logDir(std::move(logDir))
+ , m_flushLog(flushLog)
+ , m_disableLog(disableLog)
+ , m_launchGroup(std::move(launchGroup))
+ , m_launchConfig(std::move(launchConfig))
  , m_ok(true)
 {
+	m_coreDumpCollector = std::make_shared<CoreDumpCollector>(m_fdWatcher);
+
 	for(auto& launchNode : m_config->nodes())
+		m_nodes.push_back(createNode(launchNode));
+
+	auto now = Clock::now();
+	for(auto& node : m_nodes)
+		m_statsSchedule.push_back({now, now, node->statsPeriod()});
+
+	m_nextProcessScan = now;
+
+	m_statTimerPeriod = 1.0;
+	if(!m_nodes.empty())
 	{
-		// Setup a sane ROSCONSOLE_FORMAT if the user did not already
-		setenv("ROSCONSOLE_FORMAT", "[${function}] [${time}]: ${message}", 0);
+		m_statTimerPeriod = std::min_element(m_statsSchedule.begin(), m_statsSchedule.end(),
+			[](const NodeStatsSchedule& a, const NodeStatsSchedule& b) { return a.period < b.period; }
+		)->period;
+	}
 
-		// Disable direct logging to stdout
-		ros::console::backend::function_print = nullptr;
+#if HAVE_STEADYTIMER
+	m_statTimer = m_nh.createSteadyTimer(
+#else
+	m_statTimer = m_nh.createWallTimer(
+#endif
+		ros::WallDuration(m_statTimerPeriod),
+		boost::bind(&Monitor::updateStats, this, _1)
+	);
+}
 
-		std::string logFile;
-		
-		if (!disableLog) {
-			// Open logger
-			if(!logDir.empty())
-			{
-				logFile = logDir + "/" + launchGroup + "_" + launchConfig + "_" + launchNode->name() + ".log";
-			} 
-			else
-			{
-				// Log to /tmp by default
+NodeMonitor::Ptr Monitor::createNode(const launch::Node::ConstPtr& launchNode)
+{
+	// Setup a sane ROSCONSOLE_FORMAT if the user did not already
+	setenv("ROSCONSOLE_FORMAT", "[${function}] [${time}]: ${message}", 0);
 
-				time_t t = time(nullptr);
-				tm currentTime;
-				memset(&currentTime, 0, sizeof(currentTime));
-				localtime_r(&t, &currentTime);
+	// Disable direct logging to stdout
+	ros::console::backend::function_print = nullptr;
 
-				char buf[256];
-				strftime(buf, sizeof(buf), "/tmp/rosmon_%Y_%m_%d_%H_%M_%S.log", &currentTime);
+	std::string logFile;
 
-				logFile = buf;
-			}
+	if (!m_disableLog) {
+		// Open logger
+		if(!m_logDir.empty())
+		{
+			logFile = m_logDir + "/" + m_launchGroup + "_" + m_launchConfig + "_" + launchNode->name() + ".log";
 		}
+		else
+		{
+			// Log to /tmp by default
 
-		auto node = std::make_shared<NodeMonitor>(launchNode, m_fdWatcher, m_nh, logFile, flushLog, disableLog);
+			time_t t = time(nullptr);
+			tm currentTime;
+			memset(&currentTime, 0, sizeof(currentTime));
+			localtime_r(&t, &currentTime);
 
-		if (!disableLog) {
-			node->logMessageSignal.connect(boost::bind(&rosmon::Logger::log, node->logger.get(), _1));
-		}
+			char buf[256];
+			strftime(buf, sizeof(buf), "/tmp/rosmon_%Y_%m_%d_%H_%M_%S.log", &currentTime);
 
-		if(launchNode->required())
-		{
-			node->exitedSignal.connect(
-				boost::bind(&Monitor::handleRequiredNodeExit, this, _1)
-			);
+			logFile = buf;
 		}
+	}
+
+	auto node = std::make_shared<NodeMonitor>(launchNode, m_fdWatcher, m_nh, logFile, m_flushLog, m_disableLog);
+	node->setCoreDumpCollector(m_coreDumpCollector);
+	node->setOutputShards(m_outputShards);
 
-		m_nodes.push_back(node);
+	if (!m_disableLog) {
+		node->logMessageSignal.connect(boost::bind(&rosmon::Logger::log, node->logger.get(), _1));
 	}
 
-#if HAVE_STEADYTIMER
-	m_statTimer = m_nh.createSteadyTimer(
-#else
-	m_statTimer = m_nh.createWallTimer(
-#endif
-		ros::WallDuration(1.0),
-		boost::bind(&Monitor::updateStats, this, _1)
-	);
+	// The required flag may change on reload, so check it on exit.
+	NodeMonitor* nodePtr = node.get();
+	node->exitedSignal.connect([this, nodePtr](const std::string&) {
+		handleNodeExit(*nodePtr);
+	});
+
+	return node;
+}
+
+void Monitor::setAdaptiveStats(bool on)
+{
+	m_adaptiveStats = on;
+}
+
+void Monitor::setThreadStats(unsigned int count)
+{
+	m_threadStatsCount = count;
+
+	for(auto& node : m_nodes)
+		node->setTopThreadCount(count);
+
+	if(count == 0)
+	{
+		for(auto& pair : m_processInfos)
+			pair.second.threads.reset();
+	}
+}
+
+void Monitor::setSmapsPeriod(double period)
+{
+	m_smapsPeriod = period;
+	m_nextSmapsUpdate = Clock::now();
+}
+
+void Monitor::setMemoryLimitMetric(NodeMonitor::MemoryMetric metric)
+{
+	m_memoryLimitMetric = metric;
+
+	for(auto& node : m_nodes)
+		node->setMemoryLimitMetric(metric);
+}
+
+void Monitor::setCoreQuota(uint64_t bytes)
+{
+	m_coreDumpCollector->setGlobalQuota(bytes);
+}
+
+void Monitor::setOutputThreads(unsigned int threads)
+{
+	if(threads == 0)
+		m_outputShards.reset();
+	else
+		m_outputShards = std::make_shared<OutputShards>(threads, m_fdWatcher);
+
+	for(auto& node : m_nodes)
+		node->setOutputShards(m_outputShards);
 }
 
 void Monitor::setParameters()
 {
+	ScopedTimer timer(&SelfStats::instance().histogram("monitor/param_upload"));
+	trace::Span span("supervisor", "setParameters");
+
 	{
 		std::vector<std::string> paramNames;
 
@@ -141,8 +225,97 @@ void Monitor::start()
 
 void Monitor::shutdown()
 {
+	std::map<int, std::vector<NodeMonitor::Ptr>> groups;
 	for(auto& node : m_nodes)
+		groups[node->launchNode()->shutdownGroup()].push_back(node);
+
+	m_shutdownGroups.assign(groups.begin(), groups.end());
+	m_currentShutdownGroup = 0;
+	m_shutdownStart = Clock::now();
+
+	if(!m_shutdownGroups.empty())
+		startShutdownGroup();
+}
+
+void Monitor::startShutdownGroup()
+{
+	auto& group = m_shutdownGroups[m_currentShutdownGroup];
+
+	if(m_shutdownGroups.size() > 1)
+		logTyped(LogEvent::Type::Info, "Shutting down group {} ({} nodes)", group.first, group.second.size());
+
+	double timeout = 0.0;
+	for(auto& node : group.second)
+	{
+		double nodeTimeout = node->stopTimeout();
+		if(node->running() && !node->launchNode()->shutdownHandler().empty())
+			nodeTimeout += node->launchNode()->shutdownHandlerTimeout();
+
+		timeout = std::max(timeout, nodeTimeout);
+
 		node->shutdown();
+	}
+
+	m_groupShutdownStart = Clock::now();
+	m_groupShutdownDeadline = m_groupShutdownStart + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(timeout));
+}
+
+bool Monitor::updateShutdown()
+{
+	if(m_currentShutdownGroup >= m_shutdownGroups.size())
+		return true;
+
+	auto now = Clock::now();
+	auto& group = m_shutdownGroups[m_currentShutdownGroup];
+
+	bool done = true;
+	for(auto& node : group.second)
+	{
+		node->updateShutdown();
+		if(node->running() || node->shutdownHandlerRunning())
+			done = false;
+	}
+
+	if(!done && now >= m_groupShutdownDeadline)
+	{
+		logTyped(LogEvent::Type::Warning, "Killing the following nodes, which are refusing to exit:\n");
+		for(auto& node : group.second)
+		{
+			if(node->running() || node->shutdownHandlerRunning())
+			{
+				logTyped(LogEvent::Type::Warning, " - {}\n", node->name());
+				node->forceExit();
+			}
+		}
+
+		done = true;
+	}
+
+	if(!done)
+		return false;
+
+	double groupTime = std::chrono::duration<double>(now - m_groupShutdownStart).count();
+	if(m_shutdownGroups.size() > 1)
+		logTyped(LogEvent::Type::Info, "Shutdown group {} finished after {:.2f}s", group.first, groupTime);
+
+	m_currentShutdownGroup++;
+	if(m_currentShutdownGroup < m_shutdownGroups.size())
+	{
+		startShutdownGroup();
+		return false;
+	}
+
+	// Nodes removed by a reload had their full stop timeout by now
+	for(auto& node : m_retiredNodes)
+	{
+		if(node->running())
+			node->forceExit();
+	}
+
+	m_shutdownDuration = std::chrono::duration<double>(now - m_shutdownStart).count();
+	logTyped(LogEvent::Type::Info, "Shutdown finished after {:.2f}s", m_shutdownDuration);
+
+	return true;
 }
 
 void Monitor::forceExit()
@@ -156,6 +329,14 @@ void Monitor::forceExit()
 			node->forceExit();
 		}
 	}
+	for(auto& node : m_retiredNodes)
+	{
+		if(node->running())
+		{
+			logTyped(LogEvent::Type::Warning, " - {}\n", node->name());
+			node->forceExit();
+		}
+	}
 }
 
 bool Monitor::allShutdown()
@@ -166,20 +347,28 @@ bool Monitor::allShutdown()
 		if(node->running())
 			allShutdown = false;
 	}
+	for(auto& node : m_retiredNodes)
+	{
+		if(node->running())
+			allShutdown = false;
+	}
 
 	return allShutdown;
 }
 
-double Monitor::shutdownTimeout()
+void Monitor::handleNodeExit(const NodeMonitor& node)
 {
-	double timeout = 0.0;
-	// Find the biggest timeout
-	for(auto& node : m_nodes)
-		if(node->stopTimeout() > timeout)
-			timeout = node->stopTimeout();
-	return timeout;
-}
+	if(!node.launchNode()->required())
+		return;
 
+	// Retired nodes (see reload()) never count as required
+	bool retired = std::any_of(m_retiredNodes.begin(), m_retiredNodes.end(), [&](const NodeMonitor::Ptr& n) {
+		return n.get() == &node;
+	});
+
+	if(!retired)
+		handleRequiredNodeExit(node.name());
+}
 
 void Monitor::handleRequiredNodeExit(const std::string& name)
 {
@@ -214,24 +403,169 @@ void Monitor::logTyped(LogEvent::Type type, const std::string& format, Args&& ..
 	});
 }
 
+namespace
+{
+	//! Full scans of /proc (to find new processes) are done at this period
+	constexpr double PROCESS_SCAN_PERIOD = 1.0;
+
+	//! @name Adaptive stats sampling
+	//@{
+	constexpr double ADAPTIVE_MIN_PERIOD = launch::Node::MIN_STATS_PERIOD;
+	constexpr double ADAPTIVE_MAX_PERIOD = 5.0;
+	constexpr double ADAPTIVE_SPEEDUP = 10.0;
+	constexpr double ADAPTIVE_SLOWDOWN = 5.0;
+	constexpr double ADAPTIVE_HIGH_USAGE = 0.8; //!< Fraction of CPU/memory limit
+	constexpr double ADAPTIVE_LOW_USAGE = 0.2;
+	//@}
+
+	double threadCPUTime()
+	{
+		timespec ts;
+		if(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+			return 0.0;
+
+		return ts.tv_sec + 1e-9 * ts.tv_nsec;
+	}
+
+	template<class Duration>
+	double toSeconds(const Duration& d)
+	{
+		return std::chrono::duration<double>(d).count();
+	}
+
+	template<class Clock>
+	typename Clock::duration fromSeconds(double seconds)
+	{
+		return std::chrono::duration_cast<typename Clock::duration>(std::chrono::duration<double>(seconds));
+	}
+
+	//! Difference of two readings of a monotonic counter
+	inline uint64_t counterDelta(uint64_t now, uint64_t before)
+	{
+		return (now >= before) ? (now - before) : 0;
+	}
+}
+
 #if HAVE_STEADYTIMER
-void Monitor::updateStats(const ros::SteadyTimerEvent& event)
+void Monitor::updateStats(const ros::SteadyTimerEvent&)
 #else
-void Monitor::updateStats(const ros::WallTimerEvent& event)
+void Monitor::updateStats(const ros::WallTimerEvent&)
 #endif
+{
+	auto now = Clock::now();
+	double cpuStart = threadCPUTime();
+
+	// Drop nodes removed by reload() once they have exited
+	m_retiredNodes.erase(
+		std::remove_if(m_retiredNodes.begin(), m_retiredNodes.end(), [](const NodeMonitor::Ptr& node) {
+			return !node->running();
+		}),
+		m_retiredNodes.end()
+	);
+
+	// Which nodes should be sampled now? We allow a little slack so that
+	// timer jitter does not delay a sample by a whole timer period.
+	std::vector<bool> due(m_nodes.size(), false);
+	bool anyDue = false;
+	for(std::size_t i = 0; i < m_nodes.size(); ++i)
+	{
+		auto& schedule = m_statsSchedule[i];
+		if(now + fromSeconds<Clock>(0.1 * schedule.period) >= schedule.nextUpdate)
+		{
+			due[i] = true;
+			anyDue = true;
+			m_nodes[i]->beginStatUpdate();
+		}
+	}
+
+	if(m_smapsPeriod > 0 && now >= m_nextSmapsUpdate)
+	{
+		updateDetailedMemory();
+		m_nextSmapsUpdate = now + fromSeconds<Clock>(m_smapsPeriod);
+	}
+
+	if(!anyDue)
+		return;
+
+	if(now >= m_nextProcessScan)
+	{
+		// Find all processes belonging to our nodes
+		scanProcesses(due);
+		m_nextProcessScan = now + fromSeconds<Clock>(PROCESS_SCAN_PERIOD);
+	}
+	else
+	{
+		// Only re-read the processes we know about
+		char path[64];
+		for(auto it = m_processInfos.begin(); it != m_processInfos.end();)
+		{
+			if(!due[it->second.node])
+			{
+				++it;
+				continue;
+			}
+
+			snprintf(path, sizeof(path), "/proc/%d/stat", it->first);
+
+			process_info::ProcessStat stat;
+			if(!process_info::readStatFile(path, &stat)
+				|| static_cast<int>(stat.pgrp) != m_nodes[it->second.node]->pid())
+			{
+				// Process has exited (or the PID was reused)
+				it = m_processInfos.erase(it);
+				continue;
+			}
+
+			accountProcess(&it->second, stat);
+			++it;
+		}
+	}
+
+	for(std::size_t i = 0; i < m_nodes.size(); ++i)
+	{
+		if(!due[i])
+			continue;
+
+		auto& node = m_nodes[i];
+		auto& schedule = m_statsSchedule[i];
+
+		double elapsedTime = toSeconds(now - schedule.lastUpdate);
+		node->endStatUpdate(elapsedTime * process_info::kernel_hz());
+
+		schedule.period = m_adaptiveStats ? adaptiveStatsPeriod(*node) : node->statsPeriod();
+		schedule.lastUpdate = now;
+		schedule.nextUpdate = now + fromSeconds<Clock>(schedule.period);
+	}
+
+	updateStatTimerPeriod();
+
+	double wallTime = toSeconds(Clock::now() - now);
+	m_statsOverhead.updates++;
+	m_statsOverhead.cpuTime += threadCPUTime() - cpuStart;
+	m_statsOverhead.wallTime += wallTime;
+	m_statsOverhead.maxWallTime = std::max(m_statsOverhead.maxWallTime, wallTime);
+
+	static Histogram& updateDuration = SelfStats::instance().histogram("monitor/update_stats");
+	updateDuration.record(wallTime);
+}
+
+void Monitor::scanProcesses(const std::vector<bool>& due)
 {
 	namespace fs = boost::filesystem;
 
+	static Histogram& scanDuration = SelfStats::instance().histogram("monitor/process_scan");
+	ScopedTimer timer(&scanDuration);
+
+	m_statsOverhead.processScans++;
+
 	fs::directory_iterator it("/proc");
 	fs::directory_iterator end;
 
-	std::map<int, NodeMonitor::Ptr> nodeMap;
-	for(auto& node : m_nodes)
+	std::map<int, std::size_t> nodeMap;
+	for(std::size_t i = 0; i < m_nodes.size(); ++i)
 	{
-		if(node->pid() != -1)
-			nodeMap[node->pid()] = node;
-
-		node->beginStatUpdate();
+		if(m_nodes[i]->pid() != -1)
+			nodeMap[m_nodes[i]->pid()] = i;
 	}
 
 	for(auto& procInfo : m_processInfos)
@@ -261,33 +595,26 @@ void Monitor::updateStats(const ros::WallTimerEvent& event)
 		if(it == nodeMap.end())
 			continue;
 
-		auto& node = it->second;
-
 		// We need to store the stats and subtract the last one to get a time
 		// delta
 		auto infoIt = m_processInfos.find(stat.pid);
-		if(infoIt == m_processInfos.end())
+		if(infoIt == m_processInfos.end() || infoIt->second.node != it->second)
 		{
 			ProcessInfo info;
 			info.stat = stat;
+			info.node = it->second;
 			info.active = true;
+			readProcessCounters(&info);
 			m_processInfos[stat.pid] = info;
 			continue;
 		}
 
-		const auto& oldStat = infoIt->second.stat;
-
-		node->addCPUTime(stat.utime - oldStat.utime, stat.stime - oldStat.stime);
-		node->addMemory(stat.mem_rss);
-
 		infoIt->second.active = true;
-		infoIt->second.stat = stat;
-	}
-
-	double elapsedTime = (event.current_real - event.last_real).toSec();
 
-	for(auto& node : m_nodes)
-		node->endStatUpdate(elapsedTime * process_info::kernel_hz());
+		// Nodes which are not due keep their old stats as reference
+		if(due[it->second])
+			accountProcess(&infoIt->second, stat);
+	}
 
 	// Clean up old processes
 	for(auto it = m_processInfos.begin(); it != m_processInfos.end();)
@@ -298,5 +625,303 @@ void Monitor::updateStats(const ros::WallTimerEvent& event)
 			it++;
 	}
 }
+
+void Monitor::accountProcess(ProcessInfo* info, const process_info::ProcessStat& stat)
+{
+	const auto& oldStat = info->stat;
+	auto& node = m_nodes[info->node];
+
+	node->addCPUTime(stat.utime - oldStat.utime, stat.stime - oldStat.stime);
+	node->addMemory(stat.mem_rss);
+	node->addThreads(stat.num_threads);
+	node->addProcessState(stat.state);
+	node->addFaults(
+		counterDelta(stat.minor_faults, oldStat.minor_faults),
+		counterDelta(stat.major_faults, oldStat.major_faults)
+	);
+
+	auto oldStatus = info->status;
+	auto oldIO = info->io;
+	bool hadStatus = info->haveStatus;
+	bool hadIO = info->haveIO;
+
+	info->stat = stat;
+	readProcessCounters(info);
+
+	if(hadStatus && info->haveStatus)
+	{
+		node->addContextSwitches(
+			counterDelta(info->status.voluntary_ctxt_switches, oldStatus.voluntary_ctxt_switches),
+			counterDelta(info->status.nonvoluntary_ctxt_switches, oldStatus.nonvoluntary_ctxt_switches)
+		);
+	}
+
+	if(hadIO && info->haveIO)
+	{
+		node->addIO(
+			counterDelta(info->io.read_bytes, oldIO.read_bytes),
+			counterDelta(info->io.write_bytes, oldIO.write_bytes)
+		);
+	}
+
+	if(m_threadStatsCount != 0)
+	{
+		info->threads->update();
+		for(const auto& thread : info->threads->threads())
+			node->addThreadTime(stat.pid, thread.tid, thread.name, thread.userTime, thread.systemTime);
+	}
+}
+
+void Monitor::readProcessCounters(ProcessInfo* info)
+{
+	char path[64];
+
+	// The tracker keeps /proc/<pid>/task open, so we only pay for the
+	// path lookup once per process.
+	if(!info->threads)
+		info->threads = std::make_shared<ThreadTracker>(info->stat.pid);
+
+	// Summed over all threads, like the fault counters from the stat file
+	info->haveStatus = info->threads->readStatus(&info->status);
+
+	snprintf(path, sizeof(path), "/proc/%lu/io", info->stat.pid);
+	info->haveIO = process_info::readIOFile(path, &info->io);
+}
+
+void Monitor::updateDetailedMemory()
+{
+	std::vector<process_info::ProcessMemory> sums(m_nodes.size(), process_info::ProcessMemory{0, 0, 0});
+	std::vector<bool> valid(m_nodes.size(), false);
+	bool unsupported = false;
+
+	char path[64];
+	for(auto& pair : m_processInfos)
+	{
+		snprintf(path, sizeof(path), "/proc/%d/smaps_rollup", pair.first);
+
+		process_info::ProcessMemory mem;
+		if(!process_info::readSmapsRollupFile(path, &mem))
+		{
+			// The process may have just exited, but the file may also be
+			// missing on kernels < 4.14.
+			if(errno == ENOENT && kill(pair.first, 0) == 0)
+				unsupported = true;
+			continue;
+		}
+
+		auto& sum = sums[pair.second.node];
+		sum.pss += mem.pss;
+		sum.uss += mem.uss;
+		sum.swap += mem.swap;
+		valid[pair.second.node] = true;
+	}
+
+	for(std::size_t i = 0; i < m_nodes.size(); ++i)
+	{
+		if(valid[i])
+			m_nodes[i]->setDetailedMemory(sums[i].pss, sums[i].uss, sums[i].swap);
+		else
+			m_nodes[i]->clearDetailedMemory();
+	}
+
+	if(unsupported && std::none_of(valid.begin(), valid.end(), [](bool v){ return v; }))
+	{
+		logTyped(LogEvent::Type::Warning, "Your kernel does not provide /proc/<pid>/smaps_rollup, disabling PSS/USS sampling");
+		m_smapsPeriod = 0.0;
+	}
+}
+
+double Monitor::adaptiveStatsPeriod(const NodeMonitor& node) const
+{
+	double basePeriod = node.statsPeriod();
+
+	// How close is the node to its limits?
+	double usage = 0.0;
+	if(node.cpuLimit() > 0)
+		usage = std::max(usage, (node.userLoad() + node.systemLoad()) / node.cpuLimit());
+	if(node.memoryLimit() > 0)
+		usage = std::max(usage, static_cast<double>(node.memoryForLimit()) / node.memoryLimit());
+
+	if(usage >= ADAPTIVE_HIGH_USAGE)
+		return std::min(basePeriod, std::max(ADAPTIVE_MIN_PERIOD, basePeriod / ADAPTIVE_SPEEDUP));
+
+	// Quiet nodes are exactly what the CPU liveness probe looks for, so do
+	// not slow down below what the probes need.
+	if(usage < ADAPTIVE_LOW_USAGE)
+	{
+		double maxPeriod = std::min(ADAPTIVE_MAX_PERIOD, node.launchNode()->liveness().maxStatsPeriod());
+		return std::max(basePeriod, std::min(maxPeriod, basePeriod * ADAPTIVE_SLOWDOWN));
+	}
+
+	return basePeriod;
+}
+
+void Monitor::updateStatTimerPeriod()
+{
+	if(m_statsSchedule.empty())
+		return;
+
+	double period = std::min_element(m_statsSchedule.begin(), m_statsSchedule.end(),
+		[](const NodeStatsSchedule& a, const NodeStatsSchedule& b) { return a.period < b.period; }
+	)->period;
+
+	if(period != m_statTimerPeriod)
+	{
+		m_statTimerPeriod = period;
+		m_statTimer.setPeriod(ros::WallDuration(period));
+	}
+}
+void Monitor::updateParameters(const launch::LaunchConfig& config, ReloadResult* result, std::vector<std::string>* changed)
+{
+	ScopedTimer timer(&SelfStats::instance().histogram("monitor/param_upload"));
+	trace::Span span("supervisor", "updateParameters");
+
+	const auto& oldParameters = m_config->parameters();
+	const auto& newParameters = config.parameters();
+
+	for(const auto& param : newParameters)
+	{
+		auto it = oldParameters.find(param.first);
+		if(it != oldParameters.end() && it->second == param.second)
+			continue;
+
+		m_nh.setParam(param.first, param.second);
+		changed->push_back(param.first);
+		result->parametersSet++;
+	}
+
+	for(const auto& param : oldParameters)
+	{
+		if(newParameters.count(param.first))
+			continue;
+
+		ros::param::del(param.first);
+		changed->push_back(param.first);
+		result->parametersDeleted++;
+	}
+}
+
+Monitor::ReloadResult Monitor::reload(const launch::LaunchConfig::ConstPtr& config)
+{
+	ReloadResult result;
+
+	// Parameters first, so that restarted nodes see the new values.
+	std::vector<std::string> changedParameters;
+	updateParameters(*config, &result, &changedParameters);
+
+	auto fullName = [](const launch::Node& node) {
+		return node.namespaceString() + "/" + node.name();
+	};
+
+	std::map<std::string, std::size_t> oldIndex;
+	for(std::size_t i = 0; i < m_nodes.size(); ++i)
+		oldIndex[fullName(*m_nodes[i]->launchNode())] = i;
+
+	constexpr std::size_t REMOVED = std::numeric_limits<std::size_t>::max();
+	std::vector<std::size_t> newIndex(m_nodes.size(), REMOVED);
+
+	std::vector<NodeMonitor::Ptr> nodes;
+	std::vector<NodeStatsSchedule> schedule;
+	std::vector<NodeMonitor::Ptr> added;
+	auto now = Clock::now();
+
+	for(const auto& launchNode : config->nodes())
+	{
+		std::string name = fullName(*launchNode);
+
+		auto it = oldIndex.find(name);
+		if(it == oldIndex.end())
+		{
+			auto node = createNode(launchNode);
+			node->setTopThreadCount(m_threadStatsCount);
+			node->setMemoryLimitMetric(m_memoryLimitMetric);
+
+			nodes.push_back(node);
+			schedule.push_back({now, now, node->statsPeriod()});
+			added.push_back(node);
+			result.started.push_back(name);
+			continue;
+		}
+
+		auto& node = m_nodes[it->second];
+		newIndex[it->second] = nodes.size();
+		nodes.push_back(node);
+		schedule.push_back(m_statsSchedule[it->second]);
+
+		const auto& oldLaunchNode = *node->launchNode();
+
+		// Nodes usually read their private parameters only on startup
+		std::string privateNamespace = name + "/";
+		bool paramsChanged = std::any_of(changedParameters.begin(), changedParameters.end(), [&](const std::string& param) {
+			return param.compare(0, privateNamespace.size(), privateNamespace) == 0;
+		});
+
+		bool processChanged = paramsChanged || !oldLaunchNode.sameProcess(*launchNode);
+		if(!processChanged && oldLaunchNode.sameSupervision(*launchNode))
+			continue;
+
+		node->reconfigure(launchNode);
+
+		if(processChanged && node->running())
+		{
+			logTyped(LogEvent::Type::Info, "Reload: restarting changed node {}", name);
+			node->restart();
+			result.restarted.push_back(name);
+		}
+		else
+			result.updated.push_back(name);
+	}
+
+	for(std::size_t i = 0; i < m_nodes.size(); ++i)
+	{
+		if(newIndex[i] != REMOVED)
+			continue;
+
+		auto& node = m_nodes[i];
+		logTyped(LogEvent::Type::Info, "Reload: stopping removed node {}", fullName(*node->launchNode()));
+		node->stop();
+		if(node->running())
+			m_retiredNodes.push_back(node);
+
+		result.stopped.push_back(fullName(*node->launchNode()));
+	}
+
+	// ProcessInfo refers to nodes by index
+	for(auto it = m_processInfos.begin(); it != m_processInfos.end();)
+	{
+		std::size_t idx = newIndex[it->second.node];
+		if(idx == REMOVED)
+		{
+			it = m_processInfos.erase(it);
+			continue;
+		}
+
+		it->second.node = idx;
+		++it;
+	}
+
+	m_nodes.swap(nodes);
+	m_statsSchedule.swap(schedule);
+	m_config = config;
+	updateStatTimerPeriod();
+
+	for(auto& node : added)
+	{
+		nodeAddedSignal(node);
+		logTyped(LogEvent::Type::Info, "Reload: starting new node {}", fullName(*node->launchNode()));
+		node->start();
+	}
+
+	nodesChangedSignal();
+
+	logTyped(LogEvent::Type::Info,
+		"Reload finished: {} started, {} stopped, {} restarted, {} updated, {} parameters set, {} deleted",
+		result.started.size(), result.stopped.size(), result.restarted.size(), result.updated.size(),
+		result.parametersSet, result.parametersDeleted
+	);
+
+	return result;
+}
+
 }
 }
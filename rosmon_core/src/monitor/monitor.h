@@ -10,11 +10,15 @@
 
 #include "node_monitor.h"
 #include "linux_process_info.h"
+#include "thread_tracker.h"
 
 #include <boost/signals2.hpp>
 
 #include <ros/node_handle.h>
 
+#include <chrono>
+#include <memory>
+
 namespace rosmon
 {
 
@@ -29,15 +33,98 @@ public:
 
 	void setParameters();
 	void start();
+
+	/**
+	 * @brief Start shutdown sequence
+	 *
+	 * Nodes are shut down in groups (see launch::Node::shutdownGroup()) in
+	 * ascending order. All nodes in a group are stopped in parallel,
+	 * including their shutdown handlers. The next group starts when all
+	 * nodes of the current one have exited. If a group takes longer than
+	 * its handler and stop timeouts, its remaining nodes are killed.
+	 *
+	 * Call updateShutdown() periodically to advance the sequence.
+	 **/
 	void shutdown();
+
+	/**
+	 * @brief Advance the shutdown sequence
+	 *
+	 * @return true if all groups are finished
+	 **/
+	bool updateShutdown();
+
+	//! Time the last shutdown sequence took in seconds
+	inline double shutdownDuration() const
+	{ return m_shutdownDuration; }
+
 	void forceExit();
 	bool allShutdown();
 
-	double shutdownTimeout();
-
 	inline bool ok() const
 	{ return m_ok; }
 
+	/**
+	 * @brief Adapt stats sampling rate to node load
+	 *
+	 * If enabled, nodes close to their CPU or memory limit are sampled up to
+	 * 10 times faster than their configured stats period, and quiet nodes
+	 * are sampled up to 5 times slower (but not slower than every 5s).
+	 **/
+	void setAdaptiveStats(bool on);
+
+	/**
+	 * @brief Enable per-thread CPU statistics
+	 *
+	 * Keeps the count threads with the highest CPU load per node, see
+	 * NodeMonitor::topThreads(). Zero disables per-thread statistics.
+	 **/
+	void setThreadStats(unsigned int count);
+
+	//! Resources used by the stats sampler itself
+	struct StatsOverhead
+	{
+		uint64_t updates = 0;      //!< Number of timer callbacks
+		uint64_t processScans = 0; //!< Number of full scans of /proc
+		double cpuTime = 0.0;      //!< CPU time spent in seconds
+		double wallTime = 0.0;     //!< Wall time spent in seconds
+		double maxWallTime = 0.0;  //!< Longest single update in seconds
+	};
+
+	/**
+	 * @brief Enable PSS/USS/swap sampling
+	 *
+	 * Reads /proc/<pid>/smaps_rollup of all node processes every period
+	 * seconds. This is more expensive than the normal stats sampling, so
+	 * it should run at a lower rate. A period of zero disables it.
+	 **/
+	void setSmapsPeriod(double period);
+
+	//! Select memory measure for memory limit checks of all nodes
+	void setMemoryLimitMetric(NodeMonitor::MemoryMetric metric);
+
+	/**
+	 * @brief Limit disk usage of collected core dumps
+	 *
+	 * If the cores collected in this session exceed the quota, the oldest
+	 * ones are deleted. Zero (the default) means unlimited. Per-node limits
+	 * are set with launch::Node::coreQuota().
+	 **/
+	void setCoreQuota(uint64_t bytes);
+
+	/**
+	 * @brief Read node output on separate threads
+	 *
+	 * With a thread count > 0, the PTYs of all nodes are drained by an
+	 * OutputShards pool instead of the main loop. Takes effect on the next
+	 * start of each node, so call this before start(). Zero (the default)
+	 * reads output on the main loop.
+	 **/
+	void setOutputThreads(unsigned int threads);
+
+	inline const StatsOverhead& statsOverhead() const
+	{ return m_statsOverhead; }
+
 	const std::vector<NodeMonitor::Ptr>& nodes() const
 	{ return m_nodes; }
 	std::vector<NodeMonitor::Ptr>& nodes()
@@ -46,35 +133,102 @@ public:
 	launch::LaunchConfig::ConstPtr config() const
 	{ return m_config; }
 
+	//! Outcome of reload()
+	struct ReloadResult
+	{
+		std::vector<std::string> started;   //!< Nodes added to the launch file
+		std::vector<std::string> stopped;   //!< Nodes removed from the launch file
+		std::vector<std::string> restarted; //!< Nodes restarted because of changes
+		std::vector<std::string> updated;   //!< Nodes reconfigured without restart
+		unsigned int parametersSet = 0;
+		unsigned int parametersDeleted = 0;
+	};
+
+	/**
+	 * @brief Switch to a new launch configuration
+	 *
+	 * Diffs the new config against the running one. Only changed parameters
+	 * are uploaded. Nodes whose process configuration or private parameters
+	 * changed are restarted, added nodes are started and removed nodes are
+	 * stopped. Everything else keeps running.
+	 *
+	 * Since this changes nodes(), nodeAddedSignal and nodesChangedSignal are
+	 * emitted so that users of the node list can update.
+	 **/
+	ReloadResult reload(const launch::LaunchConfig::ConstPtr& config);
+
 	boost::signals2::signal<void(LogEvent)> logMessageSignal;
+
+	//! Emitted by reload() for each added node
+	boost::signals2::signal<void(const NodeMonitor::Ptr&)> nodeAddedSignal;
+
+	//! Emitted by reload() after nodes() changed
+	boost::signals2::signal<void()> nodesChangedSignal;
 private:
+	using Clock = std::chrono::steady_clock;
+
 	struct ProcessInfo
 	{
 		process_info::ProcessStat stat;
+		process_info::ProcessStatus status;
+		process_info::ProcessIO io;
+		bool haveStatus = false;
+		bool haveIO = false;     //!< /proc/<pid>/io may not be readable
+		std::shared_ptr<ThreadTracker> threads; //!< Cached /proc/<pid>/task listing
+		std::size_t node; //!< Index into m_nodes
 		bool active;
 	};
 
+	struct NodeStatsSchedule
+	{
+		Clock::time_point lastUpdate;
+		Clock::time_point nextUpdate;
+		double period;
+	};
+
 	template<typename... Args>
 	void log(const char* fmt, Args&& ... args);
 
 	template<typename... Args>
 	void logTyped(LogEvent::Type type, const std::string& fmt, Args&& ... args);
 
+	NodeMonitor::Ptr createNode(const launch::Node::ConstPtr& launchNode);
+	void handleNodeExit(const NodeMonitor& node);
+	void startShutdownGroup();
 	void handleRequiredNodeExit(const std::string& name);
+	void updateParameters(const launch::LaunchConfig& config, ReloadResult* result, std::vector<std::string>* changed);
 
 #if HAVE_STEADYTIMER
 	void updateStats(const ros::SteadyTimerEvent& event);
 #else
 	void updateStats(const ros::WallTimerEvent& event);
 #endif
+	void scanProcesses(const std::vector<bool>& due);
+	void accountProcess(ProcessInfo* info, const process_info::ProcessStat& stat);
+	double adaptiveStatsPeriod(const NodeMonitor& node) const;
+	void updateStatTimerPeriod();
+	void updateDetailedMemory();
+	static void readProcessCounters(ProcessInfo* info);
 
 	launch::LaunchConfig::ConstPtr m_config;
 
 	ros::NodeHandle m_nh;
 	FDWatcher::Ptr m_fdWatcher;
 
+	CoreDumpCollector::Ptr m_coreDumpCollector;
+	OutputShards::Ptr m_outputShards;
+
 	std::vector<NodeMonitor::Ptr> m_nodes;
 
+	//! Nodes removed by reload() that are still shutting down
+	std::vector<NodeMonitor::Ptr> m_retiredNodes;
+
+	std::string m_logDir;
+	bool m_flushLog;
+	bool m_disableLog;
+	std::string m_launchGroup;
+	std::string m_launchConfig;
+
 	bool m_ok;
 
 #if HAVE_STEADYTIMER
@@ -84,6 +238,26 @@ private:
 #endif
 
 	std::map<int, ProcessInfo> m_processInfos;
+
+	std::vector<NodeStatsSchedule> m_statsSchedule;
+	Clock::time_point m_nextProcessScan;
+	double m_statTimerPeriod = 0.0;
+	bool m_adaptiveStats = false;
+	unsigned int m_threadStatsCount = 0;
+	NodeMonitor::MemoryMetric m_memoryLimitMetric = NodeMonitor::MEMORY_RSS;
+
+	double m_smapsPeriod = 0.0;
+	Clock::time_point m_nextSmapsUpdate;
+
+	StatsOverhead m_statsOverhead;
+
+	//! Node groups in shutdown order
+	std::vector<std::pair<int, std::vector<NodeMonitor::Ptr>>> m_shutdownGroups;
+	std::size_t m_currentShutdownGroup = 0;
+	Clock::time_point m_shutdownStart;
+	Clock::time_point m_groupShutdownStart;
+	Clock::time_point m_groupShutdownDeadline;
+	double m_shutdownDuration = 0.0;
 };
 
 }
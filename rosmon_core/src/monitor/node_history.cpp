@@ -0,0 +1,84 @@
+// Time series of resource usage for a single node
+// Author: Max Schwarz <max.schwarz@uni-bonn.de>
+
+#include "node_history.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace rosmon
+{
+
+namespace monitor
+{
+
+namespace
+{
+	void mergeStatistic(NodeHistory::Statistic* stat, unsigned int count, const NodeHistory::Statistic& other, unsigned int otherCount)
+	{
+		stat->min = std::min(stat->min, other.min);
+		stat->max = std::max(stat->max, other.max);
+		stat->mean = (count * stat->mean + otherCount * other.mean) / (count + otherCount);
+	}
+}
+
+void NodeHistory::Sample::merge(const Sample& other)
+{
+	if(count == 0)
+	{
+		*this = other;
+		return;
+	}
+
+	mergeStatistic(&userLoad, count, other.userLoad, other.count);
+	mergeStatistic(&systemLoad, count, other.systemLoad, other.count);
+	mergeStatistic(&memory, count, other.memory, other.count);
+	mergeStatistic(&threads, count, other.threads, other.count);
+
+	count += other.count;
+	duration += other.duration;
+	restartCount = other.restartCount;
+}
+
+NodeHistory::NodeHistory(double period)
+{
+	// 10 minutes of raw samples, 1 hour at 10s and 24 hours at 1min.
+	// The raw tier is sized in setPeriod().
+	m_tiers.emplace_back(0.0, 0);
+	m_tiers.emplace_back(10.0, 360);
+	m_tiers.emplace_back(60.0, 1440);
+
+	setPeriod(period);
+}
+
+void NodeHistory::setPeriod(double period)
+{
+	m_period = period;
+
+	// Adaptive sampling may deviate from the configured period, so the
+	// covered time is only approximately RAW_SPAN.
+	auto capacity = static_cast<std::size_t>(std::ceil(RAW_SPAN / period));
+	m_tiers[0].samples.rset_capacity(std::max<std::size_t>(capacity, 1));
+}
+
+void NodeHistory::addSample(const Sample& sample)
+{
+	m_tiers[0].samples.push_back(sample);
+
+	for(std::size_t i = 1; i < m_tiers.size(); ++i)
+	{
+		auto& tier = m_tiers[i];
+
+		// Allow for a little jitter in the sample durations
+		tier.pending.merge(sample);
+		if(tier.pending.duration >= 0.99 * tier.interval)
+		{
+			tier.samples.push_back(tier.pending);
+			tier.pending = {};
+		}
+	}
+}
+
+}
+
+}
@@ -0,0 +1,114 @@
+// Time series of resource usage for a single node
+// Author: Max Schwarz <max.schwarz@uni-bonn.de>
+
+#ifndef ROSMON_MONITOR_NODE_HISTORY_H
+#define ROSMON_MONITOR_NODE_HISTORY_H
+
+#include <ros/time.h>
+
+#include <boost/circular_buffer.hpp>
+
+#include <vector>
+
+namespace rosmon
+{
+
+namespace monitor
+{
+
+/**
+ * @brief Time series of resource usage for a single node
+ *
+ * Raw samples are kept in a ring buffer at the stats sampling rate, sized
+ * to cover RAW_SPAN seconds at the configured stats period. Additional
+ * tiers aggregate raw samples into fixed time intervals (keeping minimum,
+ * mean and maximum), so that longer time windows can be covered with
+ * bounded memory.
+ **/
+class NodeHistory
+{
+public:
+	//! Minimum, mean and maximum of a quantity over a sample interval
+	struct Statistic
+	{
+		Statistic()
+		{}
+
+		explicit Statistic(double value)
+		 : min{value}, mean{value}, max{value}
+		{}
+
+		double min = 0.0;
+		double mean = 0.0;
+		double max = 0.0;
+	};
+
+	struct Sample
+	{
+		ros::WallTime stamp;       //!< Start of the covered interval
+		double duration = 0.0;     //!< Length of the covered interval in seconds
+		unsigned int count = 0;    //!< Number of raw samples aggregated
+
+		Statistic userLoad;
+		Statistic systemLoad;
+		Statistic memory;          //!< Resident memory in bytes
+		Statistic threads;
+
+		unsigned int restartCount = 0; //!< Restart count at the end of the interval
+
+		//! Extend this sample by a later one
+		void merge(const Sample& other);
+	};
+
+	//! Time covered by raw samples in seconds
+	constexpr static double RAW_SPAN = 600.0;
+
+	/**
+	 * @brief Constructor
+	 *
+	 * @param period Stats sampling period in seconds
+	 **/
+	explicit NodeHistory(double period = 1.0);
+
+	/**
+	 * @brief Resize the raw tier for a new stats sampling period
+	 *
+	 * Keeps the newest raw samples.
+	 **/
+	void setPeriod(double period);
+
+	//! Add a raw sample
+	void addSample(const Sample& sample);
+
+	//! Number of tiers (including the raw tier 0)
+	inline std::size_t numTiers() const
+	{ return m_tiers.size(); }
+
+	//! Time covered by one sample of tier in seconds (stats period for tier 0)
+	inline double tierInterval(std::size_t tier) const
+	{ return tier == 0 ? m_period : m_tiers[tier].interval; }
+
+	//! Samples of tier, oldest first
+	inline const boost::circular_buffer<Sample>& samples(std::size_t tier) const
+	{ return m_tiers[tier].samples; }
+private:
+	struct Tier
+	{
+		Tier(double interval, std::size_t capacity)
+		 : interval{interval}, samples{capacity}
+		{}
+
+		double interval;
+		boost::circular_buffer<Sample> samples;
+		Sample pending;
+	};
+
+	double m_period;
+	std::vector<Tier> m_tiers;
+};
+
+}
+
+}
+
+#endif
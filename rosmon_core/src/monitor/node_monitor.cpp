@@ -3,22 +3,26 @@
 
 #include "node_monitor.h"
 
+#include <algorithm>
 #include <cerrno>
+#include <cmath>
 #include <csignal>
 #include <cstdarg>
 #include <cstdio>
 #include <cstring>
+#include <limits>
 #include <sstream>
 
 #include <fcntl.h>
-#include <glob.h>
 #include <pty.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/resource.h>
-#include <sys/utsname.h>
 #include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/un.h>
 #include <unistd.h>
 #include <wordexp.h>
 
@@ -26,9 +30,9 @@
 #include <boost/range.hpp>
 #include <boost/algorithm/string.hpp>
 
+#include "linux_process_info.h"
 #include "../fmt_no_throw.h"
-
-#define TASK_COMM_LEN 16 // from linux/sched.h
+#include "../trace.h"
 
 namespace
 {
@@ -79,6 +83,32 @@ namespace
 
 	static bool g_coreIsRelative = true;
 	static bool g_coreIsRelative_valid = false;
+
+	/**
+	 * Enlarge the kernel buffer of a pipe, so that nodes can keep writing
+	 * while we are busy. Unprivileged processes are limited by
+	 * /proc/sys/fs/pipe-max-size (1 MiB by default). Failure is harmless,
+	 * the pipe keeps its default size of 64 KiB.
+	 **/
+	void enlargePipe(int fd)
+	{
+		static int maxSize = -1;
+		if(maxSize < 0)
+		{
+			maxSize = 1024 * 1024;
+
+			FILE* f = fopen("/proc/sys/fs/pipe-max-size", "re");
+			if(f)
+			{
+				int value;
+				if(fscanf(f, "%d", &value) == 1 && value > 0)
+					maxSize = std::min(maxSize, value);
+				fclose(f);
+			}
+		}
+
+		fcntl(fd, F_SETPIPE_SZ, maxSize);
+	}
 }
 
 namespace rosmon
@@ -90,14 +120,18 @@ NodeMonitor::NodeMonitor(launch::Node::ConstPtr launchNode, FDWatcher::Ptr fdWat
  : m_launchNode(std::move(launchNode))
  , m_fdWatcher(std::move(fdWatcher))
  , m_rxBuffer(4096)
+ , m_stderrRxBuffer(4096)
  , m_exitCode(0)
  , m_command(CMD_STOP) // we start in stopped state
  , m_restarting(false)
+ , m_nh(nh)
 {
-	m_restartTimer = nh.createWallTimer(ros::WallDuration(1.0), boost::bind(&NodeMonitor::start, this), false, false);
+	m_restartTimer = nh.createWallTimer(ros::WallDuration(1.0), boost::bind(&NodeMonitor::launchProcess, this), false, false);
 	m_stopCheckTimer = nh.createWallTimer(ros::WallDuration(m_launchNode->stopTimeout()), boost::bind(&NodeMonitor::checkStop, this));
 
-	m_processWorkingDirectory = m_launchNode->workingDirectory();
+	configure();
+
+	m_traceTrack = trace::createTrack("node " + name());
 
 	if(!g_coreIsRelative_valid)
 	{
@@ -132,6 +166,75 @@ NodeMonitor::~NodeMonitor()
 	{
 		kill(m_pid, SIGKILL);
 	}
+
+	closeHeartbeatSocket();
+
+	if(m_traceExecFD != -1)
+	{
+		m_fdWatcher->removeFD(m_traceExecFD);
+		close(m_traceExecFD);
+	}
+
+	if(m_coreDumpCollector)
+		m_coreDumpCollector->forget(this);
+
+	if(m_outputToken)
+		m_outputShards->remove(m_outputToken);
+	if(m_stderrToken)
+		m_outputShards->remove(m_stderrToken);
+}
+
+void NodeMonitor::configure()
+{
+	m_stopCheckTimer.setPeriod(ros::WallDuration(m_launchNode->stopTimeout()));
+	m_history.setPeriod(m_launchNode->statsPeriod());
+
+	m_processWorkingDirectory = m_launchNode->workingDirectory();
+
+	const auto& liveness = m_launchNode->liveness();
+	if(liveness.enabled())
+	{
+		// Check a few times per timeout, but not too often
+		double timeout = std::numeric_limits<double>::infinity();
+		for(double t : {liveness.cpuTimeout, liveness.dStateTimeout, liveness.outputTimeout, liveness.heartbeatTimeout})
+		{
+			if(t > 0)
+				timeout = std::min(timeout, t);
+		}
+
+		double period = std::max(0.1, std::min(1.0, timeout / 4.0));
+		m_livenessTimer = m_nh.createWallTimer(ros::WallDuration(period), boost::bind(&NodeMonitor::checkLiveness, this), false, false);
+
+		// Kept open by reconfigure() if the heartbeat did not change
+		if(boost::starts_with(liveness.heartbeat, "unix:") && m_heartbeatFD == -1)
+			openHeartbeatSocket();
+	}
+}
+
+void NodeMonitor::reconfigure(launch::Node::ConstPtr launchNode)
+{
+	if(m_livenessTimer.isValid())
+		m_livenessTimer.stop();
+	m_livenessTimer = ros::WallTimer();
+
+	// Rebinding the socket would lose heartbeats, so only do it if needed
+	const auto& liveness = launchNode->liveness();
+	if(!liveness.enabled() || liveness.heartbeat != m_launchNode->liveness().heartbeat)
+		closeHeartbeatSocket();
+
+	m_launchNode = std::move(launchNode);
+	configure();
+
+	// Probes apply to the running process, starting with a new grace period.
+	// m_startTime stays the process start time (backoff, uptime).
+	if(running() && m_livenessTimer.isValid())
+	{
+		m_livenessGraceStart = ros::WallTime::now();
+		m_lastCPUProgress = m_livenessGraceStart;
+		m_lastOutput = m_livenessGraceStart;
+		m_lastHeartbeat = m_livenessGraceStart;
+		m_livenessTimer.start();
+	}
 }
 
 std::vector<std::string> NodeMonitor::composeCommand() const
@@ -166,6 +269,21 @@ std::vector<std::string> NodeMonitor::composeCommand() const
 }
 
 void NodeMonitor::start()
+{
+	resetRespawnBackoff();
+	launchProcess();
+}
+
+void NodeMonitor::resetRespawnBackoff()
+{
+	m_failed = false;
+	m_backoff = false;
+	m_backoffLevel = 0;
+	m_exitTimes.clear();
+	m_livenessRestart = false;
+}
+
+void NodeMonitor::launchProcess()
 {
 	m_command = CMD_RUN;
 
@@ -176,6 +294,14 @@ void NodeMonitor::start()
 	if(running())
 		return;
 
+	// Any core of the previous process is stale now, see gatherCoredump()
+	m_debuggerCommand.clear();
+	m_corePid = -1;
+
+	uint64_t traceStart = trace::now();
+	if(m_traceTrack && !m_firstStart)
+		trace::instant("node", "restart", {}, m_traceTrack);
+
 	if(m_launchNode->coredumpsEnabled() && g_coreIsRelative)
 	{
 		char tmpfile[256];
@@ -208,23 +334,81 @@ void NodeMonitor::start()
 			free(arg);
 	});
 
+	bool pipeOutput = (m_launchNode->outputMode() != launch::Node::OUTPUT_PTY);
+	bool rawOutput = (m_launchNode->outputMode() == launch::Node::OUTPUT_RAW);
+
 	// Open pseudo-terminal
 	// NOTE: We are not using forkpty() here, as it is probably not safe in
 	//  a multi-threaded process (see
 	//  https://www.linuxprogrammingblog.com/threads-and-fork-think-twice-before-using-them)
-	int master, slave;
+	int master = -1, slave = -1;
+
+	// ... or pipes, which avoid the line discipline and buffer much more.
+	int stdoutPipe[2] = {-1, -1};
+	int stderrPipe[2] = {-1, -1};
 
-	if(openpty(&master, &slave, nullptr, nullptr, nullptr) == -1)
+	if(pipeOutput)
+	{
+		if(pipe2(stdoutPipe, O_CLOEXEC) != 0)
+			throw error("Could not create output pipe for child process: {}", strerror(errno));
+
+		// Raw output is a single stream, it mostly goes to the log file
+		if(!rawOutput && pipe2(stderrPipe, O_CLOEXEC) != 0)
+		{
+			int err = errno;
+			close(stdoutPipe[0]);
+			close(stdoutPipe[1]);
+			throw error("Could not create output pipe for child process: {}", strerror(err));
+		}
+
+		enlargePipe(stdoutPipe[0]);
+		if(stderrPipe[0] != -1)
+			enlargePipe(stderrPipe[0]);
+	}
+	else if(openpty(&master, &slave, nullptr, nullptr, nullptr) == -1)
 		throw error("Could not open pseudo terminal for child process: {}", strerror(errno));
 
+	// While tracing, a pipe tells us when the node is exec()d. _shim marks
+	// the write end close-on-exec right before it starts the node, so shim
+	// setup does not count as node runtime.
+	int execPipe[2] = {-1, -1};
+	if(m_traceTrack)
+	{
+		if(m_traceExecFD != -1)
+		{
+			m_fdWatcher->removeFD(m_traceExecFD);
+			close(m_traceExecFD);
+			m_traceExecFD = -1;
+		}
+
+		if(pipe2(execPipe, O_CLOEXEC) != 0)
+			execPipe[0] = execPipe[1] = -1;
+	}
+
 	// Compose args
 	{
 		args.push_back(strdup("rosrun"));
 		args.push_back(strdup("rosmon_core"));
 		args.push_back(strdup("_shim"));
 
-		args.push_back(strdup("--tty"));
-		args.push_back(strdup(fmt::format("{}", slave).c_str()));
+		if(pipeOutput)
+		{
+			args.push_back(strdup("--stdout"));
+			args.push_back(strdup(fmt::format("{}", stdoutPipe[1]).c_str()));
+			args.push_back(strdup("--stderr"));
+			args.push_back(strdup(fmt::format("{}", rawOutput ? stdoutPipe[1] : stderrPipe[1]).c_str()));
+		}
+		else
+		{
+			args.push_back(strdup("--tty"));
+			args.push_back(strdup(fmt::format("{}", slave).c_str()));
+		}
+
+		if(execPipe[1] != -1)
+		{
+			args.push_back(strdup("--exec-fd"));
+			args.push_back(strdup(fmt::format("{}", execPipe[1]).c_str()));
+		}
 
 		if(!m_launchNode->namespaceString().empty())
 		{
@@ -250,6 +434,67 @@ void NodeMonitor::start()
 			}
 		}
 
+		if(!m_launchNode->cpuAffinity().empty())
+		{
+			std::stringstream ss;
+			for(unsigned int cpu : m_launchNode->cpuAffinity())
+				ss << cpu << ",";
+
+			args.push_back(strdup("--cpu-affinity"));
+			args.push_back(strdup(ss.str().c_str()));
+		}
+
+		if(m_launchNode->hasNice())
+		{
+			args.push_back(strdup("--nice"));
+			args.push_back(strdup(fmt::format("{}", m_launchNode->nice()).c_str()));
+		}
+
+		if(m_launchNode->schedPolicy() >= 0)
+		{
+			args.push_back(strdup("--sched-policy"));
+			args.push_back(strdup(fmt::format("{}", m_launchNode->schedPolicy()).c_str()));
+			args.push_back(strdup("--sched-priority"));
+			args.push_back(strdup(fmt::format("{}", m_launchNode->schedPriority()).c_str()));
+		}
+
+		if(m_launchNode->mlockAll())
+		{
+			args.push_back(strdup("--mlockall"));
+			args.push_back(strdup(m_launchNode->executable().c_str()));
+		}
+
+		if(m_launchNode->hasMemlockLimit())
+		{
+			args.push_back(strdup("--memlock-limit"));
+			if(m_launchNode->memlockLimit() == launch::Node::MEMLOCK_UNLIMITED)
+				args.push_back(strdup("unlimited"));
+			else
+				args.push_back(strdup(fmt::format("{}", m_launchNode->memlockLimit()).c_str()));
+		}
+
+		if(m_launchNode->numaPolicy() >= 0)
+		{
+			std::stringstream ss;
+			for(unsigned int numaNode : m_launchNode->numaNodes())
+				ss << numaNode << ",";
+
+			args.push_back(strdup("--numa-policy"));
+			args.push_back(strdup(fmt::format("{}", m_launchNode->numaPolicy()).c_str()));
+			args.push_back(strdup("--numa-nodes"));
+			args.push_back(strdup(ss.str().c_str()));
+		}
+
+		if(!m_launchNode->liveness().heartbeat.empty())
+		{
+			std::string heartbeat = m_launchNode->liveness().heartbeat;
+			if(boost::starts_with(heartbeat, "unix:"))
+				heartbeat = heartbeat.substr(5);
+
+			args.push_back(strdup("--env"));
+			args.push_back(strdup(fmt::format("ROSMON_HEARTBEAT={}", heartbeat).c_str()));
+		}
+
 		args.push_back(strdup("--run"));
 
 		for(auto& c : cmd)
@@ -265,7 +510,24 @@ void NodeMonitor::start()
 
 	if(pid == 0)
 	{
-		close(master);
+		if(pipeOutput)
+		{
+			close(stdoutPipe[0]);
+
+			// The write ends need to survive exec()
+			fcntl(stdoutPipe[1], F_SETFD, 0);
+
+			if(stderrPipe[0] != -1)
+			{
+				close(stderrPipe[0]);
+				fcntl(stderrPipe[1], F_SETFD, 0);
+			}
+		}
+		else
+			close(master);
+
+		if(execPipe[1] != -1)
+			fcntl(execPipe[1], F_SETFD, 0);
 
 		if(execvp("rosrun", args.data()) != 0)
 		{
@@ -281,11 +543,65 @@ void NodeMonitor::start()
 	}
 
 	// Parent
-	close(slave);
+	if(pipeOutput)
+	{
+		close(stdoutPipe[1]);
+		if(stderrPipe[1] != -1)
+			close(stderrPipe[1]);
+	}
+	else
+		close(slave);
+
+	if(m_traceTrack)
+	{
+		trace::complete("node", "fork", traceStart, trace::now() - traceStart, fmt::format("\"pid\":{}", pid), m_traceTrack);
+		m_traceStart = trace::now();
+		m_traceFirstOutput = true;
 
-	m_fd = master;
+		if(execPipe[0] != -1)
+		{
+			close(execPipe[1]);
+			m_traceExecFD = execPipe[0];
+			m_fdWatcher->registerFD(m_traceExecFD, boost::bind(&NodeMonitor::handleTraceExec, this, _1), "trace_exec/" + name());
+		}
+	}
+
+	m_pipeOutput = pipeOutput && !rawOutput;
+	m_rawSplice = true;
+	if(logger)
+		logger->setRaw(rawOutput);
+
+	m_fd = pipeOutput ? stdoutPipe[0] : master;
+	m_stderrFD = stderrPipe[0];
 	m_pid = pid;
-	m_fdWatcher->registerFD(m_fd, boost::bind(&NodeMonitor::communicate, this));
+	m_startTime = ros::WallTime::now();
+	m_livenessGraceStart = m_startTime;
+	m_lastCPUProgress = m_startTime;
+	m_lastOutput = m_startTime;
+	m_lastHeartbeat = m_startTime;
+	m_inDState = false;
+	if(m_livenessTimer.isValid())
+		m_livenessTimer.start();
+
+	if(rawOutput)
+	{
+		// Splicing is cheap, so this stays on the main loop
+		m_fdWatcher->registerFD(m_fd, boost::bind(&NodeMonitor::communicateRaw, this), "output/" + name());
+	}
+	else if(m_outputShards)
+	{
+		m_outputToken = m_outputShards->add(m_fd, name(), shardHandler(m_fd));
+		if(m_stderrFD != -1)
+			m_stderrToken = m_outputShards->add(m_stderrFD, name() + " (stderr)", shardHandler(m_stderrFD));
+	}
+	else
+	{
+		m_fdWatcher->registerFD(m_fd, boost::bind(&NodeMonitor::communicate, this, _1), "output/" + name());
+		if(m_stderrFD != -1)
+			m_fdWatcher->registerFD(m_stderrFD, boost::bind(&NodeMonitor::communicate, this, _1), "stderr/" + name());
+	}
+
+	stateChangedSignal(name());
 }
 
 void NodeMonitor::stop(bool restart)
@@ -293,10 +609,15 @@ void NodeMonitor::stop(bool restart)
 	if(restart)
 		m_command = CMD_RESTART;
 	else
+	{
 		m_command = CMD_STOP;
+		m_livenessRestart = false;
+	}
 
 	m_stopCheckTimer.stop();
 	m_restartTimer.stop();
+	m_restarting = false;
+	m_failed = false;
 
 	if(!running())
 		return;
@@ -325,6 +646,8 @@ void NodeMonitor::restart()
 	m_stopCheckTimer.stop();
 	m_restartTimer.stop();
 
+	resetRespawnBackoff();
+
 	if(running())
 		stop(true);
 	else
@@ -333,20 +656,96 @@ void NodeMonitor::restart()
 
 void NodeMonitor::shutdown()
 {
-	if(m_pid != -1)
+	// No automatic restarts from here on
+	m_command = CMD_STOP;
+	m_restartTimer.stop();
+	m_restarting = false;
+
+	if(m_pid == -1)
+		return;
+
+	const std::string& handler = m_launchNode->shutdownHandler();
+	if(handler.empty())
 	{
-		if (!m_launchNode->shutdownHandler().empty()) 
-		{
-			logTyped(LogEvent::Type::Info, "Handler: {}", m_launchNode->shutdownHandler());
-			ROS_INFO("Handler: %s", m_launchNode->shutdownHandler().c_str());
-			int error = system(m_launchNode->shutdownHandler().c_str());
-			if (error) {
-				logTyped(LogEvent::Type::Error, "Handler returned error");
-				ROS_ERROR("Handler returned error");
-			}
-		}
 		kill(-m_pid, SIGINT);
+		return;
+	}
+
+	logTyped(LogEvent::Type::Info, "Handler: {}", handler);
+	ROS_INFO("Handler: %s", handler.c_str());
+
+	// Run the handler as a child process, so that slow handlers of
+	// multiple nodes run in parallel and do not block the main loop.
+	int pid = fork();
+	if(pid < 0)
+	{
+		logTyped(LogEvent::Type::Error, "Could not fork() for shutdown handler: {}", strerror(errno));
+		kill(-m_pid, SIGINT);
+		return;
+	}
+
+	if(pid == 0)
+	{
+		// Own process group, so that we can kill the whole handler on timeout
+		setpgid(0, 0);
+		execl("/bin/sh", "sh", "-c", handler.c_str(), static_cast<char*>(nullptr));
+		_exit(127);
+	}
+
+	setpgid(pid, pid);
+	m_handlerPid = pid;
+	m_handlerStart = ros::WallTime::now();
+}
+
+void NodeMonitor::updateShutdown()
+{
+	if(m_handlerPid == -1)
+		return;
+
+	int status;
+	int ret = waitpid(m_handlerPid, &status, WNOHANG);
+	if(ret == m_handlerPid)
+	{
+		finishShutdownHandler(status);
+		return;
+	}
+
+	if(ret < 0 && errno != EINTR)
+	{
+		logTyped(LogEvent::Type::Error, "Could not waitpid() for shutdown handler: {}", strerror(errno));
+		finishShutdownHandler(-1);
+		return;
+	}
+
+	double elapsed = (ros::WallTime::now() - m_handlerStart).toSec();
+	if(elapsed > m_launchNode->shutdownHandlerTimeout())
+	{
+		logTyped(LogEvent::Type::Warning, "Handler timed out after {:.1f}s, killing it", elapsed);
+		ROS_WARN("Handler of %s timed out", name().c_str());
+
+		kill(-m_handlerPid, SIGKILL);
+		if(waitpid(m_handlerPid, &status, 0) != m_handlerPid)
+			status = -1;
+
+		finishShutdownHandler(status);
+	}
+}
+
+void NodeMonitor::finishShutdownHandler(int status)
+{
+	double elapsed = (ros::WallTime::now() - m_handlerStart).toSec();
+	m_handlerPid = -1;
+
+	if(status != -1 && WIFEXITED(status) && WEXITSTATUS(status) == 0)
+		logTyped(LogEvent::Type::Info, "Handler finished after {:.2f}s", elapsed);
+	else
+	{
+		logTyped(LogEvent::Type::Error, "Handler returned error");
+		ROS_ERROR("Handler returned error");
 	}
+
+	if(m_pid != -1)
+		kill(-m_pid, SIGINT);
 }
 
 void NodeMonitor::forceExit()
@@ -355,6 +754,13 @@ void NodeMonitor::forceExit()
 	{
 		kill(-m_pid, SIGKILL);
 	}
+
+	if(m_handlerPid != -1)
+	{
+		kill(-m_handlerPid, SIGKILL);
+		waitpid(m_handlerPid, nullptr, 0);
+		m_handlerPid = -1;
+	}
 }
 
 bool NodeMonitor::running() const
@@ -367,8 +773,11 @@ NodeMonitor::State NodeMonitor::state() const
 	if(running())
 		return STATE_RUNNING;
 
+	if(m_failed)
+		return STATE_FAILED;
+
 	if(m_restarting)
-		return STATE_WAITING;
+		return m_backoff ? STATE_BACKOFF : STATE_WAITING;
 
 	if(m_exitCode == 0)
 		return STATE_IDLE;
@@ -376,255 +785,393 @@ NodeMonitor::State NodeMonitor::state() const
 	return STATE_CRASHED;
 }
 
-void NodeMonitor::communicate()
+void NodeMonitor::communicate(int fd)
 {
 	char buf[1024];
-	int bytes = read(m_fd, buf, sizeof(buf));
+	int bytes = read(fd, buf, sizeof(buf));
 
 	if(bytes == 0 || (bytes < 0 && errno == EIO))
 	{
-		int status;
-
-		while(true)
-		{
-			if(waitpid(m_pid, &status, 0) > 0)
-				break;
+		m_fdWatcher->removeFD(fd);
+		handleOutputClosed(fd);
+		return;
+	}
 
-			if(errno == EINTR || errno == EAGAIN)
-				continue;
+	if(bytes < 0)
+		throw error("{}: Could not read: {}", name(), strerror(errno));
 
-			throw error("{}: Could not waitpid(): {}", m_launchNode->name(), strerror(errno));
-		}
+	handleOutput(bytes);
 
-		if(WIFEXITED(status))
-		{
-			auto type = (WEXITSTATUS(status) == 0) ? LogEvent::Type::Info : LogEvent::Type::Error;
-			logTyped(type, "{} exited with status {}", name(), WEXITSTATUS(status));
-			ROS_INFO("rosmon: %s exited with status %d", name().c_str(), WEXITSTATUS(status));
-			m_exitCode = WEXITSTATUS(status);
-		}
-		else if(WIFSIGNALED(status))
-		{
-			logTyped(LogEvent::Type::Error, "{} died from signal {}", name(), WTERMSIG(status));
-			ROS_ERROR("rosmon: %s died from signal %d", name().c_str(), WTERMSIG(status));
-			m_exitCode = 255;
-		}
+	auto& rxBuffer = (fd == m_stderrFD) ? m_stderrRxBuffer : m_rxBuffer;
+	splitLines(&rxBuffer, buf, bytes, outputChannel(fd));
+}
 
-#ifdef WCOREDUMP
-		if(WCOREDUMP(status))
-		{
-			if(!m_launchNode->launchPrefix().empty())
-			{
-				logTyped(LogEvent::Type::Info, "{} used launch-prefix, not collecting core dump as it is probably useless.", name());
-			}
-			else
-			{
-				// We have a chance to find the core dump...
-				logTyped(LogEvent::Type::Info, "{} left a core dump", name());
-				gatherCoredump(WTERMSIG(status));
-			}
-		}
-#endif
+void NodeMonitor::communicateRaw()
+{
+	// A readable pipe with nothing in it has no writers left
+	int available = 0;
+	if(ioctl(m_fd, FIONREAD, &available) != 0)
+		throw error("{}: Could not query output pipe: {}", name(), strerror(errno));
 
-		m_pid = -1;
+	if(available == 0)
+	{
 		m_fdWatcher->removeFD(m_fd);
-		close(m_fd);
-		m_fd = -1;
+		handleOutputClosed(m_fd);
+		return;
+	}
 
-		if(m_command == CMD_RESTART || (m_command == CMD_RUN && m_launchNode->respawn()))
+	// Nobody is watching, move the output to the log file in the kernel
+	if(logger && !m_outputPeek && m_rawSplice)
+	{
+		ssize_t bytes = logger->spliceRaw(name(), m_fd, available);
+		if(bytes > 0)
 		{
-			if(m_command == CMD_RESTART)
-				m_restartTimer.setPeriod(ros::WallDuration(1.0));
-			else
-				m_restartTimer.setPeriod(m_launchNode->respawnDelay());
-
-			m_restartCount++;
-			m_restartTimer.start();
-			m_restarting = true;
+			handleOutput(bytes);
+			return;
 		}
 
-		exitedSignal(name());
+		if(bytes == 0 || errno == EAGAIN || errno == EINTR)
+			return;
 
-		return;
+		logTyped(LogEvent::Type::Warning, "Could not splice output into the log file ({}), copying it instead", strerror(errno));
+		m_rawSplice = false;
 	}
 
+	char buf[4096];
+	int bytes = read(m_fd, buf, sizeof(buf));
 	if(bytes < 0)
+	{
+		if(errno == EAGAIN || errno == EINTR)
+			return;
+
 		throw error("{}: Could not read: {}", name(), strerror(errno));
+	}
 
-	for(int i = 0; i < bytes; ++i)
+	handleOutput(bytes);
+
+	if(logger)
+		logger->writeRaw(name(), buf, bytes);
+
+	splitLines(&m_rxBuffer, buf, bytes, LogEvent::Channel::NotApplicable);
+}
+
+void NodeMonitor::splitLines(boost::circular_buffer<char>* rxBuffer, const char* data, std::size_t size, LogEvent::Channel channel)
+{
+	auto stamp = std::chrono::system_clock::now();
+
+	for(std::size_t i = 0; i < size; ++i)
 	{
-		m_rxBuffer.push_back(buf[i]);
-		if(buf[i] == '\n')
+		rxBuffer->push_back(data[i]);
+		if(data[i] == '\n')
 		{
-			m_rxBuffer.push_back(0);
-			m_rxBuffer.linearize();
+			rxBuffer->push_back(0);
+			rxBuffer->linearize();
 
-			auto one = m_rxBuffer.array_one();
-			logMessageSignal({name(), one.first});
+			auto one = rxBuffer->array_one();
+			handleLine(one.first, channel, stamp);
 
-			m_rxBuffer.clear();
+			rxBuffer->clear();
 		}
 	}
 }
 
-template<typename... Args>
-void NodeMonitor::log(const char* format, Args&& ... args)
+OutputShards::Handler NodeMonitor::shardHandler(int fd)
 {
-	logMessageSignal({name(), fmt::format(format, std::forward<Args>(args)...)});
+	return [this, fd](const OutputShards::Event& event) {
+		if(event.bytes != 0)
+			handleOutput(event.bytes);
+
+		LogEvent::Channel channel = outputChannel(fd);
+
+		// The lines were read at event.time, which may be a while ago
+		auto stamp = std::chrono::system_clock::now() - std::chrono::duration_cast<std::chrono::system_clock::duration>(
+			OutputShards::Clock::now() - event.time
+		);
+		for(auto& line : event.lines)
+			handleLine(line.c_str(), channel, stamp);
+
+		if(!event.error.empty())
+			logTyped(LogEvent::Type::Error, "Stopped reading output of {}: {}", name(), event.error);
+
+		if(event.closed)
+		{
+			// The shard has already dropped the fd
+			if(fd == m_stderrFD)
+				m_stderrToken = 0;
+			else
+				m_outputToken = 0;
+
+			handleOutputClosed(fd);
+		}
+	};
 }
 
-template<typename... Args>
-void NodeMonitor::logTyped(LogEvent::Type type, const std::string& format, Args&& ... args)
+LogEvent::Channel NodeMonitor::outputChannel(int fd) const
 {
-	time_t t = time(nullptr);
-	tm currentTime;
-	memset(&currentTime, 0, sizeof(currentTime));
-	localtime_r(&t, &currentTime);
+	if(!m_pipeOutput)
+		return LogEvent::Channel::NotApplicable;
 
-	char buf[256];
-	strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &currentTime);
-	std::string time_stamped_format = "["+ toString(type) + " " + std::string(buf) + " rosmon]: "+ format;
-	logMessageSignal({name(), fmt::format(time_stamped_format, std::forward<Args>(args)...), type});
+	return (fd == m_stderrFD) ? LogEvent::Channel::Stderr : LogEvent::Channel::Stdout;
+}
+
+void NodeMonitor::handleOutputClosed(int fd)
+{
+	close(fd);
+
+	if(fd == m_stderrFD)
+		m_stderrFD = -1;
+	else
+		m_fd = -1;
+
+	// The process is gone (or has at least given up all of its output)
+	// once all streams are closed.
+	if(m_fd == -1 && m_stderrFD == -1)
+		handleExit();
 }
 
-static boost::iterator_range<std::string::const_iterator>
-corePatternFormatFinder(std::string::const_iterator begin, std::string::const_iterator end)
+void NodeMonitor::handleOutput(std::size_t bytes)
 {
-	for(; begin != end && begin+1 != end; ++begin)
+	if(m_livenessTimer.isValid())
+		m_lastOutput = ros::WallTime::now();
+
+	if(m_traceFirstOutput)
 	{
-		if(*begin == '%')
-			return {begin, begin+2};
+		trace::instant("node", "first output", {}, m_traceTrack);
+		m_traceFirstOutput = false;
 	}
 
-	return {end, end};
+	m_outputBytes += bytes;
 }
 
-void NodeMonitor::gatherCoredump(int signal)
+void NodeMonitor::handleLine(const char* line, LogEvent::Channel channel, const std::chrono::system_clock::time_point& stamp)
+{
+	m_outputLines++;
+
+	LogEvent event{name(), line, LogEvent::Type::Raw, channel};
+	event.stamp = stamp;
+	logMessageSignal(event);
+}
+
+void NodeMonitor::handleExit()
 {
-	char core_pattern[256];
-	int core_fd = open("/proc/sys/kernel/core_pattern", O_RDONLY | O_CLOEXEC);
-	if(core_fd < 0)
+	int status;
+
+	while(true)
 	{
-		logTyped(LogEvent::Type::Error, "could not open /proc/sys/kernel/core_pattern: {}", strerror(errno));
-		return;
-	}
+		if(waitpid(m_pid, &status, 0) > 0)
+			break;
 
-	int bytes = read(core_fd, core_pattern, sizeof(core_pattern)-1);
-	close(core_fd);
+		if(errno == EINTR || errno == EAGAIN)
+			continue;
 
-	if(bytes < 1)
+		throw error("{}: Could not waitpid(): {}", m_launchNode->name(), strerror(errno));
+	}
+
+	if(WIFEXITED(status))
 	{
-		log("Could not read /proc/sys/kernel/core_pattern: {}", strerror(errno));
-		return;
+		auto type = (WEXITSTATUS(status) == 0) ? LogEvent::Type::Info : LogEvent::Type::Error;
+		logTyped(type, "{} exited with status {}", name(), WEXITSTATUS(status));
+		ROS_INFO("rosmon: %s exited with status %d", name().c_str(), WEXITSTATUS(status));
+		m_exitCode = WEXITSTATUS(status);
 	}
+	else if(WIFSIGNALED(status))
+	{
+		// In backtrace mode, the crash is reported together with the
+		// backtrace once the collector is done (see gatherCoredump()).
+		bool reportLater = false;
+#ifdef WCOREDUMP
+		reportLater = WCOREDUMP(status) && m_coreDumpCollector
+			&& m_launchNode->coreMode() == launch::Node::CORE_BACKTRACE
+			&& m_launchNode->launchPrefix().empty();
+#endif
 
-	core_pattern[bytes-1] = 0; // Strip off the newline at the end
+		if(!reportLater)
+			logTyped(LogEvent::Type::Error, "{} died from signal {}", name(), WTERMSIG(status));
+		ROS_ERROR("rosmon: %s died from signal %d", name().c_str(), WTERMSIG(status));
+		m_exitCode = 255;
+	}
 
-	if(core_pattern[0] == '|')
+	if(m_traceTrack)
 	{
-		// This may be apport, but apport still writes a "core" file if the
-		// limit is set appropriately.
-		strncpy(core_pattern, "core", sizeof(core_pattern));
+		trace::complete("node", "run", m_traceStart, trace::now() - m_traceStart,
+			fmt::format("\"pid\":{},\"exit_code\":{}", m_pid, m_exitCode), m_traceTrack
+		);
+		m_traceFirstOutput = false;
 	}
 
-	auto formatter = [&](boost::iterator_range<std::string::const_iterator> match) -> std::string {
-		char code = *(match.begin()+1);
-
-		switch(code)
+#ifdef WCOREDUMP
+	if(WCOREDUMP(status))
+	{
+		if(!m_launchNode->launchPrefix().empty())
 		{
-			case '%':
-				return "%";
-			case 'p':
-				return std::to_string(m_pid);
-			case 'u':
-				return std::to_string(getuid());
-			case 'g':
-				return std::to_string(getgid());
-			case 's':
-				return std::to_string(signal);
-			case 't':
-				return "*"; // No chance
-			case 'h':
-			{
-				utsname uts;
-				memset(&uts, 0, sizeof(uts));
-				if(uname(&uts) != 0)
-					return "*";
+			logTyped(LogEvent::Type::Info, "{} used launch-prefix, not collecting core dump as it is probably useless.", name());
+		}
+		else
+		{
+			// We have a chance to find the core dump...
+			logTyped(LogEvent::Type::Info, "{} left a core dump", name());
+			gatherCoredump(WTERMSIG(status));
+		}
+	}
+#endif
 
-				return uts.nodename;
-			}
-			case 'e':
-				return m_launchNode->type().substr(0, TASK_COMM_LEN-1);
-			case 'E':
-			{
-				std::string executable = m_launchNode->executable();
-				boost::replace_all(executable, "/", "!");
-				return executable;
-			}
-			case 'c':
-			{
-				rlimit limit;
-				memset(&limit, 0, sizeof(limit));
-				getrlimit(RLIMIT_CORE, &limit);
+	m_pid = -1;
+	if(m_livenessTimer.isValid())
+		m_livenessTimer.stop();
 
-				// core limit is set to the maximum above
-				return std::to_string(limit.rlim_max);
-			}
-			default:
-				return "*";
-		}
-	};
+	if(m_livenessRestart)
+	{
+		// Hung nodes are treated like crashed ones, so backoff and
+		// crash loop detection apply.
+		m_livenessRestart = false;
+		m_command = CMD_RUN;
+		scheduleRespawn(true);
+	}
+	else if(m_command == CMD_RESTART)
+	{
+		m_respawnDelay = 1.0;
+		m_restartTimer.setPeriod(ros::WallDuration(m_respawnDelay));
 
-	std::string coreGlob = boost::find_format_all_copy(std::string(core_pattern), corePatternFormatFinder, formatter);
+		m_restartCount++;
+		m_restartTimer.start();
+		m_restarting = true;
+	}
+	else if(m_command == CMD_RUN && m_launchNode->respawn())
+		scheduleRespawn(m_exitCode != 0);
 
-	// If the pattern is not absolute, it is relative to our node's cwd.
-	if(coreGlob[0] != '/')
-		coreGlob = m_processWorkingDirectory.find("/tmp/rosmon-node-") == std::string::npos ? m_processWorkingDirectory + "/core_dumps/" + coreGlob : m_processWorkingDirectory + "/" + coreGlob;
+	exitedSignal(name());
+	stateChangedSignal(name());
+}
 
+template<typename... Args>
+void NodeMonitor::log(const char* format, Args&& ... args)
+{
+	logMessageSignal({name(), fmt::format(format, std::forward<Args>(args)...)});
+}
+
+template<typename... Args>
+void NodeMonitor::logTyped(LogEvent::Type type, const std::string& format, Args&& ... args)
+{
 	time_t t = time(nullptr);
 	tm currentTime;
 	memset(&currentTime, 0, sizeof(currentTime));
 	localtime_r(&t, &currentTime);
 
 	char buf[256];
-	strftime(buf, sizeof(buf), "_%Y_%m_%d_%H_%M_%S", &currentTime);
-	std::string core_rename = coreGlob + "_" + m_launchNode->name() + std::string(buf);
+	strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &currentTime);
+	std::string time_stamped_format = "["+ toString(type) + " " + std::string(buf) + " rosmon]: "+ format;
+	logMessageSignal({name(), fmt::format(time_stamped_format, std::forward<Args>(args)...), type});
+}
+
+void NodeMonitor::scheduleRespawn(bool abnormal)
+{
+	ros::WallTime now = ros::WallTime::now();
+
+	// A process that stayed up for longer than the maximum delay is
+	// considered healthy, so the next crash starts over with the base delay.
+	if(now - m_startTime > m_launchNode->respawnMaxDelay())
+		m_backoffLevel = 0;
+
+	// Nodes may exit cleanly on purpose to get respawned, that is no crash
+	if(abnormal && m_launchNode->crashLoopCount() != 0)
+	{
+		ros::WallDuration window = m_launchNode->crashLoopWindow();
 
-	if (rename(const_cast<char*>(coreGlob.c_str()), const_cast<char*>(core_rename.c_str())) != 0) {
-		logTyped(LogEvent::Type::Warning, "Error renaming core files");
+		m_exitTimes.push_back(now);
+		while(!m_exitTimes.empty() && now - m_exitTimes.front() > window)
+			m_exitTimes.pop_front();
+
+		if(m_exitTimes.size() >= m_launchNode->crashLoopCount())
+		{
+			logTyped(LogEvent::Type::Error,
+				"{} crashed {} times within {:.0f}s, not restarting it anymore (crash loop)",
+				name(), m_exitTimes.size(), window.toSec()
+			);
+			ROS_ERROR("rosmon: %s is in a crash loop, giving up", name().c_str());
+
+			m_failed = true;
+			m_restarting = false;
+			return;
+		}
 	}
 
-	coreGlob = core_rename;
+	double baseDelay = m_launchNode->respawnDelay().toSec();
 
-	log("Determined pattern '{}'", coreGlob);
+	double delay = m_launchNode->respawnDelayAt(m_backoffLevel);
+	if(m_launchNode->respawnDelayAt(m_backoffLevel + 1) > delay)
+		m_backoffLevel++;
 
-	glob_t results;
-	memset(&results, 0, sizeof(results));
-	int ret = glob(coreGlob.c_str(), GLOB_NOSORT, nullptr, &results);
+	m_backoff = (delay > baseDelay);
 
-	if(ret != 0 || results.gl_pathc == 0)
+	// Jitter avoids restarting many nodes that crashed together in lockstep
+	double jitter = m_launchNode->respawnJitter();
+	if(jitter > 0.0)
 	{
-		logTyped(LogEvent::Type::Warning, "Could not find a matching core file :-(");
-		globfree(&results);
-		return;
+		std::uniform_real_distribution<double> distribution(-jitter, jitter);
+		delay *= 1.0 + distribution(m_rng);
 	}
 
-	if(results.gl_pathc > 1)
-	{
-		logTyped(LogEvent::Type::Info, "Found multiple matching core files :-(");
-		globfree(&results);
+	if(m_backoff)
+		logTyped(LogEvent::Type::Warning, "{} keeps exiting, restarting in {:.1f}s", name(), delay);
+
+	m_respawnDelay = delay;
+	m_restartTimer.setPeriod(ros::WallDuration(delay));
+
+	if(m_traceTrack)
+		trace::instant("node", "respawn scheduled", fmt::format("\"delay\":{}", delay), m_traceTrack);
+
+	m_restartCount++;
+	m_restartTimer.start();
+	m_restarting = true;
+}
+
+void NodeMonitor::gatherCoredump(int signal)
+{
+	if(!m_coreDumpCollector)
 		return;
-	}
 
-	std::string coreFile = results.gl_pathv[0];
-	globfree(&results);
+	CoreDumpCollector::Job job;
+	job.nodeName = m_launchNode->name();
+	job.nodeType = m_launchNode->type();
+	job.executable = m_launchNode->executable();
+	job.workingDirectory = m_processWorkingDirectory;
+	job.pid = m_pid;
+	job.signal = signal;
+	job.nodeQuota = m_launchNode->coreQuota();
+	job.backtraceOnly = (m_launchNode->coreMode() == launch::Node::CORE_BACKTRACE);
+
+	// The collector runs in the background, we are called back on the
+	// main loop once the core has been found and compressed.
+	// By then, the node may have been restarted already.
+	m_corePid = m_pid;
+	int pid = m_pid;
+	bool backtraceOnly = job.backtraceOnly;
+	m_coreDumpCollector->submit(this, job, [this, pid, signal, backtraceOnly](const CoreDumpCollector::Result& result) {
+		for(auto& msg : result.messages)
+			logTyped(msg.first, "{}", msg.second);
+
+		if(backtraceOnly)
+		{
+			if(result.backtrace.empty())
+				logTyped(LogEvent::Type::Error, "{} died from signal {}", name(), signal);
+			else
+				logTyped(LogEvent::Type::Error, "{} died from signal {}, backtrace:\n{}", name(), signal, result.backtrace);
+		}
 
-	std::stringstream ss;
+		if(!result.debuggerCommand.empty() && pid == m_corePid)
+			m_debuggerCommand = result.debuggerCommand;
+	});
+}
 
-	ss << "gdb " << m_launchNode->executable() << " " << coreFile;
-	logTyped(LogEvent::Type::Info, "Debug with '{}'", ss.str());
+void NodeMonitor::handleTraceExec(int fd)
+{
+	// The pipe is closed by exec() of the node (or by the child dying
+	// before it), see launchProcess().
+	trace::instant("node", "exec", {}, m_traceTrack);
 
-	m_debuggerCommand = ss.str();
+	m_fdWatcher->removeFD(fd);
+	close(fd);
+	m_traceExecFD = -1;
 }
 
 void NodeMonitor::launchDebugger()
@@ -671,12 +1218,30 @@ void NodeMonitor::beginStatUpdate()
 	m_userTime = 0;
 	m_systemTime = 0;
 	m_memory = 0;
+	m_threads = 0;
+	m_minorFaults = 0;
+	m_majorFaults = 0;
+	m_voluntarySwitches = 0;
+	m_involuntarySwitches = 0;
+	m_readBytes = 0;
+	m_writeBytes = 0;
+	m_sawDState = false;
+	m_threadTimes.clear();
 }
 
 void NodeMonitor::addCPUTime(uint64_t userTime, uint64_t systemTime)
 {
 	m_userTime += userTime;
 	m_systemTime += systemTime;
+
+	if(userTime + systemTime != 0)
+		m_lastCPUProgress = ros::WallTime::now();
+}
+
+void NodeMonitor::addProcessState(char state)
+{
+	if(state == 'D')
+		m_sawDState = true;
 }
 
 void NodeMonitor::addMemory(uint64_t memoryBytes)
@@ -684,10 +1249,238 @@ void NodeMonitor::addMemory(uint64_t memoryBytes)
 	m_memory += memoryBytes;
 }
 
+void NodeMonitor::addThreads(unsigned int threads)
+{
+	m_threads += threads;
+}
+
+void NodeMonitor::addFaults(uint64_t minorFaults, uint64_t majorFaults)
+{
+	m_minorFaults += minorFaults;
+	m_majorFaults += majorFaults;
+}
+
+void NodeMonitor::addContextSwitches(uint64_t voluntary, uint64_t involuntary)
+{
+	m_voluntarySwitches += voluntary;
+	m_involuntarySwitches += involuntary;
+}
+
+void NodeMonitor::addIO(uint64_t readBytes, uint64_t writeBytes)
+{
+	m_readBytes += readBytes;
+	m_writeBytes += writeBytes;
+}
+
+void NodeMonitor::addThreadTime(unsigned long pid, unsigned long tid, const std::string& name, uint64_t userTime, uint64_t systemTime)
+{
+	// Loads are computed in endStatUpdate()
+	m_threadTimes.push_back(ThreadLoad{pid, tid, name,
+		static_cast<double>(userTime), static_cast<double>(systemTime)
+	});
+}
+
+void NodeMonitor::setTopThreadCount(unsigned int count)
+{
+	m_topThreadCount = count;
+	if(count == 0)
+		m_topThreads.clear();
+}
+
+void NodeMonitor::setDetailedMemory(uint64_t pss, uint64_t uss, uint64_t swap)
+{
+	m_detailedMemoryAvailable = true;
+	m_memoryPSS = pss;
+	m_memoryUSS = uss;
+	m_memorySwap = swap;
+}
+
+void NodeMonitor::clearDetailedMemory()
+{
+	m_detailedMemoryAvailable = false;
+	m_memoryPSS = 0;
+	m_memoryUSS = 0;
+	m_memorySwap = 0;
+}
+
+void NodeMonitor::setMemoryLimitMetric(MemoryMetric metric)
+{
+	m_memoryLimitMetric = metric;
+}
+
+uint64_t NodeMonitor::memoryForLimit() const
+{
+	if(m_detailedMemoryAvailable)
+	{
+		switch(m_memoryLimitMetric)
+		{
+			case MEMORY_RSS: break;
+			case MEMORY_PSS: return m_memoryPSS;
+			case MEMORY_USS: return m_memoryUSS;
+		}
+	}
+
+	return m_memory;
+}
+
 void NodeMonitor::endStatUpdate(double elapsedTimeInTicks)
 {
 	m_userLoad = m_userTime / elapsedTimeInTicks;
 	m_systemLoad = m_systemTime / elapsedTimeInTicks;
+
+	double elapsedTime = elapsedTimeInTicks / process_info::kernel_hz();
+
+	if(m_topThreadCount != 0)
+	{
+		auto byLoad = [](const ThreadLoad& a, const ThreadLoad& b) {
+			return a.load() > b.load();
+		};
+
+		std::size_t count = std::min<std::size_t>(m_topThreadCount, m_threadTimes.size());
+		std::partial_sort(m_threadTimes.begin(), m_threadTimes.begin() + count, m_threadTimes.end(), byLoad);
+		m_threadTimes.resize(count);
+
+		for(auto& thread : m_threadTimes)
+		{
+			thread.userLoad /= elapsedTimeInTicks;
+			thread.systemLoad /= elapsedTimeInTicks;
+		}
+
+		m_topThreads.swap(m_threadTimes);
+	}
+
+	// Track how long the node has been in uninterruptible sleep
+	if(m_sawDState && !m_inDState)
+		m_dStateSince = ros::WallTime::now();
+	m_inDState = m_sawDState;
+
+	if(elapsedTime > 0)
+	{
+		m_minorFaultRate = m_minorFaults / elapsedTime;
+		m_majorFaultRate = m_majorFaults / elapsedTime;
+		m_voluntarySwitchRate = m_voluntarySwitches / elapsedTime;
+		m_involuntarySwitchRate = m_involuntarySwitches / elapsedTime;
+		m_readRate = m_readBytes / elapsedTime;
+		m_writeRate = m_writeBytes / elapsedTime;
+	}
+
+	NodeHistory::Sample sample;
+	sample.stamp = ros::WallTime::now() - ros::WallDuration(elapsedTime);
+	sample.duration = elapsedTime;
+	sample.count = 1;
+	sample.userLoad = NodeHistory::Statistic{m_userLoad};
+	sample.systemLoad = NodeHistory::Statistic{m_systemLoad};
+	sample.memory = NodeHistory::Statistic{static_cast<double>(m_memory)};
+	sample.threads = NodeHistory::Statistic{static_cast<double>(m_threads)};
+	sample.restartCount = m_restartCount;
+
+	m_history.addSample(sample);
+}
+
+void NodeMonitor::openHeartbeatSocket()
+{
+	std::string path = m_launchNode->liveness().heartbeat.substr(5);
+
+	sockaddr_un addr{};
+	addr.sun_family = AF_UNIX;
+	if(path.size() >= sizeof(addr.sun_path))
+	{
+		logTyped(LogEvent::Type::Error, "heartbeat socket path '{}' is too long", path);
+		return;
+	}
+	strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+	int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(fd < 0)
+	{
+		logTyped(LogEvent::Type::Error, "Could not create heartbeat socket: {}", strerror(errno));
+		return;
+	}
+
+	// Remove stale socket from an earlier run
+	unlink(path.c_str());
+
+	if(bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0)
+	{
+		logTyped(LogEvent::Type::Error, "Could not bind heartbeat socket '{}': {}", path, strerror(errno));
+		close(fd);
+		return;
+	}
+
+	m_heartbeatFD = fd;
+	m_fdWatcher->registerFD(m_heartbeatFD, boost::bind(&NodeMonitor::handleHeartbeat, this), "heartbeat/" + name());
+}
+
+void NodeMonitor::closeHeartbeatSocket()
+{
+	if(m_heartbeatFD == -1)
+		return;
+
+	m_fdWatcher->removeFD(m_heartbeatFD);
+	close(m_heartbeatFD);
+	m_heartbeatFD = -1;
+
+	unlink(m_launchNode->liveness().heartbeat.substr(5).c_str());
+}
+
+void NodeMonitor::handleHeartbeat()
+{
+	// Any datagram counts as a heartbeat, the content is ignored.
+	char buf[256];
+	while(recv(m_heartbeatFD, buf, sizeof(buf), 0) >= 0)
+		m_lastHeartbeat = ros::WallTime::now();
+}
+
+void NodeMonitor::checkLiveness()
+{
+	const auto& liveness = m_launchNode->liveness();
+
+	if(!running() || m_command != CMD_RUN || m_livenessRestart)
+		return;
+
+	ros::WallTime now = ros::WallTime::now();
+	if((now - m_livenessGraceStart).toSec() < liveness.grace)
+		return;
+
+	if(liveness.cpuTimeout > 0 && (now - m_lastCPUProgress).toSec() > liveness.cpuTimeout)
+		return failLiveness(fmt::format("no CPU progress for {:.1f}s", (now - m_lastCPUProgress).toSec()));
+
+	if(liveness.dStateTimeout > 0 && m_inDState && (now - m_dStateSince).toSec() > liveness.dStateTimeout)
+		return failLiveness(fmt::format("in uninterruptible sleep (D state) for {:.1f}s", (now - m_dStateSince).toSec()));
+
+	if(liveness.outputTimeout > 0 && (now - m_lastOutput).toSec() > liveness.outputTimeout)
+		return failLiveness(fmt::format("no output for {:.1f}s", (now - m_lastOutput).toSec()));
+
+	if(liveness.heartbeatTimeout > 0)
+	{
+		if(m_heartbeatFD == -1)
+		{
+			// Heartbeat file: the node touches it, we look at the mtime.
+			struct stat st;
+			if(stat(liveness.heartbeat.c_str(), &st) == 0)
+			{
+				ros::WallTime mtime(static_cast<uint32_t>(st.st_mtim.tv_sec), static_cast<uint32_t>(st.st_mtim.tv_nsec));
+				if(mtime > m_lastHeartbeat)
+					m_lastHeartbeat = mtime;
+			}
+		}
+
+		if((now - m_lastHeartbeat).toSec() > liveness.heartbeatTimeout)
+			return failLiveness(fmt::format("no heartbeat for {:.1f}s", (now - m_lastHeartbeat).toSec()));
+	}
+}
+
+void NodeMonitor::failLiveness(const std::string& reason)
+{
+	logTyped(LogEvent::Type::Error, "{}: liveness probe failed ({}), restarting", name(), reason);
+	ROS_ERROR("rosmon: %s: liveness probe failed (%s), restarting", name().c_str(), reason.c_str());
+
+	m_livenessFailures++;
+	m_livenessRestart = true;
+
+	// Use the normal stop escalation (SIGINT, SIGKILL after the stop
+	// timeout). The exit handler in handleExit() schedules the restart.
+	stop(true);
 }
 
 }
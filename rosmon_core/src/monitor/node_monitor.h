@@ -9,11 +9,18 @@
 #include "../log_event.h"
 #include "../logger.h"
 
+#include "coredump_collector.h"
+#include "node_history.h"
+#include "output_shards.h"
+
 #include <ros/node_handle.h>
 
 #include <boost/signals2.hpp>
 #include <boost/circular_buffer.hpp>
 
+#include <deque>
+#include <random>
+
 namespace rosmon
 {
 
@@ -35,7 +42,30 @@ public:
 		STATE_IDLE,    //!< Idle (e.g. exited with code 0)
 		STATE_RUNNING, //!< Running
 		STATE_CRASHED, //!< Crashed (i.e. exited with code != 0)
-		STATE_WAITING  //!< Waiting for automatic restart after crash
+		STATE_WAITING, //!< Waiting for automatic restart after crash
+		STATE_BACKOFF, //!< Waiting for automatic restart with increased delay
+		STATE_FAILED   //!< Not restarted anymore because of a crash loop
+	};
+
+	//! CPU usage of a single thread, see topThreads()
+	struct ThreadLoad
+	{
+		unsigned long pid;
+		unsigned long tid;
+		std::string name;
+		double userLoad;
+		double systemLoad;
+
+		inline double load() const
+		{ return userLoad + systemLoad; }
+	};
+
+	//! Memory measure used for memory limit checks
+	enum MemoryMetric
+	{
+		MEMORY_RSS, //!< Resident set size (shared pages are counted fully)
+		MEMORY_PSS, //!< Proportional set size (shared pages are split)
+		MEMORY_USS  //!< Unique set size (only private pages)
 	};
 
 	/**
@@ -60,13 +90,40 @@ public:
 	//! Restart the node
 	void restart();
 
+	/**
+	 * @brief Replace the launch configuration
+	 *
+	 * Supervision settings (respawn, limits, liveness probes, ...) apply
+	 * immediately. A running process keeps its command line and
+	 * environment until it is restarted.
+	 **/
+	void reconfigure(launch::Node::ConstPtr launchNode);
+
+	//! Current launch configuration
+	inline launch::Node::ConstPtr launchNode() const
+	{ return m_launchNode; }
+
 	/**
 	 * @brief Start shutdown sequence
 	 *
-	 * If the node is still running, this sends SIGINT.
+	 * If the node is still running, this starts the shutdown handler (if
+	 * configured) as a child process. SIGINT is sent once the handler has
+	 * finished or timed out, see updateShutdown(). Without handler, SIGINT
+	 * is sent immediately.
 	 **/
 	void shutdown();
 
+	/**
+	 * @brief Check on the shutdown handler
+	 *
+	 * Needs to be called periodically during shutdown.
+	 **/
+	void updateShutdown();
+
+	//! Is the shutdown handler still running?
+	inline bool shutdownHandlerRunning() const
+	{ return m_handlerPid != -1; }
+
 	/**
 	 * @brief Finish shutdown sequence
 	 *
@@ -106,6 +163,33 @@ public:
 	 * against the coredump instead of the running process.
 	 **/
 	void launchDebugger();
+
+	/**
+	 * @brief Collect core dumps of this node in the background
+	 *
+	 * Without a collector, core dumps are left where the kernel put them.
+	 **/
+	inline void setCoreDumpCollector(const CoreDumpCollector::Ptr& collector)
+	{ m_coreDumpCollector = collector; }
+
+	/**
+	 * @brief Read output on an output shard instead of the main loop
+	 *
+	 * Takes effect on the next start of the process.
+	 **/
+	inline void setOutputShards(const OutputShards::Ptr& shards)
+	{ m_outputShards = shards; }
+
+	/**
+	 * @brief Look at the output of a node in raw output mode
+	 *
+	 * Raw output (see launch::Node::OUTPUT_RAW) is spliced into the log file
+	 * without passing through rosmon. While peeking, it is copied and split
+	 * into lines for logMessageSignal as usual. The UI enables this for
+	 * nodes that are not muted.
+	 **/
+	inline void setOutputPeek(bool peek)
+	{ m_outputPeek = peek; }
 	//@}
 
 	//! @name Statistics
@@ -114,8 +198,17 @@ public:
 	void beginStatUpdate();
 	void addCPUTime(uint64_t userTime, uint64_t systemTime);
 	void addMemory(uint64_t memoryBytes);
+	void addThreads(unsigned int threads);
+	void addProcessState(char state);
+	void addFaults(uint64_t minorFaults, uint64_t majorFaults);
+	void addContextSwitches(uint64_t voluntary, uint64_t involuntary);
+	void addIO(uint64_t readBytes, uint64_t writeBytes);
+	void addThreadTime(unsigned long pid, unsigned long tid, const std::string& name, uint64_t userTime, uint64_t systemTime);
 	void endStatUpdate(double elapsedTimeInTicks);
 
+	void setDetailedMemory(uint64_t pss, uint64_t uss, uint64_t swap);
+	void clearDetailedMemory();
+
 	/**
 	 * @brief Estimate of the userspace load
 	 *
@@ -145,9 +238,102 @@ public:
 	inline double memory() const
 	{ return m_memory; }
 
+	/**
+	 * @brief Are PSS/USS/swap values available?
+	 *
+	 * These are only sampled if enabled (see Monitor::setSmapsPeriod()).
+	 **/
+	inline bool detailedMemoryAvailable() const
+	{ return m_detailedMemoryAvailable; }
+
+	//! Proportional set size in bytes (shared pages divided among users)
+	inline uint64_t memoryPSS() const
+	{ return m_memoryPSS; }
+
+	//! Unique set size in bytes (private pages only)
+	inline uint64_t memoryUSS() const
+	{ return m_memoryUSS; }
+
+	//! Swapped out memory in bytes
+	inline uint64_t memorySwap() const
+	{ return m_memorySwap; }
+
+	//! Select the memory measure used by memoryForLimit()
+	void setMemoryLimitMetric(MemoryMetric metric);
+
+	/**
+	 * @brief Memory usage to be compared against memoryLimit()
+	 *
+	 * Falls back to the resident memory if the selected measure is not
+	 * available (yet).
+	 **/
+	uint64_t memoryForLimit() const;
+
+	//! Number of threads, summed over all processes of the node
+	inline unsigned int threads() const
+	{ return m_threads; }
+
+	/**
+	 * @brief Number of threads kept in topThreads()
+	 *
+	 * Zero (the default) disables per-thread statistics.
+	 **/
+	void setTopThreadCount(unsigned int count);
+
+	inline unsigned int topThreadCount() const
+	{ return m_topThreadCount; }
+
+	//! Threads with the highest CPU load in the last sample, highest first
+	inline const std::vector<ThreadLoad>& topThreads() const
+	{ return m_topThreads; }
+
+	//! Page faults without disk access per second
+	inline double minorFaultRate() const
+	{ return m_minorFaultRate; }
+
+	//! Page faults requiring disk access per second
+	inline double majorFaultRate() const
+	{ return m_majorFaultRate; }
+
+	//! Voluntary context switches (blocking) per second
+	inline double voluntarySwitchRate() const
+	{ return m_voluntarySwitchRate; }
+
+	//! Involuntary context switches (preemption) per second
+	inline double involuntarySwitchRate() const
+	{ return m_involuntarySwitchRate; }
+
+	//! Bytes read from storage per second
+	inline double readRate() const
+	{ return m_readRate; }
+
+	//! Bytes written to storage per second
+	inline double writeRate() const
+	{ return m_writeRate; }
+
 	inline unsigned int restartCount() const
 	{ return m_restartCount; }
 
+	//! Delay of the currently scheduled (or last) automatic restart
+	inline double respawnDelay() const
+	{ return m_respawnDelay; }
+
+	//! How often was the node restarted because a liveness probe failed?
+	inline unsigned int livenessFailures() const
+	{ return m_livenessFailures; }
+
+	//! Total number of output lines received from the node
+	inline uint64_t outputLines() const
+	{ return m_outputLines; }
+
+	//! Total number of output bytes received from the node
+	inline uint64_t outputBytes() const
+	{ return m_outputBytes; }
+
+	//! Resource usage history, see NodeHistory
+	inline const NodeHistory& history() const
+	{ return m_history; }
+
     inline uint64_t memoryLimit()const
     { return m_launchNode->memoryLimitByte();}
 
@@ -171,6 +357,10 @@ public:
 	//! Node stop timeout
 	inline double stopTimeout() const
 	{ return m_launchNode->stopTimeout(); }
+
+	//! Configured sampling period for resource statistics
+	inline double statsPeriod() const
+	{ return m_launchNode->statsPeriod(); }
         
 	boost::scoped_ptr<rosmon::Logger> logger;
 
@@ -183,6 +373,9 @@ public:
 
 	//! Signalled whenever the process exits.
 	boost::signals2::signal<void(std::string)> exitedSignal;
+
+	//! Signalled whenever state() changes (start, exit, restart)
+	boost::signals2::signal<void(std::string)> stateChangedSignal;
 private:
 	enum Command
 	{
@@ -193,7 +386,15 @@ private:
 
 	std::vector<std::string> composeCommand() const;
 
-	void communicate();
+	void communicate(int fd);
+	void communicateRaw();
+	void splitLines(boost::circular_buffer<char>* rxBuffer, const char* data, std::size_t size, LogEvent::Channel channel);
+	void handleOutput(std::size_t bytes);
+	void handleLine(const char* line, LogEvent::Channel channel, const std::chrono::system_clock::time_point& stamp);
+	void handleOutputClosed(int fd);
+	void handleExit();
+	LogEvent::Channel outputChannel(int fd) const;
+	OutputShards::Handler shardHandler(int fd);
 
 	template<typename... Args>
 	void log(const char* format, Args&& ... args);
@@ -202,6 +403,21 @@ private:
 	void logTyped(LogEvent::Type type, const std::string& format, Args&& ... args);
 
 	void checkStop();
+	void launchProcess();
+	//! @param abnormal Non-zero exit status, signal or liveness failure
+	void scheduleRespawn(bool abnormal);
+	void resetRespawnBackoff();
+
+	void configure();
+
+	void openHeartbeatSocket();
+	void closeHeartbeatSocket();
+
+	void finishShutdownHandler(int status);
+	void handleHeartbeat();
+	void handleTraceExec(int fd);
+	void checkLiveness();
+	void failLiveness(const std::string& reason);
 	void gatherCoredump(int signal);
 
 	launch::Node::ConstPtr m_launchNode;
@@ -209,9 +425,16 @@ private:
 	FDWatcher::Ptr m_fdWatcher;
 
 	boost::circular_buffer<char> m_rxBuffer;
+	boost::circular_buffer<char> m_stderrRxBuffer;
+	uint64_t m_outputLines = 0;
+	uint64_t m_outputBytes = 0;
 
 	int m_pid = -1;
-	int m_fd = -1;
+	int m_fd = -1;        //!< PTY master, or stdout pipe in pipe mode
+	int m_stderrFD = -1;  //!< stderr pipe in pipe mode
+	bool m_pipeOutput = false;  //!< stdout & stderr are separate pipes
+	bool m_rawSplice = true;    //!< splice() works for the log file
+	bool m_outputPeek = false;
 	int m_exitCode;
 
 	ros::WallTimer m_stopCheckTimer;
@@ -221,7 +444,38 @@ private:
 
 	bool m_restarting;
 
+	ros::NodeHandle m_nh;
+	bool m_backoff = false;
+	bool m_failed = false;
+
+	ros::WallTime m_startTime;
+	unsigned int m_backoffLevel = 0;
+	double m_respawnDelay = 0.0;
+	std::deque<ros::WallTime> m_exitTimes;
+	std::mt19937 m_rng{std::random_device{}()};
+
+	ros::WallTimer m_livenessTimer;
+	ros::WallTime m_livenessGraceStart;
+	ros::WallTime m_lastCPUProgress;
+	ros::WallTime m_lastOutput;
+	ros::WallTime m_lastHeartbeat;
+	ros::WallTime m_dStateSince;
+	bool m_sawDState = false;
+	bool m_inDState = false;
+	int m_heartbeatFD = -1;
+	bool m_livenessRestart = false;
+	unsigned int m_livenessFailures = 0;
+
+	int m_handlerPid = -1;
+	ros::WallTime m_handlerStart;
+
 	std::string m_debuggerCommand;
+	int m_corePid = -1; //!< Process the awaited core dump belongs to
+	CoreDumpCollector::Ptr m_coreDumpCollector;
+
+	OutputShards::Ptr m_outputShards;
+	uint64_t m_outputToken = 0;
+	uint64_t m_stderrToken = 0;
 
 	unsigned int m_restartCount = 0;
 
@@ -230,10 +484,43 @@ private:
 	double m_userLoad = 0.0;
 	double m_systemLoad = 0.0;
 	uint64_t m_memory = 0;
+	unsigned int m_threads = 0;
+
+	uint64_t m_minorFaults = 0;
+	uint64_t m_majorFaults = 0;
+	uint64_t m_voluntarySwitches = 0;
+	uint64_t m_involuntarySwitches = 0;
+	uint64_t m_readBytes = 0;
+	uint64_t m_writeBytes = 0;
+
+	unsigned int m_topThreadCount = 0;
+	std::vector<ThreadLoad> m_threadTimes;
+	std::vector<ThreadLoad> m_topThreads;
+
+	double m_minorFaultRate = 0.0;
+	double m_majorFaultRate = 0.0;
+	double m_voluntarySwitchRate = 0.0;
+	double m_involuntarySwitchRate = 0.0;
+	double m_readRate = 0.0;
+	double m_writeRate = 0.0;
+
+	bool m_detailedMemoryAvailable = false;
+	uint64_t m_memoryPSS = 0;
+	uint64_t m_memoryUSS = 0;
+	uint64_t m_memorySwap = 0;
+	MemoryMetric m_memoryLimitMetric = MEMORY_RSS;
+
+	NodeHistory m_history;
 
 	std::string m_processWorkingDirectory;
 
 	bool m_firstStart = true;
+
+	//! Trace track of this node, zero if tracing is disabled
+	uint32_t m_traceTrack = 0;
+	uint64_t m_traceStart = 0;
+	bool m_traceFirstOutput = false;
+	int m_traceExecFD = -1;
 };
 
 }
@@ -0,0 +1,433 @@
+// Reads node output on a pool of event loop threads
+// Author: Max Schwarz <max.schwarz@uni-bonn.de>
+
+#include "output_shards.h"
+
+#include "../self_stats.h"
+#include "../trace.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <fmt/format.h>
+
+namespace rosmon
+{
+
+namespace monitor
+{
+
+namespace
+{
+	// Same limit as the line buffer of NodeMonitor: longer lines are
+	// truncated at the front.
+	const std::size_t MAX_LINE_LENGTH = 4096;
+
+	// If the main loop falls behind by more than this, the shard stops
+	// reading and the nodes block in write() as without sharding.
+	const std::size_t MAX_BACKLOG = 64 * 1024 * 1024;
+
+	void createPipe(int* fds)
+	{
+		if(pipe2(fds, O_CLOEXEC | O_NONBLOCK) != 0)
+			throw std::runtime_error(fmt::format("Could not create pipe: {}", strerror(errno)));
+	}
+
+	/**
+	 * Write a wakeup byte to the non-blocking pipe fd. A full pipe is fine,
+	 * the reader is woken up anyway.
+	 * @return false on other errors
+	 **/
+	bool signalPipe(int fd, char c)
+	{
+		while(write(fd, &c, 1) != 1)
+		{
+			if(errno != EINTR)
+				return errno == EAGAIN;
+		}
+
+		return true;
+	}
+
+	void drainPipe(int fd)
+	{
+		char buf[256];
+		while(read(fd, buf, sizeof(buf)) > 0)
+			;
+	}
+
+	void appendCapped(std::string* line, const char* begin, const char* end)
+	{
+		line->append(begin, end);
+		if(line->size() > MAX_LINE_LENGTH)
+			line->erase(0, line->size() - MAX_LINE_LENGTH);
+	}
+}
+
+class OutputShards::Shard
+{
+public:
+	Shard(unsigned int index, int notifyFD)
+	 : m_index(index)
+	 , m_notifyFD(notifyFD)
+	{
+		createPipe(m_wakePipe);
+		m_thread = std::thread(&Shard::run, this);
+	}
+
+	~Shard()
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_quit = true;
+		}
+		wake();
+		m_thread.join();
+
+		close(m_wakePipe[0]);
+		close(m_wakePipe[1]);
+	}
+
+	void add(int fd, uint64_t token)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_commands.push_back({Command::ADD, fd, token});
+			m_commandsQueued++;
+		}
+		wake();
+	}
+
+	void remove(uint64_t token)
+	{
+		uint64_t seq;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_commands.push_back({Command::REMOVE, -1, token});
+			seq = ++m_commandsQueued;
+		}
+		wake();
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_cond.wait(lock, [&]() { return m_commandsDone >= seq || m_quit; });
+
+		m_events.erase(std::remove_if(m_events.begin(), m_events.end(), [&](const Event& event) {
+			return event.token == token;
+		}), m_events.end());
+	}
+
+	//! Move all pending events to events
+	void take(std::vector<Event>* events)
+	{
+		bool throttled;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			std::move(m_events.begin(), m_events.end(), std::back_inserter(*events));
+			m_events.clear();
+
+			throttled = m_backlog > MAX_BACKLOG;
+			m_backlog = 0;
+		}
+
+		if(throttled)
+			wake();
+	}
+
+	//! Number of fds, only touched by the main thread
+	unsigned int load = 0;
+private:
+	struct Command
+	{
+		enum Type
+		{
+			ADD,
+			REMOVE
+		};
+
+		Type type;
+		int fd;
+		uint64_t token;
+	};
+
+	struct Stream
+	{
+		int fd;
+		uint64_t token;
+		std::string partial;
+	};
+
+	void wake()
+	{
+		// Cannot fail while we own both ends of the pipe. Also called from
+		// the destructor, so do not throw.
+		signalPipe(m_wakePipe[1], 'w');
+	}
+
+	void run()
+	{
+		trace::setThreadName(fmt::format("output shard {}", m_index));
+
+		std::vector<pollfd> fds;
+		std::vector<char> buf(65536);
+
+		while(true)
+		{
+			bool throttled;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				if(m_quit)
+					return;
+
+				for(auto& cmd : m_commands)
+				{
+					if(cmd.type == Command::ADD)
+						m_streams.push_back({cmd.fd, cmd.token, {}});
+					else
+					{
+						m_streams.erase(std::remove_if(m_streams.begin(), m_streams.end(), [&](const Stream& stream) {
+							return stream.token == cmd.token;
+						}), m_streams.end());
+					}
+				}
+				m_commandsDone += m_commands.size();
+				m_commands.clear();
+
+				throttled = m_backlog > MAX_BACKLOG;
+			}
+			m_cond.notify_all();
+
+			fds.clear();
+			fds.push_back({m_wakePipe[0], POLLIN, 0});
+			if(!throttled)
+			{
+				for(auto& stream : m_streams)
+					fds.push_back({stream.fd, POLLIN, 0});
+			}
+
+			std::vector<Event> events;
+			std::size_t bytes = 0;
+
+			if(poll(fds.data(), fds.size(), -1) < 0)
+			{
+				if(errno == EINTR)
+					continue;
+
+				if(errno == EAGAIN || errno == ENOMEM)
+				{
+					std::this_thread::sleep_for(std::chrono::milliseconds(10));
+					continue;
+				}
+
+				// We cannot read anymore. Hand all streams back to the main
+				// loop (as if they were closed) instead of taking rosmon down.
+				std::string error = fmt::format("Could not poll(): {}", strerror(errno));
+				for(auto& stream : m_streams)
+				{
+					Event event;
+					event.time = Clock::now();
+					event.token = stream.token;
+					event.closed = true;
+					event.error = error;
+					events.push_back(std::move(event));
+					stream.fd = -1;
+				}
+			}
+			else
+			{
+				if(fds[0].revents)
+					drainPipe(m_wakePipe[0]);
+
+				for(std::size_t i = 1; i < fds.size(); ++i)
+				{
+					if(fds[i].revents)
+						bytes += readStream(&m_streams[i-1], buf, &events);
+				}
+			}
+
+			m_streams.erase(std::remove_if(m_streams.begin(), m_streams.end(), [](const Stream& stream) {
+				return stream.fd == -1;
+			}), m_streams.end());
+
+			if(events.empty())
+				continue;
+
+			bool notify;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				notify = m_events.empty();
+				std::move(events.begin(), events.end(), std::back_inserter(m_events));
+				m_backlog += bytes;
+			}
+
+			// If this fails, the pipe is gone and with it the main loop. The
+			// events stay queued, there is nobody to report to.
+			if(notify)
+				signalPipe(m_notifyFD, 'e');
+		}
+	}
+
+	std::size_t readStream(Stream* stream, std::vector<char>& buf, std::vector<Event>* events)
+	{
+		ssize_t bytes = read(stream->fd, buf.data(), buf.size());
+		if(bytes < 0 && (errno == EINTR || errno == EAGAIN))
+			return 0;
+
+		Event event;
+		event.time = Clock::now();
+		event.token = stream->token;
+
+		// EOF, or EIO if the slave side of the PTY is closed
+		if(bytes <= 0)
+		{
+			if(bytes < 0 && errno != EIO)
+				event.error = fmt::format("Could not read(): {}", strerror(errno));
+
+			event.closed = true;
+			events->push_back(std::move(event));
+			stream->fd = -1;
+			return 0;
+		}
+
+		event.bytes = bytes;
+
+		const char* begin = buf.data();
+		const char* end = begin + bytes;
+		while(begin != end)
+		{
+			const char* newline = std::find(begin, end, '\n');
+			if(newline == end)
+			{
+				appendCapped(&stream->partial, begin, end);
+				break;
+			}
+
+			appendCapped(&stream->partial, begin, newline + 1);
+			event.lines.push_back(std::move(stream->partial));
+			stream->partial.clear();
+
+			begin = newline + 1;
+		}
+
+		events->push_back(std::move(event));
+		return bytes;
+	}
+
+	unsigned int m_index;
+	int m_notifyFD;
+	int m_wakePipe[2];
+
+	std::thread m_thread;
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+
+	// Protected by m_mutex
+	bool m_quit = false;
+	std::vector<Command> m_commands;
+	uint64_t m_commandsQueued = 0;
+	uint64_t m_commandsDone = 0;
+	std::vector<Event> m_events;
+	std::size_t m_backlog = 0;
+
+	// Only touched by the shard thread
+	std::vector<Stream> m_streams;
+};
+
+OutputShards::OutputShards(unsigned int threads, FDWatcher::Ptr fdWatcher)
+ : m_fdWatcher(std::move(fdWatcher))
+ , m_dispatch(&SelfStats::instance().histogram("output_shards/dispatch"))
+{
+	createPipe(m_pipe);
+
+	for(unsigned int i = 0; i < threads; ++i)
+		m_shards.emplace_back(new Shard(i, m_pipe[1]));
+
+	m_fdWatcher->registerFD(m_pipe[0], [this](int fd) { handleEvents(fd); }, "output_shards");
+}
+
+OutputShards::~OutputShards()
+{
+	m_shards.clear();
+
+	m_fdWatcher->removeFD(m_pipe[0]);
+	close(m_pipe[0]);
+	close(m_pipe[1]);
+}
+
+uint64_t OutputShards::add(int fd, const std::string& name, const Handler& handler)
+{
+	auto it = std::min_element(m_shards.begin(), m_shards.end(), [](const std::unique_ptr<Shard>& a, const std::unique_ptr<Shard>& b) {
+		return a->load < b->load;
+	});
+	Shard* shard = it->get();
+
+	uint64_t token = m_nextToken++;
+	m_registrations[token] = {shard, handler};
+
+	shard->load++;
+	shard->add(fd, token);
+
+	trace::instant("output", "add", fmt::format("\"node\":\"{}\",\"shard\":{}", trace::escape(name), it - m_shards.begin()));
+
+	return token;
+}
+
+void OutputShards::remove(uint64_t token)
+{
+	auto it = m_registrations.find(token);
+	if(it == m_registrations.end())
+		return;
+
+	Shard* shard = it->second.shard;
+	m_registrations.erase(it);
+
+	shard->load--;
+	shard->remove(token);
+}
+
+void OutputShards::handleEvents(int fd)
+{
+	ScopedTimer timer(m_dispatch);
+
+	drainPipe(fd);
+
+	// Events of a single shard are already ordered, merge all shards.
+	std::vector<Event> events;
+	for(auto& shard : m_shards)
+	{
+		std::size_t middle = events.size();
+		shard->take(&events);
+		std::inplace_merge(events.begin(), events.begin() + middle, events.end(), [](const Event& a, const Event& b) {
+			return a.time < b.time;
+		});
+	}
+
+	for(auto& event : events)
+	{
+		// The handler may call remove() for any token, so look it up each time
+		auto it = m_registrations.find(event.token);
+		if(it == m_registrations.end())
+			continue;
+
+		Handler handler = it->second.handler;
+		if(event.closed)
+		{
+			it->second.shard->load--;
+			m_registrations.erase(it);
+		}
+
+		handler(event);
+	}
+}
+
+}
+
+}
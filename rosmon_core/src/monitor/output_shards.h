@@ -0,0 +1,119 @@
+// Reads node output on a pool of event loop threads
+// Author: Max Schwarz <max.schwarz@uni-bonn.de>
+
+#ifndef ROSMON_MONITOR_OUTPUT_SHARDS_H
+#define ROSMON_MONITOR_OUTPUT_SHARDS_H
+
+#include "../fd_watcher.h"
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace rosmon
+{
+
+class Histogram;
+
+namespace monitor
+{
+
+/**
+ * @brief Drains node PTYs on N threads, independent of the main loop
+ *
+ * On the main loop, a burst of output from one node (or a slow UI or log
+ * file) delays reading the PTYs of all other nodes. Once the kernel buffer
+ * of a PTY is full, the node blocks in write(), which stalls real-time
+ * nodes that log.
+ *
+ * Here, each output fd is assigned to one of N shards. Each shard runs its
+ * own poll() loop and line splitter, so nodes are only blocked if rosmon
+ * falls behind by more than a generous in-memory queue. Adding and
+ * removing fds is marshalled to the shard through a command queue.
+ *
+ * Events are passed back to the main loop through a pipe registered with
+ * the FDWatcher, merged across shards in order of their read time and
+ * dispatched to the registered handlers. So all node state, the UI and the
+ * Logger are still only touched from the main thread.
+ **/
+class OutputShards
+{
+public:
+	typedef std::shared_ptr<OutputShards> Ptr;
+	typedef std::chrono::steady_clock Clock;
+
+	struct Event
+	{
+		Clock::time_point time;
+		uint64_t token;
+
+		//! Number of bytes read
+		std::size_t bytes = 0;
+
+		//! Completed lines, including the trailing newline
+		std::vector<std::string> lines;
+
+		//! EOF or error, the shard has dropped the fd. The fd is not closed.
+		bool closed = false;
+
+		//! Why the shard stopped reading, empty on EOF
+		std::string error;
+	};
+
+	typedef std::function<void(const Event&)> Handler;
+
+	OutputShards(unsigned int threads, FDWatcher::Ptr fdWatcher);
+	~OutputShards();
+
+	OutputShards(const OutputShards&) = delete;
+	OutputShards& operator=(const OutputShards&) = delete;
+
+	inline unsigned int threadCount() const
+	{ return m_shards.size(); }
+
+	/**
+	 * @brief Start reading from fd on the least loaded shard
+	 *
+	 * @param name Name for debugging purposes
+	 * @param handler Called on the main loop for each batch of output. After
+	 *   an event with Event::closed set, the handler is dropped.
+	 * @return Token for remove()
+	 **/
+	uint64_t add(int fd, const std::string& name, const Handler& handler);
+
+	/**
+	 * @brief Stop reading from the fd registered under token
+	 *
+	 * Blocks until the shard does not touch the fd anymore, so the caller
+	 * may close it afterwards. Pending events are discarded.
+	 **/
+	void remove(uint64_t token);
+private:
+	class Shard;
+
+	void handleEvents(int fd);
+
+	FDWatcher::Ptr m_fdWatcher;
+	int m_pipe[2];
+
+	std::vector<std::unique_ptr<Shard>> m_shards;
+
+	// Only touched by the main thread
+	struct Registration
+	{
+		Shard* shard;
+		Handler handler;
+	};
+	uint64_t m_nextToken = 1;
+	std::map<uint64_t, Registration> m_registrations;
+	Histogram* m_dispatch;
+};
+
+}
+
+}
+
+#endif
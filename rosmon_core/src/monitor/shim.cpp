@@ -1,12 +1,16 @@
 // Sets up a node process environment and executes the target node
 // Author: Max Schwarz <max.schwarz@ais.uni-bonn.de>
 
+#include <climits>
 #include <stdexcept>
+#include <string>
 #include <vector>
 #include <sstream>
 
+#include <fcntl.h>
 #include <unistd.h>
 #include <getopt.h>
+#include <sched.h>
 #include <string.h>
 
 #include <utmp.h>
@@ -14,6 +18,9 @@
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <sys/prctl.h>
+#include <sys/syscall.h>
+
+#include <linux/mempolicy.h>
 
 static const struct option OPTIONS[] = {
 	{"help", no_argument, nullptr, 'h'},
@@ -22,11 +29,146 @@ static const struct option OPTIONS[] = {
 	{"coredump", no_argument, nullptr, 'c'},
 	{"coredump-relative", required_argument, nullptr, 'C'},
 	{"tty", required_argument, nullptr, 't'},
+	{"stdout", required_argument, nullptr, 'o'},
+	{"stderr", required_argument, nullptr, 'E'},
+	{"cpu-affinity", required_argument, nullptr, 'a'},
+	{"nice", required_argument, nullptr, 'N'},
+	{"sched-policy", required_argument, nullptr, 'p'},
+	{"sched-priority", required_argument, nullptr, 'P'},
+	{"mlockall", required_argument, nullptr, 'm'},
+	{"memlock-limit", required_argument, nullptr, 'M'},
+	{"numa-policy", required_argument, nullptr, 'u'},
+	{"numa-nodes", required_argument, nullptr, 'U'},
+	{"exec-fd", required_argument, nullptr, 'x'},
 	{"run", required_argument, nullptr, 'r'},
 
 	{nullptr, 0, nullptr, 0}
 };
 
+// Parse a comma-separated list of indices
+template<class Callback>
+static void parseList(const char* list, Callback&& cb)
+{
+	for(const char* p = list; *p; )
+	{
+		char* end;
+		unsigned long value = strtoul(p, &end, 10);
+		if(end == p)
+			break;
+
+		cb(value);
+
+		p = (*end == ',') ? end + 1 : end;
+	}
+}
+
+// Format indices for which isSet(i) is true as "0-3,6"
+template<class Predicate>
+static std::string formatList(unsigned long count, Predicate&& isSet)
+{
+	std::stringstream ss;
+	for(unsigned long i = 0; i < count; ++i)
+	{
+		if(!isSet(i))
+			continue;
+
+		unsigned long last = i;
+		while(last+1 < count && isSet(last+1))
+			last++;
+
+		if(ss.tellp() != 0)
+			ss << ",";
+
+		if(last == i)
+			ss << i;
+		else
+			ss << i << "-" << last;
+
+		i = last;
+	}
+
+	return ss.str();
+}
+
+static const char* schedPolicyName(int policy)
+{
+	switch(policy)
+	{
+		case SCHED_OTHER: return "other";
+		case SCHED_BATCH: return "batch";
+		case SCHED_IDLE: return "idle";
+		case SCHED_FIFO: return "fifo";
+		case SCHED_RR: return "rr";
+		default: return "unknown";
+	}
+}
+
+static const char* numaPolicyName(int mode)
+{
+	switch(mode)
+	{
+		case MPOL_DEFAULT: return "default";
+		case MPOL_BIND: return "bind";
+		case MPOL_PREFERRED: return "preferred";
+		case MPOL_INTERLEAVE: return "interleave";
+		case MPOL_LOCAL: return "local";
+		default: return "unknown";
+	}
+}
+
+// Print the effective placement of this process (inherited by the node)
+static void reportPlacement(bool mlockRequested)
+{
+	std::stringstream ss;
+
+	cpu_set_t cpus;
+	if(sched_getaffinity(0, sizeof(cpus), &cpus) == 0)
+		ss << "CPUs " << formatList(CPU_SETSIZE, [&](unsigned long i){ return CPU_ISSET(i, &cpus); });
+
+	int policy = sched_getscheduler(0);
+	sched_param param{};
+	if(policy >= 0 && sched_getparam(0, &param) == 0)
+	{
+		ss << ", policy " << schedPolicyName(policy);
+		if(policy == SCHED_FIFO || policy == SCHED_RR)
+			ss << "/" << param.sched_priority;
+	}
+
+	errno = 0;
+	int nice = getpriority(PRIO_PROCESS, 0);
+	if(errno == 0)
+		ss << ", nice " << nice;
+
+	constexpr unsigned long MAX_NUMA_NODES = 1024;
+	unsigned long mask[MAX_NUMA_NODES / (8*sizeof(unsigned long))] = {};
+	int mode;
+	if(syscall(SYS_get_mempolicy, &mode, mask, MAX_NUMA_NODES, nullptr, 0) == 0)
+	{
+		ss << ", NUMA " << numaPolicyName(mode);
+		if(mode != MPOL_DEFAULT && mode != MPOL_LOCAL)
+		{
+			constexpr unsigned long BITS = 8*sizeof(unsigned long);
+			ss << " " << formatList(MAX_NUMA_NODES, [&](unsigned long i){ return (mask[i / BITS] >> (i % BITS)) & 1; });
+		}
+	}
+
+	rlimit limit;
+	if(getrlimit(RLIMIT_MEMLOCK, &limit) == 0)
+	{
+		ss << ", memlock limit ";
+		if(limit.rlim_cur == RLIM_INFINITY)
+			ss << "unlimited";
+		else
+			ss << limit.rlim_cur << " bytes";
+	}
+
+	if(mlockRequested)
+		ss << ", mlockall";
+
+	fprintf(stdout, "rosmon: placement: %s\n", ss.str().c_str());
+	fflush(stdout);
+}
+
 void usage()
 {
 	fprintf(stderr, R"EOS(
@@ -40,6 +182,18 @@ Options:
   --env=A=B                Set environment variable A to value B (can be repeated)
   --coredump               Enable coredump collection
   --coredump-relative=DIR  Coredumps should go to DIR
+  --tty=FD                 Use FD as controlling terminal and stdin/stdout/stderr
+  --stdout=FD              Use FD as stdout (instead of --tty)
+  --stderr=FD              Use FD as stderr (instead of --tty)
+  --cpu-affinity=A,B,...   Restrict to the given CPUs
+  --nice=N                 Set nice value
+  --sched-policy=POLICY    Set scheduling policy (SCHED_* value)
+  --sched-priority=PRIO    Static priority for --sched-policy
+  --mlockall=EXE           Lock all memory of node executable EXE (via LD_PRELOAD)
+  --memlock-limit=BYTES    Set RLIMIT_MEMLOCK (or "unlimited")
+  --numa-policy=MODE       Set NUMA memory policy (MPOL_* value)
+  --numa-nodes=A,B,...     NUMA nodes for --numa-policy
+  --exec-fd=FD             Close FD when executing the node (for tracing)
   --run <executable>       All arguments after this one are passed on
 )EOS");
 }
@@ -53,6 +207,21 @@ int main(int argc, char** argv)
 	int nodeOptionsBegin = -1;
 
 	int tty = -1;
+	int stdoutFD = -1;
+	int stderrFD = -1;
+
+	char* cpuAffinity = nullptr;
+	bool niceSet = false;
+	int nice = 0;
+	int schedPolicy = -1;
+	int schedPriority = 0;
+
+	char* mlockAll = nullptr;
+	char* memlockLimit = nullptr;
+	int numaPolicy = -1;
+	char* numaNodes = nullptr;
+
+	int execFD = -1;
 
 	while(true)
 	{
@@ -93,6 +262,40 @@ int main(int argc, char** argv)
 			case 't':
 				tty = atoi(optarg);
 				break;
+			case 'o':
+				stdoutFD = atoi(optarg);
+				break;
+			case 'E':
+				stderrFD = atoi(optarg);
+				break;
+			case 'a':
+				cpuAffinity = optarg;
+				break;
+			case 'N':
+				niceSet = true;
+				nice = atoi(optarg);
+				break;
+			case 'p':
+				schedPolicy = atoi(optarg);
+				break;
+			case 'P':
+				schedPriority = atoi(optarg);
+				break;
+			case 'm':
+				mlockAll = optarg;
+				break;
+			case 'M':
+				memlockLimit = optarg;
+				break;
+			case 'u':
+				numaPolicy = atoi(optarg);
+				break;
+			case 'U':
+				numaNodes = optarg;
+				break;
+			case 'x':
+				execFD = atoi(optarg);
+				break;
 			case 'r':
 				nodeExecutable = optarg;
 				nodeOptionsBegin = optind;
@@ -106,14 +309,46 @@ int main(int argc, char** argv)
 	if(!nodeExecutable)
 		throw std::invalid_argument("Need --run option");
 
-	if(tty < 0)
-		throw std::invalid_argument("Need --tty option");
-
-	if(login_tty(tty) != 0)
+	if(tty >= 0)
 	{
-		perror("Could not call login_tty()");
-		std::abort();
+		if(login_tty(tty) != 0)
+		{
+			perror("Could not call login_tty()");
+			std::abort();
+		}
 	}
+	else if(stdoutFD >= 0 && stderrFD >= 0)
+	{
+		// Own session as with login_tty(), so that rosmon can signal the
+		// whole process group.
+		setsid();
+
+		int devnull = open("/dev/null", O_RDONLY);
+		if(devnull < 0 || dup2(devnull, STDIN_FILENO) < 0 || dup2(stdoutFD, STDOUT_FILENO) < 0 || dup2(stderrFD, STDERR_FILENO) < 0)
+		{
+			perror("Could not set up output pipes");
+			std::abort();
+		}
+
+		// The fds may already be the standard streams, or the same fd (raw
+		// output), so be careful not to close what we just set up.
+		auto closeExtra = [](int fd) {
+			if(fd != STDIN_FILENO && fd != STDOUT_FILENO && fd != STDERR_FILENO)
+				close(fd);
+		};
+
+		closeExtra(devnull);
+		closeExtra(stdoutFD);
+		if(stderrFD != stdoutFD)
+			closeExtra(stderrFD);
+
+		// stdio buffers pipes fully. Ask rosconsole and Python to write
+		// line by line, unless the user configured something else.
+		setenv("ROSCONSOLE_STDOUT_LINE_BUFFERED", "1", 0);
+		setenv("PYTHONUNBUFFERED", "1", 0);
+	}
+	else
+		throw std::invalid_argument("Need --tty or --stdout and --stderr options");
 
 	// Try to enable core dumps
 	if(coredumpsEnabled)
@@ -150,6 +385,103 @@ int main(int argc, char** argv)
 		}
 	}
 
+	// Scheduling settings are inherited across exec(). Failures (usually
+	// missing privileges) are reported on the node output, but the node
+	// is started anyway.
+	if(cpuAffinity)
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+
+		parseList(cpuAffinity, [&](unsigned long cpu) {
+			if(cpu < CPU_SETSIZE)
+				CPU_SET(cpu, &set);
+		});
+
+		if(sched_setaffinity(0, sizeof(set), &set) != 0)
+			fprintf(stderr, "rosmon: Could not set CPU affinity to %s: %s\n", cpuAffinity, strerror(errno));
+	}
+
+	if(schedPolicy >= 0)
+	{
+		sched_param param{};
+		param.sched_priority = schedPriority;
+
+		if(sched_setscheduler(0, schedPolicy, &param) != 0)
+		{
+			fprintf(stderr, "rosmon: Could not set scheduling policy %d with priority %d: %s\n",
+				schedPolicy, schedPriority, strerror(errno)
+			);
+		}
+	}
+
+	if(niceSet)
+	{
+		if(setpriority(PRIO_PROCESS, 0, nice) != 0)
+			fprintf(stderr, "rosmon: Could not set nice value %d: %s\n", nice, strerror(errno));
+	}
+
+	// Memory placement (RLIMIT_MEMLOCK and the NUMA policy survive exec())
+	if(memlockLimit || mlockAll)
+	{
+		rlimit limit;
+		if(getrlimit(RLIMIT_MEMLOCK, &limit) == 0)
+		{
+			if(!memlockLimit)
+				limit.rlim_cur = limit.rlim_max; // as much as we are allowed
+			else if(strcmp(memlockLimit, "unlimited") == 0)
+				limit.rlim_cur = limit.rlim_max = RLIM_INFINITY;
+			else
+				limit.rlim_cur = limit.rlim_max = strtoull(memlockLimit, nullptr, 10);
+
+			if(setrlimit(RLIMIT_MEMLOCK, &limit) != 0)
+				fprintf(stderr, "rosmon: Could not set RLIMIT_MEMLOCK: %s\n", strerror(errno));
+		}
+	}
+
+	if(numaPolicy >= 0 && numaNodes)
+	{
+		constexpr unsigned long MAX_NUMA_NODES = 1024;
+		constexpr unsigned long BITS = 8*sizeof(unsigned long);
+		unsigned long mask[MAX_NUMA_NODES / BITS] = {};
+
+		parseList(numaNodes, [&](unsigned long node) {
+			if(node < MAX_NUMA_NODES)
+				mask[node / BITS] |= 1UL << (node % BITS);
+		});
+
+		if(syscall(SYS_set_mempolicy, numaPolicy, mask, MAX_NUMA_NODES) != 0)
+			fprintf(stderr, "rosmon: Could not set NUMA policy %s on nodes %s: %s\n", numaPolicyName(numaPolicy), numaNodes, strerror(errno));
+	}
+
+	if(mlockAll)
+	{
+		// Locks do not survive exec(), so we lock from inside the node
+		// process using a preloaded library, which lives next to us.
+		// The library only locks in the image running the node executable,
+		// see mlock_preload.cpp.
+		char self[PATH_MAX];
+		ssize_t len = readlink("/proc/self/exe", self, sizeof(self)-1);
+		if(len > 0)
+		{
+			self[len] = 0;
+			std::string lib = self;
+			lib = lib.substr(0, lib.rfind('/')) + "/librosmon_mlock.so";
+
+			const char* preload = getenv("LD_PRELOAD");
+			if(preload && preload[0])
+				lib += std::string(":") + preload;
+
+			setenv("LD_PRELOAD", lib.c_str(), 1);
+			setenv("ROSMON_MLOCKALL", mlockAll, 1);
+		}
+		else
+			fprintf(stderr, "rosmon: Could not find mlock library: %s\n", strerror(errno));
+	}
+
+	if(cpuAffinity || niceSet || schedPolicy >= 0 || mlockAll || memlockLimit || numaPolicy >= 0)
+		reportPlacement(mlockAll != nullptr);
+
 	// Allow gdb to attach
 	prctl(PR_SET_PTRACER, PR_SET_PTRACER_ANY);
 
@@ -163,6 +495,10 @@ int main(int argc, char** argv)
 
 	args.push_back(nullptr);
 
+	// rosmon watches for this fd to be closed
+	if(execFD >= 0)
+		fcntl(execFD, F_SETFD, FD_CLOEXEC);
+
 	// Go!
 	if(execvp(nodeExecutable, args.data()) != 0)
 	{
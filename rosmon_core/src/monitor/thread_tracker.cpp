@@ -0,0 +1,164 @@
+// Per-thread CPU usage of a single process
+// Author: Max Schwarz <max.schwarz@uni-bonn.de>
+
+#include "thread_tracker.h"
+
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+namespace rosmon
+{
+
+namespace monitor
+{
+
+namespace
+{
+	// glibc < 2.30 has no getdents64() wrapper
+	struct LinuxDirent64
+	{
+		uint64_t d_ino;
+		int64_t d_off;
+		unsigned short d_reclen;
+		unsigned char d_type;
+		char d_name[];
+	};
+}
+
+ThreadTracker::ThreadTracker(unsigned long pid)
+{
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/%lu/task", pid);
+
+	m_taskFD = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+ThreadTracker::~ThreadTracker()
+{
+	if(m_taskFD >= 0)
+		close(m_taskFD);
+}
+
+template<typename Callback>
+bool ThreadTracker::forEachThread(Callback&& callback)
+{
+	if(m_taskFD < 0)
+		return false;
+
+	// Rewind the directory, /proc re-generates the listing
+	if(lseek(m_taskFD, 0, SEEK_SET) != 0)
+		return false;
+
+	alignas(LinuxDirent64) char buf[4096];
+
+	while(true)
+	{
+		long size = syscall(SYS_getdents64, m_taskFD, buf, sizeof(buf));
+		if(size < 0)
+			return false;
+		if(size == 0)
+			break;
+
+		for(long off = 0; off < size;)
+		{
+			auto entry = reinterpret_cast<LinuxDirent64*>(buf + off);
+			off += entry->d_reclen;
+
+			if(entry->d_name[0] < '0' || entry->d_name[0] > '9')
+				continue;
+
+			callback(strtoul(entry->d_name, nullptr, 10));
+		}
+	}
+
+	return true;
+}
+
+bool ThreadTracker::update()
+{
+	m_threads.clear();
+
+	bool initial = (m_generation == 0);
+	m_generation++;
+
+	char path[64];
+	char name[64];
+
+	bool ok = forEachThread([&](unsigned long tid) {
+		snprintf(path, sizeof(path), "%lu/stat", tid);
+		process_info::ProcessStat stat;
+		if(!process_info::readStatFileAt(m_taskFD, path, &stat))
+			return; // Thread exited in the meantime
+
+		auto it = m_entries.find(tid);
+		bool isNew = (it == m_entries.end());
+		if(isNew)
+		{
+			it = m_entries.emplace(tid, Entry{}).first;
+
+			snprintf(path, sizeof(path), "%lu/comm", tid);
+			if(process_info::readCommFileAt(m_taskFD, path, name, sizeof(name)))
+				it->second.name = name;
+		}
+
+		Entry& e = it->second;
+
+		Thread thread;
+		thread.tid = tid;
+		thread.name = e.name;
+		thread.userTime = (stat.utime >= e.utime && !(isNew && initial)) ? stat.utime - e.utime : 0;
+		thread.systemTime = (stat.stime >= e.stime && !(isNew && initial)) ? stat.stime - e.stime : 0;
+		m_threads.push_back(std::move(thread));
+
+		e.utime = stat.utime;
+		e.stime = stat.stime;
+		e.generation = m_generation;
+	});
+	if(!ok)
+		return false;
+
+	// Forget exited threads
+	for(auto it = m_entries.begin(); it != m_entries.end();)
+	{
+		if(it->second.generation != m_generation)
+			it = m_entries.erase(it);
+		else
+			++it;
+	}
+
+	return !m_threads.empty();
+}
+
+bool ThreadTracker::readStatus(process_info::ProcessStatus* status)
+{
+	process_info::ProcessStatus sum{0, 0};
+	bool found = false;
+	char path[64];
+
+	bool ok = forEachThread([&](unsigned long tid) {
+		snprintf(path, sizeof(path), "%lu/status", tid);
+
+		process_info::ProcessStatus thread;
+		if(!process_info::readStatusFileAt(m_taskFD, path, &thread))
+			return; // Thread exited in the meantime
+
+		sum.voluntary_ctxt_switches += thread.voluntary_ctxt_switches;
+		sum.nonvoluntary_ctxt_switches += thread.nonvoluntary_ctxt_switches;
+		found = true;
+	});
+
+	if(!ok || !found)
+		return false;
+
+	*status = sum;
+	return true;
+}
+
+}
+
+}
@@ -0,0 +1,92 @@
+// Per-thread CPU usage of a single process
+// Author: Max Schwarz <max.schwarz@uni-bonn.de>
+
+#ifndef ROSMON_MONITOR_THREAD_TRACKER_H
+#define ROSMON_MONITOR_THREAD_TRACKER_H
+
+#include "linux_process_info.h"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace rosmon
+{
+
+namespace monitor
+{
+
+/**
+ * @brief Tracks CPU time of all threads of one process
+ *
+ * Keeps /proc/<pid>/task open for the lifetime of the process, so that each
+ * update only needs one getdents64() call on the cached directory fd and one
+ * openat() per thread, without any path lookups from the root directory.
+ * Thread names are read once, when a thread is first seen.
+ *
+ * The same listing is used to sum up per-thread scheduler counters.
+ **/
+class ThreadTracker
+{
+public:
+	struct Thread
+	{
+		unsigned long tid;
+		std::string name;
+		process_info::jiffies_t userTime;   //!< User time since last update
+		process_info::jiffies_t systemTime; //!< System time since last update
+	};
+
+	explicit ThreadTracker(unsigned long pid);
+	~ThreadTracker();
+
+	ThreadTracker(const ThreadTracker&) = delete;
+	ThreadTracker& operator=(const ThreadTracker&) = delete;
+
+	/**
+	 * @brief Re-read all threads
+	 *
+	 * Threads which appeared since the last update are accounted with their
+	 * full CPU time (except on the very first update).
+	 *
+	 * @return false if the process is gone
+	 **/
+	bool update();
+
+	/**
+	 * @brief Sum context switches over all threads
+	 *
+	 * The kernel only reports them per thread. Switches of threads that have
+	 * exited are lost, so the sum may decrease.
+	 *
+	 * @return false if the process is gone
+	 **/
+	bool readStatus(process_info::ProcessStatus* status);
+
+	//! Threads seen in the last update()
+	inline const std::vector<Thread>& threads() const
+	{ return m_threads; }
+private:
+	struct Entry
+	{
+		std::string name;
+		process_info::jiffies_t utime = 0;
+		process_info::jiffies_t stime = 0;
+		unsigned int generation = 0;
+	};
+
+	template<typename Callback>
+	bool forEachThread(Callback&& callback);
+
+	int m_taskFD = -1;
+
+	unsigned int m_generation = 0;
+	std::unordered_map<unsigned long, Entry> m_entries;
+	std::vector<Thread> m_threads;
+};
+
+}
+
+}
+
+#endif
@@ -4,12 +4,117 @@
 #include "ros_interface.h"
 
 #include <rosmon_msgs/State.h>
+#include <rosmon_msgs/StateDelta.h>
 
 #include <algorithm>
+#include <cmath>
+
+#include <fnmatch.h>
+
+#include <boost/regex.hpp>
+
+#include <fmt/format.h>
+
+#include "self_stats.h"
 
 namespace rosmon
 {
 
+namespace
+{
+	// Delay for publishing after a state change, so that e.g. a whole
+	// group of nodes exiting results in a single message.
+	const ros::WallDuration STATE_CHANGE_DELAY(0.02);
+
+	// Resource usage changes below these thresholds are not sent as
+	// delta updates (they are still contained in the next keyframe).
+	constexpr double DELTA_LOAD_THRESHOLD = 0.005;
+	constexpr double DELTA_MEMORY_THRESHOLD = 0.01; // relative
+
+	std::string fullName(const std::string& name, const std::string& ns)
+	{
+		return ns + "/" + name;
+	}
+
+	uint8_t stateToMsg(monitor::NodeMonitor::State state)
+	{
+		switch(state)
+		{
+			case monitor::NodeMonitor::STATE_RUNNING:
+				return rosmon_msgs::NodeState::RUNNING;
+			case monitor::NodeMonitor::STATE_CRASHED:
+				return rosmon_msgs::NodeState::CRASHED;
+			case monitor::NodeMonitor::STATE_IDLE:
+				return rosmon_msgs::NodeState::IDLE;
+			case monitor::NodeMonitor::STATE_WAITING:
+				return rosmon_msgs::NodeState::WAITING;
+			case monitor::NodeMonitor::STATE_BACKOFF:
+				return rosmon_msgs::NodeState::BACKOFF;
+			case monitor::NodeMonitor::STATE_FAILED:
+				return rosmon_msgs::NodeState::FAILED;
+		}
+
+		return rosmon_msgs::NodeState::IDLE;
+	}
+
+	rosmon_msgs::NodeState nodeStateToMsg(const monitor::NodeMonitor& node)
+	{
+		rosmon_msgs::NodeState nstate;
+		nstate.name = node.name();
+		nstate.ns = node.namespaceString();
+
+		nstate.state = stateToMsg(node.state());
+
+		nstate.restart_count = node.restartCount();
+		nstate.respawn_delay = node.respawnDelay();
+		nstate.liveness_failures = node.livenessFailures();
+
+		nstate.user_load = node.userLoad();
+		nstate.system_load = node.systemLoad();
+
+		nstate.memory = node.memory();
+
+		nstate.memory_pss = node.memoryPSS();
+		nstate.memory_uss = node.memoryUSS();
+		nstate.memory_swap = node.memorySwap();
+
+		nstate.minor_fault_rate = node.minorFaultRate();
+		nstate.major_fault_rate = node.majorFaultRate();
+		nstate.voluntary_switch_rate = node.voluntarySwitchRate();
+		nstate.involuntary_switch_rate = node.involuntarySwitchRate();
+		nstate.read_rate = node.readRate();
+		nstate.write_rate = node.writeRate();
+
+		return nstate;
+	}
+
+	rosmon_msgs::NodeStateUpdate nodeUpdateToMsg(std::size_t index, const monitor::NodeMonitor& node)
+	{
+		rosmon_msgs::NodeStateUpdate update;
+		update.index = index;
+		update.state = stateToMsg(node.state());
+		update.restart_count = node.restartCount();
+		update.user_load = node.userLoad();
+		update.system_load = node.systemLoad();
+		update.memory = node.memory();
+
+		return update;
+	}
+
+	bool significantChange(const rosmon_msgs::NodeStateUpdate& a, const rosmon_msgs::NodeStateUpdate& b)
+	{
+		if(a.state != b.state || a.restart_count != b.restart_count)
+			return true;
+
+		if(std::abs(a.user_load - b.user_load) > DELTA_LOAD_THRESHOLD
+			|| std::abs(a.system_load - b.system_load) > DELTA_LOAD_THRESHOLD)
+			return true;
+
+		double memDiff = std::abs(static_cast<double>(a.memory) - static_cast<double>(b.memory));
+		return memDiff > DELTA_MEMORY_THRESHOLD * std::max<double>(a.memory, b.memory);
+	}
+}
+
 ROSInterface::ROSInterface(monitor::Monitor* monitor, LaunchInfo* launchInfo, bool enableDiagnostics,
                            const std::string& diagnosticsPrefix)
  : m_monitor(monitor)
@@ -26,13 +131,175 @@ ROSInterface::ROSInterface(monitor::Monitor* monitor, LaunchInfo* launchInfo, bo
 
 	m_pub_state = m_nh.advertise<rosmon_msgs::State>("ros_monitor", 10, true);
 
+	m_eventTimer = m_nh.createWallTimer(STATE_CHANGE_DELAY, boost::bind(&ROSInterface::handleStateChange, this), true, false);
+
+	for(auto& node : m_monitor->nodes())
+		connectNode(node);
+
+	m_stateConnections.push_back(m_monitor->nodeAddedSignal.connect(boost::bind(&ROSInterface::connectNode, this, _1)));
+	m_stateConnections.push_back(m_monitor->nodesChangedSignal.connect(boost::bind(&ROSInterface::handleNodesChanged, this)));
+
+	rebuildNodeIndex();
+
+	m_pendingStartTimer = m_nh.createWallTimer(ros::WallDuration(0.1), boost::bind(&ROSInterface::checkPendingStarts, this), false, false);
+
 	m_srv_startStop = m_nh.advertiseService("start_stop", &ROSInterface::handleStartStop, this);
+	m_srv_startStopMulti = m_nh.advertiseService("start_stop_multi", &ROSInterface::handleStartStopMulti, this);
+	m_srv_getHistory = m_nh.advertiseService("get_history", &ROSInterface::handleGetHistory, this);
+	m_srv_getThreads = m_nh.advertiseService("get_threads", &ROSInterface::handleGetThreads, this);
+	m_srv_getSelfStats = m_nh.advertiseService("get_self_stats", &ROSInterface::handleGetSelfStats, this);
+
+	m_pub_selfStats = m_nh.advertise<rosmon_msgs::SelfStats>("self_stats", 1);
 
 	if(m_diagnosticsEnabled)
 		m_diagnosticsPublisher.reset(new DiagnosticsPublisher(diagnosticsPrefix));
 }
 
+ROSInterface::~ROSInterface()
+{
+	for(auto& connection : m_stateConnections)
+		connection.disconnect();
+}
+
+void ROSInterface::connectNode(const monitor::NodeMonitor::Ptr& node)
+{
+	m_stateConnections.push_back(node->stateChangedSignal.connect([this](const std::string&) {
+		schedulePublish();
+	}));
+}
+
+void ROSInterface::schedulePublish()
+{
+	if(m_eventPending)
+		return;
+
+	// A one-shot timer needs to be stopped before it can be re-armed
+	m_eventPending = true;
+	m_eventTimer.stop();
+	m_eventTimer.start();
+}
+
+void ROSInterface::handleNodesChanged()
+{
+	rebuildNodeIndex();
+
+	// Indices in the delta stream are only valid within a keyframe
+	m_lastKeyframe = ros::WallTime();
+	m_lastUpdates.clear();
+
+	// Do not start nodes that have been removed in the meantime
+	const auto& nodes = m_monitor->nodes();
+	for(auto& group : m_pendingStarts)
+	{
+		group.erase(std::remove_if(group.begin(), group.end(), [&](const monitor::NodeMonitor::Ptr& node) {
+			return std::find(nodes.begin(), nodes.end(), node) == nodes.end();
+		}), group.end());
+	}
+
+	publishState();
+}
+
+void ROSInterface::setReloadHandler(const ReloadHandler& handler)
+{
+	m_reloadHandler = handler;
+	m_srv_reload = m_nh.advertiseService("reload", &ROSInterface::handleReload, this);
+}
+
+bool ROSInterface::handleReload(rosmon_msgs::ReloadRequest&, rosmon_msgs::ReloadResponse& resp)
+{
+	monitor::Monitor::ReloadResult result;
+	try
+	{
+		result = m_reloadHandler();
+	}
+	catch(std::exception& e)
+	{
+		resp.success = false;
+		resp.message = e.what();
+		return true;
+	}
+
+	resp.success = true;
+	resp.started = result.started;
+	resp.stopped = result.stopped;
+	resp.restarted = result.restarted;
+	resp.updated = result.updated;
+	resp.parameters_set = result.parametersSet;
+	resp.parameters_deleted = result.parametersDeleted;
+
+	return true;
+}
+
+void ROSInterface::setUpdatePeriod(double seconds)
+{
+	m_updateTimer.setPeriod(ros::WallDuration(seconds));
+}
+
+void ROSInterface::enableDeltaPublishing(double keyframePeriod)
+{
+	m_deltaEnabled = true;
+	m_keyframePeriod = ros::WallDuration(keyframePeriod);
+
+	// Not latched: the last message is usually not a keyframe, so a late
+	// subscriber could not use it. Instead, new subscribers trigger a
+	// keyframe right away.
+	m_pub_stateDelta = m_nh.advertise<rosmon_msgs::StateDelta>("ros_monitor_delta", 10,
+		boost::bind(&ROSInterface::handleDeltaSubscriber, this)
+	);
+}
+
+void ROSInterface::handleDeltaSubscriber()
+{
+	m_lastKeyframe = ros::WallTime();
+	schedulePublish();
+}
+
+void ROSInterface::enableLogStreaming(double flushPeriod, unsigned int maxLines)
+{
+	m_logStreamer.reset(new LogStreamer(m_monitor, m_nh, flushPeriod, maxLines));
+}
+
+void ROSInterface::rebuildNodeIndex()
+{
+	m_nodeIndex.clear();
+
+	const auto& nodes = m_monitor->nodes();
+	m_nodeIndex.reserve(nodes.size());
+	for(std::size_t i = 0; i < nodes.size(); ++i)
+		m_nodeIndex[fullName(nodes[i]->name(), nodes[i]->namespaceString())] = i;
+}
+
+monitor::NodeMonitor::Ptr ROSInterface::findNode(const std::string& name, const std::string& ns) const
+{
+	auto it = m_nodeIndex.find(fullName(name, ns));
+	if(it == m_nodeIndex.end())
+		return {};
+
+	return m_monitor->nodes()[it->second];
+}
+
 void ROSInterface::update()
+{
+	if(m_diagnosticsPublisher)
+		m_diagnosticsPublisher->publish(m_monitor->nodes());
+
+	publishState();
+
+	if(m_pub_selfStats.getNumSubscribers() != 0)
+	{
+		rosmon_msgs::SelfStats msg;
+		fillSelfStats(&msg, &m_topicRates);
+		m_pub_selfStats.publish(msg);
+	}
+}
+
+void ROSInterface::handleStateChange()
+{
+	m_eventPending = false;
+	publishState();
+}
+
+void ROSInterface::publishState()
 {
 	rosmon_msgs::State state;
 	state.header.stamp = ros::Time::now();
@@ -40,82 +307,390 @@ void ROSInterface::update()
 	state.launch_group = m_launchInfo->launch_group;
 	state.launch_config = m_launchInfo->launch_config;
 
-	if(m_diagnosticsPublisher)
-		m_diagnosticsPublisher->publish(m_monitor->nodes());
-
+	state.nodes.reserve(m_monitor->nodes().size());
 	for(auto& node : m_monitor->nodes())
+		state.nodes.push_back(nodeStateToMsg(*node));
+
+	m_pub_state.publish(state);
+
+	if(m_deltaEnabled)
+		publishDelta();
+}
+
+void ROSInterface::publishDelta()
+{
+	const auto& nodes = m_monitor->nodes();
+	auto now = ros::WallTime::now();
+
+	rosmon_msgs::StateDelta delta;
+	delta.header.stamp = ros::Time::now();
+
+	bool keyframe = m_lastUpdates.size() != nodes.size()
+		|| m_lastKeyframe.isZero()
+		|| now - m_lastKeyframe >= m_keyframePeriod;
+
+	if(keyframe)
 	{
-		rosmon_msgs::NodeState nstate;
-		nstate.name = node->name();
-		nstate.ns = node->namespaceString();
+		m_keyframeSeq++;
+		m_lastKeyframe = now;
+
+		delta.keyframe = true;
+		delta.keyframe_seq = m_keyframeSeq;
 
-		switch(node->state())
+		delta.nodes.reserve(nodes.size());
+		m_lastUpdates.resize(nodes.size());
+		for(std::size_t i = 0; i < nodes.size(); ++i)
 		{
-			case monitor::NodeMonitor::STATE_RUNNING:
-				nstate.state = nstate.RUNNING;
-				break;
-			case monitor::NodeMonitor::STATE_CRASHED:
-				nstate.state = nstate.CRASHED;
-				break;
-			case monitor::NodeMonitor::STATE_IDLE:
-				nstate.state = nstate.IDLE;
-				break;
-			case monitor::NodeMonitor::STATE_WAITING:
-				nstate.state = nstate.WAITING;
-				break;
-			default:
-				nstate.state = nstate.IDLE;
-				break;
+			delta.nodes.push_back(nodeStateToMsg(*nodes[i]));
+			m_lastUpdates[i] = nodeUpdateToMsg(i, *nodes[i]);
 		}
+	}
+	else
+	{
+		delta.keyframe = false;
+		delta.keyframe_seq = m_keyframeSeq;
 
-		nstate.restart_count = node->restartCount();
-
-		nstate.user_load = node->userLoad();
-		nstate.system_load = node->systemLoad();
+		for(std::size_t i = 0; i < nodes.size(); ++i)
+		{
+			auto update = nodeUpdateToMsg(i, *nodes[i]);
+			if(!significantChange(update, m_lastUpdates[i]))
+				continue;
 
-		nstate.memory = node->memory();
+			delta.updates.push_back(update);
+			m_lastUpdates[i] = update;
+		}
 
-		state.nodes.push_back(nstate);
+		// Nothing to say
+		if(delta.updates.empty())
+			return;
 	}
 
-	m_pub_state.publish(state);
+	m_pub_stateDelta.publish(delta);
 }
 
 bool ROSInterface::handleStartStop(rosmon_msgs::StartStopRequest& req, rosmon_msgs::StartStopResponse&)
 {
-	auto it = std::find_if(
-		m_monitor->nodes().begin(), m_monitor->nodes().end(),
-		[&](const monitor::NodeMonitor::ConstPtr& n){ return (n->name() == req.node) && (n->namespaceString() == req.ns); }
-	);
-
-	if(it == m_monitor->nodes().end())
+	auto node = findNode(req.node, req.ns);
+	if(!node)
 		return false;
 
 	switch(req.action)
 	{
 		case rosmon_msgs::StartStopRequest::START:
-			(*it)->start();
+			node->start();
 			break;
 		case rosmon_msgs::StartStopRequest::STOP:
-			(*it)->stop();
+			node->stop();
 			break;
 		case rosmon_msgs::StartStopRequest::RESTART:
-			(*it)->restart();
+			node->restart();
 			break;
 	}
 
 	return true;
 }
 
+bool ROSInterface::handleStartStopMulti(rosmon_msgs::StartStopMultiRequest& req, rosmon_msgs::StartStopMultiResponse& resp)
+{
+	const auto& nodes = m_monitor->nodes();
+
+	// Resolve patterns. Plain names are looked up in the index, everything
+	// else needs a scan over all nodes.
+	std::vector<bool> selected(nodes.size(), false);
+	for(const auto& rawPattern : req.patterns)
+	{
+		std::string pattern = rawPattern;
+		if(!req.regex && !pattern.empty() && pattern[0] != '/' && pattern[0] != '*')
+			pattern = "/" + pattern;
+
+		bool matched = false;
+
+		if(!req.regex && pattern.find_first_of("*?[\\") == std::string::npos)
+		{
+			auto it = m_nodeIndex.find(pattern);
+			if(it != m_nodeIndex.end())
+			{
+				selected[it->second] = true;
+				matched = true;
+			}
+		}
+		else
+		{
+			boost::regex regex;
+			if(req.regex)
+			{
+				try
+				{
+					regex = boost::regex(pattern);
+				}
+				catch(boost::regex_error& e)
+				{
+					rosmon_msgs::StartStopResult result;
+					result.node = rawPattern;
+					result.success = false;
+					result.message = fmt::format("invalid regular expression: {}", e.what());
+					resp.results.push_back(result);
+					continue;
+				}
+			}
+
+			for(std::size_t i = 0; i < nodes.size(); ++i)
+			{
+				std::string name = fullName(nodes[i]->name(), nodes[i]->namespaceString());
+
+				bool match = req.regex
+					? boost::regex_match(name, regex)
+					: (fnmatch(pattern.c_str(), name.c_str(), 0) == 0);
+
+				if(match)
+				{
+					selected[i] = true;
+					matched = true;
+				}
+			}
+		}
+
+		if(!matched)
+		{
+			rosmon_msgs::StartStopResult result;
+			result.node = rawPattern;
+			result.success = false;
+			result.message = "no matching node";
+			resp.results.push_back(result);
+		}
+	}
+
+	std::vector<monitor::NodeMonitor::Ptr> group;
+	for(std::size_t i = 0; i < nodes.size(); ++i)
+	{
+		if(!selected[i])
+			continue;
+
+		auto& node = nodes[i];
+
+		rosmon_msgs::StartStopResult result;
+		result.node = node->name();
+		result.ns = node->namespaceString();
+		result.success = true;
+
+		switch(req.action)
+		{
+			case rosmon_msgs::StartStopMultiRequest::START:
+				node->start();
+				result.message = "started";
+				break;
+			case rosmon_msgs::StartStopMultiRequest::STOP:
+				node->stop();
+				result.message = "stopping";
+				break;
+			case rosmon_msgs::StartStopMultiRequest::RESTART:
+				if(req.stop_before_start)
+				{
+					node->stop();
+					group.push_back(node);
+					result.message = "stopping, will be started when the group has stopped";
+				}
+				else
+				{
+					node->restart();
+					result.message = "restarting";
+				}
+				break;
+			default:
+				result.success = false;
+				result.message = fmt::format("unknown action {}", req.action);
+				break;
+		}
+
+		resp.results.push_back(result);
+	}
+
+	if(!group.empty())
+	{
+		m_pendingStarts.push_back(std::move(group));
+		m_pendingStartTimer.start();
+	}
+
+	return true;
+}
+
+void ROSInterface::checkPendingStarts()
+{
+	for(auto it = m_pendingStarts.begin(); it != m_pendingStarts.end();)
+	{
+		bool stopped = std::none_of(it->begin(), it->end(), [](const monitor::NodeMonitor::Ptr& node) {
+			return node->running();
+		});
+
+		if(!stopped)
+		{
+			++it;
+			continue;
+		}
+
+		for(auto& node : *it)
+			node->start();
+
+		it = m_pendingStarts.erase(it);
+	}
+
+	if(m_pendingStarts.empty())
+		m_pendingStartTimer.stop();
+}
+
+bool ROSInterface::handleGetHistory(rosmon_msgs::GetHistoryRequest& req, rosmon_msgs::GetHistoryResponse& resp)
+{
+	auto node = findNode(req.node, req.ns);
+	if(!node)
+		return false;
+
+	const auto& history = node->history();
+
+	if(req.tier >= history.numTiers())
+		return false;
+
+	resp.num_tiers = history.numTiers();
+	resp.tier_interval = history.tierInterval(req.tier);
+
+	const auto& samples = history.samples(req.tier);
+	resp.samples.reserve(samples.size());
+
+	for(const auto& sample : samples)
+	{
+		ros::Time stamp(sample.stamp.sec, sample.stamp.nsec);
+		if(stamp <= req.since)
+			continue;
+
+		rosmon_msgs::HistorySample msg;
+		msg.stamp = stamp;
+		msg.duration = sample.duration;
+		msg.count = sample.count;
+
+		msg.user_load_min = sample.userLoad.min;
+		msg.user_load_avg = sample.userLoad.mean;
+		msg.user_load_max = sample.userLoad.max;
+
+		msg.system_load_min = sample.systemLoad.min;
+		msg.system_load_avg = sample.systemLoad.mean;
+		msg.system_load_max = sample.systemLoad.max;
+
+		msg.memory_min = sample.memory.min;
+		msg.memory_avg = sample.memory.mean;
+		msg.memory_max = sample.memory.max;
+
+		msg.threads_min = sample.threads.min;
+		msg.threads_avg = sample.threads.mean;
+		msg.threads_max = sample.threads.max;
+
+		msg.restart_count = sample.restartCount;
+
+		resp.samples.push_back(msg);
+	}
+
+	return true;
+}
+
+bool ROSInterface::handleGetThreads(rosmon_msgs::GetThreadsRequest& req, rosmon_msgs::GetThreadsResponse& resp)
+{
+	auto node = findNode(req.node, req.ns);
+	if(!node)
+		return false;
+
+	const auto& threads = node->topThreads();
+	resp.threads.reserve(threads.size());
+
+	for(const auto& thread : threads)
+	{
+		rosmon_msgs::ThreadState msg;
+		msg.pid = thread.pid;
+		msg.tid = thread.tid;
+		msg.name = thread.name;
+		msg.user_load = thread.userLoad;
+		msg.system_load = thread.systemLoad;
+
+		resp.threads.push_back(msg);
+	}
+
+	return true;
+}
+
+void ROSInterface::fillSelfStats(rosmon_msgs::SelfStats* msg, OutputRates* rates)
+{
+	const auto& stats = SelfStats::instance();
+
+	msg->stamp = ros::Time::now();
+	msg->uptime = stats.uptime();
+
+	msg->histograms.reserve(stats.histograms().size());
+	for(const auto& pair : stats.histograms())
+	{
+		rosmon_msgs::HistogramStats histogram;
+		histogram.name = pair.first;
+		histogram.count = pair.second.count();
+		histogram.mean = pair.second.mean();
+		histogram.p50 = pair.second.percentile(0.5);
+		histogram.p99 = pair.second.percentile(0.99);
+		histogram.max = pair.second.max();
+
+		msg->histograms.push_back(histogram);
+	}
+
+	double elapsed = msg->uptime - rates->lastTime;
+	rates->lastTime = msg->uptime;
+
+	msg->nodes.reserve(m_monitor->nodes().size());
+	for(const auto& node : m_monitor->nodes())
+	{
+		rosmon_msgs::NodeOutputStats output;
+		output.name = node->name();
+		output.ns = node->namespaceString();
+		output.lines = node->outputLines();
+		output.bytes = node->outputBytes();
+
+		auto& last = rates->lastTotals[fullName(output.name, output.ns)];
+		if(elapsed > 0 && output.lines >= last.first && output.bytes >= last.second)
+		{
+			output.lines_per_second = (output.lines - last.first) / elapsed;
+			output.bytes_per_second = (output.bytes - last.second) / elapsed;
+		}
+		last = {output.lines, output.bytes};
+
+		msg->nodes.push_back(output);
+	}
+}
+
+bool ROSInterface::handleGetSelfStats(rosmon_msgs::GetSelfStatsRequest&, rosmon_msgs::GetSelfStatsResponse& resp)
+{
+	// Rates since the previous service call
+	fillSelfStats(&resp.stats, &m_serviceRates);
+	return true;
+}
+
 void ROSInterface::shutdown()
 {
 	m_updateTimer.stop();
+	m_eventTimer.stop();
+
+	for(auto& connection : m_stateConnections)
+		connection.disconnect();
+
+	// Get rid of the last log lines
+	m_logStreamer.reset();
 
 	// Send empty state packet to clear the GUI
 	rosmon_msgs::State state;
 	state.header.stamp = ros::Time::now();
 	m_pub_state.publish(state);
 
+	if(m_deltaEnabled)
+	{
+		rosmon_msgs::StateDelta delta;
+		delta.header.stamp = state.header.stamp;
+		delta.keyframe = true;
+		delta.keyframe_seq = ++m_keyframeSeq;
+		m_pub_stateDelta.publish(delta);
+	}
+
 	// HACK: Currently there is no way to make sure that we sent a message.
 	usleep(200 * 1000);
 }
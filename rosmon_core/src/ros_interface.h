@@ -6,10 +6,22 @@
 
 #include "monitor/monitor.h"
 #include "diagnostics_publisher.h"
+#include "log_streamer.h"
 
 #include <ros/node_handle.h>
 
+#include <rosmon_msgs/GetHistory.h>
+#include <rosmon_msgs/GetSelfStats.h>
+#include <rosmon_msgs/GetThreads.h>
+#include <rosmon_msgs/NodeStateUpdate.h>
+#include <rosmon_msgs/Reload.h>
 #include <rosmon_msgs/StartStop.h>
+#include <rosmon_msgs/StartStopMulti.h>
+
+#include <boost/signals2/connection.hpp>
+
+#include <functional>
+#include <unordered_map>
 
 namespace rosmon
 {
@@ -26,11 +38,68 @@ public:
 	ROSInterface(monitor::Monitor* monitor, LaunchInfo* launchInfo, bool enableDiagnostics=false,
 		const std::string& diagnosticsPrefix={}
 	);
+	~ROSInterface();
+
+	/**
+	 * @brief Set period of the periodic state & diagnostics publishing
+	 *
+	 * Node state transitions (start, exit, restart) are published
+	 * immediately in addition to that.
+	 **/
+	void setUpdatePeriod(double seconds);
+
+	/**
+	 * @brief Publish compact rosmon_msgs::StateDelta messages
+	 *
+	 * @param keyframePeriod Maximum time between two full keyframes
+	 **/
+	void enableDeltaPublishing(double keyframePeriod);
+
+	/**
+	 * @brief Publish node output in batches on ~log_stream
+	 *
+	 * @param flushPeriod Maximum time a line is held back in seconds
+	 * @param maxLines Maximum number of lines per message
+	 * @sa LogStreamer
+	 **/
+	void enableLogStreaming(double flushPeriod, unsigned int maxLines);
+
+	//! Re-parses the launch file and calls Monitor::reload()
+	typedef std::function<monitor::Monitor::ReloadResult()> ReloadHandler;
+
+	//! Offer the ~reload service
+	void setReloadHandler(const ReloadHandler& handler);
 
 	void shutdown();
 private:
 	void update();
+	void handleStateChange();
+	void publishState();
+	void publishDelta();
+	void handleDeltaSubscriber();
+	void schedulePublish();
 	bool handleStartStop(rosmon_msgs::StartStopRequest& req, rosmon_msgs::StartStopResponse& resp);
+	bool handleStartStopMulti(rosmon_msgs::StartStopMultiRequest& req, rosmon_msgs::StartStopMultiResponse& resp);
+	void checkPendingStarts();
+
+	void connectNode(const monitor::NodeMonitor::Ptr& node);
+	void handleNodesChanged();
+	bool handleReload(rosmon_msgs::ReloadRequest& req, rosmon_msgs::ReloadResponse& resp);
+
+	void rebuildNodeIndex();
+	monitor::NodeMonitor::Ptr findNode(const std::string& name, const std::string& ns) const;
+	bool handleGetHistory(rosmon_msgs::GetHistoryRequest& req, rosmon_msgs::GetHistoryResponse& resp);
+	bool handleGetThreads(rosmon_msgs::GetThreadsRequest& req, rosmon_msgs::GetThreadsResponse& resp);
+
+	//! Output totals per node at the last fillSelfStats() call, for rates
+	struct OutputRates
+	{
+		std::unordered_map<std::string, std::pair<uint64_t, uint64_t>> lastTotals;
+		double lastTime = 0.0;
+	};
+
+	void fillSelfStats(rosmon_msgs::SelfStats* msg, OutputRates* rates);
+	bool handleGetSelfStats(rosmon_msgs::GetSelfStatsRequest& req, rosmon_msgs::GetSelfStatsResponse& resp);
 
 	monitor::Monitor* m_monitor;
 
@@ -40,12 +109,46 @@ private:
 
 	ros::WallTimer m_updateTimer;
 
+	//! Coalesces bursts of state changes into one publish
+	ros::WallTimer m_eventTimer;
+	bool m_eventPending = false;
+	std::vector<boost::signals2::connection> m_stateConnections;
+
 	ros::Publisher m_pub_state;
 
+	bool m_deltaEnabled = false;
+	ros::Publisher m_pub_stateDelta;
+	ros::WallDuration m_keyframePeriod;
+	ros::WallTime m_lastKeyframe;
+	uint32_t m_keyframeSeq = 0;
+	std::vector<rosmon_msgs::NodeStateUpdate> m_lastUpdates;
+
 	ros::ServiceServer m_srv_startStop;
+	ros::ServiceServer m_srv_startStopMulti;
+	ros::ServiceServer m_srv_getHistory;
+	ros::ServiceServer m_srv_getThreads;
+	ros::ServiceServer m_srv_reload;
+	ros::ServiceServer m_srv_getSelfStats;
+
+	ros::Publisher m_pub_selfStats;
+
+	// Separate, so that service calls do not disturb the topic rates
+	OutputRates m_topicRates;
+	OutputRates m_serviceRates;
+
+	ReloadHandler m_reloadHandler;
+
+	//! Full node name (/ns/name) -> index into m_monitor->nodes()
+	std::unordered_map<std::string, std::size_t> m_nodeIndex;
+
+	//! Groups of stopped nodes to be started once all of them have exited
+	std::vector<std::vector<monitor::NodeMonitor::Ptr>> m_pendingStarts;
+	ros::WallTimer m_pendingStartTimer;
 
 	bool m_diagnosticsEnabled;
 	std::unique_ptr<DiagnosticsPublisher> m_diagnosticsPublisher;
+
+	std::unique_ptr<LogStreamer> m_logStreamer;
 };
 
 }
@@ -0,0 +1,64 @@
+// Counters and latency histograms for rosmon's own overhead
+// Author: Max Schwarz <max.schwarz@uni-bonn.de>
+
+#include "self_stats.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace rosmon
+{
+
+void Histogram::record(double seconds)
+{
+	double us = seconds * 1e6;
+
+	std::size_t bucket = 0;
+	if(us >= 1.0)
+		bucket = std::min<std::size_t>(std::ilogb(us), m_buckets.size()-1);
+
+	m_buckets[bucket]++;
+	m_count++;
+	m_sum += seconds;
+	m_max = std::max(m_max, seconds);
+}
+
+double Histogram::percentile(double p) const
+{
+	if(m_count == 0)
+		return 0.0;
+
+	uint64_t rank = std::max<uint64_t>(1, std::ceil(p * m_count));
+	uint64_t seen = 0;
+	for(std::size_t i = 0; i < m_buckets.size(); ++i)
+	{
+		seen += m_buckets[i];
+		if(seen >= rank)
+			return std::min(m_max, std::ldexp(1.0, i+1) * 1e-6);
+	}
+
+	return m_max;
+}
+
+SelfStats::SelfStats()
+ : m_start(std::chrono::steady_clock::now())
+{
+}
+
+SelfStats& SelfStats::instance()
+{
+	static SelfStats stats;
+	return stats;
+}
+
+Histogram& SelfStats::histogram(const std::string& name)
+{
+	return m_histograms[name];
+}
+
+double SelfStats::uptime() const
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+}
+
+}
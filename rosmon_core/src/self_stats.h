@@ -0,0 +1,110 @@
+// Counters and latency histograms for rosmon's own overhead
+// Author: Max Schwarz <max.schwarz@uni-bonn.de>
+
+#ifndef ROSMON_SELF_STATS_H
+#define ROSMON_SELF_STATS_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+
+namespace rosmon
+{
+
+/**
+ * @brief Duration histogram with power-of-two buckets
+ *
+ * Bucket i counts durations in [2^i, 2^(i+1)) microseconds, so recording is
+ * cheap enough for the hot paths of the event loop. Percentiles are
+ * estimated from the bucket bounds.
+ **/
+class Histogram
+{
+public:
+	//! Record a duration in seconds
+	void record(double seconds);
+
+	inline uint64_t count() const
+	{ return m_count; }
+
+	//! Mean duration in seconds
+	inline double mean() const
+	{ return m_count ? m_sum / m_count : 0.0; }
+
+	//! Total recorded duration in seconds
+	inline double sum() const
+	{ return m_sum; }
+
+	//! Maximum duration in seconds
+	inline double max() const
+	{ return m_max; }
+
+	/**
+	 * @brief Estimate a percentile
+	 *
+	 * @param p Percentile in [0, 1]
+	 * @return Upper bound of the bucket containing the percentile, in seconds
+	 **/
+	double percentile(double p) const;
+private:
+	std::array<uint64_t, 32> m_buckets{};
+	uint64_t m_count = 0;
+	double m_sum = 0.0;
+	double m_max = 0.0;
+};
+
+/**
+ * @brief Registry of named histograms
+ *
+ * All instrumented code runs on the main loop, so there is no locking.
+ * Histograms are never removed, callers may keep references to them.
+ **/
+class SelfStats
+{
+public:
+	//! Process-wide instance
+	static SelfStats& instance();
+
+	//! Get or create the histogram with the given name
+	Histogram& histogram(const std::string& name);
+
+	inline const std::map<std::string, Histogram>& histograms() const
+	{ return m_histograms; }
+
+	//! Seconds since rosmon started
+	double uptime() const;
+private:
+	SelfStats();
+
+	std::map<std::string, Histogram> m_histograms;
+	std::chrono::steady_clock::time_point m_start;
+};
+
+/**
+ * @brief Records the lifetime of the object into a histogram
+ **/
+class ScopedTimer
+{
+public:
+	explicit ScopedTimer(Histogram* histogram)
+	 : m_histogram(histogram)
+	 , m_start(std::chrono::steady_clock::now())
+	{}
+
+	~ScopedTimer()
+	{
+		m_histogram->record(std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count());
+	}
+
+	ScopedTimer(const ScopedTimer&) = delete;
+	ScopedTimer& operator=(const ScopedTimer&) = delete;
+private:
+	Histogram* m_histogram;
+	std::chrono::steady_clock::time_point m_start;
+};
+
+}
+
+#endif
@@ -14,6 +14,7 @@
 #endif
 
 #include <cstdio>
+#include <cstring>
 
 
 #include <sys/ioctl.h>
@@ -21,7 +22,6 @@
 
 #include <boost/lexical_cast.hpp>
 #include <boost/regex.hpp>
-#include <boost/tokenizer.hpp>
 
 #include "fmt_no_throw.h"
 
@@ -33,36 +33,42 @@ Terminal::Parser::Parser(Terminal* terminal)
 {
 }
 
-void Terminal::Parser::parseSetAttributes(const std::string& str)
+void Terminal::Parser::parseSetAttributes(const char* str, std::size_t len)
 {
-	using Tokenizer = boost::tokenizer<boost::char_separator<char>>;
+	const char* end = str + len;
 
-	boost::char_separator<char> sep(";");
-	Tokenizer tok(str, sep);
-
-	for(Tokenizer::iterator it = tok.begin(); it != tok.end(); ++it)
+	while(str != end)
 	{
-		errno = 0;
-		auto endptr = const_cast<char*>(it->c_str());
-		int code = strtoul(it->c_str(), &endptr, 10);
+		// Skip empty fields
+		if(*str == ';')
+		{
+			++str;
+			continue;
+		}
 
-		if(errno != 0 || *endptr != 0)
+		unsigned int code = 0;
+		for(; str != end && *str != ';'; ++str)
 		{
-			// Error in specification, break out of here
-			m_fgColor = {};
-			m_bgColor = {};
-			return;
+			if(*str < '0' || *str > '9')
+			{
+				// Error in specification, break out of here
+				m_fgColor = -1;
+				m_bgColor = -1;
+				return;
+			}
+
+			code = 10*code + (*str - '0');
 		}
 
 		if(code == 0)
 		{
-			m_fgColor = {};
-			m_bgColor = {};
+			m_fgColor = -1;
+			m_bgColor = -1;
 		}
 		else if(code >= 30 && code <= 37)
-			m_fgColor = m_term->color(static_cast<SimpleColor>(code - 30));
+			m_fgColor = code - 30;
 		else if(code >= 40 && code <= 47)
-			m_bgColor = m_term->color(static_cast<SimpleColor>(code - 40));
+			m_bgColor = code - 40;
 		else if(code == 1)
 			m_bold = true;
 	}
@@ -85,7 +91,7 @@ bool Terminal::Parser::parse(char c)
 			if(c == '[')
 			{
 				m_state = STATE_CSI;
-				m_buf.clear();
+				m_bufLength = 0;
 			}
 			else
 				m_state = STATE_ESCAPE;
@@ -93,13 +99,13 @@ bool Terminal::Parser::parse(char c)
 		case STATE_CSI:
 			if(c == 'm')
 			{
-				parseSetAttributes(m_buf);
+				parseSetAttributes(m_buf, m_bufLength);
 				m_state = STATE_ESCAPE;
 			}
 			else
 			{
-				m_buf.push_back(c);
-				if(m_buf.length() >= 16)
+				m_buf[m_bufLength++] = c;
+				if(m_bufLength >= sizeof(m_buf))
 					m_state = STATE_ESCAPE;
 			}
 			break;
@@ -117,45 +123,98 @@ void Terminal::Parser::parse(const std::string& str)
 		parse(c);
 }
 
-std::vector<std::string> Terminal::Parser::wrap(const std::string& str, unsigned int columns)
+namespace
+{
+	/**
+	 * Find the first character in [begin, end) which cannot be copied
+	 * verbatim by Parser::wrap(), i.e. the start of an escape sequence or
+	 * a line break.
+	 **/
+	inline const char* findSpecialChar(const char* begin, const char* end)
+	{
+		for(char c : {'\033', '\n', '\r'})
+		{
+			auto p = static_cast<const char*>(std::memchr(begin, c, end - begin));
+			if(p)
+				end = p;
+		}
+
+		return end;
+	}
+}
+
+void Terminal::Parser::wrap(const char* begin, const char* end, unsigned int columns, WrapBuffer* out)
 {
+	out->clear();
+
 	if(!m_term)
-		return {};
+		return;
 
+	std::string& data = out->m_data;
 	unsigned int col = 0;
-	std::vector<std::string> ret;
-	std::string currentLine;
 
 	auto setupLine = [&](){
-		currentLine = m_term->standardColorCode();
-		currentLine += m_fgColor.foregroundCode();
-		currentLine += m_bgColor.backgroundCode();
+		data += m_term->m_opStr;
+		data += m_term->m_sgr0Str;
+
+		if(m_fgColor >= 0 && static_cast<std::size_t>(m_fgColor) < m_term->m_ansiColors.size())
+			data += m_term->m_ansiColors[m_fgColor].foregroundCode();
+		if(m_bgColor >= 0 && static_cast<std::size_t>(m_bgColor) < m_term->m_ansiColors.size())
+			data += m_term->m_ansiColors[m_bgColor].backgroundCode();
+	};
+
+	auto nextLine = [&](){
+		out->m_lineEnds.push_back(data.size());
+		setupLine();
+		col = 0;
 	};
 
 	setupLine();
 
-	for(char c : str)
+	const char* p = begin;
+	while(p != end)
 	{
+		if(m_state == STATE_ESCAPE)
+		{
+			// Fast path: copy visible characters up to the next escape
+			// sequence, line break or wrap position in one go.
+			const char* limit = end;
+			if(columns != 0 && static_cast<std::size_t>(end - p) > columns - col)
+				limit = p + (columns - col);
+
+			const char* special = findSpecialChar(p, limit);
+
+			data.append(p, special);
+			col += special - p;
+			p = special;
+
+			if(columns != 0 && col == columns)
+			{
+				nextLine();
+				continue;
+			}
+
+			if(p == end)
+				break;
+		}
+
+		// Slow path: line breaks and escape sequences
+		char c = *(p++);
+
 		if(c == '\r' || c == '\n')
 			continue;
 
 		if(parse(c))
 			col++;
 
-		currentLine.push_back(c);
+		data.push_back(c);
 
-		if(col == columns)
-		{
-			ret.push_back(std::move(currentLine));
-			setupLine();
-			col = 0;
-		}
+		if(columns != 0 && col == columns)
+			nextLine();
 	}
 
 	if(col != 0)
-		ret.push_back(std::move(currentLine));
-
-	return ret;
+		out->m_lineEnds.push_back(data.size());
 }
 
 void Terminal::Parser::apply()
@@ -164,8 +223,11 @@ void Terminal::Parser::apply()
 		return;
 
 	m_term->setStandardColors();
-	m_fgColor.foreground();
-	m_bgColor.background();
+
+	if(m_fgColor >= 0 && static_cast<std::size_t>(m_fgColor) < m_term->m_ansiColors.size())
+		m_term->m_ansiColors[m_fgColor].foreground();
+	if(m_bgColor >= 0 && static_cast<std::size_t>(m_bgColor) < m_term->m_ansiColors.size())
+		m_term->m_ansiColors[m_bgColor].background();
 }
 
 std::string safe_tigetstr(const char* key)
@@ -262,6 +324,10 @@ Terminal::Terminal()
 
 	m_boldStr = safe_tigetstr("bold");
 
+	// Parser needs these for every colored line of node output
+	for(int i = Black; i <= White; ++i)
+		m_ansiColors.push_back(color(static_cast<SimpleColor>(i)));
+
 	// The terminfo db says screen doesn't support rmam/smam, but both screen
 	// and tmux do. *sigh*
 	const char* TERM = getenv("TERM");
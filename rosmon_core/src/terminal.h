@@ -7,6 +7,7 @@
 #include <stdint.h>
 #include <chrono>
 #include <string>
+#include <string_view>
 #include <map>
 #include <vector>
 
@@ -93,6 +94,44 @@ public:
 		Color m_bg;
 	};
 
+	class Parser;
+
+	/**
+	 * @brief Output buffer for Parser::wrap()
+	 *
+	 * Stores all wrapped lines back-to-back in a single character buffer.
+	 * clear() keeps the allocated memory, so a buffer that is reused for
+	 * every log line does not allocate in the steady state.
+	 **/
+	class WrapBuffer
+	{
+	public:
+		void clear()
+		{
+			m_data.clear();
+			m_lineEnds.clear();
+		}
+
+		//! Number of lines
+		std::size_t size() const
+		{ return m_lineEnds.size(); }
+
+		bool empty() const
+		{ return m_lineEnds.empty(); }
+
+		//! Line i, including the leading color setup escape sequences
+		std::string_view line(std::size_t i) const
+		{
+			std::size_t begin = (i == 0) ? 0 : m_lineEnds[i-1];
+			return {m_data.data() + begin, m_lineEnds[i] - begin};
+		}
+	private:
+		friend class Parser;
+
+		std::string m_data;
+		std::vector<std::size_t> m_lineEnds;
+	};
+
 	/**
 	 * @brief Terminal escape sequence parser
 	 *
@@ -117,12 +156,15 @@ public:
 		/**
 		 * @brief Apply line wrapping
 		 *
-		 * Each returned line contains the appropriate escape sequences to set
-		 * up the current color mode.
+		 * The range [begin, end) is split into lines of at most @a columns
+		 * visible characters (0 means no limit), which are stored in @a out.
+		 * Each line starts with the escape sequences needed to set up the
+		 * current color mode, so colors carry over from line to line and
+		 * from one call to the next.
 		 **/
-		std::vector<std::string> wrap(const std::string& str, unsigned int columns);
+		void wrap(const char* begin, const char* end, unsigned int columns, WrapBuffer* out);
 	private:
-		void parseSetAttributes(const std::string& str);
+		void parseSetAttributes(const char* str, std::size_t len);
 
 		enum State
 		{
@@ -134,10 +176,12 @@ public:
 		Terminal* m_term = nullptr;
 
 		State m_state = STATE_ESCAPE;
-		std::string m_buf;
+		char m_buf[16];
+		std::size_t m_bufLength = 0;
 
-		Color m_fgColor;
-		Color m_bgColor;
+		//! Current colors as SimpleColor index, -1 means standard color
+		int m_fgColor = -1;
+		int m_bgColor = -1;
 		bool m_bold = false;
 	};
 
@@ -255,6 +299,9 @@ private:
 	std::string m_lineWrapOffStr;
 	std::string m_lineWrapOnStr;
 
+	//! Cached colors for the eight basic ANSI color codes
+	std::vector<Color> m_ansiColors;
+
 	std::map<std::string, SpecialKey> m_specialKeys;
 
 	std::string m_currentEscapeStr;
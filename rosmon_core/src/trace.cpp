@@ -0,0 +1,332 @@
+// Chrome trace event recorder for startup and supervision spans
+// Author: Max Schwarz <max.schwarz@uni-bonn.de>
+
+#include "trace.h"
+
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <fmt/format.h>
+
+namespace rosmon
+{
+
+namespace trace
+{
+
+namespace detail
+{
+	std::atomic<bool> g_enabled{false};
+}
+
+namespace
+{
+
+struct Event
+{
+	uint64_t ts;
+	uint64_t duration;
+	char phase;
+	const char* category;
+	std::string name;
+	std::string args;
+	uint32_t track;
+};
+
+constexpr std::size_t CHUNK_SIZE = 256;
+
+struct Chunk
+{
+	std::array<Event, CHUNK_SIZE> events;
+	std::atomic<std::size_t> count{0};
+	std::atomic<Chunk*> next{nullptr};
+};
+
+/**
+ * Events of one thread. The owning thread is the only producer and only
+ * touches m_tail, flush() is the only consumer and only touches m_head.
+ * Slots are published by the release store to Chunk::count and never
+ * reused, so no locking is needed.
+ **/
+class ThreadBuffer
+{
+public:
+	explicit ThreadBuffer(uint32_t tid)
+	 : tid(tid)
+	 , m_head(new Chunk)
+	 , m_tail(m_head)
+	{}
+
+	~ThreadBuffer()
+	{
+		while(m_head)
+		{
+			Chunk* next = m_head->next.load(std::memory_order_acquire);
+			delete m_head;
+			m_head = next;
+		}
+	}
+
+	void push(Event&& event)
+	{
+		std::size_t count = m_tail->count.load(std::memory_order_relaxed);
+		if(count == CHUNK_SIZE)
+		{
+			Chunk* chunk = new Chunk;
+			m_tail->next.store(chunk, std::memory_order_release);
+			m_tail = chunk;
+			count = 0;
+		}
+
+		m_tail->events[count] = std::move(event);
+		m_tail->count.store(count + 1, std::memory_order_release);
+	}
+
+	//! Call cb for all unread events. Returns true if the buffer is empty.
+	template<class F>
+	bool drain(F cb)
+	{
+		while(true)
+		{
+			std::size_t count = m_head->count.load(std::memory_order_acquire);
+			for(; m_readIndex < count; ++m_readIndex)
+				cb(m_head->events[m_readIndex]);
+
+			if(count != CHUNK_SIZE)
+				return true;
+
+			// Chunk is full. Once the producer moved on, we can free it.
+			Chunk* next = m_head->next.load(std::memory_order_acquire);
+			if(!next)
+				return true;
+
+			delete m_head;
+			m_head = next;
+			m_readIndex = 0;
+		}
+	}
+
+	const uint32_t tid;
+private:
+	Chunk* m_head;
+	std::size_t m_readIndex = 0;
+	Chunk* m_tail;
+};
+
+struct State
+{
+	std::mutex mutex;
+	std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+	std::vector<std::string> metadata;
+	FILE* file = nullptr;
+	bool firstEvent = true;
+	uint32_t pid = 0;
+	uint32_t nextTrack = 0;
+	const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+};
+
+State& state()
+{
+	static State s;
+	return s;
+}
+
+ThreadBuffer& threadBuffer()
+{
+	thread_local std::shared_ptr<ThreadBuffer> buffer;
+	if(!buffer)
+	{
+		buffer = std::make_shared<ThreadBuffer>(syscall(SYS_gettid));
+
+		std::unique_lock<std::mutex> lock(state().mutex);
+		state().buffers.push_back(buffer);
+	}
+
+	return *buffer;
+}
+
+std::string nameMetadata(uint32_t pid, uint32_t tid, const std::string& name)
+{
+	return fmt::format(R"({{"name":"thread_name","ph":"M","pid":{},"tid":{},"args":{{"name":"{}"}}}})",
+		pid, tid, escape(name)
+	);
+}
+
+void writeRecord(State& s, const std::string& record)
+{
+	fputs(s.firstEvent ? "\n" : ",\n", s.file);
+	fputs(record.c_str(), s.file);
+	s.firstEvent = false;
+}
+
+}
+
+void start(const std::string& path)
+{
+	State& s = state();
+	std::unique_lock<std::mutex> lock(s.mutex);
+
+	if(s.file)
+		throw std::runtime_error("Tracing is already active");
+
+	s.file = fopen(path.c_str(), "we");
+	if(!s.file)
+		throw std::runtime_error(fmt::format("Could not open trace file '{}': {}", path, strerror(errno)));
+
+	// JSON array format: viewers accept a missing closing bracket, so the
+	// trace stays readable if we crash.
+	fputs("[", s.file);
+	s.firstEvent = true;
+	s.pid = getpid();
+
+	writeRecord(s, fmt::format(R"({{"name":"process_name","ph":"M","pid":{},"args":{{"name":"rosmon"}}}})", s.pid));
+
+	detail::g_enabled = true;
+}
+
+void flush()
+{
+	State& s = state();
+	std::unique_lock<std::mutex> lock(s.mutex);
+
+	if(!s.file)
+		return;
+
+	for(auto& record : s.metadata)
+		writeRecord(s, record);
+	s.metadata.clear();
+
+	for(auto it = s.buffers.begin(); it != s.buffers.end();)
+	{
+		auto& buffer = *it;
+		bool empty = buffer->drain([&](const Event& event) {
+			std::string record = fmt::format(R"({{"name":"{}","cat":"{}","ph":"{}","ts":{},"pid":{},"tid":{})",
+				escape(event.name), event.category, event.phase, event.ts,
+				s.pid, event.track ? event.track : buffer->tid
+			);
+
+			if(event.phase == 'X')
+				record += fmt::format(R"(,"dur":{})", event.duration);
+			else if(event.phase == 'i')
+				record += R"(,"s":"t")";
+
+			if(!event.args.empty())
+				record += ",\"args\":{" + event.args + "}";
+
+			record += "}";
+
+			writeRecord(s, record);
+		});
+
+		// The thread is gone and we have everything
+		if(empty && buffer.use_count() == 1)
+			it = s.buffers.erase(it);
+		else
+			++it;
+	}
+
+	fflush(s.file);
+}
+
+void stop()
+{
+	if(!enabled())
+		return;
+
+	detail::g_enabled = false;
+	flush();
+
+	State& s = state();
+	std::unique_lock<std::mutex> lock(s.mutex);
+
+	fputs("\n]\n", s.file);
+	fclose(s.file);
+	s.file = nullptr;
+}
+
+std::string escape(const std::string& in)
+{
+	std::string out;
+	out.reserve(in.size());
+
+	for(char c : in)
+	{
+		switch(c)
+		{
+			case '"':  out += "\\\""; break;
+			case '\\': out += "\\\\"; break;
+			case '\n': out += "\\n"; break;
+			default:
+				if(static_cast<unsigned char>(c) < 0x20)
+					out += fmt::format("\\u{:04x}", static_cast<int>(c));
+				else
+					out += c;
+		}
+	}
+
+	return out;
+}
+
+uint64_t now()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - state().epoch
+	).count();
+}
+
+void setThreadName(const std::string& name)
+{
+	if(!enabled())
+		return;
+
+	uint32_t tid = threadBuffer().tid;
+
+	State& s = state();
+	std::unique_lock<std::mutex> lock(s.mutex);
+	s.metadata.push_back(nameMetadata(s.pid, tid, name));
+}
+
+uint32_t createTrack(const std::string& name)
+{
+	if(!enabled())
+		return 0;
+
+	State& s = state();
+	std::unique_lock<std::mutex> lock(s.mutex);
+
+	// Keep clear of real thread IDs (pid_max is at most 2^22)
+	uint32_t track = (1u << 30) + s.nextTrack++;
+	s.metadata.push_back(nameMetadata(s.pid, track, name));
+
+	return track;
+}
+
+void complete(const char* category, const std::string& name, uint64_t start, uint64_t duration, const std::string& args, uint32_t track)
+{
+	if(!enabled())
+		return;
+
+	threadBuffer().push({start, duration, 'X', category, name, args, track});
+}
+
+void instant(const char* category, const std::string& name, const std::string& args, uint32_t track)
+{
+	if(!enabled())
+		return;
+
+	threadBuffer().push({now(), 0, 'i', category, name, args, track});
+}
+
+}
+
+}
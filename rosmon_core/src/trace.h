@@ -0,0 +1,116 @@
+// Chrome trace event recorder for startup and supervision spans
+// Author: Max Schwarz <max.schwarz@uni-bonn.de>
+
+#ifndef ROSMON_TRACE_H
+#define ROSMON_TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace rosmon
+{
+
+/**
+ * @brief Lightweight tracing into a Chrome trace JSON file
+ *
+ * The output can be opened in chrome://tracing or https://ui.perfetto.dev.
+ *
+ * Each thread appends events to its own buffer without any locking, so
+ * recording a span costs a clock read and a few stores. Buffers are
+ * drained into the file by flush(), which should be called periodically
+ * from the main loop. When tracing is disabled, all recording functions
+ * return after a single relaxed atomic load.
+ **/
+namespace trace
+{
+
+namespace detail
+{
+	extern std::atomic<bool> g_enabled;
+}
+
+//! Is a trace being recorded?
+inline bool enabled()
+{ return detail::g_enabled.load(std::memory_order_relaxed); }
+
+/**
+ * @brief Start recording into a file
+ *
+ * @throw std::runtime_error if the file cannot be opened
+ **/
+void start(const std::string& path);
+
+//! Write all recorded events to the file
+void flush();
+
+//! Flush and close the file, the trace is complete afterwards
+void stop();
+
+//! Monotonic timestamp in microseconds
+uint64_t now();
+
+//! Escape a string for use in a JSON string literal (e.g. in args)
+std::string escape(const std::string& str);
+
+//! Name the calling thread in the trace
+void setThreadName(const std::string& name);
+
+/**
+ * @brief Create a named track for events not tied to a rosmon thread
+ *
+ * This is used for node processes, so that each node gets its own row.
+ * Returns zero if tracing is disabled.
+ **/
+uint32_t createTrack(const std::string& name);
+
+/**
+ * @brief Record a complete span
+ *
+ * @param args Preformatted JSON object members, e.g. "\"pid\":42", or empty
+ * @param track Track from createTrack(), zero for the calling thread
+ **/
+void complete(const char* category, const std::string& name, uint64_t start, uint64_t duration, const std::string& args = {}, uint32_t track = 0);
+
+//! Record an instant event
+void instant(const char* category, const std::string& name, const std::string& args = {}, uint32_t track = 0);
+
+/**
+ * @brief Records a span for its lifetime
+ **/
+class Span
+{
+public:
+	Span(const char* category, std::string name, std::string args = {})
+	{
+		if(enabled())
+		{
+			m_active = true;
+			m_category = category;
+			m_name = std::move(name);
+			m_args = std::move(args);
+			m_start = now();
+		}
+	}
+
+	~Span()
+	{
+		if(m_active)
+			complete(m_category, m_name, m_start, now() - m_start, m_args);
+	}
+
+	Span(const Span&) = delete;
+	Span& operator=(const Span&) = delete;
+private:
+	bool m_active = false;
+	const char* m_category = nullptr;
+	std::string m_name;
+	std::string m_args;
+	uint64_t m_start = 0;
+};
+
+}
+
+}
+
+#endif
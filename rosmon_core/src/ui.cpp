@@ -45,6 +45,13 @@ UI::UI(monitor::Monitor* monitor, const FDWatcher::Ptr& fdWatcher)
 		node->logMessageSignal.connect(boost::bind(&UI::log, this, _1));
 	}
 
+	// Launch file reloads may add & remove nodes
+	m_connections.push_back(m_monitor->nodeAddedSignal.connect([this](const monitor::NodeMonitor::Ptr& node) {
+		node->logMessageSignal.connect(boost::bind(&UI::log, this, _1));
+		node->setOutputPeek(!isMuted(node->name()));
+	}));
+	m_connections.push_back(m_monitor->nodesChangedSignal.connect(boost::bind(&UI::handleNodesChanged, this)));
+
 	m_sizeTimer = ros::NodeHandle().createWallTimer(ros::WallDuration(2.0), boost::bind(&UI::checkWindowSize, this));
 	m_sizeTimer.start();
 
@@ -53,6 +60,7 @@ UI::UI(monitor::Monitor* monitor, const FDWatcher::Ptr& fdWatcher)
 
 	checkWindowSize();
 	setupColors();
+	updateOutputPeek();
 
 	// Switch cursor off
 	m_term.setCursorInvisible();
@@ -90,12 +98,34 @@ UI::UI(monitor::Monitor* monitor, const FDWatcher::Ptr& fdWatcher)
 	m_style_nodeCrashedFaded = Terminal::Style{m_term.color(Terminal::Black), m_term.color(0x000040, Terminal::Red)};
 	m_style_nodeWaitingFaded = Terminal::Style{m_term.color(Terminal::Black), m_term.color(0x004040, Terminal::Yellow)};
 
-	fdWatcher->registerFD(STDIN_FILENO, boost::bind(&UI::readInput, this));
+	fdWatcher->registerFD(STDIN_FILENO, boost::bind(&UI::readInput, this), "ui");
 }
 
 UI::~UI()
 {
+	for(auto& connection : m_connections)
+		connection.disconnect();
+
 	m_fdWatcher->removeFD(STDIN_FILENO);
+
+	for(auto& node : m_monitor->nodes())
+		node->setOutputPeek(false);
+}
+
+void UI::handleNodesChanged()
+{
+	// Node indices are not valid anymore
+	m_selectedNode = -1;
+	m_searchActive = false;
+
+	setupColors();
+}
+
+void UI::updateOutputPeek()
+{
+	// Nodes in raw output mode only copy their output for us if shown
+	for(auto& node : m_monitor->nodes())
+		node->setOutputPeek(!isMuted(node->name()));
 }
 
 void UI::setupColors()
@@ -196,6 +226,8 @@ void UI::drawStatusLine()
 				case monitor::NodeMonitor::STATE_IDLE:    state = "is idle";    break;
 				case monitor::NodeMonitor::STATE_CRASHED: state = "has crashed"; break;
 				case monitor::NodeMonitor::STATE_WAITING: state = "is waiting"; break;
+				case monitor::NodeMonitor::STATE_BACKOFF: state = "is backing off"; break;
+				case monitor::NodeMonitor::STATE_FAILED:  state = "has failed (crash loop)"; break;
 				default: state = "<UNKNOWN>"; break;
 			}
 
@@ -234,6 +266,40 @@ void UI::drawStatusLine()
 		lines++;
 	}
 
+	// Thread detail view for the selected node
+	if(!m_searchActive && m_selectedNode != -1 && m_monitor->nodes()[m_selectedNode]->topThreadCount() != 0)
+	{
+		m_term.setStandardColors();
+		m_term.clearToEndOfLine();
+		m_style_bar.use();
+
+		ColumnPrinter print;
+		print(" Top threads:");
+
+		const auto& threads = m_monitor->nodes()[m_selectedNode]->topThreads();
+		if(threads.empty())
+			print(" (no data yet)");
+
+		for(const auto& thread : threads)
+		{
+			std::string entry = fmt::format("  {} ({}) {:.1f}%",
+				thread.name, thread.tid, thread.load() * 100.0
+			);
+
+			if(print.column() + entry.size() > static_cast<unsigned int>(m_columns))
+				break;
+
+			print("{}", entry);
+		}
+
+		for(int i = print.column(); i < m_columns; ++i)
+			putchar(' ');
+
+		putchar('\n');
+
+		lines++;
+	}
+
 	int col = 0;
 
 	m_term.setStandardColors();
@@ -323,9 +389,11 @@ void UI::drawStatusLine()
 						m_style_nodeIdle.use();
 						break;
 					case monitor::NodeMonitor::STATE_CRASHED:
+					case monitor::NodeMonitor::STATE_FAILED:
 						m_style_nodeCrashed.use();
 						break;
 					case monitor::NodeMonitor::STATE_WAITING:
+					case monitor::NodeMonitor::STATE_BACKOFF:
 						m_style_nodeWaiting.use();
 						break;
 				}
@@ -341,9 +409,11 @@ void UI::drawStatusLine()
 						m_style_nodeIdleFaded.use();
 						break;
 					case monitor::NodeMonitor::STATE_CRASHED:
+					case monitor::NodeMonitor::STATE_FAILED:
 						m_style_nodeCrashedFaded.use();
 						break;
 					case monitor::NodeMonitor::STATE_WAITING:
+					case monitor::NodeMonitor::STATE_BACKOFF:
 						m_style_nodeWaitingFaded.use();
 						break;
 				}
@@ -408,9 +478,9 @@ void UI::log(const LogEvent& event)
 		m_term.setLineWrap(false);
 
 		auto actualLabelWidth = std::max<unsigned int>(m_nodeLabelWidth, event.source.size());
-		auto lines = it->second.parser.wrap(clean, m_columns - actualLabelWidth - 2);
+		it->second.parser.wrap(clean.data(), clean.data() + clean.size(), m_columns - actualLabelWidth - 2, &m_wrapBuffer);
 
-		for(unsigned int line = 0; line < lines.size(); ++line)
+		for(unsigned int line = 0; line < m_wrapBuffer.size(); ++line)
 		{
 			// Draw label
 			if(m_term.has256Colors())
@@ -438,7 +508,8 @@ void UI::log(const LogEvent& event)
 			m_term.clearToEndOfLine();
 			putchar(' ');
 
-			fputs(lines[line].c_str(), stdout);
+			auto lineData = m_wrapBuffer.line(line);
+			fwrite(lineData.data(), 1, lineData.size(), stdout);
 			putchar('\n');
 		}
 
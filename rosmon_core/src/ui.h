@@ -47,6 +47,7 @@ private:
 	void drawStatusLine();
 	void checkWindowSize();
 	void setupColors();
+	void handleNodesChanged();
 
 	void readInput();
 	void checkTerminal();
@@ -60,16 +61,18 @@ private:
 	{ return m_mutedSet.find(s) != m_mutedSet.end(); }
 
 	inline void mute(const std::string &s)
-	{ m_mutedSet.insert(s); }
+	{ m_mutedSet.insert(s); updateOutputPeek(); }
 
 	inline void unmute(const std::string &s)
-	{ m_mutedSet.erase(s); }
+	{ m_mutedSet.erase(s); updateOutputPeek(); }
 
 	inline void muteAll()
-	{ for(auto& node : m_monitor->nodes()) m_mutedSet.insert(node->name()); }
+	{ for(auto& node : m_monitor->nodes()) m_mutedSet.insert(node->name()); updateOutputPeek(); }
 
 	inline void unmuteAll()
-	{ m_mutedSet.clear(); }
+	{ m_mutedSet.clear(); updateOutputPeek(); }
+
+	void updateOutputPeek();
 
 	monitor::Monitor* m_monitor;
 	FDWatcher::Ptr m_fdWatcher;
@@ -84,8 +87,13 @@ private:
 
 	std::map<std::string, ChannelInfo> m_nodeColorMap;
 
+	//! Reused for wrapping node output lines in log()
+	Terminal::WrapBuffer m_wrapBuffer;
+
 	int m_selectedNode;
 
+	std::vector<boost::signals2::connection> m_connections;
+
 	std::string m_strSetColor;
 
 	bool m_searchActive = false;
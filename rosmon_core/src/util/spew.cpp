@@ -0,0 +1,157 @@
+// Output load generator (used for benchmarking the log pipeline)
+// Author: Max Schwarz <max.schwarz@uni-bonn.de>
+//
+// Every line starts with a marker "@@<id>:<seq>:<t>@@", where t is the
+// CLOCK_REALTIME time in microseconds just before the write() call. This
+// allows measuring drops and latency at the other end of the pipeline.
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+
+static const struct option OPTIONS[] = {
+	{"id", required_argument, nullptr, 'i'},
+	{"rate", required_argument, nullptr, 'r'},
+	{"length", required_argument, nullptr, 'l'},
+	{"color", required_argument, nullptr, 'c'},
+	{"burst", required_argument, nullptr, 'b'},
+	{"count", required_argument, nullptr, 'n'},
+	{"help", no_argument, nullptr, 'h'},
+	{nullptr, 0, nullptr, 0}
+};
+
+static void usage()
+{
+	fprintf(stderr,
+		"Usage: spew [options]\n"
+		"\n"
+		"Options:\n"
+		"  --id=ID       Identifier in the line marker (default: pid)\n"
+		"  --rate=R      Lines per second, 0 for as fast as possible (default 100)\n"
+		"  --length=L    Line length in bytes including newline (default 100)\n"
+		"  --color=P     Fraction of lines wrapped in ANSI colors, 0-1 (default 0.2)\n"
+		"  --burst=B     Lines written back-to-back per burst (default 1)\n"
+		"  --count=N     Exit after N lines, 0 for never (default 0)\n"
+	);
+}
+
+static uint64_t now(clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return uint64_t(ts.tv_sec) * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static bool writeAll(const char* data, std::size_t size)
+{
+	while(size != 0)
+	{
+		ssize_t ret = write(STDOUT_FILENO, data, size);
+		if(ret < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			return false;
+		}
+
+		data += ret;
+		size -= ret;
+	}
+
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	std::string id = std::to_string(getpid());
+	double rate = 100.0;
+	std::size_t length = 100;
+	double colorDensity = 0.2;
+	unsigned int burst = 1;
+	uint64_t count = 0;
+
+	while(true)
+	{
+		int option_index;
+		int c = getopt_long(argc, argv, "h", OPTIONS, &option_index);
+
+		if(c == -1)
+			break;
+
+		switch(c)
+		{
+			case 'i': id = optarg; break;
+			case 'r': rate = atof(optarg); break;
+			case 'l': length = strtoul(optarg, nullptr, 10); break;
+			case 'c': colorDensity = atof(optarg); break;
+			case 'b': burst = std::max(1ul, strtoul(optarg, nullptr, 10)); break;
+			case 'n': count = strtoull(optarg, nullptr, 10); break;
+			case 'h':
+				usage();
+				return 0;
+			default:
+				usage();
+				return 1;
+		}
+	}
+
+	const char* COLORS[] = {"\033[31m", "\033[32m", "\033[33m", "\033[34m", "\033[35m", "\033[36m"};
+	const char* RESET = "\033[0m";
+
+	std::string line;
+	line.reserve(length + 64);
+
+	uint64_t start = now(CLOCK_MONOTONIC);
+
+	for(uint64_t seq = 0; count == 0 || seq < count;)
+	{
+		for(unsigned int i = 0; i < burst && (count == 0 || seq < count); ++i, ++seq)
+		{
+			// Spread colored lines evenly
+			bool colored = std::floor((seq + 1) * colorDensity) > std::floor(seq * colorDensity);
+
+			char marker[128];
+			int markerLength = snprintf(marker, sizeof(marker), "@@%s:%llu:%llu@@ ",
+				id.c_str(), (unsigned long long)seq, (unsigned long long)now(CLOCK_REALTIME)
+			);
+
+			line.clear();
+			if(colored)
+				line += COLORS[seq % (sizeof(COLORS) / sizeof(COLORS[0]))];
+
+			line.append(marker, markerLength);
+
+			std::size_t visible = line.size() + (colored ? strlen(RESET) : 0) + 1;
+			if(visible < length)
+				line.append(length - visible, 'x');
+
+			if(colored)
+				line += RESET;
+			line += '\n';
+
+			if(!writeAll(line.data(), line.size()))
+				return 1;
+		}
+
+		if(rate > 0)
+		{
+			// Sleep until the next burst is due. Deadlines are absolute, so
+			// the rate stays constant even if single writes block.
+			uint64_t due = start + uint64_t(seq * 1e6 / rate);
+			uint64_t current = now(CLOCK_MONOTONIC);
+			if(due > current)
+				usleep(due - current);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,510 @@
+// In-process stand-in for the ROS master
+// Author: Max Schwarz <max.schwarz@uni-bonn.de>
+
+#include "fake_master.h"
+
+#include <stdexcept>
+
+#include <unistd.h>
+
+#include <fmt/format.h>
+
+using XmlRpc::XmlRpcValue;
+
+namespace rosmon
+{
+
+namespace
+{
+	// Status codes of the master API
+	const int SUCCESS = 1;
+	const int ERROR = -1;
+
+	void respond(XmlRpcValue& result, int code, const std::string& msg, const XmlRpcValue& value)
+	{
+		result.setSize(3);
+		result[0] = code;
+		result[1] = msg;
+		result[2] = value;
+	}
+
+	// Parameter names may carry a trailing slash
+	std::string normalize(std::string name)
+	{
+		while(name.size() > 1 && name.back() == '/')
+			name.pop_back();
+
+		if(name.empty() || name[0] != '/')
+			name = "/" + name;
+
+		return name;
+	}
+
+	// Prefix of all parameters below name
+	std::string childPrefix(const std::string& name)
+	{
+		return name == "/" ? name : name + "/";
+	}
+
+	XmlRpcValue emptyStruct()
+	{
+		int offset = 0;
+		return XmlRpcValue("<value><struct></struct></value>", &offset);
+	}
+
+	XmlRpcValue stringList(const std::map<std::string, std::string>& map, bool values)
+	{
+		XmlRpcValue list;
+		list.setSize(0);
+
+		int i = 0;
+		for(auto& pair : map)
+			list[i++] = values ? pair.second : pair.first;
+
+		return list;
+	}
+}
+
+class FakeMaster::Method : public XmlRpc::XmlRpcServerMethod
+{
+public:
+	Method(const std::string& name, FakeMaster* master, Handler handler)
+	 : XmlRpc::XmlRpcServerMethod(name, &master->m_server)
+	 , m_master(master)
+	 , m_handler(handler)
+	{}
+
+	void execute(XmlRpcValue& params, XmlRpcValue& result) override
+	{
+		m_master->delay();
+		m_master->dispatch(name(), m_handler, params, result);
+	}
+private:
+	FakeMaster* m_master;
+	Handler m_handler;
+};
+
+FakeMaster::FakeMaster(int port)
+{
+	addMethod("setParam", &FakeMaster::setParam);
+	addMethod("getParam", &FakeMaster::getParam);
+	addMethod("hasParam", &FakeMaster::hasParam);
+	addMethod("deleteParam", &FakeMaster::deleteParam);
+	addMethod("getParamNames", &FakeMaster::getParamNames);
+	addMethod("subscribeParam", &FakeMaster::subscribeParam);
+	addMethod("unsubscribeParam", &FakeMaster::unsubscribeParam);
+	addMethod("registerService", &FakeMaster::registerService);
+	addMethod("unregisterService", &FakeMaster::unregisterService);
+	addMethod("lookupService", &FakeMaster::lookupService);
+	addMethod("registerPublisher", &FakeMaster::registerPublisher);
+	addMethod("unregisterPublisher", &FakeMaster::unregisterPublisher);
+	addMethod("registerSubscriber", &FakeMaster::registerSubscriber);
+	addMethod("unregisterSubscriber", &FakeMaster::unregisterSubscriber);
+	addMethod("lookupNode", &FakeMaster::lookupNode);
+	addMethod("getPid", &FakeMaster::getPid);
+	addMethod("getUri", &FakeMaster::getUri);
+	addMethod("getSystemState", &FakeMaster::getSystemState);
+
+	// Registering our own system.multicall takes precedence over the
+	// built-in one, which would apply the latency for every sub-call.
+	m_methods.emplace_back(new Method("system.multicall", this, &FakeMaster::multicall));
+
+	if(!m_server.bindAndListen(port))
+		throw std::runtime_error(fmt::format("FakeMaster: could not bind to port {}", port));
+
+	m_port = m_server.get_port();
+
+	m_thread = std::thread([this]() {
+		while(!m_shutdown)
+			m_server.work(0.01);
+	});
+}
+
+FakeMaster::~FakeMaster()
+{
+	m_shutdown = true;
+	m_thread.join();
+
+	m_server.shutdown();
+}
+
+std::string FakeMaster::uri() const
+{
+	return fmt::format("http://127.0.0.1:{}/", m_port);
+}
+
+void FakeMaster::setLatency(std::chrono::microseconds latency)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_latency = latency;
+}
+
+std::map<std::string, uint64_t> FakeMaster::callCounts() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_callCounts;
+}
+
+void FakeMaster::resetCallCounts()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_callCounts.clear();
+}
+
+std::vector<std::string> FakeMaster::parameterNames() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	std::vector<std::string> names;
+	for(auto& pair : m_params)
+		names.push_back(pair.first);
+
+	return names;
+}
+
+void FakeMaster::addMethod(const std::string& name, Handler handler)
+{
+	m_methods.emplace_back(new Method(name, this, handler));
+	m_handlers[name] = handler;
+}
+
+void FakeMaster::dispatch(const std::string& name, Handler handler, XmlRpcValue& params, XmlRpcValue& result)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	invoke(name, handler, params, result);
+}
+
+void FakeMaster::invoke(const std::string& name, Handler handler, XmlRpcValue& params, XmlRpcValue& result)
+{
+	m_callCounts[name]++;
+
+	try
+	{
+		(this->*handler)(params, result);
+	}
+	catch(XmlRpc::XmlRpcException& e)
+	{
+		respond(result, ERROR, fmt::format("Invalid arguments: {}", e.getMessage()), 0);
+	}
+}
+
+void FakeMaster::delay()
+{
+	std::chrono::microseconds latency;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		latency = m_latency;
+	}
+
+	if(latency.count() != 0)
+		std::this_thread::sleep_for(latency);
+}
+
+void FakeMaster::eraseParam(const std::string& key)
+{
+	m_params.erase(key);
+
+	std::string prefix = childPrefix(key);
+	auto it = m_params.lower_bound(prefix);
+	while(it != m_params.end() && it->first.compare(0, prefix.size(), prefix) == 0)
+		it = m_params.erase(it);
+}
+
+void FakeMaster::storeParam(const std::string& key, XmlRpcValue& value)
+{
+	// Dictionaries are stored as individual leaves, as the real master does
+	if(value.getType() == XmlRpcValue::TypeStruct && value.size() != 0)
+	{
+		for(auto& member : value)
+			storeParam(childPrefix(key) + member.first, member.second);
+	}
+	else
+		m_params[key] = value;
+}
+
+void FakeMaster::setParam(XmlRpcValue& params, XmlRpcValue& result)
+{
+	std::string key = normalize(params[1]);
+
+	eraseParam(key);
+	storeParam(key, params[2]);
+
+	respond(result, SUCCESS, "parameter set", 0);
+}
+
+void FakeMaster::getParam(XmlRpcValue& params, XmlRpcValue& result)
+{
+	std::string key = normalize(params[1]);
+
+	auto it = m_params.find(key);
+	if(it != m_params.end())
+	{
+		respond(result, SUCCESS, "", it->second);
+		return;
+	}
+
+	// Assemble a dictionary from all leaves below key
+	std::string prefix = childPrefix(key);
+	XmlRpcValue dict;
+	bool found = false;
+
+	for(it = m_params.lower_bound(prefix); it != m_params.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it)
+	{
+		XmlRpcValue* target = &dict;
+
+		std::size_t start = prefix.size();
+		std::size_t end;
+		while((end = it->first.find('/', start)) != std::string::npos)
+		{
+			target = &(*target)[it->first.substr(start, end - start)];
+			start = end + 1;
+		}
+
+		(*target)[it->first.substr(start)] = it->second;
+		found = true;
+	}
+
+	if(!found)
+	{
+		// The root namespace always exists
+		if(key == "/")
+			respond(result, SUCCESS, "", emptyStruct());
+		else
+			respond(result, ERROR, fmt::format("Parameter [{}] is not set", key), 0);
+		return;
+	}
+
+	respond(result, SUCCESS, "", dict);
+}
+
+void FakeMaster::hasParam(XmlRpcValue& params, XmlRpcValue& result)
+{
+	std::string key = normalize(params[1]);
+	std::string prefix = childPrefix(key);
+
+	bool found = m_params.count(key) != 0;
+	if(!found)
+	{
+		auto it = m_params.lower_bound(prefix);
+		found = it != m_params.end() && it->first.compare(0, prefix.size(), prefix) == 0;
+	}
+
+	respond(result, SUCCESS, key, found);
+}
+
+void FakeMaster::deleteParam(XmlRpcValue& params, XmlRpcValue& result)
+{
+	std::string key = normalize(params[1]);
+
+	std::size_t sizeBefore = m_params.size();
+	eraseParam(key);
+
+	if(m_params.size() == sizeBefore)
+		respond(result, ERROR, fmt::format("Parameter [{}] is not set", key), 0);
+	else
+		respond(result, SUCCESS, "parameter deleted", 0);
+}
+
+void FakeMaster::getParamNames(XmlRpcValue&, XmlRpcValue& result)
+{
+	XmlRpcValue names;
+	names.setSize(0);
+
+	int i = 0;
+	for(auto& pair : m_params)
+		names[i++] = pair.first;
+
+	respond(result, SUCCESS, "Parameter names", names);
+}
+
+void FakeMaster::subscribeParam(XmlRpcValue& params, XmlRpcValue& result)
+{
+	// We never send paramUpdate, so the subscriber just gets the value.
+	// Unset parameters are reported as an empty dictionary.
+	getParam(params, result);
+
+	if(static_cast<int>(result[0]) != SUCCESS)
+		respond(result, SUCCESS, "", emptyStruct());
+}
+
+void FakeMaster::unsubscribeParam(XmlRpcValue&, XmlRpcValue& result)
+{
+	respond(result, SUCCESS, "", 1);
+}
+
+void FakeMaster::registerService(XmlRpcValue& params, XmlRpcValue& result)
+{
+	std::string service = params[1];
+	std::string node = params[0];
+
+	m_services[service] = static_cast<std::string&>(params[2]);
+	m_nodes[node] = static_cast<std::string&>(params[3]);
+
+	respond(result, SUCCESS, "", 0);
+}
+
+void FakeMaster::unregisterService(XmlRpcValue& params, XmlRpcValue& result)
+{
+	auto it = m_services.find(static_cast<std::string&>(params[1]));
+	if(it == m_services.end() || it->second != static_cast<std::string&>(params[2]))
+	{
+		respond(result, SUCCESS, "not registered", 0);
+		return;
+	}
+
+	m_services.erase(it);
+	respond(result, SUCCESS, "unregistered", 1);
+}
+
+void FakeMaster::lookupService(XmlRpcValue& params, XmlRpcValue& result)
+{
+	std::string service = params[1];
+
+	auto it = m_services.find(service);
+	if(it == m_services.end())
+	{
+		respond(result, ERROR, fmt::format("no provider for service [{}]", service), "");
+		return;
+	}
+
+	respond(result, SUCCESS, "", it->second);
+}
+
+void FakeMaster::registerPublisher(XmlRpcValue& params, XmlRpcValue& result)
+{
+	std::string node = params[0];
+	std::string api = params[3];
+
+	Topic& topic = m_topics[static_cast<std::string&>(params[1])];
+	topic.publishers[node] = api;
+	m_nodes[node] = api;
+
+	respond(result, SUCCESS, "", stringList(topic.subscribers, true));
+}
+
+void FakeMaster::unregisterPublisher(XmlRpcValue& params, XmlRpcValue& result)
+{
+	Topic& topic = m_topics[static_cast<std::string&>(params[1])];
+	int removed = topic.publishers.erase(static_cast<std::string&>(params[0]));
+
+	respond(result, SUCCESS, "", removed);
+}
+
+void FakeMaster::registerSubscriber(XmlRpcValue& params, XmlRpcValue& result)
+{
+	std::string node = params[0];
+	std::string api = params[3];
+
+	Topic& topic = m_topics[static_cast<std::string&>(params[1])];
+	topic.subscribers[node] = api;
+	m_nodes[node] = api;
+
+	respond(result, SUCCESS, "", stringList(topic.publishers, true));
+}
+
+void FakeMaster::unregisterSubscriber(XmlRpcValue& params, XmlRpcValue& result)
+{
+	Topic& topic = m_topics[static_cast<std::string&>(params[1])];
+	int removed = topic.subscribers.erase(static_cast<std::string&>(params[0]));
+
+	respond(result, SUCCESS, "", removed);
+}
+
+void FakeMaster::lookupNode(XmlRpcValue& params, XmlRpcValue& result)
+{
+	std::string node = params[1];
+
+	auto it = m_nodes.find(node);
+	if(it == m_nodes.end())
+	{
+		respond(result, ERROR, fmt::format("unknown node [{}]", node), "");
+		return;
+	}
+
+	respond(result, SUCCESS, "", it->second);
+}
+
+void FakeMaster::getPid(XmlRpcValue&, XmlRpcValue& result)
+{
+	respond(result, SUCCESS, "", static_cast<int>(getpid()));
+}
+
+void FakeMaster::getUri(XmlRpcValue&, XmlRpcValue& result)
+{
+	respond(result, SUCCESS, "", uri());
+}
+
+void FakeMaster::getSystemState(XmlRpcValue&, XmlRpcValue& result)
+{
+	XmlRpcValue publishers;
+	XmlRpcValue subscribers;
+	XmlRpcValue services;
+	publishers.setSize(0);
+	subscribers.setSize(0);
+	services.setSize(0);
+
+	for(auto& pair : m_topics)
+	{
+		if(!pair.second.publishers.empty())
+		{
+			XmlRpcValue entry;
+			entry[0] = pair.first;
+			entry[1] = stringList(pair.second.publishers, false);
+			publishers[publishers.size()] = entry;
+		}
+
+		if(!pair.second.subscribers.empty())
+		{
+			XmlRpcValue entry;
+			entry[0] = pair.first;
+			entry[1] = stringList(pair.second.subscribers, false);
+			subscribers[subscribers.size()] = entry;
+		}
+	}
+
+	// We do not remember which node provides a service, report the URI
+	for(auto& pair : m_services)
+	{
+		XmlRpcValue entry;
+		entry[0] = pair.first;
+		entry[1].setSize(1);
+		entry[1][0] = pair.second;
+		services[services.size()] = entry;
+	}
+
+	XmlRpcValue state;
+	state[0] = publishers;
+	state[1] = subscribers;
+	state[2] = services;
+
+	respond(result, SUCCESS, "current system state", state);
+}
+
+void FakeMaster::multicall(XmlRpcValue& params, XmlRpcValue& result)
+{
+	XmlRpcValue& calls = params[0];
+
+	result.setSize(calls.size());
+
+	for(int i = 0; i < calls.size(); ++i)
+	{
+		std::string name = calls[i]["methodName"];
+
+		auto it = m_handlers.find(name);
+		if(it == m_handlers.end())
+		{
+			result[i]["faultCode"] = -1;
+			result[i]["faultString"] = fmt::format("unknown method '{}'", name);
+			continue;
+		}
+
+		// Each successful result is wrapped in a one-element array
+		XmlRpcValue callResult;
+		invoke(name, it->second, calls[i]["params"], callResult);
+
+		result[i].setSize(1);
+		result[i][0] = callResult;
+	}
+}
+
+}
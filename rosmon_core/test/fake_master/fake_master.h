@@ -0,0 +1,139 @@
+// In-process stand-in for the ROS master
+// Author: Max Schwarz <max.schwarz@uni-bonn.de>
+
+#ifndef ROSMON_TEST_FAKE_MASTER_H
+#define ROSMON_TEST_FAKE_MASTER_H
+
+#include <XmlRpc.h>
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace rosmon
+{
+
+/**
+ * @brief Minimal XML-RPC master for offline benchmarks and tests
+ *
+ * Implements the subset of the ROS master API that roscpp and rosmon use:
+ * the parameter server (setParam, getParam, hasParam, deleteParam,
+ * getParamNames, subscribeParam), service and topic registration,
+ * lookupNode, getSystemState and system.multicall.
+ *
+ * Each request is delayed by a configurable latency before it is handled,
+ * so that a remote or loaded master can be simulated deterministically.
+ * A system.multicall request is delayed only once, like a single round
+ * trip.
+ *
+ * Publishers are not notified of new subscribers (publisherUpdate), so
+ * subscribers should be created after the corresponding publishers.
+ *
+ * The server runs in its own thread.
+ **/
+class FakeMaster
+{
+public:
+	/**
+	 * @brief Start listening
+	 *
+	 * @param port TCP port, zero picks a free one
+	 * @throw std::runtime_error if the port cannot be bound
+	 **/
+	explicit FakeMaster(int port = 0);
+	~FakeMaster();
+
+	FakeMaster(const FakeMaster&) = delete;
+	FakeMaster& operator=(const FakeMaster&) = delete;
+
+	//! URI for ROS_MASTER_URI / the __master remapping
+	std::string uri() const;
+
+	inline int port() const
+	{ return m_port; }
+
+	//! Delay applied to every request
+	void setLatency(std::chrono::microseconds latency);
+
+	//! Number of handled calls per method name (sub-calls of multicall included)
+	std::map<std::string, uint64_t> callCounts() const;
+
+	void resetCallCounts();
+
+	//! Names of all leaf parameters
+	std::vector<std::string> parameterNames() const;
+private:
+	class Method;
+	typedef void (FakeMaster::*Handler)(XmlRpc::XmlRpcValue& params, XmlRpc::XmlRpcValue& result);
+
+	void addMethod(const std::string& name, Handler handler);
+	void dispatch(const std::string& name, Handler handler, XmlRpc::XmlRpcValue& params, XmlRpc::XmlRpcValue& result);
+
+	//! Count and execute a call, m_mutex is held
+	void invoke(const std::string& name, Handler handler, XmlRpc::XmlRpcValue& params, XmlRpc::XmlRpcValue& result);
+	void delay();
+
+	void setParam(XmlRpc::XmlRpcValue& params, XmlRpc::XmlRpcValue& result);
+	void getParam(XmlRpc::XmlRpcValue& params, XmlRpc::XmlRpcValue& result);
+	void hasParam(XmlRpc::XmlRpcValue& params, XmlRpc::XmlRpcValue& result);
+	void deleteParam(XmlRpc::XmlRpcValue& params, XmlRpc::XmlRpcValue& result);
+	void getParamNames(XmlRpc::XmlRpcValue& params, XmlRpc::XmlRpcValue& result);
+	void subscribeParam(XmlRpc::XmlRpcValue& params, XmlRpc::XmlRpcValue& result);
+	void unsubscribeParam(XmlRpc::XmlRpcValue& params, XmlRpc::XmlRpcValue& result);
+
+	void registerService(XmlRpc::XmlRpcValue& params, XmlRpc::XmlRpcValue& result);
+	void unregisterService(XmlRpc::XmlRpcValue& params, XmlRpc::XmlRpcValue& result);
+	void lookupService(XmlRpc::XmlRpcValue& params, XmlRpc::XmlRpcValue& result);
+
+	void registerPublisher(XmlRpc::XmlRpcValue& params, XmlRpc::XmlRpcValue& result);
+	void unregisterPublisher(XmlRpc::XmlRpcValue& params, XmlRpc::XmlRpcValue& result);
+	void registerSubscriber(XmlRpc::XmlRpcValue& params, XmlRpc::XmlRpcValue& result);
+	void unregisterSubscriber(XmlRpc::XmlRpcValue& params, XmlRpc::XmlRpcValue& result);
+
+	void lookupNode(XmlRpc::XmlRpcValue& params, XmlRpc::XmlRpcValue& result);
+	void getPid(XmlRpc::XmlRpcValue& params, XmlRpc::XmlRpcValue& result);
+	void getUri(XmlRpc::XmlRpcValue& params, XmlRpc::XmlRpcValue& result);
+	void getSystemState(XmlRpc::XmlRpcValue& params, XmlRpc::XmlRpcValue& result);
+
+	void multicall(XmlRpc::XmlRpcValue& params, XmlRpc::XmlRpcValue& result);
+
+	void eraseParam(const std::string& key);
+	void storeParam(const std::string& key, XmlRpc::XmlRpcValue& value);
+
+	XmlRpc::XmlRpcServer m_server;
+	std::vector<std::unique_ptr<Method>> m_methods;
+	std::map<std::string, Handler> m_handlers;
+
+	std::thread m_thread;
+	std::atomic<bool> m_shutdown{false};
+	int m_port = 0;
+
+	mutable std::mutex m_mutex;
+	std::chrono::microseconds m_latency{0};
+	std::map<std::string, uint64_t> m_callCounts;
+
+	//! Leaf parameters by full name
+	std::map<std::string, XmlRpc::XmlRpcValue> m_params;
+
+	//! Service name -> rosrpc:// URI
+	std::map<std::string, std::string> m_services;
+
+	//! Node name -> XML-RPC URI
+	std::map<std::string, std::string> m_nodes;
+
+	struct Topic
+	{
+		std::map<std::string, std::string> publishers;  //!< node name -> API
+		std::map<std::string, std::string> subscribers; //!< node name -> API
+	};
+	std::map<std::string, Topic> m_topics;
+};
+
+}
+
+#endif
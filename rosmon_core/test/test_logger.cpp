@@ -0,0 +1,149 @@
+// Unit tests for the raw mode of the log file writer
+// Author: Max Schwarz <max.schwarz@uni-bonn.de>
+
+#include <catch_ros/catch.hpp>
+
+#include "../src/logger.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace rosmon;
+
+namespace
+{
+	class TempFile
+	{
+	public:
+		TempFile()
+		{
+			char name[] = "/tmp/rosmon-test-logger-XXXXXX";
+			int fd = mkstemp(name);
+			REQUIRE(fd >= 0);
+			close(fd);
+			path = name;
+		}
+
+		~TempFile()
+		{
+			unlink(path.c_str());
+		}
+
+		std::vector<std::string> lines() const
+		{
+			std::ifstream stream(path);
+			std::vector<std::string> ret;
+			std::string line;
+			while(std::getline(stream, line))
+				ret.push_back(line);
+			return ret;
+		}
+
+		std::string path;
+	};
+
+	bool isMarker(const std::string& line, const std::string& source)
+	{
+		const std::string suffix = " " + source + ": [raw output]";
+		return line.size() >= suffix.size()
+			&& line.compare(line.size() - suffix.size(), suffix.size(), suffix) == 0;
+	}
+
+	void spliceString(Logger* logger, const std::string& source, const std::string& data)
+	{
+		int fds[2];
+		REQUIRE(pipe2(fds, O_CLOEXEC) == 0);
+		REQUIRE(write(fds[1], data.c_str(), data.size()) == static_cast<ssize_t>(data.size()));
+
+		std::size_t done = 0;
+		while(done < data.size())
+		{
+			ssize_t bytes = logger->spliceRaw(source, fds[0], data.size() - done);
+			REQUIRE(bytes > 0);
+			done += bytes;
+		}
+
+		close(fds[0]);
+		close(fds[1]);
+	}
+}
+
+TEST_CASE("logger splice", "[logger]")
+{
+	TempFile file;
+
+	{
+		Logger logger(file.path);
+		logger.setRaw(true);
+
+		spliceString(&logger, "node_a", "first ");
+		spliceString(&logger, "node_a", "line\nsecond line\n");
+	}
+
+	// Consecutive chunks within a second share one marker
+	auto lines = file.lines();
+	REQUIRE(lines.size() == 3);
+	CHECK(isMarker(lines[0], "node_a"));
+	CHECK(lines[1] == "first line");
+	CHECK(lines[2] == "second line");
+}
+
+TEST_CASE("logger writeRaw", "[logger]")
+{
+	TempFile file;
+
+	{
+		Logger logger(file.path);
+		logger.setRaw(true);
+
+		logger.writeRaw("node_a", "a1\n", 3);
+
+		// Ignored in raw mode, the output arrives through writeRaw()
+		logger.log({"node_a", "ignored"});
+
+		logger.writeRaw("node_a", "a2\n", 3);
+	}
+
+	auto lines = file.lines();
+	REQUIRE(lines.size() == 3);
+	CHECK(isMarker(lines[0], "node_a"));
+	CHECK(lines[1] == "a1");
+	CHECK(lines[2] == "a2");
+}
+
+TEST_CASE("logger shared file", "[logger]")
+{
+	TempFile file;
+
+	{
+		Logger loggerA(file.path);
+		loggerA.setRaw(true);
+
+		Logger loggerB(file.path, true);
+
+		spliceString(&loggerA, "node_a", "a1\n");
+		loggerB.log({"node_b", "b1"});
+		spliceString(&loggerA, "node_a", "a2\n");
+		loggerA.writeRaw("node_a", "a3\n", 3);
+		loggerB.log({"node_b", "b2"});
+		loggerA.writeRaw("node_a", "a4\n", 3);
+	}
+
+	// Each chunk following output of node_b needs a new marker
+	auto lines = file.lines();
+	REQUIRE(lines.size() == 9);
+	CHECK(isMarker(lines[0], "node_a"));
+	CHECK(lines[1] == "a1");
+	CHECK(lines[2].find("node_b: b1") != std::string::npos);
+	CHECK(isMarker(lines[3], "node_a"));
+	CHECK(lines[4] == "a2");
+	CHECK(lines[5] == "a3");
+	CHECK(lines[6].find("node_b: b2") != std::string::npos);
+	CHECK(isMarker(lines[7], "node_a"));
+	CHECK(lines[8] == "a4");
+}
@@ -0,0 +1,171 @@
+// Unit tests for the tiered node resource history
+// Author: Max Schwarz <max.schwarz@uni-bonn.de>
+
+#include <catch_ros/catch.hpp>
+
+#include "../src/monitor/node_history.h"
+
+using namespace rosmon::monitor;
+
+namespace
+{
+	NodeHistory::Sample makeSample(double t, double duration, double load, unsigned int restarts = 0)
+	{
+		NodeHistory::Sample sample;
+		sample.stamp = ros::WallTime(static_cast<uint32_t>(t), 0);
+		sample.duration = duration;
+		sample.count = 1;
+		sample.userLoad = NodeHistory::Statistic(load);
+		sample.systemLoad = NodeHistory::Statistic(0.5 * load);
+		sample.memory = NodeHistory::Statistic(1000.0 * load);
+		sample.threads = NodeHistory::Statistic(4.0);
+		sample.restartCount = restarts;
+		return sample;
+	}
+}
+
+TEST_CASE("node history raw tier", "[history]")
+{
+	NodeHistory history(2.0);
+
+	REQUIRE(history.numTiers() == 3);
+	CHECK(history.tierInterval(0) == Approx(2.0));
+	CHECK(history.tierInterval(1) == Approx(10.0));
+	CHECK(history.tierInterval(2) == Approx(60.0));
+
+	// RAW_SPAN at the configured period
+	CHECK(history.samples(0).capacity() == 300);
+
+	for(int i = 0; i < 400; ++i)
+		history.addSample(makeSample(2.0 * i, 2.0, i));
+
+	// Oldest samples are dropped first
+	const auto& raw = history.samples(0);
+	REQUIRE(raw.size() == 300);
+	CHECK(raw.front().userLoad.mean == Approx(100.0));
+	CHECK(raw.back().userLoad.mean == Approx(399.0));
+
+	// A faster period keeps the newest samples
+	history.setPeriod(1.0);
+	CHECK(history.tierInterval(0) == Approx(1.0));
+	CHECK(raw.capacity() == 600);
+	CHECK(raw.size() == 300);
+	CHECK(raw.back().userLoad.mean == Approx(399.0));
+
+	history.setPeriod(4.0);
+	CHECK(raw.capacity() == 150);
+	REQUIRE(raw.size() == 150);
+	CHECK(raw.front().userLoad.mean == Approx(250.0));
+	CHECK(raw.back().userLoad.mean == Approx(399.0));
+}
+
+TEST_CASE("node history tier rollover", "[history]")
+{
+	NodeHistory history(1.0);
+
+	// Nine seconds do not complete a 10s interval
+	for(int i = 0; i < 9; ++i)
+		history.addSample(makeSample(i, 1.0, 1.0));
+
+	CHECK(history.samples(0).size() == 9);
+	CHECK(history.samples(1).empty());
+
+	// ... the tenth does
+	history.addSample(makeSample(9, 1.0, 1.0));
+	REQUIRE(history.samples(1).size() == 1);
+	CHECK(history.samples(1).back().count == 10);
+	CHECK(history.samples(1).back().duration == Approx(10.0));
+	CHECK(history.samples(1).back().stamp.sec == 0);
+	CHECK(history.samples(2).empty());
+
+	// The next interval starts with the following sample
+	for(int i = 10; i < 60; ++i)
+		history.addSample(makeSample(i, 1.0, 1.0));
+
+	REQUIRE(history.samples(1).size() == 6);
+	CHECK(history.samples(1).back().stamp.sec == 50);
+
+	REQUIRE(history.samples(2).size() == 1);
+	CHECK(history.samples(2).back().count == 60);
+	CHECK(history.samples(2).back().duration == Approx(60.0));
+}
+
+TEST_CASE("node history jitter", "[history]")
+{
+	NodeHistory history(1.0);
+
+	// Slightly short sample durations still close the interval
+	for(int i = 0; i < 10; ++i)
+		history.addSample(makeSample(i, 0.995, 1.0));
+
+	CHECK(history.samples(1).size() == 1);
+}
+
+TEST_CASE("node history long samples", "[history]")
+{
+	// Adaptive sampling may produce samples longer than a tier interval
+	NodeHistory history(1.0);
+
+	history.addSample(makeSample(0, 15.0, 1.0));
+	REQUIRE(history.samples(1).size() == 1);
+	CHECK(history.samples(1).back().count == 1);
+	CHECK(history.samples(1).back().duration == Approx(15.0));
+}
+
+TEST_CASE("node history aggregation", "[history]")
+{
+	NodeHistory history(1.0);
+
+	const double loads[] = {3.0, 1.0, 4.0, 1.0, 5.0, 9.0, 2.0, 6.0, 5.0, 4.0};
+	unsigned int restarts = 0;
+	for(int i = 0; i < 10; ++i)
+	{
+		if(i == 5)
+			restarts++;
+
+		history.addSample(makeSample(i, 1.0, loads[i], restarts));
+	}
+
+	REQUIRE(history.samples(1).size() == 1);
+	const auto& sample = history.samples(1).back();
+
+	CHECK(sample.userLoad.min == Approx(1.0));
+	CHECK(sample.userLoad.max == Approx(9.0));
+	CHECK(sample.userLoad.mean == Approx(4.0));
+
+	CHECK(sample.systemLoad.min == Approx(0.5));
+	CHECK(sample.systemLoad.max == Approx(4.5));
+	CHECK(sample.systemLoad.mean == Approx(2.0));
+
+	CHECK(sample.memory.min == Approx(1000.0));
+	CHECK(sample.memory.max == Approx(9000.0));
+	CHECK(sample.memory.mean == Approx(4000.0));
+
+	CHECK(sample.threads.min == Approx(4.0));
+	CHECK(sample.threads.max == Approx(4.0));
+	CHECK(sample.threads.mean == Approx(4.0));
+
+	// Restart count from the end of the interval
+	CHECK(sample.restartCount == 1);
+}
+
+TEST_CASE("node history merge weights", "[history]")
+{
+	// Means of aggregated samples are weighted by their raw sample count
+	NodeHistory::Sample a;
+	a.count = 3;
+	a.duration = 3.0;
+	a.userLoad = NodeHistory::Statistic(1.0);
+
+	NodeHistory::Sample b;
+	b.count = 1;
+	b.duration = 1.0;
+	b.userLoad = NodeHistory::Statistic(5.0);
+
+	a.merge(b);
+	CHECK(a.count == 4);
+	CHECK(a.duration == Approx(4.0));
+	CHECK(a.userLoad.mean == Approx(2.0));
+	CHECK(a.userLoad.min == Approx(1.0));
+	CHECK(a.userLoad.max == Approx(5.0));
+}
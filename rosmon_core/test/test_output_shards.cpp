@@ -0,0 +1,284 @@
+// Unit tests for the output reader threads
+// Author: Max Schwarz <max.schwarz@uni-bonn.de>
+
+#include <catch_ros/catch.hpp>
+
+#include "../src/monitor/output_shards.h"
+
+#include <boost/make_shared.hpp>
+
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace rosmon;
+using namespace rosmon::monitor;
+
+namespace
+{
+	// Same as in output_shards.cpp
+	const std::size_t MAX_BACKLOG = 64 * 1024 * 1024;
+
+	class Pipe
+	{
+	public:
+		Pipe()
+		{
+			REQUIRE(pipe2(fds, O_CLOEXEC) == 0);
+		}
+
+		~Pipe()
+		{
+			closeWrite();
+			close(fds[0]);
+		}
+
+		int readFD() const
+		{ return fds[0]; }
+
+		void write(const std::string& data)
+		{
+			REQUIRE(::write(fds[1], data.c_str(), data.size()) == static_cast<ssize_t>(data.size()));
+		}
+
+		void closeWrite()
+		{
+			if(fds[1] >= 0)
+				close(fds[1]);
+			fds[1] = -1;
+		}
+
+		int fds[2];
+	};
+
+	//! Run the main loop until done() returns true
+	bool runUntil(FDWatcher* watcher, const std::function<bool()>& done)
+	{
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+		while(!done())
+		{
+			if(std::chrono::steady_clock::now() > deadline)
+				return false;
+
+			watcher->wait(ros::WallDuration(0.01));
+		}
+
+		return true;
+	}
+
+	//! Run the main loop for a while, dispatching everything pending
+	void runFor(FDWatcher* watcher, std::chrono::milliseconds duration)
+	{
+		auto deadline = std::chrono::steady_clock::now() + duration;
+		while(std::chrono::steady_clock::now() < deadline)
+			watcher->wait(ros::WallDuration(0.01));
+	}
+
+	//! Give the shard threads time to read what was written
+	void settle()
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	}
+
+	struct Recorder
+	{
+		OutputShards::Handler handler(const std::string& name)
+		{
+			return [this, name](const OutputShards::Event& event) {
+				for(auto& line : event.lines)
+					lines.push_back(name + ": " + line);
+
+				if(event.closed)
+				{
+					closed.push_back(name);
+					errors.push_back(event.error);
+				}
+
+				times.push_back(event.time);
+			};
+		}
+
+		std::vector<std::string> lines;
+		std::vector<std::string> closed;
+		std::vector<std::string> errors;
+		std::vector<OutputShards::Clock::time_point> times;
+	};
+}
+
+TEST_CASE("output shards lines", "[output_shards]")
+{
+	auto watcher = boost::make_shared<FDWatcher>();
+	OutputShards shards(1, watcher);
+	Recorder recorder;
+	Pipe pipe;
+
+	shards.add(pipe.readFD(), "a", recorder.handler("a"));
+
+	pipe.write("first\nsecond\npar");
+	REQUIRE(runUntil(watcher.get(), [&]() { return recorder.lines.size() == 2; }));
+	CHECK(recorder.lines[0] == "a: first\n");
+	CHECK(recorder.lines[1] == "a: second\n");
+
+	// Partial lines are completed by later reads
+	pipe.write("tial\n");
+	REQUIRE(runUntil(watcher.get(), [&]() { return recorder.lines.size() == 3; }));
+	CHECK(recorder.lines[2] == "a: partial\n");
+
+	// Closing the write end results in a closed event without error
+	pipe.closeWrite();
+	REQUIRE(runUntil(watcher.get(), [&]() { return !recorder.closed.empty(); }));
+	CHECK(recorder.closed == std::vector<std::string>{"a"});
+	CHECK(recorder.errors == std::vector<std::string>{""});
+
+	// The handler is dropped afterwards
+	runFor(watcher.get(), std::chrono::milliseconds(50));
+	CHECK(recorder.closed.size() == 1);
+}
+
+TEST_CASE("output shards merge order", "[output_shards]")
+{
+	auto watcher = boost::make_shared<FDWatcher>();
+	OutputShards shards(2, watcher);
+	REQUIRE(shards.threadCount() == 2);
+
+	Recorder recorder;
+	Pipe pipeA;
+	Pipe pipeB;
+
+	// Least loaded shard first, so both end up on different shards
+	shards.add(pipeA.readFD(), "a", recorder.handler("a"));
+	shards.add(pipeB.readFD(), "b", recorder.handler("b"));
+
+	// Let events pile up in both shards before dispatching them
+	pipeA.write("1\n");
+	settle();
+	pipeB.write("2\n");
+	settle();
+	pipeA.write("3\n");
+	settle();
+	pipeB.write("4\n");
+	settle();
+
+	REQUIRE(runUntil(watcher.get(), [&]() { return recorder.lines.size() == 4; }));
+	CHECK(recorder.lines == std::vector<std::string>{"a: 1\n", "b: 2\n", "a: 3\n", "b: 4\n"});
+	CHECK(std::is_sorted(recorder.times.begin(), recorder.times.end()));
+}
+
+TEST_CASE("output shards remove", "[output_shards]")
+{
+	auto watcher = boost::make_shared<FDWatcher>();
+	OutputShards shards(1, watcher);
+	Recorder recorder;
+	Pipe pipeA;
+	Pipe pipeB;
+
+	uint64_t tokenA = shards.add(pipeA.readFD(), "a", recorder.handler("a"));
+	shards.add(pipeB.readFD(), "b", recorder.handler("b"));
+
+	SECTION("pending events are discarded")
+	{
+		pipeA.write("dropped\n");
+		pipeB.write("kept\n");
+		settle();
+
+		shards.remove(tokenA);
+
+		// The fd is not touched anymore
+		pipeA.write("unread\n");
+
+		runFor(watcher.get(), std::chrono::milliseconds(100));
+		CHECK(recorder.lines == std::vector<std::string>{"b: kept\n"});
+
+		char buf[16];
+		CHECK(read(pipeA.readFD(), buf, sizeof(buf)) == 7);
+	}
+
+	SECTION("remove from a handler")
+	{
+		Recorder other;
+		Pipe pipeC;
+
+		uint64_t tokenC = shards.add(pipeC.readFD(), "c", other.handler("c"));
+
+		// Replace the handler of pipeA by one that removes pipeC
+		shards.remove(tokenA);
+		auto handlerD = recorder.handler("d");
+		shards.add(pipeA.readFD(), "d", [&](const OutputShards::Event& event) {
+			handlerD(event);
+			shards.remove(tokenC);
+		});
+
+		pipeA.write("first\n");
+		settle();
+		pipeC.write("in flight\n");
+		settle();
+
+		runFor(watcher.get(), std::chrono::milliseconds(100));
+		CHECK(recorder.lines == std::vector<std::string>{"d: first\n"});
+		CHECK(other.lines.empty());
+	}
+
+	// Unknown tokens are ignored
+	shards.remove(12345);
+}
+
+TEST_CASE("output shards backlog", "[output_shards]")
+{
+	auto watcher = boost::make_shared<FDWatcher>();
+	OutputShards shards(1, watcher);
+	Pipe pipe;
+
+	std::size_t received = 0;
+	shards.add(pipe.readFD(), "a", [&](const OutputShards::Event& event) {
+		received += event.bytes;
+	});
+
+	REQUIRE(fcntl(pipe.fds[1], F_SETFL, O_NONBLOCK) == 0);
+
+	// Returns once writing stalled for a while
+	std::vector<char> chunk(65536, 'x');
+	auto writeUntilStalled = [&]() {
+		std::size_t written = 0;
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(20);
+		auto lastProgress = std::chrono::steady_clock::now();
+
+		while(std::chrono::steady_clock::now() < deadline)
+		{
+			ssize_t ret = write(pipe.fds[1], chunk.data(), chunk.size());
+			if(ret > 0)
+			{
+				written += ret;
+				lastProgress = std::chrono::steady_clock::now();
+				continue;
+			}
+
+			if(errno != EAGAIN)
+				FAIL("Could not write(): " << strerror(errno));
+
+			if(std::chrono::steady_clock::now() - lastProgress > std::chrono::milliseconds(200))
+				break;
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+
+		return written;
+	};
+
+	// Without a main loop, the shard stops reading after MAX_BACKLOG bytes
+	std::size_t written = writeUntilStalled();
+	CHECK(written > MAX_BACKLOG);
+	CHECK(written < MAX_BACKLOG + 1024 * 1024);
+	CHECK(received == 0);
+
+	// Dispatching the events resumes reading
+	REQUIRE(runUntil(watcher.get(), [&]() { return received > MAX_BACKLOG; }));
+
+	written += writeUntilStalled();
+	REQUIRE(runUntil(watcher.get(), [&]() { return received == written; }));
+}
@@ -7,6 +7,9 @@
 
 #include <boost/filesystem.hpp>
 
+#include <linux/mempolicy.h>
+#include <sched.h>
+
 #include "core_utils.h"
 #include "node_utils.h"
 #include "param_utils.h"
@@ -272,3 +275,466 @@ TEST_CASE("node enable-coredumps", "[node]")
 	CHECK(getNode(nodes, "test_node_on")->coredumpsEnabled() == true);
 	CHECK(getNode(nodes, "test_node_off")->coredumpsEnabled() == false);
 }
+
+TEST_CASE("node rosmon-stats-period", "[node]")
+{
+	LaunchConfig config;
+	config.setDefaultStatsPeriod(2.0);
+	config.parseString(R"EOF(
+		<launch>
+			<node name="test_node_fast" pkg="rosmon_core" type="abort" rosmon-stats-period="0.05" />
+			<node name="test_node_def" pkg="rosmon_core" type="abort" />
+		</launch>
+	)EOF");
+
+	config.evaluateParameters();
+
+	auto nodes = config.nodes();
+	CAPTURE(nodes);
+
+	CHECK(getNode(nodes, "test_node_fast")->statsPeriod() == Approx(0.05));
+	CHECK(getNode(nodes, "test_node_def")->statsPeriod() == Approx(2.0));
+
+	requireParsingException(R"EOF(
+		<launch>
+			<node name="test_node" pkg="rosmon_core" type="abort" rosmon-stats-period="0" />
+		</launch>
+	)EOF");
+
+	// Would allocate a huge history and run the stats timer at 10 kHz
+	requireParsingException(R"EOF(
+		<launch>
+			<node name="test_node" pkg="rosmon_core" type="abort" rosmon-stats-period="0.0001" />
+		</launch>
+	)EOF");
+}
+
+TEST_CASE("node scheduling attributes", "[node]")
+{
+	LaunchConfig config;
+	config.parseString(R"EOF(
+		<launch>
+			<node name="test_node_rt" pkg="rosmon_core" type="abort"
+				rosmon-cpu-affinity="0-2, 5,1" rosmon-nice="-5"
+				rosmon-sched-policy="fifo" rosmon-sched-priority="50" />
+			<node name="test_node_batch" pkg="rosmon_core" type="abort" rosmon-sched-policy="batch" />
+			<node name="test_node_def" pkg="rosmon_core" type="abort" />
+		</launch>
+	)EOF");
+
+	config.evaluateParameters();
+
+	auto nodes = config.nodes();
+	CAPTURE(nodes);
+
+	{
+		auto node = getNode(nodes, "test_node_rt");
+		CHECK(node->cpuAffinity() == std::vector<unsigned int>({0, 1, 2, 5}));
+		CHECK(node->hasNice());
+		CHECK(node->nice() == -5);
+		CHECK(node->schedPolicy() == SCHED_FIFO);
+		CHECK(node->schedPriority() == 50);
+	}
+
+	{
+		auto node = getNode(nodes, "test_node_batch");
+		CHECK(node->schedPolicy() == SCHED_BATCH);
+		CHECK(node->schedPriority() == 0);
+	}
+
+	{
+		auto node = getNode(nodes, "test_node_def");
+		CHECK(node->cpuAffinity().empty());
+		CHECK(!node->hasNice());
+		CHECK(node->schedPolicy() == -1);
+	}
+
+	requireParsingException(R"EOF(
+		<launch>
+			<node name="test_node" pkg="rosmon_core" type="abort" rosmon-cpu-affinity="3-1" />
+		</launch>
+	)EOF");
+
+	requireParsingException(R"EOF(
+		<launch>
+			<node name="test_node" pkg="rosmon_core" type="abort" rosmon-nice="20" />
+		</launch>
+	)EOF");
+
+	requireParsingException(R"EOF(
+		<launch>
+			<node name="test_node" pkg="rosmon_core" type="abort" rosmon-sched-policy="deadline" />
+		</launch>
+	)EOF");
+
+	requireParsingException(R"EOF(
+		<launch>
+			<node name="test_node" pkg="rosmon_core" type="abort" rosmon-sched-policy="rr" rosmon-sched-priority="0" />
+		</launch>
+	)EOF");
+
+	requireParsingException(R"EOF(
+		<launch>
+			<node name="test_node" pkg="rosmon_core" type="abort" rosmon-sched-priority="10" />
+		</launch>
+	)EOF");
+}
+
+TEST_CASE("node memory placement attributes", "[node]")
+{
+	LaunchConfig config;
+	config.parseString(R"EOF(
+		<launch>
+			<node name="test_node_locked" pkg="rosmon_core" type="abort"
+				rosmon-mlockall="true" rosmon-memlock-limit="512 MiB"
+				rosmon-numa-policy="bind" rosmon-numa-nodes="0-1" />
+			<node name="test_node_unlimited" pkg="rosmon_core" type="abort"
+				rosmon-memlock-limit="unlimited" rosmon-numa-policy="preferred" rosmon-numa-nodes="1" />
+			<node name="test_node_def" pkg="rosmon_core" type="abort" />
+		</launch>
+	)EOF");
+
+	config.evaluateParameters();
+
+	auto nodes = config.nodes();
+	CAPTURE(nodes);
+
+	{
+		auto node = getNode(nodes, "test_node_locked");
+		CHECK(node->mlockAll());
+		CHECK(node->hasMemlockLimit());
+		CHECK(node->memlockLimit() == 512ull << 20);
+		CHECK(node->numaPolicy() == MPOL_BIND);
+		CHECK(node->numaNodes() == std::vector<unsigned int>({0, 1}));
+	}
+
+	{
+		auto node = getNode(nodes, "test_node_unlimited");
+		CHECK(!node->mlockAll());
+		CHECK(node->memlockLimit() == Node::MEMLOCK_UNLIMITED);
+		CHECK(node->numaPolicy() == MPOL_PREFERRED);
+	}
+
+	{
+		auto node = getNode(nodes, "test_node_def");
+		CHECK(!node->mlockAll());
+		CHECK(!node->hasMemlockLimit());
+		CHECK(node->numaPolicy() == -1);
+	}
+
+	requireParsingException(R"EOF(
+		<launch>
+			<node name="test_node" pkg="rosmon_core" type="abort" rosmon-numa-policy="bind" />
+		</launch>
+	)EOF");
+
+	requireParsingException(R"EOF(
+		<launch>
+			<node name="test_node" pkg="rosmon_core" type="abort" rosmon-numa-policy="preferred" rosmon-numa-nodes="0,1" />
+		</launch>
+	)EOF");
+
+	requireParsingException(R"EOF(
+		<launch>
+			<node name="test_node" pkg="rosmon_core" type="abort" rosmon-memlock-limit="lots" />
+		</launch>
+	)EOF");
+}
+
+TEST_CASE("node respawn delay without backoff", "[node]")
+{
+	LaunchConfig config;
+	config.parseString(R"EOF(
+		<launch>
+			<node name="test_node" pkg="rosmon_core" type="abort" respawn="true" respawn_delay="120" />
+		</launch>
+	)EOF");
+
+	config.evaluateParameters();
+
+	auto nodes = config.nodes();
+	CAPTURE(nodes);
+
+	// The default maximum delay must not shorten a long respawn_delay
+	auto node = getNode(nodes, "test_node");
+	CHECK(node->respawnMaxDelay().toSec() == Approx(120.0));
+	CHECK(node->respawnDelayAt(0) == Approx(120.0));
+	CHECK(node->respawnDelayAt(5) == Approx(120.0));
+}
+
+TEST_CASE("node respawn backoff attributes", "[node]")
+{
+	LaunchConfig config;
+	config.parseString(R"EOF(
+		<launch>
+			<node name="test_node_backoff" pkg="rosmon_core" type="abort" respawn="true" respawn_delay="0.5"
+				rosmon-respawn-backoff="2" rosmon-respawn-max-delay="30" rosmon-respawn-jitter="0.1"
+				rosmon-crash-loop-count="5" rosmon-crash-loop-window="120" />
+			<node name="test_node_def" pkg="rosmon_core" type="abort" respawn="true" />
+		</launch>
+	)EOF");
+
+	config.evaluateParameters();
+
+	auto nodes = config.nodes();
+	CAPTURE(nodes);
+
+	{
+		auto node = getNode(nodes, "test_node_backoff");
+		CHECK(node->respawnBackoff() == Approx(2.0));
+		CHECK(node->respawnMaxDelay().toSec() == Approx(30.0));
+		CHECK(node->respawnJitter() == Approx(0.1));
+		CHECK(node->crashLoopCount() == 5);
+		CHECK(node->crashLoopWindow().toSec() == Approx(120.0));
+	}
+
+	{
+		auto node = getNode(nodes, "test_node_def");
+		CHECK(node->respawnBackoff() == Approx(1.0));
+		CHECK(node->respawnJitter() == Approx(0.0));
+		CHECK(node->crashLoopCount() == 0);
+	}
+
+	{
+		auto node = getNode(nodes, "test_node_backoff");
+		CHECK(node->respawnDelayAt(0) == Approx(0.5));
+		CHECK(node->respawnDelayAt(3) == Approx(4.0));
+		CHECK(node->respawnDelayAt(10) == Approx(30.0));
+	}
+
+	requireParsingException(R"EOF(
+		<launch>
+			<node name="test_node" pkg="rosmon_core" type="abort" rosmon-respawn-backoff="0.5" />
+		</launch>
+	)EOF");
+
+	requireParsingException(R"EOF(
+		<launch>
+			<node name="test_node" pkg="rosmon_core" type="abort" respawn_delay="10" rosmon-respawn-max-delay="5" />
+		</launch>
+	)EOF");
+
+	requireParsingException(R"EOF(
+		<launch>
+			<node name="test_node" pkg="rosmon_core" type="abort" rosmon-respawn-jitter="2" />
+		</launch>
+	)EOF");
+
+	requireParsingException(R"EOF(
+		<launch>
+			<node name="test_node" pkg="rosmon_core" type="abort" rosmon-crash-loop-window="10" />
+		</launch>
+	)EOF");
+}
+
+TEST_CASE("node liveness attributes", "[node]")
+{
+	LaunchConfig config;
+	config.parseString(R"EOF(
+		<launch>
+			<node name="test_node_probes" pkg="rosmon_core" type="abort"
+				rosmon-liveness-cpu="10" rosmon-liveness-dstate="5" rosmon-liveness-output="30"
+				rosmon-liveness-heartbeat="unix:/tmp/test_node.sock" rosmon-liveness-grace="2" />
+			<node name="test_node_file" pkg="rosmon_core" type="abort" rosmon-liveness-heartbeat="/tmp/test_node.alive" />
+			<node name="test_node_def" pkg="rosmon_core" type="abort" />
+		</launch>
+	)EOF");
+
+	config.evaluateParameters();
+
+	auto nodes = config.nodes();
+	CAPTURE(nodes);
+
+	{
+		const auto& liveness = getNode(nodes, "test_node_probes")->liveness();
+		CHECK(liveness.enabled());
+		CHECK(liveness.cpuTimeout == Approx(10.0));
+		CHECK(liveness.dStateTimeout == Approx(5.0));
+		CHECK(liveness.outputTimeout == Approx(30.0));
+		CHECK(liveness.heartbeat == "unix:/tmp/test_node.sock");
+		CHECK(liveness.heartbeatTimeout == Approx(5.0));
+		CHECK(liveness.grace == Approx(2.0));
+	}
+
+	{
+		const auto& liveness = getNode(nodes, "test_node_file")->liveness();
+		CHECK(liveness.enabled());
+		CHECK(liveness.cpuTimeout == 0);
+		CHECK(liveness.heartbeat == "/tmp/test_node.alive");
+	}
+
+	CHECK(!getNode(nodes, "test_node_def")->liveness().enabled());
+
+	requireParsingException(R"EOF(
+		<launch>
+			<node name="test_node" pkg="rosmon_core" type="abort" rosmon-liveness-cpu="-1" />
+		</launch>
+	)EOF");
+
+	requireParsingException(R"EOF(
+		<launch>
+			<node name="test_node" pkg="rosmon_core" type="abort" rosmon-liveness-heartbeat-timeout="3" />
+		</launch>
+	)EOF");
+
+	// The CPU probe needs at least two samples per timeout
+	requireParsingException(R"EOF(
+		<launch>
+			<node name="test_node" pkg="rosmon_core" type="abort" rosmon-stats-period="2" rosmon-liveness-cpu="3" />
+		</launch>
+	)EOF");
+
+	CHECK(getNode(nodes, "test_node_probes")->liveness().maxStatsPeriod() == Approx(2.5));
+}
+
+TEST_CASE("node reload comparison", "[node]")
+{
+	auto load = [](const std::string& attributes) {
+		LaunchConfig config;
+		config.parseString(R"EOF(
+			<launch>
+				<node name="test_node" pkg="rosmon_core" type="abort" )EOF" + attributes + R"EOF( />
+			</launch>
+		)EOF");
+		config.evaluateParameters();
+
+		return config.nodes().at(0);
+	};
+
+	auto base = load(R"(args="a b" respawn="true")");
+
+	CHECK(base->sameProcess(*load(R"(args="a b" respawn="true")")));
+	CHECK(base->sameSupervision(*load(R"(args="a b" respawn="true")")));
+
+	// Process changes need a restart
+	CHECK(!base->sameProcess(*load(R"(args="a c" respawn="true")")));
+	CHECK(!base->sameProcess(*load(R"(args="a b" respawn="true" rosmon-nice="5")")));
+
+	// Supervision changes do not
+	auto limited = load(R"(args="a b" respawn="true" rosmon-memory-limit="100 MB")");
+	CHECK(base->sameProcess(*limited));
+	CHECK(!base->sameSupervision(*limited));
+}
+
+TEST_CASE("node shutdown attributes", "[node]")
+{
+	LaunchConfig config;
+	config.parseString(R"EOF(
+		<launch>
+			<node name="test_node_driver" pkg="rosmon_core" type="abort"
+				shutdown-handler="true" rosmon-shutdown-handler-timeout="2.5" rosmon-shutdown-group="1" />
+			<node name="test_node_def" pkg="rosmon_core" type="abort" />
+		</launch>
+	)EOF");
+
+	config.evaluateParameters();
+
+	auto nodes = config.nodes();
+	CAPTURE(nodes);
+
+	{
+		auto node = getNode(nodes, "test_node_driver");
+		CHECK(node->shutdownHandler() == "true");
+		CHECK(node->shutdownHandlerTimeout() == Approx(2.5));
+		CHECK(node->shutdownGroup() == 1);
+	}
+
+	{
+		auto node = getNode(nodes, "test_node_def");
+		CHECK(node->shutdownHandlerTimeout() == Approx(10.0));
+		CHECK(node->shutdownGroup() == 0);
+	}
+
+	requireParsingException(R"EOF(
+		<launch>
+			<node name="test_node" pkg="rosmon_core" type="abort" rosmon-shutdown-group="last" />
+		</launch>
+	)EOF");
+
+	requireParsingException(R"EOF(
+		<launch>
+			<node name="test_node" pkg="rosmon_core" type="abort" rosmon-shutdown-handler-timeout="-1" />
+		</launch>
+	)EOF");
+}
+
+TEST_CASE("node core quota", "[node]")
+{
+	LaunchConfig config;
+	config.parseString(R"EOF(
+		<launch>
+			<node name="test_node_quota" pkg="rosmon_core" type="abort" rosmon-core-quota="2GiB" />
+			<node name="test_node_def" pkg="rosmon_core" type="abort" />
+		</launch>
+	)EOF");
+
+	config.evaluateParameters();
+
+	auto nodes = config.nodes();
+	CAPTURE(nodes);
+
+	CHECK(getNode(nodes, "test_node_quota")->coreQuota() == (2ull << 30));
+	CHECK(getNode(nodes, "test_node_def")->coreQuota() == 0);
+
+	requireParsingException(R"EOF(
+		<launch>
+			<node name="test_node" pkg="rosmon_core" type="abort" rosmon-core-quota="big" />
+		</launch>
+	)EOF");
+}
+
+TEST_CASE("node core mode", "[node]")
+{
+	LaunchConfig config;
+	config.parseString(R"EOF(
+		<launch>
+			<node name="test_node_bt" pkg="rosmon_core" type="abort" rosmon-core-mode="backtrace" />
+			<node name="test_node_full" pkg="rosmon_core" type="abort" rosmon-core-mode="full" />
+			<node name="test_node_def" pkg="rosmon_core" type="abort" />
+		</launch>
+	)EOF");
+
+	config.evaluateParameters();
+
+	auto nodes = config.nodes();
+	CAPTURE(nodes);
+
+	CHECK(getNode(nodes, "test_node_bt")->coreMode() == Node::CORE_BACKTRACE);
+	CHECK(getNode(nodes, "test_node_full")->coreMode() == Node::CORE_FULL);
+	CHECK(getNode(nodes, "test_node_def")->coreMode() == Node::CORE_FULL);
+
+	requireParsingException(R"EOF(
+		<launch>
+			<node name="test_node" pkg="rosmon_core" type="abort" rosmon-core-mode="minidump" />
+		</launch>
+	)EOF");
+}
+
+TEST_CASE("node output mode", "[node]")
+{
+	LaunchConfig config;
+	config.parseString(R"EOF(
+		<launch>
+			<node name="test_node_pipe" pkg="rosmon_core" type="abort" rosmon-output="pipe" />
+			<node name="test_node_pty" pkg="rosmon_core" type="abort" rosmon-output="pty" />
+			<node name="test_node_raw" pkg="rosmon_core" type="abort" rosmon-output="raw" />
+			<node name="test_node_def" pkg="rosmon_core" type="abort" />
+		</launch>
+	)EOF");
+
+	config.evaluateParameters();
+
+	auto nodes = config.nodes();
+	CAPTURE(nodes);
+
+	CHECK(getNode(nodes, "test_node_pipe")->outputMode() == Node::OUTPUT_PIPE);
+	CHECK(getNode(nodes, "test_node_pty")->outputMode() == Node::OUTPUT_PTY);
+	CHECK(getNode(nodes, "test_node_raw")->outputMode() == Node::OUTPUT_RAW);
+	CHECK(getNode(nodes, "test_node_def")->outputMode() == Node::OUTPUT_PTY);
+
+	requireParsingException(R"EOF(
+		<launch>
+			<node name="test_node" pkg="rosmon_core" type="abort" rosmon-output="socket" />
+		</launch>
+	)EOF");
+}
@@ -181,8 +181,10 @@ QVariant NodeModel::data(const QModelIndex& index, int role) const
 				case rosmon_msgs::NodeState::IDLE:
 					return QColor(200, 200, 200);
 				case rosmon_msgs::NodeState::CRASHED:
+				case rosmon_msgs::NodeState::FAILED:
 					return QColor(255, 100, 100);
 				case rosmon_msgs::NodeState::WAITING:
+				case rosmon_msgs::NodeState::BACKOFF:
 					return QColor(255, 255, 128);
 			}
 			break;